@@ -0,0 +1,26 @@
+#pragma once
+#include <benchmark/benchmark.h>
+#include <cstdint>
+
+// Counts calls to the global operator new, which Allocations.cpp replaces for the whole benchmark binary.
+// Memory from malloc() directly, like zlib's, isn't counted.
+namespace Allocations {
+
+    /// @brief How many times operator new was called so far, by any thread.
+    uint64_t getCount();
+
+    // Counts the allocations from its construction to report(), so put it right before the benchmark loop
+    class Counter {
+    public:
+        Counter() : m_start(getCount()) {}
+        /// @brief Add an allocs/op counter to the results, averaged over the iterations.
+        /// @param opsPerIteration For benchmarks that do a batch of operations each iteration.
+        void report(benchmark::State& state, int opsPerIteration = 1) const {
+            double allocations = static_cast<double>(getCount() - m_start) / opsPerIteration;
+            state.counters["allocs/op"] = benchmark::Counter(allocations, benchmark::Counter::kAvgIterations);
+        }
+
+    private:
+        uint64_t m_start;
+    };
+}
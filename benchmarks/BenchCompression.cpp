@@ -0,0 +1,68 @@
+#include <benchmark/benchmark.h>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+#include "Compression.h"
+#include "Router.h"
+
+namespace {
+    // A listing page of about 30 KB, markup heavy like most HTML a handler would render
+    std::string samplePage() {
+        std::string page = "<!DOCTYPE html><html><head><title>Orders</title><link rel=\"stylesheet\" href=\"/style.css\"></head><body><table>\n";
+        for (int i = 0; i < 400; i++) {
+            page += "<tr class=\"" + std::string(i % 2 ? "odd" : "even") + "\"><td>" + std::to_string(100000 + i * 37) +
+                    "</td><td>Customer " + std::to_string(i % 53) + "</td><td>" + std::to_string(i * 13 % 997) + ".00</td></tr>\n";
+        }
+        return page + "</table></body></html>\n";
+    }
+
+    // What a handler response costs to compress, and what it saves on the wire
+    void compressBody(benchmark::State& state, Compression::Encoding encoding, int level) {
+        if (encoding != Compression::IDENTITY && !(Compression::getAvailable() & encoding)) {
+            state.SkipWithError("encoding not built in");
+            return;
+        }
+        Compression::Settings settings;
+        settings.gzipLevel = level;
+        settings.brotliQuality = level;
+        std::string page = samplePage();
+        size_t wireBytes = 0;
+        for (auto _ : state) {
+            HTTPResponse response(HTTPResponse::Status::OK, {{"Content-Type", "text/html"}});
+            response.setBody(page);
+            Compression::compressResponse(response, encoding, settings);
+            wireBytes = response.headersToString().size() + response.getBody().size();
+            benchmark::DoNotOptimize(response);
+        }
+        state.counters["wire_bytes"] = wireBytes;
+        state.counters["ratio"] = static_cast<double>(page.size()) / std::max<size_t>(wireBytes, 1);
+        state.SetBytesProcessed(state.iterations() * page.size());
+    }
+
+    // A static file whose compressed variant is already cached costs no more than an uncompressed hit
+    void staticFile(benchmark::State& state, int accepted) {
+        std::filesystem::path dir = std::filesystem::temp_directory_path() / ("myhttp_bench_" + std::to_string(getpid()));
+        std::filesystem::create_directories(dir);
+        std::ofstream(dir / "index.html") << samplePage();
+        {
+            Router router(dir);
+            size_t wireBytes = 0;
+            for (auto _ : state) {
+                auto response = router.getStaticFile(HTTPRequest::Method::GET, "/index.html", accepted);
+                wireBytes = response->toString().size();
+                benchmark::DoNotOptimize(response);
+            }
+            state.counters["wire_bytes"] = wireBytes;
+        }
+        std::filesystem::remove_all(dir);
+    }
+}
+
+BENCHMARK_CAPTURE(compressBody, identity, Compression::IDENTITY, 0);
+BENCHMARK_CAPTURE(compressBody, gzip_1, Compression::GZIP, 1);
+BENCHMARK_CAPTURE(compressBody, gzip_6, Compression::GZIP, 6);
+BENCHMARK_CAPTURE(compressBody, brotli_4, Compression::BROTLI, 4);
+BENCHMARK_CAPTURE(compressBody, brotli_5, Compression::BROTLI, 5);
+BENCHMARK_CAPTURE(staticFile, identity, Compression::IDENTITY);
+BENCHMARK_CAPTURE(staticFile, gzip, Compression::GZIP);
+BENCHMARK_CAPTURE(staticFile, brotli, Compression::BROTLI);
@@ -0,0 +1,44 @@
+#include <benchmark/benchmark.h>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+#include "Allocations.h"
+#include "ResponseGenerator.h"
+
+namespace {
+    // Opening and describing a file, which is never read into memory, so its size should hardly matter
+    void fileResponse(benchmark::State& state) {
+        std::filesystem::path file = std::filesystem::temp_directory_path() / ("myhttp_bench_file_" + std::to_string(getpid()) + ".html");
+        std::ofstream(file) << std::string(state.range(0), 'x');
+        Allocations::Counter allocations;
+        for (auto _ : state)
+            benchmark::DoNotOptimize(ResponseGenerator::generateFileResponse(file));
+        allocations.report(state);
+        std::filesystem::remove(file);
+    }
+
+    // Serializing what a handler returns, headers and body
+    void toString(benchmark::State& state) {
+        HTTPResponse response = ResponseGenerator::generateHTMLResponse(std::string(state.range(0), 'x'));
+        response.setHeader("Cache-Control", "no-store");
+        response.setHeader("X-Request-Id", "3f2504e0-4f89-11d3-9a0c-0305e82c3301");
+        Allocations::Counter allocations;
+        for (auto _ : state)
+            benchmark::DoNotOptimize(response.toString());
+        allocations.report(state);
+        state.SetBytesProcessed(state.iterations() * response.toString().size());
+    }
+
+    void cannedToString(benchmark::State& state) {
+        HTTPResponse response = ResponseGenerator::generateNotFoundResponse();
+        Allocations::Counter allocations;
+        for (auto _ : state)
+            benchmark::DoNotOptimize(response.toString());
+        allocations.report(state);
+    }
+}
+
+BENCHMARK(fileResponse)->Arg(1 << 10)->Arg(64 << 10)->Arg(1 << 20);
+BENCHMARK(toString)->Arg(64)->Arg(4 << 10)->Arg(64 << 10);
+BENCHMARK(cannedToString);
@@ -0,0 +1,70 @@
+#include <benchmark/benchmark.h>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "Allocations.h"
+#include "ResponseGenerator.h"
+#include "Router.h"
+
+namespace {
+    // Three routes per resource, like a REST API: its collection, one item, and something under the item
+    std::string addApi(Router& router, int route) {
+        auto handler = [](const RequestView&) { return ResponseGenerator::generateNotFoundResponse(); };
+        std::string base = "/api/v1/resource" + std::to_string(route / 3);
+        switch (route % 3) {
+            case 0:
+                router.addRoute(base, HTTPRequest::Method::GET | HTTPRequest::Method::POST, handler);
+                return base;
+            case 1:
+                router.addRoute(base + "/:id", HTTPRequest::Method::GET | HTTPRequest::Method::PUT | HTTPRequest::Method::DELETE, handler);
+                return base + "/12345";
+            default:
+                router.addRoute(base + "/:id/history/*rest", HTTPRequest::Method::GET, handler);
+                return base + "/12345/history/2024/05";
+        }
+    }
+
+    void lookup(benchmark::State& state) {
+        Router router(std::filesystem::temp_directory_path());
+        int routes = state.range(0);
+        std::vector<std::string> paths;
+        for (int i = 0; i < routes; i++) {
+            std::string path = addApi(router, i);
+            if (i % 7 < 3)
+                paths.push_back(path);
+        }
+
+        size_t next = 0;
+        Allocations::Counter allocations;
+        for (auto _ : state) {
+            RequestView request(HTTPRequest::Method::GET, paths[next], "HTTP/1.1", "");
+            benchmark::DoNotOptimize(router.getHandler(request));
+            next = next + 1 == paths.size() ? 0 : next + 1;
+        }
+        allocations.report(state);
+        state.SetItemsProcessed(state.iterations());
+    }
+
+    // A file served from the static file cache, or a path with no file behind it
+    void getStaticFile(benchmark::State& state, const char* route) {
+        std::filesystem::path dir = std::filesystem::temp_directory_path() / ("myhttp_bench_router_" + std::to_string(getpid()));
+        std::filesystem::create_directories(dir);
+        std::ofstream(dir / "index.html") << std::string(4096, 'x');
+        {
+            Router router(dir);
+            // The first request fills the cache
+            benchmark::DoNotOptimize(router.getStaticFile(HTTPRequest::Method::GET, route));
+            Allocations::Counter allocations;
+            for (auto _ : state)
+                benchmark::DoNotOptimize(router.getStaticFile(HTTPRequest::Method::GET, route));
+            allocations.report(state);
+        }
+        std::filesystem::remove_all(dir);
+    }
+}
+
+BENCHMARK(lookup)->Arg(10)->Arg(100)->Arg(1000);
+BENCHMARK_CAPTURE(getStaticFile, hit, "/index.html");
+BENCHMARK_CAPTURE(getStaticFile, miss, "/missing.html");
@@ -0,0 +1,85 @@
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include "Allocations.h"
+#include "WorkerPool.h"
+
+namespace {
+    // The pool as it was before work stealing: one queue of std::function behind one lock
+    class MutexPool {
+    public:
+        explicit MutexPool(size_t numThreads) {
+            for (size_t i = 0; i < numThreads; ++i)
+                m_workers.emplace_back([this] { run(); });
+        }
+        ~MutexPool() {
+            m_queueMutex.lock();
+            m_stop = true;
+            m_queueMutex.unlock();
+            m_cv.notify_all();
+            for (std::thread& worker : m_workers)
+                worker.join();
+        }
+        void enqueue(std::function<void()> task) {
+            m_queueMutex.lock();
+            m_tasks.push(std::move(task));
+            m_queueMutex.unlock();
+            m_cv.notify_one();
+        }
+
+    private:
+        std::vector<std::thread> m_workers;
+        std::queue<std::function<void()>> m_tasks;
+        std::mutex m_queueMutex;
+        std::condition_variable m_cv;
+        bool m_stop = false;
+
+        void run() {
+            std::function<void()> task;
+            while (true) {
+                {
+                    std::unique_lock<std::mutex> lock(m_queueMutex);
+                    m_cv.wait(lock, [&] { return m_stop || !m_tasks.empty(); });
+                    if (m_stop && m_tasks.empty())
+                        return;
+                    task = std::move(m_tasks.front());
+                    m_tasks.pop();
+                }
+                task();
+            }
+        }
+    };
+
+    constexpr int BATCH = 10000;
+
+    // One producer queues a batch of small tasks, like the epoll thread handing out client events,
+    // and waits for the workers to finish them
+    template <typename Pool>
+    void submit(benchmark::State& state) {
+        Pool pool(state.range(0));
+        std::atomic<int> done = 0;
+        // Captures the same amount as the server's client handler
+        void* context[3] = {&done, nullptr, nullptr};
+        Allocations::Counter allocations;
+        for (auto _ : state) {
+            done.store(0);
+            for (int i = 0; i < BATCH; i++) {
+                pool.enqueue([context, i] {
+                    static_cast<std::atomic<int>*>(context[0])->fetch_add(1, std::memory_order_relaxed);
+                    benchmark::DoNotOptimize(i);
+                });
+            }
+            while (done.load() < BATCH)
+                std::this_thread::yield();
+        }
+        allocations.report(state, BATCH);
+        state.SetItemsProcessed(state.iterations() * BATCH);
+    }
+}
+
+BENCHMARK_TEMPLATE(submit, MutexPool)->RangeMultiplier(2)->Range(1, 64)->UseRealTime();
+BENCHMARK_TEMPLATE(submit, WorkerPool)->RangeMultiplier(2)->Range(1, 64)->UseRealTime();
@@ -0,0 +1,690 @@
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "Histogram.h"
+#include "HTTPRequest.h"
+#include "ResponseGenerator.h"
+#include "Server.h"
+
+// An HTTP/1.1 load generator, to compare builds and settings on the same machine without installing wrk.
+// Every client thread runs an epoll loop over its share of the keep-alive connections, and each connection
+// keeps a number of requests in flight, sending the next one as soon as a response arrives. Like wrk that's
+// a closed loop: when the server stalls fewer requests are sent, and latency is measured from when a request
+// is written to when its response has all arrived. Without --target it starts a Server in this process.
+// Prints one JSON object with the throughput and latency percentiles.
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    enum class Kind { STATIC, RANDOM, POST, COUNT };
+    constexpr size_t KINDS = static_cast<size_t>(Kind::COUNT);
+    constexpr const char* KIND_NAMES[KINDS] = {"static", "random", "post"};
+
+    // Longer response headers are a broken response
+    constexpr size_t MAX_HEADER_BYTES = 64 * 1024;
+
+    struct Options {
+        // Empty to start a server in this process
+        std::string target;
+        int port = 18080;
+        int connections = 256;
+        int threads = std::max(1u, std::thread::hardware_concurrency() / 2);
+        int pipeline = 1;
+        double duration = 10;
+        double warmup = 1;
+        std::array<unsigned, KINDS> mix{1, 0, 0};
+        std::string staticPath = "/test.txt";
+        std::string randomPath = "/random";
+        std::string postPath = "/echo";
+        size_t postBytes = 64;
+        std::string output;
+        // Only for the server in this process
+        Server::Mode serverMode = Server::Mode::THREAD_POOL;
+        int serverThreads = std::max(1u, std::thread::hardware_concurrency() / 2);
+        std::filesystem::path root = MYHTTP_PUBLIC_HTML;
+    };
+
+    struct Results {
+        // Nanoseconds from writing a request to reading the end of its response
+        Histogram latency;
+        std::array<uint64_t, KINDS> responses{};
+        uint64_t bytesReceived = 0;
+        // Responses with a status other than 2xx, which are counted as responses too
+        uint64_t non2xx = 0;
+        uint64_t connectErrors = 0;
+        // Requests lost because the connection failed or was closed with them in flight
+        uint64_t socketErrors = 0;
+        uint64_t parseErrors = 0;
+    };
+
+    struct InFlight {
+        Clock::time_point sentAt;
+        Kind kind;
+    };
+
+    struct Connection {
+        int fd = -1;
+        bool connected = false;
+        // The requests queued but not all sent yet
+        std::string out;
+        size_t outOffset = 0;
+        // The start of a response whose headers haven't all arrived
+        std::string in;
+        // Body bytes left of the response being read, once its headers are
+        size_t bodyLeft = 0;
+        int status = 0;
+        bool closeAfter = false;
+        // A circular queue of what was sent, oldest first
+        std::vector<InFlight> inFlight;
+        size_t inFlightHead = 0;
+        size_t inFlightCount = 0;
+        // Where this connection is in the request mix
+        size_t next = 0;
+    };
+
+    [[noreturn]] void usage(const std::string& error) {
+        std::cerr << "bench_load: " << error << "\n\n"
+                  << "Usage: bench_load [options]\n"
+                  << "  --target HOST:PORT      Load a server that is already running, instead of starting one\n"
+                  << "  --port N                Port of the server started in this process (18080)\n"
+                  << "  --server-mode MODE      thread_pool, multi_reactor or io_uring (thread_pool)\n"
+                  << "  --server-threads N      Threads of the server started in this process\n"
+                  << "  --root DIR              Directory it serves static files from (public_html)\n"
+                  << "  --connections N         Keep-alive connections, spread over the client threads (256)\n"
+                  << "  --threads N             Client threads\n"
+                  << "  --pipeline N            Requests each connection keeps in flight (1)\n"
+                  << "  --duration SECONDS      How long to measure for (10)\n"
+                  << "  --warmup SECONDS        How long to run before measuring (1)\n"
+                  << "  --mix static=W,random=W,post=W\n"
+                  << "                          Relative weights of the kinds of requests (static=1)\n"
+                  << "  --static-path PATH      The static file requested (/test.txt)\n"
+                  << "  --random-path PATH      The dynamic GET route requested (/random)\n"
+                  << "  --post-path PATH        Where POST requests go (/echo)\n"
+                  << "  --post-bytes N          Size of the POST bodies (64)\n"
+                  << "  --output FILE           Write the JSON to a file instead of stdout\n";
+        std::exit(2);
+    }
+
+    template <typename T>
+    T parseNumber(std::string_view text, const std::string& option) {
+        T value{};
+        auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+        if (error != std::errc() || end != text.data() + text.size())
+            usage("bad value for " + option + ": " + std::string(text));
+        return value;
+    }
+
+    void parseMix(std::string_view text, Options& options) {
+        options.mix.fill(0);
+        while (!text.empty()) {
+            size_t comma = text.find(',');
+            std::string_view part = text.substr(0, comma);
+            text = comma == std::string_view::npos ? std::string_view() : text.substr(comma + 1);
+            size_t equals = part.find('=');
+            std::string_view name = part.substr(0, equals);
+            auto kind = std::find(std::begin(KIND_NAMES), std::end(KIND_NAMES), name);
+            if (equals == std::string_view::npos || kind == std::end(KIND_NAMES))
+                usage("bad --mix entry: " + std::string(part));
+            options.mix[kind - std::begin(KIND_NAMES)] = parseNumber<unsigned>(part.substr(equals + 1), "--mix");
+        }
+        if (options.mix[0] + options.mix[1] + options.mix[2] == 0)
+            usage("--mix needs a weight above 0");
+    }
+
+    Options parseOptions(int argc, char** argv) {
+        Options options;
+        for (int i = 1; i < argc; i++) {
+            std::string option = argv[i];
+            if (option == "--help" || option == "-h")
+                usage("load an HTTP server and report its throughput and latency");
+            if (i + 1 == argc)
+                usage(option + " needs a value");
+            std::string_view value = argv[++i];
+            if (option == "--target")
+                options.target = value;
+            else if (option == "--port")
+                options.port = parseNumber<int>(value, option);
+            else if (option == "--server-mode") {
+                if (value == "thread_pool")
+                    options.serverMode = Server::Mode::THREAD_POOL;
+                else if (value == "multi_reactor")
+                    options.serverMode = Server::Mode::MULTI_REACTOR;
+                else if (value == "io_uring")
+                    options.serverMode = Server::Mode::IO_URING;
+                else
+                    usage("unknown server mode: " + std::string(value));
+            }
+            else if (option == "--server-threads")
+                options.serverThreads = parseNumber<int>(value, option);
+            else if (option == "--root")
+                options.root = value;
+            else if (option == "--connections")
+                options.connections = parseNumber<int>(value, option);
+            else if (option == "--threads")
+                options.threads = parseNumber<int>(value, option);
+            else if (option == "--pipeline")
+                options.pipeline = parseNumber<int>(value, option);
+            else if (option == "--duration")
+                options.duration = parseNumber<double>(value, option);
+            else if (option == "--warmup")
+                options.warmup = parseNumber<double>(value, option);
+            else if (option == "--mix")
+                parseMix(value, options);
+            else if (option == "--static-path")
+                options.staticPath = value;
+            else if (option == "--random-path")
+                options.randomPath = value;
+            else if (option == "--post-path")
+                options.postPath = value;
+            else if (option == "--post-bytes")
+                options.postBytes = parseNumber<size_t>(value, option);
+            else if (option == "--output")
+                options.output = value;
+            else
+                usage("unknown option: " + option);
+        }
+        if (options.connections < 1 || options.threads < 1 || options.pipeline < 1 || options.serverThreads < 1)
+            usage("--connections, --threads, --pipeline and --server-threads must be at least 1");
+        if (options.duration <= 0 || options.warmup < 0)
+            usage("--duration must be above 0 and --warmup at least 0");
+        options.threads = std::min(options.threads, options.connections);
+        return options;
+    }
+
+    sockaddr_in resolve(const std::string& target, int& port) {
+        size_t colon = target.rfind(':');
+        if (colon == std::string::npos)
+            usage("--target needs HOST:PORT");
+        std::string host = target.substr(0, colon);
+        port = parseNumber<int>(std::string_view(target).substr(colon + 1), "--target");
+        addrinfo hints{};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* found = nullptr;
+        if (getaddrinfo(host.c_str(), nullptr, &hints, &found) != 0 || !found)
+            usage("can't resolve " + host);
+        sockaddr_in address = *reinterpret_cast<sockaddr_in*>(found->ai_addr);
+        freeaddrinfo(found);
+        address.sin_port = htons(port);
+        return address;
+    }
+
+    bool equalsIgnoringCase(std::string_view a, std::string_view b) {
+        return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+            return std::tolower(static_cast<unsigned char>(x)) == std::tolower(static_cast<unsigned char>(y));
+        });
+    }
+
+    // Reads the status line and the headers that say where a response ends
+    bool parseHeaders(std::string_view headers, int& status, size_t& bodyLength, bool& close) {
+        if (headers.size() < 12 || !headers.starts_with("HTTP/1."))
+            return false;
+        if (std::from_chars(headers.data() + 9, headers.data() + 12, status).ec != std::errc())
+            return false;
+        bodyLength = 0;
+        close = headers[7] == '0';
+        size_t lineStart = headers.find("\r\n") + 2;
+        while (lineStart < headers.size()) {
+            size_t lineEnd = headers.find("\r\n", lineStart);
+            std::string_view line = headers.substr(lineStart, lineEnd - lineStart);
+            lineStart = lineEnd + 2;
+            size_t colon = line.find(':');
+            if (colon == std::string_view::npos)
+                continue;
+            std::string_view name = line.substr(0, colon);
+            std::string_view value = line.substr(colon + 1);
+            while (!value.empty() && value.front() == ' ')
+                value.remove_prefix(1);
+            if (equalsIgnoringCase(name, "Content-Length")) {
+                if (std::from_chars(value.data(), value.data() + value.size(), bodyLength).ec != std::errc())
+                    return false;
+            } else if (equalsIgnoringCase(name, "Transfer-Encoding")) {
+                // MyHTTP never sends chunked responses, so neither does anything this is meant for
+                return false;
+            } else if (equalsIgnoringCase(name, "Connection")) {
+                close = equalsIgnoringCase(value, "close");
+            }
+        }
+        // These never have a body, whatever their headers say
+        if (status / 100 == 1 || status == 204 || status == 304)
+            bodyLength = 0;
+        return true;
+    }
+
+    class Client {
+    public:
+        Client(const Options& options, const sockaddr_in& address, const std::array<std::string, KINDS>& requests,
+               const std::vector<Kind>& schedule, int connections, int firstConnection, Results& results)
+            : m_options(options), m_address(address), m_requests(requests), m_schedule(schedule),
+              m_connections(connections), m_results(results)
+        {
+            m_epollFd = epoll_create1(0);
+            for (int i = 0; i < connections; i++) {
+                m_connections[i].inFlight.resize(options.pipeline);
+                // Spread the connections over the mix, so they don't all send the same kind of request at once
+                m_connections[i].next = (firstConnection + i) % schedule.size();
+            }
+        }
+
+        ~Client() {
+            for (Connection& connection : m_connections) {
+                if (connection.fd != -1)
+                    close(connection.fd);
+            }
+            close(m_epollFd);
+        }
+
+        void run(Clock::time_point measureFrom, Clock::time_point measureUntil) {
+            m_measureFrom = measureFrom;
+            m_measureUntil = measureUntil;
+            for (Connection& connection : m_connections)
+                open(connection);
+
+            std::vector<epoll_event> events(1024);
+            Clock::time_point lastRetry = Clock::now();
+            while ((m_now = Clock::now()) < m_measureUntil) {
+                // Connections that couldn't connect are retried every so often, rather than in a tight loop
+                int timeout = m_closed.empty() ? 100 : 10;
+                int count = epoll_wait(m_epollFd, events.data(), events.size(), timeout);
+                m_now = Clock::now();
+                for (int i = 0; i < count; i++) {
+                    Connection& connection = m_connections[events[i].data.u64];
+                    if (!handle(connection, events[i].events))
+                        fail(connection);
+                }
+                if (!m_closed.empty() && m_now - lastRetry >= std::chrono::milliseconds(10)) {
+                    lastRetry = m_now;
+                    std::vector<size_t> closed;
+                    closed.swap(m_closed);
+                    for (size_t index : closed)
+                        open(m_connections[index]);
+                }
+            }
+        }
+
+    private:
+        const Options& m_options;
+        sockaddr_in m_address;
+        const std::array<std::string, KINDS>& m_requests;
+        const std::vector<Kind>& m_schedule;
+        std::vector<Connection> m_connections;
+        // Indexes of connections waiting to be opened again
+        std::vector<size_t> m_closed;
+        Results& m_results;
+        int m_epollFd;
+        Clock::time_point m_measureFrom;
+        Clock::time_point m_measureUntil;
+        // When the events being handled arrived
+        Clock::time_point m_now;
+
+        bool isMeasuring() const { return m_now >= m_measureFrom; }
+
+        void open(Connection& connection) {
+            size_t index = &connection - m_connections.data();
+            connection.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (connection.fd == -1) {
+                m_results.connectErrors++;
+                m_closed.push_back(index);
+                return;
+            }
+            int one = 1;
+            setsockopt(connection.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            if (connect(connection.fd, reinterpret_cast<const sockaddr*>(&m_address), sizeof(m_address)) == -1 &&
+                errno != EINPROGRESS) {
+                m_results.connectErrors++;
+                reset(connection);
+                m_closed.push_back(index);
+                return;
+            }
+            epoll_event event{};
+            event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            event.data.u64 = index;
+            epoll_ctl(m_epollFd, EPOLL_CTL_ADD, connection.fd, &event);
+        }
+
+        void reset(Connection& connection) {
+            close(connection.fd);
+            connection.fd = -1;
+            connection.connected = false;
+            connection.out.clear();
+            connection.outOffset = 0;
+            connection.in.clear();
+            connection.bodyLeft = 0;
+            connection.inFlightHead = 0;
+            connection.inFlightCount = 0;
+        }
+
+        // Closes a connection that broke, and opens it again
+        void fail(Connection& connection) {
+            if (!connection.connected)
+                m_results.connectErrors++;
+            else if (isMeasuring())
+                m_results.socketErrors += connection.inFlightCount;
+            reset(connection);
+            m_closed.push_back(&connection - m_connections.data());
+        }
+
+        bool handle(Connection& connection, uint32_t events) {
+            if (!connection.connected) {
+                int error = 0;
+                socklen_t length = sizeof(error);
+                getsockopt(connection.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+                if (error != 0 || (events & (EPOLLERR | EPOLLHUP)))
+                    return false;
+                connection.connected = true;
+            }
+            if ((events & EPOLLIN) && !receive(connection))
+                return false;
+            // The server closed it after a response, as it said it would
+            if (connection.fd == -1) {
+                open(connection);
+                return true;
+            }
+            fill(connection);
+            return send(connection);
+        }
+
+        // Queues requests until the connection has as many in flight as it may
+        void fill(Connection& connection) {
+            while (connection.inFlightCount < connection.inFlight.size()) {
+                Kind kind = m_schedule[connection.next];
+                connection.next = connection.next + 1 == m_schedule.size() ? 0 : connection.next + 1;
+                connection.out += m_requests[static_cast<size_t>(kind)];
+                size_t slot = (connection.inFlightHead + connection.inFlightCount) % connection.inFlight.size();
+                connection.inFlight[slot] = InFlight{m_now, kind};
+                connection.inFlightCount++;
+            }
+        }
+
+        bool send(Connection& connection) {
+            while (connection.outOffset < connection.out.size()) {
+                ssize_t sent = ::send(connection.fd, connection.out.data() + connection.outOffset,
+                                      connection.out.size() - connection.outOffset, MSG_NOSIGNAL);
+                if (sent > 0) {
+                    connection.outOffset += sent;
+                } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return true;
+                } else if (errno != EINTR) {
+                    return false;
+                }
+            }
+            connection.out.clear();
+            connection.outOffset = 0;
+            return true;
+        }
+
+        bool receive(Connection& connection) {
+            thread_local char buffer[64 * 1024];
+            while (true) {
+                ssize_t received = recv(connection.fd, buffer, sizeof(buffer), 0);
+                if (received > 0) {
+                    if (isMeasuring())
+                        m_results.bytesReceived += received;
+                    if (!consume(connection, std::string_view(buffer, received))) {
+                        m_results.parseErrors++;
+                        return false;
+                    }
+                    if (connection.fd == -1)
+                        return true;
+                } else if (received == 0) {
+                    return false;
+                } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return true;
+                } else if (errno != EINTR) {
+                    return false;
+                }
+            }
+        }
+
+        // Reads responses out of what was received. Only headers are kept until they have all arrived,
+        // body bytes are just counted off.
+        bool consume(Connection& connection, std::string_view data) {
+            while (!data.empty()) {
+                if (connection.bodyLeft > 0) {
+                    size_t taken = std::min(connection.bodyLeft, data.size());
+                    connection.bodyLeft -= taken;
+                    data.remove_prefix(taken);
+                    if (connection.bodyLeft == 0 && !complete(connection))
+                        return true;
+                    continue;
+                }
+
+                // A header block split between reads might end in the bytes already kept
+                size_t kept = connection.in.size();
+                size_t searchFrom = kept >= 3 ? kept - 3 : 0;
+                connection.in.append(data);
+                size_t end = connection.in.find("\r\n\r\n", searchFrom);
+                if (end == std::string::npos) {
+                    if (connection.in.size() > MAX_HEADER_BYTES)
+                        return false;
+                    return true;
+                }
+                size_t bodyLength = 0;
+                // A response with no request in flight means the two sides lost track of each other
+                if (connection.inFlightCount == 0 ||
+                    !parseHeaders(std::string_view(connection.in).substr(0, end + 2), connection.status, bodyLength,
+                                  connection.closeAfter))
+                    return false;
+                data.remove_prefix(end + 4 - kept);
+                connection.in.clear();
+                connection.bodyLeft = bodyLength;
+                if (bodyLength == 0 && !complete(connection))
+                    return true;
+            }
+            return true;
+        }
+
+        // Records the response that just ended. Returns false if the connection was closed after it.
+        bool complete(Connection& connection) {
+            InFlight request = connection.inFlight[connection.inFlightHead];
+            connection.inFlightHead = (connection.inFlightHead + 1) % connection.inFlight.size();
+            connection.inFlightCount--;
+            // Only requests sent while measuring count, so the warmup doesn't leak into the results
+            if (request.sentAt >= m_measureFrom) {
+                m_results.latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(m_now - request.sentAt).count());
+                m_results.responses[static_cast<size_t>(request.kind)]++;
+                if (connection.status / 100 != 2)
+                    m_results.non2xx++;
+            }
+            if (connection.closeAfter) {
+                if (isMeasuring())
+                    m_results.socketErrors += connection.inFlightCount;
+                reset(connection);
+                return false;
+            }
+            return true;
+        }
+    };
+
+    std::array<std::string, KINDS> makeRequests(const Options& options, const std::string& host) {
+        std::string body(options.postBytes, 'x');
+        std::array<std::string, KINDS> requests;
+        requests[static_cast<size_t>(Kind::STATIC)] = "GET " + options.staticPath + " HTTP/1.1\r\nHost: " + host + "\r\n\r\n";
+        requests[static_cast<size_t>(Kind::RANDOM)] = "GET " + options.randomPath + " HTTP/1.1\r\nHost: " + host + "\r\n\r\n";
+        requests[static_cast<size_t>(Kind::POST)] = "POST " + options.postPath + " HTTP/1.1\r\nHost: " + host +
+            "\r\nContent-Type: application/x-www-form-urlencoded\r\nContent-Length: " + std::to_string(body.size()) +
+            "\r\n\r\n" + body;
+        return requests;
+    }
+
+    // Every kind of request as many times as its weight, shuffled the same way on every run
+    std::vector<Kind> makeSchedule(const Options& options) {
+        std::vector<Kind> schedule;
+        for (size_t kind = 0; kind < KINDS; kind++)
+            schedule.insert(schedule.end(), options.mix[kind], static_cast<Kind>(kind));
+        std::shuffle(schedule.begin(), schedule.end(), std::mt19937(42));
+        return schedule;
+    }
+
+    // The server's socket starts listening when its loop does
+    bool waitForServer(const sockaddr_in& address) {
+        for (int attempt = 0; attempt < 500; attempt++) {
+            int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            bool connected = connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0;
+            close(fd);
+            if (connected)
+                return true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return false;
+    }
+
+    // Tens of thousands of connections need more file descriptors than the usual soft limit
+    void raiseFileLimit(const Options& options) {
+        rlimit limit{};
+        if (getrlimit(RLIMIT_NOFILE, &limit) != 0)
+            return;
+        rlim_t wanted = options.connections * (options.target.empty() ? 2 : 1) + 256;
+        if (limit.rlim_cur < wanted) {
+            limit.rlim_cur = std::min(limit.rlim_max, wanted);
+            setrlimit(RLIMIT_NOFILE, &limit);
+            if (limit.rlim_cur < wanted)
+                std::cerr << "bench_load: only " << limit.rlim_cur << " file descriptors are allowed, some connections will fail\n";
+        }
+    }
+
+    std::string formatMicros(uint64_t nanoseconds) {
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%.1f", nanoseconds / 1000.0);
+        return buffer;
+    }
+
+    std::string escape(const std::string& text) {
+        std::string escaped;
+        for (char c : text) {
+            if (c == '"' || c == '\\')
+                escaped += '\\';
+            if (static_cast<unsigned char>(c) >= 0x20)
+                escaped += c;
+        }
+        return escaped;
+    }
+
+    std::string toJson(const Options& options, const std::string& target, const Results& total, double seconds) {
+        const char* modes[] = {"thread_pool", "multi_reactor", "io_uring"};
+        uint64_t responses = total.responses[0] + total.responses[1] + total.responses[2];
+        uint64_t count = total.latency.getCount();
+        char rate[32];
+        snprintf(rate, sizeof(rate), "%.1f", responses / seconds);
+        char duration[32];
+        snprintf(duration, sizeof(duration), "%g", seconds);
+
+        std::string json = "{\"target\":\"" + escape(target) + "\",";
+        if (options.target.empty())
+            json += "\"server\":{\"mode\":\"" + std::string(modes[static_cast<int>(options.serverMode)]) +
+                    "\",\"threads\":" + std::to_string(options.serverThreads) + "},";
+        json += "\"connections\":" + std::to_string(options.connections) + ",\"threads\":" + std::to_string(options.threads) +
+                ",\"pipeline\":" + std::to_string(options.pipeline) + ",\"duration_s\":" + std::string(duration) + ",\"mix\":{";
+        for (size_t kind = 0; kind < KINDS; kind++)
+            json += std::string(kind ? "," : "") + "\"" + KIND_NAMES[kind] + "\":" + std::to_string(options.mix[kind]);
+        json += "},\"requests\":" + std::to_string(responses) + ",\"requests_by_kind\":{";
+        for (size_t kind = 0; kind < KINDS; kind++)
+            json += std::string(kind ? "," : "") + "\"" + KIND_NAMES[kind] + "\":" + std::to_string(total.responses[kind]);
+        json += "},\"requests_per_second\":" + std::string(rate) + ",\"bytes_received\":" + std::to_string(total.bytesReceived) +
+                ",\"errors\":{\"connect\":" + std::to_string(total.connectErrors) + ",\"socket\":" + std::to_string(total.socketErrors) +
+                ",\"parse\":" + std::to_string(total.parseErrors) + ",\"non_2xx\":" + std::to_string(total.non2xx) + "}" +
+                ",\"latency_us\":{\"mean\":" + formatMicros(count ? total.latency.getSum() / count : 0) +
+                ",\"p50\":" + formatMicros(total.latency.getQuantile(0.5)) + ",\"p90\":" + formatMicros(total.latency.getQuantile(0.9)) +
+                ",\"p99\":" + formatMicros(total.latency.getQuantile(0.99)) + ",\"p999\":" + formatMicros(total.latency.getQuantile(0.999)) +
+                ",\"max\":" + formatMicros(total.latency.getQuantile(1)) + "}}\n";
+        return json;
+    }
+}
+
+int main(int argc, char** argv) {
+    Options options = parseOptions(argc, argv);
+    raiseFileLimit(options);
+
+    std::string target = options.target.empty() ? "127.0.0.1:" + std::to_string(options.port) : options.target;
+    int port = 0;
+    sockaddr_in address = resolve(target, port);
+
+    std::unique_ptr<Server> server;
+    if (options.target.empty()) {
+        server = std::make_unique<Server>(options.port, options.root, options.serverThreads, 30, options.serverMode);
+        server->addRoute("/random", HTTPRequest::Method::GET, [](const RequestView&) {
+            thread_local std::minstd_rand random(std::random_device{}());
+            return ResponseGenerator::generateHTMLResponse(std::to_string(random() % 100));
+        });
+        server->addRoute("/echo", HTTPRequest::Method::POST, [](const RequestView& request) {
+            return ResponseGenerator::generateHTMLResponse(std::string(request.getBody()));
+        });
+        std::thread([&server] { server->start(); }).detach();
+        if (!waitForServer(address)) {
+            std::cerr << "bench_load: the server didn't start listening on port " << options.port << "\n";
+            return 1;
+        }
+    }
+
+    std::array<std::string, KINDS> requests = makeRequests(options, target.substr(0, target.rfind(':')));
+    std::vector<Kind> schedule = makeSchedule(options);
+    std::vector<Results> results(options.threads);
+    std::vector<std::unique_ptr<Client>> clients;
+    int assigned = 0;
+    for (int i = 0; i < options.threads; i++) {
+        int connections = options.connections / options.threads + (i < options.connections % options.threads ? 1 : 0);
+        clients.push_back(std::make_unique<Client>(options, address, requests, schedule, connections, assigned, results[i]));
+        assigned += connections;
+    }
+
+    Clock::time_point measureFrom = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.warmup));
+    Clock::time_point measureUntil = measureFrom + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.duration));
+    std::vector<std::thread> threads;
+    for (auto& client : clients)
+        threads.emplace_back([&client, measureFrom, measureUntil] { client->run(measureFrom, measureUntil); });
+    for (std::thread& thread : threads)
+        thread.join();
+    clients.clear();
+
+    Results total;
+    for (const Results& part : results) {
+        total.latency.add(part.latency);
+        for (size_t kind = 0; kind < KINDS; kind++)
+            total.responses[kind] += part.responses[kind];
+        total.bytesReceived += part.bytesReceived;
+        total.non2xx += part.non2xx;
+        total.connectErrors += part.connectErrors;
+        total.socketErrors += part.socketErrors;
+        total.parseErrors += part.parseErrors;
+    }
+
+    std::string json = toJson(options, target, total, options.duration);
+    if (options.output.empty()) {
+        std::cout << json << std::flush;
+    } else {
+        std::ofstream out(options.output, std::ios::trunc);
+        out << json;
+        if (!out) {
+            std::cerr << "bench_load: failed to write " << options.output << "\n";
+            return 1;
+        }
+    }
+    if (total.latency.getCount() == 0)
+        std::cerr << "bench_load: no responses arrived\n";
+
+    // The server only stops through its signal handler, which prints to stdout, so it's left running
+    std::fflush(nullptr);
+    _exit(total.latency.getCount() == 0 ? 1 : 0);
+}
@@ -0,0 +1,327 @@
+#pragma once
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include "Task.h"
+
+// Coroutines for handlers that wait on timers, sockets or files without holding a thread while they do.
+// Whatever a task waits on is registered with the EventLoop of the thread it runs on, and the task is
+// resumed from that loop once it's ready. Named Async::Task since the worker pool's Task has the plain name.
+namespace Async {
+    template <typename T = void>
+    class Task;
+
+    namespace detail {
+        struct PromiseBase {
+            std::coroutine_handle<> continuation;
+            std::exception_ptr exception;
+
+            // Lazy, nothing runs until the task is awaited
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            struct FinalAwaiter {
+                bool await_ready() noexcept { return false; }
+                // Straight back to whoever awaited the task, so a long chain of them doesn't grow the stack
+                template <typename Promise>
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+                    std::coroutine_handle<> continuation = handle.promise().continuation;
+                    return continuation ? continuation : std::noop_coroutine();
+                }
+                void await_resume() noexcept {}
+            };
+            FinalAwaiter final_suspend() noexcept { return {}; }
+            void unhandled_exception() { exception = std::current_exception(); }
+        };
+
+        template <typename T>
+        struct Promise : PromiseBase {
+            std::optional<T> value;
+
+            Task<T> get_return_object() noexcept;
+            template <typename U>
+            void return_value(U&& result) { value.emplace(std::forward<U>(result)); }
+            T take() {
+                if (exception)
+                    std::rethrow_exception(exception);
+                return std::move(*value);
+            }
+        };
+
+        template <>
+        struct Promise<void> : PromiseBase {
+            Task<void> get_return_object() noexcept;
+            void return_void() noexcept {}
+            void take() {
+                if (exception)
+                    std::rethrow_exception(exception);
+            }
+        };
+    }
+
+    // A coroutine producing a T, started when it is co_awaited. Exceptions thrown inside it are rethrown to the awaiter.
+    template <typename T>
+    class Task {
+    public:
+        using promise_type = detail::Promise<T>;
+
+        Task(Task&& other) noexcept : m_handle(std::exchange(other.m_handle, nullptr)) {}
+        Task& operator=(Task&& other) noexcept {
+            if (this != &other) {
+                reset();
+                m_handle = std::exchange(other.m_handle, nullptr);
+            }
+            return *this;
+        }
+        Task(const Task&) = delete;
+        Task& operator=(const Task&) = delete;
+        ~Task() { reset(); }
+
+        bool await_ready() const noexcept { return false; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+            m_handle.promise().continuation = awaiting;
+            return m_handle;
+        }
+        T await_resume() { return m_handle.promise().take(); }
+
+    private:
+        friend promise_type;
+        template <typename U>
+        friend U run(Task<U> task);
+
+        std::coroutine_handle<promise_type> m_handle;
+
+        explicit Task(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
+        void reset() {
+            if (m_handle)
+                std::exchange(m_handle, nullptr).destroy();
+        }
+    };
+
+    template <typename T>
+    Task<T> detail::Promise<T>::get_return_object() noexcept {
+        return Task<T>(std::coroutine_handle<Promise>::from_promise(*this));
+    }
+
+    inline Task<void> detail::Promise<void>::get_return_object() noexcept {
+        return Task<void>(std::coroutine_handle<Promise>::from_promise(*this));
+    }
+
+    // Where tasks wait. It owns an epoll instance for the fds they wait on, a timerfd for their timers and
+    // an eventfd for work finished on other threads, all behind one fd its owner polls along with its own.
+    // Tasks may wait from any thread, and are resumed by whichever thread calls processEvents(), or by the executor.
+    class EventLoop {
+    public:
+        using Clock = std::chrono::steady_clock;
+        using Executor = std::function<void(std::coroutine_handle<>)>;
+
+        // A task waiting for an fd, kept in the awaiting coroutine's frame
+        struct FdWaiter {
+            int fd;
+            uint32_t events;
+            std::coroutine_handle<> handle;
+        };
+
+        /// @throws std::runtime_error if the loop's fds can't be created.
+        EventLoop();
+        ~EventLoop();
+        EventLoop(const EventLoop&) = delete;
+        EventLoop& operator=(const EventLoop&) = delete;
+
+        /// @brief Readable whenever processEvents() has tasks to resume.
+        int getFd() const { return m_epollFd; }
+        /// @brief Resume every task whose wait is over.
+        /// @param timeoutMillis How long to wait for one if there are none yet, -1 for as long as it takes.
+        void processEvents(int timeoutMillis = 0);
+        /// @brief Hand tasks to this instead of resuming them on the thread calling processEvents(),
+        /// e.g. to run them on a worker pool. Set it before anything waits.
+        void setExecutor(Executor executor) { m_executor = std::move(executor); }
+
+        /// @brief Resume a task once the deadline has passed.
+        void addTimer(Clock::time_point deadline, std::coroutine_handle<> handle);
+        /// @brief Resume a task once its fd reports one of its events. Only one task may wait on an fd at a time.
+        /// The waiter may be resumed on another thread before this returns.
+        /// @return false if the fd can't be waited on, like a regular file or one that is already waited on.
+        bool addWaiter(FdWaiter& waiter);
+        /// @brief Resume a task from the loop, for work finished on another thread.
+        void post(std::coroutine_handle<> handle);
+
+        /// @return The loop tasks started on this thread wait on, or null.
+        static EventLoop* current();
+        /// @return The loop that was current before.
+        static EventLoop* setCurrent(EventLoop* loop);
+
+    private:
+        struct Timer {
+            Clock::time_point deadline;
+            // Timers for the same time fire in the order they were added
+            uint64_t sequence;
+            std::coroutine_handle<> handle;
+
+            bool operator>(const Timer& other) const {
+                return deadline != other.deadline ? deadline > other.deadline : sequence > other.sequence;
+            }
+        };
+
+        int m_epollFd = -1;
+        int m_timerFd = -1;
+        int m_wakeFd = -1;
+        Executor m_executor;
+
+        std::mutex m_mutex;
+        std::priority_queue<Timer, std::vector<Timer>, std::greater<>> m_timers;
+        uint64_t m_sequence = 0;
+        std::vector<std::coroutine_handle<>> m_posted;
+
+        /// @brief Point the timerfd at the earliest timer. Caller holds the lock.
+        void armTimer();
+        void resume(std::coroutine_handle<> handle);
+    };
+
+    namespace detail {
+        /// @brief The loop of the current thread.
+        /// @throws std::runtime_error if there is none.
+        EventLoop& currentLoop();
+        /// @brief Run blocking work on a small pool shared by every loop, started on first use.
+        void runBlocking(::Task task);
+
+        // A coroutine nobody awaits, which frees itself when it finishes
+        struct Detached {
+            struct promise_type {
+                Detached get_return_object() noexcept { return {}; }
+                std::suspend_never initial_suspend() noexcept { return {}; }
+                std::suspend_never final_suspend() noexcept { return {}; }
+                void return_void() noexcept {}
+                void unhandled_exception() noexcept { std::terminate(); }
+            };
+        };
+
+        template <typename T, typename F>
+        Detached runDetached(Task<T> task, F onDone) {
+            if constexpr (std::is_void_v<T>) {
+                co_await std::move(task);
+                onDone();
+            } else {
+                onDone(co_await std::move(task));
+            }
+        }
+    }
+
+    /// @brief Start a task without waiting for it, and call onDone with its result once it finishes. That is before
+    /// spawn() returns if the task never had to wait. A task that throws ends the program, so catch inside it.
+    template <typename T, typename F>
+    void spawn(Task<T> task, F onDone) {
+        detail::runDetached(std::move(task), std::move(onDone));
+    }
+
+    /// @brief Run a task to the end on a loop of its own, blocking the calling thread. For code outside the server, like tests.
+    template <typename T>
+    T run(Task<T> task) {
+        EventLoop loop;
+        EventLoop* previous = EventLoop::setCurrent(&loop);
+        task.m_handle.resume();
+        while (!task.m_handle.done())
+            loop.processEvents(-1);
+        EventLoop::setCurrent(previous);
+        return task.await_resume();
+    }
+
+    class Sleep {
+    public:
+        explicit Sleep(EventLoop::Clock::time_point deadline) : m_deadline(deadline) {}
+        bool await_ready() const noexcept { return m_deadline <= EventLoop::Clock::now(); }
+        void await_suspend(std::coroutine_handle<> handle) { detail::currentLoop().addTimer(m_deadline, handle); }
+        void await_resume() const noexcept {}
+
+    private:
+        EventLoop::Clock::time_point m_deadline;
+    };
+
+    class FdWait {
+    public:
+        FdWait(int fd, uint32_t events) : m_waiter{fd, events, nullptr} {}
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> handle) {
+            m_waiter.handle = handle;
+            // Once it's registered another thread may resume the task, so nothing here can be touched after
+            if (detail::currentLoop().addWaiter(m_waiter))
+                return true;
+            m_failed = true;
+            return false;
+        }
+        /// @return false if the fd couldn't be waited on.
+        bool await_resume() const noexcept { return !m_failed; }
+
+    private:
+        EventLoop::FdWaiter m_waiter;
+        bool m_failed = false;
+    };
+
+    template <typename F>
+    class Offload {
+    public:
+        using Result = std::invoke_result_t<F&>;
+        static_assert(!std::is_void_v<Result>, "Offloaded work has to return something");
+
+        explicit Offload(F function) : m_function(std::move(function)) {}
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) {
+            EventLoop* loop = &detail::currentLoop();
+            detail::runBlocking([this, loop, handle] {
+                try {
+                    m_result.emplace(m_function());
+                } catch (...) {
+                    m_exception = std::current_exception();
+                }
+                loop->post(handle);
+            });
+        }
+        Result await_resume() {
+            if (m_exception)
+                std::rethrow_exception(m_exception);
+            return std::move(*m_result);
+        }
+
+    private:
+        F m_function;
+        std::optional<Result> m_result;
+        std::exception_ptr m_exception;
+    };
+
+    /// @brief co_await to let the task sleep without holding its thread.
+    inline Sleep sleep(EventLoop::Clock::duration duration) { return Sleep(EventLoop::Clock::now() + duration); }
+    inline Sleep sleepUntil(EventLoop::Clock::time_point deadline) { return Sleep(deadline); }
+    /// @brief co_await until a non-blocking socket or pipe has something to read. Resumes with false if it can't be waited on.
+    FdWait readable(int fd);
+    /// @brief co_await until a non-blocking socket or pipe has room to write. Resumes with false if it can't be waited on.
+    FdWait writable(int fd);
+    /// @brief co_await to run blocking work, like reading a regular file that epoll can't wait on, on a pool
+    /// of its own. The task resumes on its loop with the result once it's done. Keep it in a variable and co_await that
+    /// if the function captures strings, GCC 12 moves temporaries in a co_await expression without their move constructor.
+    template <typename F>
+    Offload<F> offload(F function) { return Offload<F>(std::move(function)); }
+
+    /// @brief Receive from a socket, waiting for it to be readable if needed.
+    /// @return The bytes received, 0 once the peer has closed, or -1 with errno set.
+    Task<ssize_t> recv(int fd, void* buffer, size_t size);
+    /// @brief Send all of data, waiting for room as needed.
+    /// @return false with errno set if the connection failed.
+    Task<bool> send(int fd, std::string_view data);
+    /// @brief Open a non-blocking TCP connection, waiting for the handshake instead of blocking on it.
+    /// @return The connected socket for the caller to close, or -1 with errno set.
+    Task<int> connect(const sockaddr* address, socklen_t length);
+    /// @brief Read a whole file without blocking the loop.
+    /// @return The contents, or nothing if it couldn't be read.
+    Task<std::optional<std::string>> readFile(std::filesystem::path path);
+}
@@ -0,0 +1,228 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include "StringHash.h"
+
+// A bounded cache of values keyed by URL path, each one made from a file on disk. Every entry has a
+// cost, 1 to bound how many there are or a size to bound the bytes, and the costs are kept under a
+// capacity by evicting with the CLOCK algorithm. Hits take a shared lock and only mark the entry as
+// referenced. Entries are indexed by file path as well, in order, so invalidating a file or a whole
+// directory only visits the entries made from it.
+template <typename Value>
+class ClockCache {
+public:
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        uint64_t invalidations;
+        size_t entries;
+        size_t cost;
+    };
+
+    /// @param capacity The most the costs of all entries add up to. 0 disables the cache.
+    /// @param maxEntryCost Values that cost more than this are never cached.
+    explicit ClockCache(size_t capacity, size_t maxEntryCost = SIZE_MAX) : m_capacity(capacity), m_maxEntryCost(maxEntryCost) {}
+    ClockCache(const ClockCache&) = delete;
+    ClockCache& operator=(const ClockCache&) = delete;
+
+    /// @brief Look up a key and hand its value to visit, which runs under the shared lock.
+    /// @return What visit returned, or nullopt on a miss.
+    template <typename Visit>
+    std::optional<std::invoke_result_t<Visit, const Value&>> find(std::string_view key, Visit&& visit);
+    /// @brief Read this before reading a file, and pass it to insert(). If anything was
+    /// invalidated in between, the possibly stale value is not cached.
+    uint64_t getGeneration() const { return m_generation.load(std::memory_order_acquire); }
+    /// @brief Cache a value unless its key is cached already, it costs too much, or something was invalidated since generation was read.
+    /// @param filePath The canonical file the value was made from.
+    void insert(const std::string& key, const std::filesystem::path& filePath, Value value, size_t cost, uint64_t generation);
+    /// @brief Remove every entry made from this path or from anything below it.
+    void invalidate(const std::filesystem::path& path);
+    /// @brief The most a value may cost to be cached right now, 0 if the cache is disabled.
+    size_t getMaxEntryCost() const;
+    /// @brief Change the limits, evicting entries as needed. Ignored once the cache is disabled for good.
+    void setLimits(size_t capacity, size_t maxEntryCost = SIZE_MAX);
+    /// @brief Empty the cache and turn it off for good, for when changes to the files can no longer be seen.
+    void disable();
+    Stats getStats() const;
+
+private:
+    // File path to slot. Everything below a directory sorts together, right after "directory/".
+    using PathIndex = std::multimap<std::string, size_t, std::less<>>;
+
+    struct Entry {
+        std::string key;
+        PathIndex::iterator filePath;
+        size_t cost;
+        Value value;
+        std::atomic<bool> referenced{true};
+    };
+
+    size_t m_capacity;
+    size_t m_maxEntryCost;
+    bool m_disabled = false;
+
+    mutable std::shared_mutex m_mutex;
+    std::unordered_map<std::string, size_t, StringHash, std::equal_to<>> m_index;
+    PathIndex m_paths;
+    // CLOCK ring, freed slots are null and reused through m_freeSlots
+    std::vector<std::unique_ptr<Entry>> m_slots;
+    std::vector<size_t> m_freeSlots;
+    size_t m_hand = 0;
+    size_t m_cost = 0;
+
+    std::atomic<uint64_t> m_generation{0};
+    std::atomic<uint64_t> m_hits{0};
+    std::atomic<uint64_t> m_misses{0};
+    std::atomic<uint64_t> m_evictions{0};
+    std::atomic<uint64_t> m_invalidations{0};
+
+    /// @brief Evict entries until there is room for this much more cost. Caller holds the unique lock.
+    void makeRoom(size_t cost);
+    void removeSlot(size_t slot);
+};
+
+template <typename Value>
+template <typename Visit>
+std::optional<std::invoke_result_t<Visit, const Value&>> ClockCache<Value>::find(std::string_view key, Visit&& visit)
+{
+    std::shared_lock lock(m_mutex);
+    auto it = m_index.find(key);
+    if (it == m_index.end()) {
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+        return std::nullopt;
+    }
+    Entry& entry = *m_slots[it->second];
+    entry.referenced.store(true, std::memory_order_relaxed);
+    m_hits.fetch_add(1, std::memory_order_relaxed);
+    return visit(static_cast<const Value&>(entry.value));
+}
+
+template <typename Value>
+void ClockCache<Value>::insert(const std::string &key, const std::filesystem::path &filePath, Value value, size_t cost, uint64_t generation)
+{
+    auto entry = std::unique_ptr<Entry>(new Entry{key, {}, cost, std::move(value)});
+
+    std::unique_lock lock(m_mutex);
+    if (cost > m_capacity || cost > m_maxEntryCost || m_generation.load(std::memory_order_relaxed) != generation || m_index.contains(key))
+        return;
+    makeRoom(cost);
+    size_t slot;
+    if (!m_freeSlots.empty()) {
+        slot = m_freeSlots.back();
+        m_freeSlots.pop_back();
+    } else {
+        slot = m_slots.size();
+        m_slots.emplace_back();
+    }
+    entry->filePath = m_paths.emplace(filePath.native(), slot);
+    m_slots[slot] = std::move(entry);
+    m_index[key] = slot;
+    m_cost += cost;
+}
+
+template <typename Value>
+void ClockCache<Value>::invalidate(const std::filesystem::path &path)
+{
+    std::unique_lock lock(m_mutex);
+    m_generation.fetch_add(1, std::memory_order_release);
+    const std::string& file = path.native();
+    std::string below = file.ends_with('/') ? file : file + '/';
+    // The path itself, then what's below it. Siblings like "name.txt" sort in between the two.
+    auto it = m_paths.lower_bound(file);
+    while (it != m_paths.end() && it->first == file) {
+        size_t slot = (it++)->second;
+        removeSlot(slot);
+        m_invalidations.fetch_add(1, std::memory_order_relaxed);
+    }
+    it = m_paths.lower_bound(below);
+    while (it != m_paths.end() && it->first.starts_with(below)) {
+        size_t slot = (it++)->second;
+        removeSlot(slot);
+        m_invalidations.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+template <typename Value>
+size_t ClockCache<Value>::getMaxEntryCost() const
+{
+    std::shared_lock lock(m_mutex);
+    return std::min(m_capacity, m_maxEntryCost);
+}
+
+template <typename Value>
+void ClockCache<Value>::setLimits(size_t capacity, size_t maxEntryCost)
+{
+    std::unique_lock lock(m_mutex);
+    if (m_disabled)
+        return;
+    m_capacity = capacity;
+    m_maxEntryCost = maxEntryCost;
+    makeRoom(0);
+    for (size_t slot = 0; slot < m_slots.size(); slot++) {
+        if (m_slots[slot] && m_slots[slot]->cost > m_maxEntryCost)
+            removeSlot(slot);
+    }
+}
+
+template <typename Value>
+void ClockCache<Value>::disable()
+{
+    std::unique_lock lock(m_mutex);
+    m_disabled = true;
+    m_capacity = 0;
+    makeRoom(0);
+}
+
+template <typename Value>
+typename ClockCache<Value>::Stats ClockCache<Value>::getStats() const
+{
+    std::shared_lock lock(m_mutex);
+    return Stats{
+        m_hits.load(std::memory_order_relaxed),
+        m_misses.load(std::memory_order_relaxed),
+        m_evictions.load(std::memory_order_relaxed),
+        m_invalidations.load(std::memory_order_relaxed),
+        m_index.size(),
+        m_cost
+    };
+}
+
+template <typename Value>
+void ClockCache<Value>::makeRoom(size_t cost)
+{
+    // CLOCK: referenced entries get a second chance, the first unreferenced one is evicted
+    while (m_cost + cost > m_capacity && !m_index.empty()) {
+        m_hand %= m_slots.size();
+        auto& entry = m_slots[m_hand];
+        if (entry && entry->referenced.exchange(false, std::memory_order_relaxed) == false) {
+            removeSlot(m_hand);
+            m_evictions.fetch_add(1, std::memory_order_relaxed);
+        }
+        m_hand++;
+    }
+}
+
+template <typename Value>
+void ClockCache<Value>::removeSlot(size_t slot)
+{
+    Entry& entry = *m_slots[slot];
+    m_cost -= entry.cost;
+    m_paths.erase(entry.filePath);
+    m_index.erase(entry.key);
+    m_slots[slot].reset();
+    m_freeSlots.push_back(slot);
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "HTTPResponse.h"
+
+// Content encodings negotiated from Accept-Encoding. gzip needs zlib and brotli needs libbrotlienc
+// at build time, an encoding that wasn't built in is never chosen for compressing, though a
+// precompressed ".gz" or ".br" file next to a static file is still served as is.
+namespace Compression {
+
+    // Bitmask, so a set of accepted encodings fits in an int
+    enum Encoding {
+        IDENTITY = 0,
+        GZIP = 1,
+        BROTLI = 1 << 1
+    };
+
+    struct Settings {
+        // Turns off compressing, sidecar files included
+        bool enabled = true;
+        // Bodies smaller than this aren't worth the CPU or the extra headers
+        size_t minSize = 1024;
+        // Content types worth compressing, matched without parameters like "; charset=utf-8"
+        std::vector<std::string> mimeTypes = {
+            "text/html", "text/css", "text/plain", "text/xml", "application/javascript",
+            "application/json", "application/xml", "image/svg+xml"
+        };
+        int gzipLevel = 6;
+        int brotliQuality = 5;
+    };
+
+    /// @brief The encodings from an Accept-Encoding header that aren't refused with q=0, as a bitmask.
+    int parseAcceptEncoding(std::string_view header);
+    /// @brief The encodings this build can compress with, as a bitmask.
+    int getAvailable();
+    /// @brief Pick the encoding to compress with from a set the client accepts, brotli first.
+    Encoding choose(int accepted);
+    /// @brief The token used in Content-Encoding, e.g. "gzip".
+    std::string_view getName(Encoding encoding);
+    /// @brief The extension of a precompressed sidecar file, e.g. ".gz".
+    std::string_view getSuffix(Encoding encoding);
+    /// @brief Whether a Content-Type is on the allow-list.
+    bool isCompressible(std::string_view contentType, const Settings& settings);
+
+    // Compresses a stream of input piece by piece, appending the output as it goes
+    class Compressor {
+    public:
+        /// @brief Throws std::runtime_error if the encoding is not available.
+        Compressor(Encoding encoding, const Settings& settings);
+        ~Compressor();
+        Compressor(const Compressor&) = delete;
+        Compressor& operator=(const Compressor&) = delete;
+
+        void write(std::string_view input, std::string& out);
+        /// @brief Flush everything that's left and end the stream. The compressor can't be written to afterwards.
+        void finish(std::string& out);
+
+    private:
+        struct State;
+        std::unique_ptr<State> m_state;
+    };
+
+    /// @brief Compress a whole buffer. Empty if the encoding is not available.
+    std::optional<std::string> compress(std::string_view input, Encoding encoding, const Settings& settings);
+    /// @brief Compress the in-memory body of a response in place if the client accepts an encoding we have,
+    /// and the body is big enough and of an allowed type. Sets Content-Encoding and Vary.
+    /// @return Whether the body was compressed.
+    bool compressResponse(HTTPResponse& response, int accepted, const Settings& settings);
+};
@@ -0,0 +1,121 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+#include "HTTPResponse.h"
+#include "Log.h"
+#include "Metrics.h"
+#include "OutputQueue.h"
+#include "RequestParser.h"
+#include "TimerWheel.h"
+
+// Everything the server keeps about one client. It is only ever touched by the thread that owns it:
+// the reactor while the fd is being accepted or timed out, and otherwise whoever is handling its
+// current epoll event. EPOLLONESHOT makes sure that is one thread at a time, so nothing here is locked.
+// The exceptions are the published deadline, which the reactor reads to decide on a timeout, and the
+// state of an async handler, which hands the connection to whichever thread finishes it.
+class Connection {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Timeout {
+        TimerWheel::Deadline kind;
+        Clock::time_point deadline;
+    };
+
+    enum class AsyncState : uint8_t {
+        // No async handler is answering a request
+        IDLE,
+        // Started, and the thread that started it still has the connection
+        RUNNING,
+        // The thread that started it let go, the thread that finishes it carries on with the connection
+        PARKED,
+        // Finished before the thread that started it let go, which carries on itself
+        DONE
+    };
+
+    struct Stats {
+        Clock::time_point acceptedAt;
+        uint64_t requests = 0;
+        uint64_t bytesReceived = 0;
+        // Time spent parsing the request that is being read, if metrics are timing it
+        Metrics::Total parseTime{};
+    };
+
+    int fd = -1;
+    // Changes every time the slot is reused, so an event for a closed fd can't reach the next client on it
+    uint32_t generation = 0;
+    // Bytes received that don't make up a whole request yet, and how far the parser got through them
+    std::string input;
+    RequestParser parser;
+    // Output that couldn't be written without blocking, until the socket is writable again
+    OutputQueue output;
+    // Set once the response to a bad request or "Connection: close" is queued
+    bool closeWhenDrained = false;
+    // While an async handler answers a request nothing more is read or answered, and the connection can't time out
+    std::atomic<AsyncState> asyncState = AsyncState::IDLE;
+    std::optional<HTTPResponse> asyncResponse;
+    // The request it answers asked for "Connection: close"
+    bool closeAfterAsync = false;
+    Stats stats;
+    // The client's address, only looked up while the access log is open
+    std::string remoteAddress;
+    // The access log entry for the request being answered
+    Log::Access access;
+
+    /// @brief Take over the slot for a newly accepted client. Only called by the reactor.
+    void open(int socket, const RequestParser::Limits& limits);
+    /// @brief Drop everything but reusable allocations. The fd may be reused as soon as it is closed,
+    /// so the owner calls this before close() and doesn't touch the connection afterwards.
+    void release();
+    bool isOpen() const { return m_open.load(std::memory_order_acquire); }
+
+    /// @brief Set and publish the deadline for what the connection is waiting for next. Header and body
+    /// reads keep the deadline they already have, so a client trickling in bytes can't hold it open forever.
+    void setDeadline(TimerWheel::Deadline kind, std::chrono::milliseconds timeout, Clock::time_point now = Clock::now());
+    /// @brief Mark the connection as being handled, it can't time out until the next setDeadline().
+    /// This also picks up everything the last owner did before it published its deadline and rearmed
+    /// the fd, which is what makes handing the connection to another worker safe.
+    void hold() { m_published.exchange(BUSY, std::memory_order_acq_rel); }
+    /// @return The published deadline, or nullopt while the connection is being handled.
+    std::optional<Timeout> getTimeout() const;
+
+private:
+    static constexpr int64_t BUSY = INT64_MAX;
+
+    std::atomic<bool> m_open = false;
+    TimerWheel::Deadline m_deadlineKind = TimerWheel::Deadline::HEADER_READ;
+    Clock::time_point m_deadline;
+    // Milliseconds on the steady clock, shifted left to make room for the kind
+    std::atomic<int64_t> m_published = BUSY;
+};
+
+// Connections indexed by fd, allocated a page at a time and never moved or freed until shutdown.
+// Every slot has a fixed address, so a worker can look its connection up without a lock while the
+// reactor adds pages for new fds.
+class ConnectionTable {
+public:
+    /// @param maxFds One more than the largest fd that can be stored. Defaults to the process's open file limit.
+    explicit ConnectionTable(size_t maxFds = getFdLimit());
+    ~ConnectionTable();
+    ConnectionTable(const ConnectionTable&) = delete;
+    ConnectionTable& operator=(const ConnectionTable&) = delete;
+
+    /// @brief The slot for fd, allocating its page if needed. Only called by the reactor.
+    /// @return nullptr if fd is past the table's end.
+    Connection* get(int fd);
+    /// @return The slot for fd, or nullptr if it was never allocated.
+    Connection* find(int fd) const;
+    /// @brief Every open connection, for closing them all on shutdown.
+    std::vector<Connection*> getOpen() const;
+
+    static size_t getFdLimit();
+
+private:
+    static constexpr size_t PAGE_SIZE = 256;
+    std::vector<std::atomic<Connection*>> m_pages;
+};
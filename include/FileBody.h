@@ -0,0 +1,28 @@
+#pragma once
+#include <memory>
+#include <sys/types.h>
+#include <unistd.h>
+
+// Owns a read-only file descriptor and closes it when the last reference goes away
+class FileHandle {
+public:
+    explicit FileHandle(int fd) : m_fd(fd) {}
+    ~FileHandle() {
+        if (m_fd != -1)
+            close(m_fd);
+    }
+    FileHandle(const FileHandle&) = delete;
+    FileHandle& operator=(const FileHandle&) = delete;
+    int get() const { return m_fd; }
+
+private:
+    int m_fd;
+};
+
+// A region of an open file used as a response body. The server writes it to the socket
+// with sendfile() so the contents never pass through userspace.
+struct FileBody {
+    std::shared_ptr<FileHandle> file;
+    off_t offset = 0;
+    size_t length = 0;
+};
@@ -3,6 +3,7 @@
 #include <string>
 #include <optional>
 #include <filesystem>
+#include <strings.h>
 
 using Route = std::filesystem::path;
 
@@ -27,17 +28,31 @@ public:
     : m_method(method), m_route(route), m_version(version), m_headers(std::move(headers)) {}
     Method getMethod() const { return m_method; }
     const Route& getRoute() const { return m_route; }
+    /// @brief Look up a header by name. Header names are case-insensitive, an exact match is just found faster.
     std::optional<std::string> getHeader(const std::string& key) const {
         auto it = m_headers.find(key);
         if (it != m_headers.end()) {
             return it->second;
         }
+        for (const auto& [name, value] : m_headers) {
+            if (strcasecmp(name.c_str(), key.c_str()) == 0)
+                return value;
+        }
         return std::nullopt;
     }
     const std::unordered_map<std::string, std::string>& getAllHeaders() const { return m_headers; }
     const std::string& getBody() const { return m_body; }
     void setBody(const std::string& body) { m_body = body; }
     const std::string& getVersion() const { return m_version; }
+    /// @brief Look up the value a route parameter matched, e.g. "id" for a route "/users/:id".
+    std::optional<std::string> getParam(const std::string& name) const {
+        auto it = m_params.find(name);
+        if (it != m_params.end()) {
+            return it->second;
+        }
+        return std::nullopt;
+    }
+    void setParam(const std::string& name, const std::string& value) { m_params[name] = value; }
     std::string toString() const {
         std::string result = getMethodString(m_method) + " " + m_route.string() + " " + m_version + "\r\n";
         for (const auto& [key, value] : m_headers) {
@@ -68,4 +83,5 @@ private:
     std::string m_body;
     Route m_route;
     std::string m_version;
+    std::unordered_map<std::string, std::string> m_params;
 };
\ No newline at end of file
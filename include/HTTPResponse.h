@@ -2,26 +2,57 @@
 
 #include <unordered_map>
 #include <string>
+#include <string_view>
 #include <optional>
 #include <filesystem>
+#include <memory>
+#include <vector>
+#include <ctime>
+#include "FileBody.h"
 
 // Holds all information about an HTTP response
 class HTTPResponse {
 public:
+    // A piece of a body sent as several, such as a multipart/byteranges one: bytes held in
+    // memory, then a region of a file if the part has one
+    struct BodyPart {
+        std::string data;
+        std::optional<FileBody> file;
+    };
+
     enum class Status {
         OK = 200,
         CREATED = 201,
         NO_CONTENT = 204,
+        PARTIAL_CONTENT = 206,
         MOVED_PERMANENTLY = 301,
+        NOT_MODIFIED = 304,
         BAD_REQUEST = 400,
         FORBIDDEN = 403,
         NOT_FOUND = 404,
+        PAYLOAD_TOO_LARGE = 413,
+        RANGE_NOT_SATISFIABLE = 416,
+        REQUEST_HEADER_FIELDS_TOO_LARGE = 431,
         INTERNAL_SERVER_ERROR = 500,
         NOT_IMPLEMENTED = 501
     };
 
     HTTPResponse(Status status, std::unordered_map<std::string, std::string> headers) 
     : m_status(status), m_headers(std::move(headers)) {}
+    /// @brief Wrap header fields, the blank line and a body that are already in wire format. The status line
+    /// and Date header are added when it is sent, as for a canned response. Sending it needs no formatting or
+    /// copying, but the headers and body are not available through the getters.
+    HTTPResponse(Status status, std::shared_ptr<const std::string> serialized)
+    : m_status(status), m_serialized(std::move(serialized)) {}
+    /// @brief Wrap header fields, the blank line and a body that were serialized in advance into bytes
+    /// that outlive every response, such as ResponseGenerator::makeCannedResponse() builds. The status line
+    /// and Date header are added when it is sent. Copies cost nothing to make or send, but the headers
+    /// and body are not available through the getters.
+    static HTTPResponse fromCanned(Status status, std::string_view canned) {
+        HTTPResponse response(status, std::unordered_map<std::string, std::string>());
+        response.m_canned = canned;
+        return response;
+    }
     Status getStatus() const { return m_status; }
     std::optional<std::string> getHeader(const std::string& key) const {
         auto it = m_headers.find(key);
@@ -31,35 +62,78 @@ public:
         return std::nullopt;
     }
     const std::unordered_map<std::string, std::string>& getAllHeaders() const { return m_headers; }
+    void setHeader(const std::string& key, const std::string& value) { m_headers[key] = value; }
     const std::string& getBody() const { return m_body; }
-    void setBody(const std::string& body);
+    void setBody(std::string body);
+    /// @brief Move the in-memory body out, so it can be sent without copying it.
+    std::string releaseBody() { return std::move(m_body); }
+    /// @brief Use a region of an open file as the body. It is sent with sendfile() after the headers.
+    void setFileBody(FileBody body);
+    const std::optional<FileBody>& getFileBody() const { return m_fileBody; }
+    /// @brief Use a sequence of parts as the body, sent one after the other. File regions are sent with sendfile().
+    void setBodyParts(std::vector<BodyPart> parts);
+    const std::vector<BodyPart>& getBodyParts() const { return m_parts; }
+    /// @brief Move the parts out, so they can be sent without copying them.
+    std::vector<BodyPart> releaseBodyParts() { return std::move(m_parts); }
+    /// @brief Drop the body, keeping the Content-Length it had, for an answer to a HEAD request.
+    /// Canned and serialized responses are cut back to their header section.
+    void dropBody();
+    const std::shared_ptr<const std::string>& getSerialized() const { return m_serialized; }
+    /// @brief The bytes after the Date header of a canned response. Empty for any other response.
+    std::string_view getCanned() const { return m_canned; }
     const std::string& getVersion() const { return m_version; }
-    std::string toString() const {
-        std::string result = m_version + " " + std::to_string(static_cast<int>(m_status)) + " " + getStatusText(m_status) + "\r\n";
-        for (const auto& [key, value] : m_headers) {
-            result += key + ": " + value + "\r\n";
-        }
-        result += "\r\n" + m_body;
+    /// @brief Serialize the status line and headers, including the blank line that ends them.
+    std::string headersToString() const {
+        std::string result(getStatusLine(m_status));
+        appendHeaders(result);
         return result;
     }
+    /// @brief Append the header fields and the blank line that ends them to a buffer. The status line is not included.
+    void appendHeaders(std::string& out) const;
+    /// @brief Serialize the response with its in-memory body. A file body is not included.
+    std::string toString() const {
+        if (m_serialized)
+            return std::string(getStatusLine(m_status)).append(getDateHeader()).append(*m_serialized);
+        if (!m_canned.empty())
+            return std::string(getStatusLine(m_status)).append(getDateHeader()).append(m_canned);
+        return headersToString() + m_body;
+    }
 
-    static constexpr std::string getStatusText(Status status) {
+    static constexpr std::string_view getStatusText(Status status) {
         switch (status) {
             case Status::OK: return "OK";
             case Status::CREATED: return "Created";
             case Status::NO_CONTENT: return "No Content";
+            case Status::PARTIAL_CONTENT: return "Partial Content";
             case Status::BAD_REQUEST: return "Bad Request";
             case Status::NOT_FOUND: return "Not Found";
             case Status::INTERNAL_SERVER_ERROR: return "Internal Server Error";
             case Status::NOT_IMPLEMENTED: return "Not Implemented";
             case Status::MOVED_PERMANENTLY: return "Moved Permanently";
+            case Status::NOT_MODIFIED: return "Not Modified";
             case Status::FORBIDDEN: return "Forbidden";
+            case Status::PAYLOAD_TOO_LARGE: return "Payload Too Large";
+            case Status::RANGE_NOT_SATISFIABLE: return "Range Not Satisfiable";
+            case Status::REQUEST_HEADER_FIELDS_TOO_LARGE: return "Request Header Fields Too Large";
             default: return "Unknown Status";
         }
     }
+    /// @brief The complete status line for a status, "HTTP/1.1 200 OK\r\n". Built once, so it can be sent in place.
+    static std::string_view getStatusLine(Status status);
+    /// @brief A "Date: ...\r\n" header field for the current time. It is formatted at most once per second
+    /// per thread and stays valid until the calling thread asks again.
+    static std::string_view getDateHeader();
+    /// @brief Format a time as an HTTP date, e.g. "Sun, 06 Nov 1994 08:49:37 GMT".
+    static std::string formatDate(time_t time);
+    /// @brief Parse an HTTP date in the format formatDate() writes. Other formats give nothing.
+    static std::optional<time_t> parseDate(std::string_view date);
 private:
     Status m_status;
     std::unordered_map<std::string, std::string> m_headers;
     std::string m_body;
+    std::optional<FileBody> m_fileBody;
+    std::vector<BodyPart> m_parts;
+    std::shared_ptr<const std::string> m_serialized;
+    std::string_view m_canned;
     std::string m_version = "HTTP/1.1";
 };
\ No newline at end of file
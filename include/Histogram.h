@@ -0,0 +1,48 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "SingleWriter.h"
+
+// Value counts in log-linear buckets, like HdrHistogram: every power of two is split into 32 equal
+// buckets, so a value is known to within 1/32 of itself from 1 up to 2^40 (18 minutes of nanoseconds).
+// One thread records into it without atomic read-modify-writes, any thread may read it meanwhile.
+class Histogram {
+public:
+    static constexpr int SUB_BUCKET_BITS = 5;
+    static constexpr size_t SUB_BUCKETS = size_t(1) << SUB_BUCKET_BITS;
+    static constexpr int MAX_EXPONENT = 40;
+    static constexpr size_t BUCKETS = SUB_BUCKETS * (MAX_EXPONENT - SUB_BUCKET_BITS + 2);
+
+    Histogram() = default;
+    // Copies take a snapshot, values recorded meanwhile may or may not make it in
+    Histogram(const Histogram& other) { add(other); }
+    Histogram& operator=(const Histogram& other);
+
+    /// @brief Count a value. Only called by the thread that owns the histogram, bigger values go in the last bucket.
+    void record(uint64_t value) {
+        SingleWriter::bump(m_counts[getIndex(value)], 1);
+        SingleWriter::bump(m_count, 1);
+        SingleWriter::bump(m_sum, value);
+    }
+    /// @brief Add another histogram's counts to this one, e.g. to merge per-thread histograms.
+    void add(const Histogram& other);
+
+    uint64_t getCount() const { return m_count.load(std::memory_order_relaxed); }
+    uint64_t getSum() const { return m_sum.load(std::memory_order_relaxed); }
+    /// @param quantile Between 0 and 1, e.g. 0.99.
+    /// @return The highest value in the bucket of the value at that quantile, or 0 if nothing was recorded.
+    uint64_t getQuantile(double quantile) const;
+    /// @return How many values were at most this one, to bucket precision.
+    uint64_t countAtMost(uint64_t value) const;
+
+    static size_t getIndex(uint64_t value);
+    /// @return The highest value that lands in a bucket.
+    static uint64_t getHighestValue(size_t index);
+
+private:
+    std::array<std::atomic<uint64_t>, BUCKETS> m_counts{};
+    std::atomic<uint64_t> m_count{0};
+    std::atomic<uint64_t> m_sum{0};
+};
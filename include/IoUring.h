@@ -0,0 +1,82 @@
+#pragma once
+#include <linux/io_uring.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Minimal io_uring wrapper over the raw syscalls, so we don't need liburing.
+// A ring is owned by a single thread, none of these methods are thread safe.
+class IoUring {
+public:
+    /// @brief Create and map a ring.
+    /// @param entries The submission queue size, the completion queue is twice as large.
+    /// @throws std::runtime_error if the kernel refuses to create the ring.
+    explicit IoUring(unsigned entries);
+    ~IoUring();
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    /// @brief Check whether io_uring with provided buffer rings works here. It can be
+    /// too old, compiled out, or blocked by seccomp. The result is computed once.
+    static bool isSupported();
+
+    /// @brief Get a zeroed submission queue entry. Flushes the queue to the kernel first if it is full.
+    /// @throws std::runtime_error if the kernel won't take any more entries.
+    io_uring_sqe* getSqe();
+    /// @brief Submit everything queued and wait until at least waitNr completions are ready.
+    /// @return The number of entries submitted, or -1 with errno set.
+    int submitAndWait(unsigned waitNr);
+    /// @brief Call fn(const io_uring_cqe&) for every ready completion, then mark them consumed.
+    template <typename F>
+    void forEachCqe(F&& fn) {
+        unsigned head = *m_cqHead;
+        unsigned tail = std::atomic_ref<unsigned>(*m_cqTail).load(std::memory_order_acquire);
+        for (; head != tail; head++) {
+            fn(m_cqes[head & m_cqMask]);
+        }
+        std::atomic_ref<unsigned>(*m_cqHead).store(head, std::memory_order_release);
+    }
+
+    /// @brief Register a ring of equally sized buffers that the kernel picks from for IOSQE_BUFFER_SELECT reads.
+    /// @param groupId The buffer group id to put in sqe->buf_group.
+    /// @param count The number of buffers, must be a power of 2.
+    /// @param size The size of each buffer.
+    /// @throws std::runtime_error if the kernel doesn't support provided buffer rings.
+    void setupBufferRing(uint16_t groupId, uint16_t count, uint32_t size);
+    char* getBuffer(uint16_t id) { return m_bufferMemory.data() + static_cast<size_t>(id) * m_bufferSize; }
+    /// @brief Hand a buffer the kernel filled back to it once its contents have been consumed.
+    void recycleBuffer(uint16_t id);
+
+private:
+    int m_fd = -1;
+
+    void* m_ringPtr = nullptr;
+    size_t m_ringSize = 0;
+    void* m_cqRingPtr = nullptr;
+    size_t m_cqRingSize = 0;
+    io_uring_sqe* m_sqes = nullptr;
+    size_t m_sqesSize = 0;
+
+    unsigned* m_sqHead = nullptr;
+    unsigned* m_sqTail = nullptr;
+    unsigned m_sqMask = 0;
+    unsigned m_sqEntries = 0;
+    // Entries we handed out but haven't published to the kernel yet
+    unsigned m_sqLocalTail = 0;
+    unsigned m_toSubmit = 0;
+
+    unsigned* m_cqHead = nullptr;
+    unsigned* m_cqTail = nullptr;
+    unsigned m_cqMask = 0;
+    io_uring_cqe* m_cqes = nullptr;
+
+    io_uring_buf_ring* m_bufRing = nullptr;
+    size_t m_bufRingSize = 0;
+    uint16_t m_bufMask = 0;
+    uint16_t m_bufTail = 0;
+    uint32_t m_bufferSize = 0;
+    std::vector<char> m_bufferMemory;
+
+    void unmap();
+};
@@ -0,0 +1,121 @@
+#pragma once
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <sys/socket.h>
+#include "RequestView.h"
+
+// Error and access logging that never blocks the thread logging. Every thread appends to a lock-free
+// ring buffer of its own, and a background thread writes what the rings hold in batches. A message
+// that doesn't fit in its thread's ring is dropped and counted, and a message logged over and over
+// from one place is rate limited per thread, so a burst of errors can't slow down serving requests.
+// The error log goes to stderr unless setErrorLog() says otherwise, the access log is off until openAccessLog().
+namespace Log {
+
+    enum class Level { DEBUG, INFO, WARNING, ERROR, OFF };
+
+    enum class Format {
+        // The Apache/nginx combined log format, with the bytes counted including headers
+        COMBINED,
+        // One JSON object per line, with how long the request took too
+        JSON
+    };
+
+    struct Stats {
+        // Lines written out
+        uint64_t written = 0;
+        // Lines lost because their thread's ring was full
+        uint64_t dropped = 0;
+        // Messages left out by the rate limit
+        uint64_t suppressed = 0;
+    };
+
+    // Bytes each thread's ring holds
+    constexpr size_t RING_BYTES = 256 * 1024;
+    // Longer messages and access log fields are cut short
+    constexpr size_t MAX_MESSAGE = 2048;
+
+    /// @brief Log messages at this level and above. Defaults to INFO.
+    void setLevel(Level level);
+    bool isEnabled(Level level);
+    /// @brief Let each thread log this many messages a second from one place, and count the rest. 0 turns the limit off.
+    void setRateLimit(uint32_t perSecond);
+    /// @brief Append the error log to a file instead of stderr, or go back to stderr with an empty path.
+    /// @throws std::runtime_error if the file can't be opened.
+    void setErrorLog(const std::filesystem::path& file);
+    /// @brief Append an access log line for every response to a file.
+    /// @throws std::runtime_error if the file can't be opened.
+    void openAccessLog(const std::filesystem::path& file, Format format = Format::COMBINED);
+    /// @brief Stop the access log, after writing out what was logged already.
+    void closeAccessLog();
+    bool isAccessLogOpen();
+    /// @brief Write out everything logged so far, waiting until it's done.
+    void flush();
+    Stats getStats();
+
+    /// @brief The IP address of a client for the access log, e.g. "127.0.0.1".
+    std::string formatAddress(const sockaddr_storage& address);
+
+    /// @brief Queue a message. The message is the first part, and also tells apart where it came from for the rate limit.
+    void write(Level level, const char* message, std::string_view text);
+
+    template <typename T>
+    void append(std::string& out, const T& part) {
+        if constexpr (std::is_same_v<T, bool>) {
+            out += part ? "true" : "false";
+        } else if constexpr (std::is_same_v<T, char>) {
+            out += part;
+        } else if constexpr (std::is_arithmetic_v<T>) {
+            char buffer[32];
+            out.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), part).ptr);
+        } else if constexpr (std::is_same_v<T, std::filesystem::path>) {
+            out += part.native();
+        } else {
+            out += part;
+        }
+    }
+
+    /// @brief Format and queue a message if its level is enabled, e.g. Log::error("Failed to read: ", strerror(errno)).
+    template <typename... Parts>
+    void log(Level level, const char* message, const Parts&... parts) {
+        if (!isEnabled(level))
+            return;
+        thread_local std::string text;
+        text.assign(message);
+        (append(text, parts), ...);
+        write(level, message, text);
+    }
+
+    template <typename... Parts>
+    void debug(const char* message, const Parts&... parts) { log(Level::DEBUG, message, parts...); }
+    template <typename... Parts>
+    void info(const char* message, const Parts&... parts) { log(Level::INFO, message, parts...); }
+    template <typename... Parts>
+    void warning(const char* message, const Parts&... parts) { log(Level::WARNING, message, parts...); }
+    template <typename... Parts>
+    void error(const char* message, const Parts&... parts) { log(Level::ERROR, message, parts...); }
+
+    // One access log entry, started when a request is parsed and written once its response is queued.
+    // It copies what the log shows of the request, so it can wait for an async handler. Reusing one
+    // per connection means its buffer is only allocated once.
+    class Access {
+    public:
+        void begin(std::string_view remoteAddress, std::string_view method, std::string_view target, std::string_view version,
+                   std::string_view referer, std::string_view userAgent);
+        void begin(std::string_view remoteAddress, const RequestView& request);
+        bool isPending() const { return m_pending; }
+        void cancel() { m_pending = false; }
+        /// @brief Queue the entry for the access log.
+        void finish(int status, uint64_t bytes);
+
+    private:
+        // The fields, laid out the way they are queued
+        std::string m_fields;
+        std::chrono::steady_clock::time_point m_started;
+        bool m_pending = false;
+    };
+}
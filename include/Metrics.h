@@ -0,0 +1,198 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Histogram.h"
+#include "SingleWriter.h"
+
+// Counters and per-stage latency histograms for the request pipeline, in the Prometheus text format.
+// Every thread records into a shard of its own with plain stores, and a scrape adds the shards up.
+// Reading the clock costs more than everything else put together, so each thread only times one in
+// every few occurrences of the per-request stages, while the counters count everything. Disabled until enable() is
+// called, until then every recording site is a branch on a flag that never changes.
+class Metrics {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    enum class Stage {
+        // accept() up to the client being registered with epoll. Every connection is timed, accepts are rare enough.
+        ACCEPT,
+        // One recv() call
+        RECEIVE,
+        // Parsing a request, over however many reads it arrived in
+        PARSE,
+        // Finding the handler
+        ROUTE,
+        // Running the handler or looking up the static file, until an async handler has its response
+        HANDLER,
+        // Queueing the response's bytes
+        SERIALIZE,
+        // One attempt at writing what is queued
+        SEND,
+        // How long a connection's event waited for a worker
+        QUEUE_WAIT,
+        COUNT
+    };
+
+    enum class Counter {
+        REQUESTS,
+        RESPONSES_1XX,
+        RESPONSES_2XX,
+        RESPONSES_3XX,
+        RESPONSES_4XX,
+        RESPONSES_5XX,
+        PARSE_ERRORS,
+        CONNECTIONS_ACCEPTED,
+        CONNECTIONS_CLOSED,
+        CONNECTIONS_TIMED_OUT,
+        BYTES_RECEIVED,
+        BYTES_SENT,
+        COUNT
+    };
+
+    // Values owned by something else, read when scraped
+    enum class Type { COUNTER, GAUGE };
+
+    // Records how long it lived as one value for a stage, if this one is sampled
+    class Span {
+    public:
+        Span(Metrics& metrics, Stage stage) : m_metrics(metrics.sample(stage) ? &metrics : nullptr), m_stage(stage) {
+            if (m_metrics)
+                m_start = Clock::now();
+        }
+        ~Span() {
+            if (m_metrics)
+                m_metrics->record(m_stage, Clock::now() - m_start);
+        }
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+
+    private:
+        Metrics* m_metrics;
+        Stage m_stage;
+        Clock::time_point m_start;
+    };
+
+    // One occurrence of a stage spread over several calls, like parsing a request that arrives in pieces.
+    // Whether it is timed is decided on its first call, and recordTotal() records it and starts the next.
+    struct Total {
+        enum class State : uint8_t { UNDECIDED, TIMED, SKIPPED };
+
+        Clock::duration elapsed{};
+        State state = State::UNDECIDED;
+    };
+
+    // Adds how long it lived to a Total, if that is being timed
+    class Stopwatch {
+    public:
+        Stopwatch(Metrics& metrics, Stage stage, Total& total) {
+            if (total.state == Total::State::UNDECIDED)
+                total.state = metrics.sample(stage) ? Total::State::TIMED : Total::State::SKIPPED;
+            if (total.state == Total::State::TIMED) {
+                m_total = &total.elapsed;
+                m_start = Clock::now();
+            }
+        }
+        ~Stopwatch() {
+            if (m_total)
+                *m_total += Clock::now() - m_start;
+        }
+        Stopwatch(const Stopwatch&) = delete;
+        Stopwatch& operator=(const Stopwatch&) = delete;
+
+    private:
+        Clock::duration* m_total = nullptr;
+        Clock::time_point m_start;
+    };
+
+    Metrics();
+    ~Metrics();
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+
+    /// @brief Start recording. Call this before any thread records.
+    /// @param timeEvery Time one in this many occurrences of each stage on each thread, rounded up to a power of two.
+    void enable(uint32_t timeEvery = 8);
+    bool isEnabled() const { return m_enabled; }
+    /// @return Whether to time this occurrence of a stage.
+    bool sample(Stage stage) {
+        return m_enabled && (++t_ticks[static_cast<size_t>(stage)] & m_sampleMask) == 0;
+    }
+
+    /// @brief Count something that happened on this thread. Does nothing while disabled.
+    void add(Counter counter, uint64_t amount = 1) {
+        if (m_enabled)
+            SingleWriter::bump(getShard().counters[static_cast<size_t>(counter)], amount);
+    }
+    /// @brief Count a response by its status code's class.
+    void addResponse(int status);
+    /// @brief Record how long a stage took on this thread. Does nothing while disabled.
+    void record(Stage stage, Clock::duration duration) {
+        if (m_enabled)
+            getShard().stages[static_cast<size_t>(stage)].record(std::max<int64_t>(0, std::chrono::nanoseconds(duration).count()));
+    }
+    /// @return The time to measure a stage from, for stages rare enough to time every occurrence of. Nothing while disabled.
+    Clock::time_point now() const { return m_enabled ? Clock::now() : Clock::time_point(); }
+    /// @return The time to measure a stage from, or nothing if this occurrence isn't sampled.
+    Clock::time_point startTiming(Stage stage) { return sample(stage) ? Clock::now() : Clock::time_point(); }
+    /// @brief Record the time since now() or startTiming() for a stage, if it was timed.
+    void recordSince(Stage stage, Clock::time_point start) {
+        if (start != Clock::time_point())
+            record(stage, Clock::now() - start);
+    }
+    /// @brief Record a Total if it was timed, and reset it for the stage's next occurrence.
+    void recordTotal(Stage stage, Total& total) {
+        if (total.state == Total::State::TIMED)
+            record(stage, total.elapsed);
+        total = Total();
+    }
+    /// @brief Export a value kept elsewhere, like a queue's depth. Call this before start().
+    /// @param name The metric's name, which should start with "myhttp_" and end in "_total" for counters.
+    void addValue(Type type, std::string name, std::string help, std::function<double()> read);
+
+    /// @return A counter added up over every thread.
+    uint64_t get(Counter counter) const;
+    /// @return A stage's latencies, in nanoseconds, merged over every thread.
+    Histogram getHistogram(Stage stage) const;
+    /// @return Everything, in the Prometheus text exposition format.
+    std::string toPrometheus() const;
+
+    static const char* getName(Stage stage);
+
+private:
+    struct alignas(64) Shard {
+        std::array<std::atomic<uint64_t>, static_cast<size_t>(Counter::COUNT)> counters{};
+        std::array<Histogram, static_cast<size_t>(Stage::COUNT)> stages;
+    };
+
+    struct Value {
+        Type type;
+        std::string name;
+        std::string help;
+        std::function<double()> read;
+    };
+
+    // Counts every thread's occurrences of each stage, for sampling. Shared by every instance, which
+    // only shifts which occurrences are timed.
+    static thread_local std::array<uint32_t, static_cast<size_t>(Stage::COUNT)> t_ticks;
+
+    bool m_enabled = false;
+    uint32_t m_sampleMask = 0;
+    // Tells instances apart in each thread's cache of its shards, addresses can be reused
+    uint64_t m_id;
+    mutable std::mutex m_mutex;
+    // Only ever appended to, and freed with the Metrics
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    std::vector<Value> m_values;
+
+    /// @brief The calling thread's shard, made on its first use.
+    Shard& getShard();
+    Shard& addShard();
+};
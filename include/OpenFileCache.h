@@ -0,0 +1,53 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include "ClockCache.h"
+#include "FileBody.h"
+
+// What a static URL path resolved to, kept so a hot path skips the canonicalization, stat() and open()
+// calls on every request, like nginx's open_file_cache. Bounded by count since every entry holds a
+// descriptor. It can't see changes by itself, the owner calls invalidate() for every path that changed.
+class OpenFileCache {
+public:
+    struct File {
+        // A directory requested without its trailing slash, answered with a redirect and nothing else set
+        bool redirect = false;
+        // The canonical file, after a directory was resolved to its index.html
+        std::filesystem::path path;
+        // Shared with every response sending it. sendfile(), pread() and splice() all take an explicit offset, so one descriptor serves them all.
+        std::shared_ptr<FileHandle> file;
+        struct stat info{};
+    };
+
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        uint64_t invalidations;
+        size_t entries;
+    };
+
+    /// @param maxEntries The most paths kept open. 0 disables the cache.
+    explicit OpenFileCache(size_t maxEntries = 256) : m_files(maxEntries) {}
+
+    std::optional<File> find(std::string_view urlPath);
+    /// @brief Read this before resolving a path, and pass it to insert(). If anything was
+    /// invalidated in between, the possibly stale result is not cached.
+    uint64_t getGeneration() const { return m_files.getGeneration(); }
+    void insert(const std::string& urlPath, File file, uint64_t generation);
+    /// @brief Forget every entry resolved to this path or to anything below it.
+    void invalidate(const std::filesystem::path& path) { m_files.invalidate(path); }
+    /// @brief Change the number of entries, evicting as needed. Ignored once the cache is disabled for good.
+    void setMaxEntries(size_t maxEntries) { m_files.setLimits(maxEntries); }
+    /// @brief Turn the cache off for good, for when changes to the files can no longer be seen.
+    void disable() { m_files.disable(); }
+    Stats getStats() const;
+
+private:
+    ClockCache<File> m_files;
+};
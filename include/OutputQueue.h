@@ -0,0 +1,94 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "FileBody.h"
+#include "HTTPResponse.h"
+
+struct iovec;
+
+// Bytes waiting to be written to one connection, in order. A chunk is an owned string,
+// a shared buffer such as a cached response, bytes that outlive the queue such as a status line,
+// a header block in the queue's own header buffer, or a region of an open file. Partial writes
+// are remembered, so a connection whose socket buffer is full can be parked and resumed later.
+class OutputQueue {
+public:
+    // The most chunks written in one call. More than enough for a batch of responses, and well under IOV_MAX
+    static constexpr size_t MAX_IOVECS = 64;
+    static constexpr size_t NO_HEADERS = SIZE_MAX;
+
+    struct Chunk {
+        std::string data{};
+        std::shared_ptr<const std::string> shared{};
+        std::optional<FileBody> file{};
+        // Bytes owned elsewhere that live at least as long as the queue
+        std::string_view fixed{};
+        // Where the chunk starts in the header buffer. An offset, since the buffer may grow.
+        size_t headerOffset = NO_HEADERS;
+        size_t headerSize = 0;
+        // How much of this chunk has already been written
+        size_t sent = 0;
+
+        size_t size() const {
+            if (file)
+                return file->length;
+            if (shared)
+                return shared->size();
+            if (headerOffset != NO_HEADERS)
+                return headerSize;
+            return fixed.data() ? fixed.size() : data.size();
+        }
+    };
+
+    enum class Status {
+        DRAINED,    // Everything was written
+        BLOCKED,    // The socket buffer is full, wait for EPOLLOUT and flush again
+        ERROR       // The connection is broken, errno is set
+    };
+
+    void push(std::string data);
+    void push(std::shared_ptr<const std::string> data);
+    void push(FileBody file);
+    /// @brief Queue bytes without copying them. They must stay valid until they are written.
+    void pushFixed(std::string_view data);
+    /// @brief Queue a whole response as separate pieces that go out in one gathered write: the
+    /// precomputed status line, a Date header and the header fields in the reusable header buffer,
+    /// the in-memory body moved in without copying, or the bytes of a cached or canned response in
+    /// place, then the file body or the body parts if it has them.
+    void push(HTTPResponse response);
+
+    bool empty() const { return m_head == m_chunks.size(); }
+    /// @brief The number of bytes still queued, including file chunks.
+    size_t size() const { return m_bytes; }
+    const Chunk& front() const { return m_chunks[m_head]; }
+    /// @brief The unsent bytes of a memory chunk. Empty for file chunks.
+    std::string_view remaining(const Chunk& chunk) const;
+    /// @brief Drop everything queued. The header buffer keeps its memory for whoever uses the queue next.
+    void clear();
+    /// @brief Mark bytes from the front of the queue as written, for callers that write chunks themselves.
+    void consume(size_t bytes);
+
+    /// @brief Point iovecs at the unsent bytes of the memory chunks at the front of the queue,
+    /// up to the first file chunk. The iovecs stay valid until the queue is modified.
+    /// @return The number of iovecs filled in, 0 if the front chunk is a file.
+    size_t gather(iovec* iov, size_t maxCount) const;
+    /// @brief Write as much as the socket takes without blocking. Consecutive memory chunks
+    /// go out in one sendmsg() call, file chunks are sent with sendfile().
+    Status flush(int socket);
+
+private:
+    // Written chunks before m_head are released but only erased once the queue drains or
+    // too many pile up, so a busy connection keeps reusing the same memory
+    std::vector<Chunk> m_chunks;
+    size_t m_head = 0;
+    // Header blocks of the queued responses, back to back. Cleared, but not freed, once everything
+    // is written, so a connection's responses reuse the same memory.
+    std::string m_headers;
+    size_t m_bytes = 0;
+
+    /// @brief Erase the written chunks and header blocks from the front of a queue that hasn't drained.
+    void compact();
+};
@@ -4,6 +4,8 @@
 
 namespace Parser
 {
+    /// @brief Parse a single complete request in one go. Connections use a RequestParser instead,
+    /// which can resume as more data arrives.
     std::optional<HTTPRequest> parseRequest(std::string_view buf);
     std::optional<HTTPRequest::Method> getMethod(std::string_view method);
     std::optional<std::pair<std::string, std::string>> parseHeaderLine(std::string_view line);
@@ -0,0 +1,113 @@
+#pragma once
+#include <functional>
+#include <string_view>
+#include <utility>
+#include "Async.h"
+#include "Connection.h"
+#include "HTTPResponse.h"
+#include "Log.h"
+#include "Metrics.h"
+#include "RequestParser.h"
+#include "Router.h"
+#include "Tracer.h"
+
+// Answers the requests waiting in a connection's input buffer, in order, for both the epoll reactors and
+// the io_uring one. They only differ in how output is written and how a connection waits for an async
+// handler, which they pass in as callbacks.
+class RequestLoop {
+public:
+    using Handler = std::function<Answer(RequestView&)>;
+
+    /// @param handler Turns a parsed request into a response, or a task that will produce one.
+    /// @param outputHighWaterMark No more requests are answered while this many response bytes wait for the client.
+    /// @param metrics Where to count parse errors and responses, and time parsing and serializing.
+    RequestLoop(Handler handler, const size_t& outputHighWaterMark, Metrics& metrics)
+    : m_handler(std::move(handler)), m_outputHighWaterMark(outputHighWaterMark), m_metrics(metrics) {}
+
+    /// @brief Answer every complete request in the input buffer and keep the rest for later. Stops after
+    /// a parse error or "Connection: close", and once the output reaches the high water mark.
+    /// @param flush Called as `bool(Connection&)` to write out what the socket takes right now, before
+    /// giving up at the high water mark and before an async handler starts.
+    /// @param startAsync Called as `bool(Connection&, Async::Task<HTTPResponse>)` to hand the connection
+    /// to an async handler, true if it finished right away and its response is queued.
+    /// @return false if either callback returned false, because the connection was closed or handed off.
+    template <typename Flush, typename StartAsync>
+    bool answer(Connection& conn, Flush&& flush, StartAsync&& startAsync) const;
+    /// @brief Queue a response for the client, counting it.
+    void queueResponse(Connection& conn, HTTPResponse response) const;
+    /// @brief Queue the response an async handler finished with, and let the connection carry on.
+    void takeAsyncResponse(Connection& conn) const;
+
+private:
+    Handler m_handler;
+    const size_t& m_outputHighWaterMark;
+    Metrics& m_metrics;
+
+    /// @brief Answer a request that couldn't be parsed, and hang up once it's sent.
+    void rejectRequest(Connection& conn, RequestParser::Result result) const;
+};
+
+template <typename Flush, typename StartAsync>
+bool RequestLoop::answer(Connection &conn, Flush &&flush, StartAsync &&startAsync) const
+{
+    std::string_view unread = conn.input;
+
+    // Answer every complete request in order, so a pipelining client gets all its responses in one write
+    // Nothing left over means no next request to start on, or to time
+    while (!conn.closeWhenDrained && !unread.empty()) {
+        RequestParser::Result result;
+        {
+            Metrics::Stopwatch stopwatch(m_metrics, Metrics::Stage::PARSE, conn.stats.parseTime);
+            Tracer::Span trace("parse");
+            result = conn.parser.parse(unread);
+        }
+        if (result == RequestParser::Result::INCOMPLETE)
+            break;
+        m_metrics.recordTotal(Metrics::Stage::PARSE, conn.stats.parseTime);
+        // Too much is queued already, write it out before answering any more
+        if (conn.output.size() >= m_outputHighWaterMark) {
+            if (!flush(conn))
+                return false;
+            if (conn.output.size() >= m_outputHighWaterMark)
+                break;
+        }
+
+        // We can't tell where the next request would start, so answer this one and hang up
+        if (result != RequestParser::Result::COMPLETE) {
+            rejectRequest(conn, result);
+            break;
+        }
+
+        // The request points into the buffer, so nothing is copied unless a handler asks for it
+        auto request = conn.parser.getView(unread);
+        if (Log::isAccessLogOpen())
+            conn.access.begin(conn.remoteAddress, *request);
+        Answer answer = m_handler(*request);
+        // Close connection if "Connection: close" header is present
+        bool wantsClose = request->wantsClose();
+        unread.remove_prefix(conn.parser.getRequestSize());
+        conn.parser.reset();
+
+        if (HTTPResponse* response = std::get_if<HTTPResponse>(&answer)) {
+            queueResponse(conn, std::move(*response));
+            conn.stats.requests++;
+            if (wantsClose)
+                conn.closeWhenDrained = true;
+            continue;
+        }
+
+        // Responses go out in order, so nothing else is answered until the async handler is done.
+        // The responses before it are sent in the meantime, and the input keeps growing while it waits.
+        conn.input.erase(0, conn.input.size() - unread.size());
+        conn.closeAfterAsync = wantsClose;
+        if (!flush(conn))
+            return false;
+        if (!startAsync(conn, std::get<Async::Task<HTTPResponse>>(std::move(answer))))
+            return false;
+        unread = conn.input;
+    }
+
+    // Keep the start of the next request, or any requests we didn't get to, for next time
+    conn.input.erase(0, conn.input.size() - unread.size());
+    return true;
+}
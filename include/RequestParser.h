@@ -0,0 +1,85 @@
+#pragma once
+#include <cstddef>
+#include <optional>
+#include <string_view>
+#include <vector>
+#include "HTTPRequest.h"
+#include "RequestView.h"
+
+// Frames one request at a time out of a connection's receive buffer. Parsing is resumable:
+// every byte is scanned once, and the next call to parse() picks up where the last one stopped.
+// Positions are kept as offsets from the start of the request, so the buffer may be reallocated
+// between calls as long as its contents are only ever appended to.
+class RequestParser {
+public:
+    struct Limits {
+        // The request line and all header lines together, including line endings
+        size_t maxHeaderBytes = 16 * 1024;
+        size_t maxHeaderCount = 100;
+        size_t maxBodyBytes = 1024 * 1024;
+    };
+
+    enum class Result {
+        INCOMPLETE,         // Needs more data
+        COMPLETE,           // A whole request has been received
+        BAD_REQUEST,        // The request line or a header is malformed
+        HEADERS_TOO_LARGE,  // Over maxHeaderBytes or maxHeaderCount
+        BODY_TOO_LARGE,     // Content-Length is over maxBodyBytes
+        NOT_IMPLEMENTED     // A Transfer-Encoding, none of which are supported
+    };
+
+    RequestParser() = default;
+    explicit RequestParser(const Limits& limits) : m_limits(limits) {}
+
+    /// @brief Continue parsing the current request.
+    /// @param buf The received data, starting at the current request. It must hold everything the
+    /// previous call was given, plus whatever arrived since.
+    /// @return Anything other than INCOMPLETE is final, and is returned again until reset().
+    Result parse(std::string_view buf);
+    /// @brief View the request once parse() returned COMPLETE. Nothing is copied.
+    /// @param buf The same buffer parse() was given. The view points into it.
+    /// @return The request, or nullopt if parsing isn't complete.
+    std::optional<RequestView> getView(std::string_view buf) const;
+    /// @brief Like getView(), but returns an owning copy of the request.
+    std::optional<HTTPRequest> getRequest(std::string_view buf) const;
+    /// @brief The size of the completed request including its body. A pipelined request starts right after it.
+    size_t getRequestSize() const { return m_headerEnd + m_contentLength; }
+    /// @brief Whether the headers are done and only the body is still missing.
+    bool isReadingBody() const { return m_state == State::BODY; }
+    /// @brief Start over on the next request. The buffer given to parse() must then start getRequestSize() bytes later.
+    void reset();
+
+private:
+    enum class State { REQUEST_LINE, HEADERS, BODY, DONE };
+
+    struct Span {
+        size_t offset = 0;
+        size_t length = 0;
+        std::string_view in(std::string_view buf) const { return buf.substr(offset, length); }
+    };
+    struct Header {
+        Span name;
+        Span value;
+    };
+
+    Limits m_limits;
+    State m_state = State::REQUEST_LINE;
+    Result m_result = Result::INCOMPLETE;
+    // Everything before this has been scanned for line endings
+    size_t m_position = 0;
+    size_t m_lineStart = 0;
+    size_t m_headerEnd = 0;
+    size_t m_contentLength = 0;
+    bool m_hasContentLength = false;
+    bool m_hasTransferEncoding = false;
+
+    HTTPRequest::Method m_method = HTTPRequest::Method::NONE;
+    Span m_target;
+    Span m_version;
+    // Cleared but not freed between requests, so a keep-alive connection reuses the allocation
+    std::vector<Header> m_headers;
+
+    Result parseRequestLine(std::string_view buf, Span line);
+    Result parseHeaderLine(std::string_view buf, Span line);
+    Result finish(Result result);
+};
@@ -0,0 +1,65 @@
+#pragma once
+#include <array>
+#include <optional>
+#include <string_view>
+#include <vector>
+#include "HTTPRequest.h"
+
+// A parsed request that points into the buffer it was received in instead of owning its data,
+// so answering it allocates nothing. It is only valid while that buffer is unchanged: a handler
+// that needs the request afterwards should take an owning copy with toRequest().
+class RequestView {
+public:
+    struct Header {
+        std::string_view name;
+        std::string_view value;
+    };
+    // A route parameter and the part of the path it matched
+    struct Param {
+        std::string_view name;
+        std::string_view value;
+    };
+    // Typical browser requests carry 10-15 headers, any more than this go to the heap
+    static constexpr size_t INLINE_HEADERS = 24;
+    // The most parameters a route may have
+    static constexpr size_t MAX_PARAMS = 8;
+
+    RequestView(HTTPRequest::Method method, std::string_view route, std::string_view version, std::string_view body)
+    : m_method(method), m_route(route), m_version(version), m_body(body) {}
+    /// @brief View an owning request. It must outlive the view.
+    explicit RequestView(const HTTPRequest& request);
+
+    HTTPRequest::Method getMethod() const { return m_method; }
+    std::string_view getRoute() const { return m_route; }
+    std::string_view getVersion() const { return m_version; }
+    std::string_view getBody() const { return m_body; }
+    /// @brief Look up a header by name, ignoring case. If it was sent more than once, the first value is returned.
+    std::optional<std::string_view> getHeader(std::string_view name) const;
+    /// @brief Whether the client sent "Connection: close".
+    bool wantsClose() const;
+    size_t getHeaderCount() const { return m_headerCount; }
+    const Header& getHeaderAt(size_t index) const {
+        return index < INLINE_HEADERS ? m_headers[index] : m_extraHeaders[index - INLINE_HEADERS];
+    }
+    void addHeader(std::string_view name, std::string_view value);
+    /// @brief Look up the value a route parameter matched, e.g. "id" for a route "/users/:id".
+    std::optional<std::string_view> getParam(std::string_view name) const;
+    size_t getParamCount() const { return m_paramCount; }
+    const Param& getParamAt(size_t index) const { return m_params[index]; }
+    /// @brief Replace the route parameters. The names must outlive the view as well as the values.
+    void setParams(const Param* params, size_t count);
+
+    /// @brief Copy everything into an HTTPRequest that doesn't depend on the receive buffer.
+    HTTPRequest toRequest() const;
+
+private:
+    HTTPRequest::Method m_method;
+    std::string_view m_route;
+    std::string_view m_version;
+    std::string_view m_body;
+    std::array<Header, INLINE_HEADERS> m_headers;
+    std::vector<Header> m_extraHeaders;
+    size_t m_headerCount = 0;
+    std::array<Param, MAX_PARAMS> m_params;
+    size_t m_paramCount = 0;
+};
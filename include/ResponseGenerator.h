@@ -1,20 +1,69 @@
 #pragma once
 #include "HTTPResponse.h"
+#include "RequestParser.h"
 #include <filesystem>
+#include <optional>
+#include <string_view>
+#include <vector>
+#include <sys/stat.h>
 
 // Methods to generate different types of HTTP responses can be added here
 namespace ResponseGenerator {
 
+    /// @brief Serialize a response that never changes once, for example at startup. The bytes are kept for
+    /// the rest of the program, so the returned response can be copied and sent without allocating.
+    /// Meant for a handful of fixed answers such as health checks, not for per-request content.
+    HTTPResponse makeCannedResponse(HTTPResponse::Status status, const std::string& contentType, const std::string& body);
+
     /// @brief Generate a simple HTML response with the given content.
     HTTPResponse generateHTMLResponse(const std::string& htmlContent);
     HTTPResponse generateRedirectResponse(const std::string& location);
+    // The error responses below are canned, so answering a flood of bad requests costs no allocations
     HTTPResponse generateNotFoundResponse();
     HTTPResponse generateBadRequestResponse();
     HTTPResponse generateForbiddenResponse();
     HTTPResponse generateInternalServerErrorResponse();
     HTTPResponse generateNotImplementedResponse();
-    /// @brief Generate a response that serves the contents of the specified file.
+    HTTPResponse generatePayloadTooLargeResponse();
+    HTTPResponse generateHeaderFieldsTooLargeResponse();
+    /// @brief Generate the response for a request the parser rejected.
+    HTTPResponse generateParseErrorResponse(RequestParser::Result result);
+    /// @brief Generate a response that serves the contents of the specified file, with a strong ETag
+    /// made from its inode, size and modification time, and its Last-Modified date.
     HTTPResponse generateFileResponse(const std::filesystem::path& filePath);
+    /// @brief Generate the response for a file that is already open, such as one from the open file cache.
+    /// @param info What fstat() said about the file, it must be a regular file.
+    HTTPResponse generateFileResponse(const std::filesystem::path& filePath, std::shared_ptr<FileHandle> file, const struct stat& info);
+
+    // The validators a client sent to ask for a response only if it changed, and the part of it asked for
+    struct Conditions {
+        std::optional<std::string_view> ifNoneMatch{};
+        std::optional<std::string_view> ifModifiedSince{};
+        std::optional<std::string_view> range{};
+        std::optional<std::string_view> ifRange{};
+    };
+    /// @brief Whether the client's copy is still current, so a 304 can be sent instead of the response.
+    /// If-None-Match is compared weakly and wins over If-Modified-Since when both are sent.
+    bool isNotModified(const Conditions& conditions, std::string_view etag, std::string_view lastModified);
+    /// @brief Generate the bodyless 304 for a response, keeping the headers a cache needs to update its copy.
+    HTTPResponse generateNotModifiedResponse(const HTTPResponse& full);
+
+    // Inclusive, like the Range header
+    struct ByteRange {
+        size_t first;
+        size_t last;
+    };
+    // More ranges than this in one request are answered with the whole file
+    constexpr size_t MAX_RANGES = 16;
+    /// @brief Parse a Range header against a body of the given length. Overlapping and adjacent ranges are merged.
+    /// @return Nothing if the header is malformed or asks for too many ranges, in which case it is ignored.
+    /// Empty if none of the ranges are satisfiable.
+    std::optional<std::vector<ByteRange>> parseRange(std::string_view header, size_t length);
+    /// @brief Answer a Range request for a file response with 206 and the requested regions of the file, sent
+    /// straight from it. Several ranges become a multipart/byteranges body. Ranges past the end of the file get 416.
+    /// The full response is returned as is if it has no file body, the header is malformed, or If-Range doesn't
+    /// match its strong ETag or Last-Modified.
+    HTTPResponse generateRangeResponse(const HTTPResponse& full, std::string_view range, std::optional<std::string_view> ifRange);
 
     const std::unordered_map<std::string, std::string> MIME_TYPES = {
         {".html", "text/html"},
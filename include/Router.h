@@ -3,22 +3,104 @@
 #include <string>
 #include <optional>
 #include <filesystem>
+#include <memory>
+#include <vector>
 #include <functional>
+#include <variant>
+#include "Async.h"
+#include "Compression.h"
 #include "HTTPRequest.h"
 #include "HTTPResponse.h"
+#include "RequestView.h"
+#include "ResponseGenerator.h"
+#include "StaticFileCache.h"
 
 using Route = std::filesystem::path;
 using Handler = std::function<HTTPResponse(const HTTPRequest&)>;
+// Handlers taking a RequestView read the request straight out of the receive buffer, without copying it
+using ViewHandler = std::function<HTTPResponse(const RequestView&)>;
+// Handlers returning a Task can wait on timers, sockets and files without holding a thread, see Async.h.
+// The request stays valid until the task finishes.
+using AsyncHandler = std::function<Async::Task<HTTPResponse>(const HTTPRequest&)>;
+// What a request gets: its response, or the task of an async handler that will produce it
+using Answer = std::variant<HTTPResponse, Async::Task<HTTPResponse>>;
 
+// Matches request paths against the registered routes with a radix tree. A route is literal text,
+// plus ":name" segments that match one path segment and a final "*name" segment that matches the
+// rest of the path, e.g. "/users/:id/files/*path". Literal text wins over a parameter, and a
+// parameter over a wildcard. Values captured for the parameters are put on the request.
 class Router {
 public:
-    Router(const std::filesystem::path& rootDir) : m_rootDir(std::filesystem::canonical(rootDir)) {}
-    // Using a bitmask of HTTPRequest::Method for the method
+    // What answers a route, either a handler or an async handler
+    struct Endpoint {
+        ViewHandler handler;
+        AsyncHandler asyncHandler;
+    };
+
+    Router(const std::filesystem::path& rootDir) : m_rootDir(std::filesystem::canonical(rootDir)), m_cache(m_rootDir), m_root(std::make_unique<Node>()) {}
+    /// @brief Add a handler for a route, for any of the methods in a bitmask of HTTPRequest::Method.
+    /// Throws std::runtime_error if the route is malformed, or names a parameter differently than a route it overlaps.
     void addRoute(Route route, int method, Handler handler);
-    std::optional<Handler> getHandler(const Route& route, HTTPRequest::Method method) const;
+    void addRoute(Route route, int method, ViewHandler handler);
+    void addAsyncRoute(Route route, int method, AsyncHandler handler);
+    /// @return The handler for a route and method, or null if there is none or it is async. Handlers added
+    /// with an HTTPRequest are wrapped to make their owning copy of the request.
+    const ViewHandler* getHandler(std::string_view route, HTTPRequest::Method method) const;
+    /// @brief Find the handler for a request, and put the values of the route's parameters on it.
+    const ViewHandler* getHandler(RequestView& request) const;
+    /// @brief Find what answers a request, sync or async, and put the values of the route's parameters on it.
+    const Endpoint* getEndpoint(RequestView& request) const;
+    /// @brief Serve a file under the root directory, from the static file cache when possible.
     std::optional<HTTPResponse> getStaticFile(const HTTPRequest& request) const;
+    /// @param acceptedEncodings The client's Accept-Encoding as a bitmask of Compression::Encoding. Text files are
+    /// answered with a ".br" or ".gz" file next to them if there is an up to date one, or else compressed once and cached.
+    /// @param conditions The client's If-None-Match and If-Modified-Since, a file it has a current copy of is answered with 304.
+    /// A Range is answered with 206 and the requested parts of the file, or 416 if they are past its end.
+    std::optional<HTTPResponse> getStaticFile(HTTPRequest::Method method, std::string_view route, int acceptedEncodings = Compression::IDENTITY,
+                                              const ResponseGenerator::Conditions& conditions = {}) const;
+    StaticFileCache& getStaticFileCache() const { return m_cache; }
+    void setCompression(const Compression::Settings& settings) { m_compression = settings; }
+    const Compression::Settings& getCompression() const { return m_compression; }
+    /// @brief Send a Cache-Control header with static files whose URL path starts with a prefix, e.g.
+    /// "public, max-age=31536000, immutable" for "/assets/". The longest matching prefix wins, and setting
+    /// a prefix again replaces its value. Call this before serving, files already cached keep their headers.
+    void setCacheControl(const std::string& prefix, const std::string& value);
 
 private:
-    std::unordered_map<Route, std::vector<std::pair<int, Handler>>> m_routes;
+    struct Node {
+        // The literal text this node matches, after its parent's
+        std::string prefix;
+        // Literal children, and the first character of each one's prefix for a quick scan
+        std::vector<std::unique_ptr<Node>> children;
+        std::string firstChars;
+        // A ":name" child matching one segment, and a "*name" child matching the rest of the path
+        std::unique_ptr<Node> param;
+        std::unique_ptr<Node> wildcard;
+        std::string name;
+        std::vector<std::pair<int, Endpoint>> handlers;
+    };
+    struct Match {
+        std::array<RequestView::Param, RequestView::MAX_PARAMS> params;
+        size_t paramCount = 0;
+    };
+
     std::filesystem::path m_rootDir;
+    // Thread safe, and caching doesn't change what getStaticFile returns
+    mutable StaticFileCache m_cache;
+    std::unique_ptr<Node> m_root;
+    Compression::Settings m_compression;
+    // Longest prefix first, so the first match is the one to use
+    std::vector<std::pair<std::string, std::string>> m_cacheControl;
+
+    /// @brief Find or add the literal child of a node that matches text exactly.
+    void addEndpoint(Route route, int method, Endpoint endpoint);
+    static Node* insertLiteral(Node* node, std::string_view text);
+    static const Endpoint* match(const Node* node, std::string_view path, HTTPRequest::Method method, Match& match);
+    static const Endpoint* findEndpoint(const Node* node, HTTPRequest::Method method);
+    /// @brief Resolve a URL path to a file under the root directory, or to a redirect for a directory, through the open file cache.
+    /// @return Nothing if there is no such file. Sets forbidden if the path leads outside the root directory.
+    std::optional<OpenFileCache::File> resolveFile(std::string_view urlPath, bool& forbidden) const;
+    /// @brief Build the compressed variant of a static file response, from a sidecar file or by compressing it.
+    std::optional<HTTPResponse> getEncodedFile(const std::filesystem::path& filePath, const HTTPResponse& response,
+                                               const struct stat& original, int acceptedEncodings) const;
 };
\ No newline at end of file
@@ -0,0 +1,34 @@
+#pragma once
+#include <cstddef>
+
+// Vectorized byte classification for the request parser, in the style of picohttpparser.
+// Each kernel finds the first byte that doesn't belong to a class, checking 16 (SSE4.2) or
+// 32 (AVX2) bytes at a time. The best version this CPU supports is picked once at runtime.
+namespace Scanner
+{
+    enum class Isa {
+        SCALAR,
+        SSE42,
+        AVX2
+    };
+
+    struct Kernels {
+        size_t (*findTokenEnd)(const char* data, size_t size);
+        size_t (*findTargetEnd)(const char* data, size_t size);
+        size_t (*findValueEnd)(const char* data, size_t size);
+    };
+
+    /// @brief The fastest instruction set this CPU and build support.
+    Isa getBestIsa();
+    /// @return The kernels for an instruction set, or nullptr if they can't run here.
+    const Kernels* getKernels(Isa isa);
+
+    /// @brief Find the first byte that isn't a token character (RFC 9110 tchar), which
+    /// ends a method or header name.
+    /// @return Its index, or size if there is none. The same goes for the functions below.
+    size_t findTokenEnd(const char* data, size_t size);
+    /// @brief Find the first byte that isn't printable ASCII, which ends a request target.
+    size_t findTargetEnd(const char* data, size_t size);
+    /// @brief Find the first control character other than tab, which ends a header value.
+    size_t findValueEnd(const char* data, size_t size);
+}
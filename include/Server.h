@@ -10,84 +10,175 @@
 #include <sys/socket.h>
 #include "WorkerPool.h"
 #include "Router.h"
+#include "UringReactor.h"
+#include "Connection.h"
+#include "RequestParser.h"
+#include "RequestLoop.h"
+#include "TimerWheel.h"
+#include "Async.h"
+#include "Metrics.h"
+#include "Tracer.h"
 #include <chrono>
 #include <csignal>
+#include <memory>
 
-struct ClientConnection {
-    int socket;
-    std::chrono::steady_clock::time_point lastActive;
-    bool operator>(const ClientConnection& other) const {
-        return lastActive > other.lastActive;
-    }
+// Everything owned by one event loop: its listening socket, epoll instance and connection state
+struct Reactor {
+    int epollFd = -1;
+    int serverSocket = -1;
+
+    // Every client this reactor accepted, indexed by fd
+    ConnectionTable connections;
+    // When to look at each connection's deadline again. Only touched by the reactor's own thread,
+    // workers publish their connection's deadline in the Connection instead.
+    TimerWheel timers;
+
+    // Where async handlers started on this reactor wait. Its fd is polled along with the clients'.
+    std::unique_ptr<Async::EventLoop> loop;
+
+    // Only used in IO_URING mode, which replaces the epoll loop and everything above except the socket
+    std::unique_ptr<UringReactor> uring;
 };
 
 class Server {
 public:
+    enum class Mode {
+        // One epoll thread accepts and polls every connection, requests are handled on the worker pool
+        THREAD_POOL,
+        // Every thread owns a SO_REUSEPORT listening socket and epoll loop, and handles its clients inline
+        MULTI_REACTOR,
+        // Like MULTI_REACTOR, but every thread drives its sockets through an io_uring instead of epoll.
+        // Falls back to MULTI_REACTOR if the kernel doesn't support it.
+        IO_URING
+    };
+
     /// @brief Construct a new Server object.
     /// @param port The port number to listen on.
     /// @param rootDir The root directory for serving static files.
     /// @param numThreads The number of worker threads in the thread pool. There is always only one acceptor thread.
-    /// @param timeoutSeconds The timeout in seconds for idle connections.
-    Server(int port, const std::filesystem::path& rootDir, int numThreads = 16, int timeoutSeconds = 30);
+    /// In MULTI_REACTOR and IO_URING mode this is the number of event loop threads instead, and there is no pool.
+    /// @param timeoutSeconds The timeout in seconds for idle connections. Used for every kind of deadline
+    /// unless setTimeouts() says otherwise.
+    /// @param mode How connections are spread across threads.
+    Server(int port, const std::filesystem::path& rootDir, int numThreads = 16, int timeoutSeconds = 30, Mode mode = Mode::THREAD_POOL);
     ~Server();
     /// @brief Start the server's main loop. This will block.
     void start();
     /// @brief Add a route to the server's router.
-    /// @param route The route path.
+    /// @param route The route path. ":name" segments match any one segment and a final "*name" segment
+    /// matches the rest of the path, the handler reads what they matched with getParam().
     /// @param method The HTTP method(s) for this route (bitmask of HTTPRequest::Method).
     /// @param handler The handler function to process requests for this route.
     void addRoute(Route route, int method, Handler handler);
+    /// @brief Add a route whose handler reads the request in place instead of getting its own copy.
+    /// The view is only valid until the handler returns.
+    void addRoute(Route route, int method, ViewHandler handler);
+    /// @brief Add a route answered by a coroutine, which can wait on timers, sockets and files (see Async.h) without
+    /// holding a thread. Until it's done nothing more is read from the connection, and it doesn't time out.
+    void addAsyncRoute(Route route, int method, AsyncHandler handler);
+    /// @brief Change which responses are compressed for clients that accept gzip or brotli, or turn it off.
+    void setCompression(const Compression::Settings& settings);
+    /// @brief Send a Cache-Control header with static files under a URL path prefix, the longest matching prefix wins.
+    void setCacheControl(const std::string& prefix, const std::string& value);
+    /// @brief Resize the in-memory static file cache. Set maxBytes to 0 to disable it.
+    /// @param maxBytes The total size of all cached responses.
+    /// @param maxEntryBytes Responses larger than this are always served from disk with sendfile().
+    void setStaticFileCacheLimits(size_t maxBytes, size_t maxEntryBytes);
+    /// @brief Set how many static file paths are kept resolved with their files open, 0 turns it off.
+    /// Each one holds a file descriptor. Defaults to 256.
+    void setOpenFileCacheLimit(size_t maxEntries);
+    /// @brief Set the largest request headers and body accepted. Bigger requests are answered with
+    /// 431 or 413 and the connection is closed. Call this before start().
+    void setRequestLimits(const RequestParser::Limits& limits);
+    /// @brief Set how long a connection may wait for each kind of deadline before it is closed.
+    /// Call this before start().
+    void setTimeouts(const TimerWheel::Timeouts& timeouts);
+    /// @brief Stop reading new requests from a connection while this many response bytes are
+    /// waiting for it to catch up. Defaults to 1 MiB.
+    void setOutputHighWaterMark(size_t bytes);
+    /// @brief Record request counts and per-stage latencies, and serve them in the Prometheus text format
+    /// at a GET route. Recording stays off, and costs nothing, unless this is called before start().
+    void enableMetrics(const std::string& path = "/metrics");
+    const Metrics& getMetrics() const { return m_metrics; }
+    /// @brief Start tracing one in every so many connection events from the epoll wakeup to the response being
+    /// sent, including the hop to a worker. Can be called from any thread while the server runs.
+    void startTracing(uint32_t sampleEvery = 100);
+    /// @brief Stop tracing, and write what was traced to a file in the Chrome trace event format for Perfetto.
+    /// @throws std::runtime_error if the file can't be written.
+    void stopTracing(const std::filesystem::path& file);
+    /// @brief Hit, miss and eviction counters for sizing the static file cache.
+    StaticFileCache::Stats getStaticFileCacheStats() const;
     /// @brief Handle an incoming HTTP request and generate a response.
     /// @param request The HTTP request to handle.
     /// @return The generated HTTP response.
     HTTPResponse handleRequest(const std::optional<HTTPRequest>& request) const;
+    /// @brief Handle a request that still points into its receive buffer. It is only copied if a
+    /// handler that takes an HTTPRequest needs it. The values of the matched route's parameters are put on it.
+    /// An async route's handler is run to the end on a loop of its own, blocking the caller.
+    HTTPResponse handleRequest(RequestView& request) const;
+    /// @brief Like handleRequest(), but an async route's handler is returned as a task instead of being run.
+    Answer startRequest(RequestView& request) const;
 
     /// @brief Handle signals, such as the shutdown signal (Ctrl + c)
     static void signalHandler(int signal);
 
 private:
-    int m_timeoutSeconds;
+    TimerWheel::Timeouts m_timeouts;
     int m_port;
+    Mode m_mode;
+    size_t m_outputHighWaterMark = 1 << 20;
+    RequestParser::Limits m_requestLimits;
     static int m_shutdownEventFd;
-    int m_serverSocket = -1;
-    int m_epollFd = -1;
     WorkerPool m_pool;
     Router m_router;
-    sockaddr_in m_serverAddress;
-    
-    std::priority_queue<ClientConnection, std::vector<ClientConnection>, std::greater<ClientConnection>> m_activeConnections;
-
-    std::mutex m_lastActiveMutex;
-    std::unordered_map<int, std::chrono::steady_clock::time_point> m_lastActiveTimes;
-
-    std::mutex m_bufferMutex;
-    std::unordered_map<int, std::string> m_connectionBuffers;
+    // Recorded into while handling requests, which doesn't change the server
+    mutable Metrics m_metrics;
+    Tracer m_tracer;
+    // Answers the requests of every reactor's connections, whichever kind of reactor it is
+    RequestLoop m_requests;
+    std::vector<std::unique_ptr<Reactor>> m_reactors;
 
-    void setupSocket();
-    void acceptConnection();
-    /// @brief This is always run in a worker thread, handles parsing and responding to a client request.
-    void handleClient(int clientSocket, uint32_t events);
-    /// @brief This is always run in the main epoll thread
-    std::optional<std::string> receiveData(int clientSocket);
-    /// @brief Send data to a client. This can block if the kernel send buffer is full, though it is extremely rare.
-    /// @return number of bytes sent on success, -1 on error and ERRNO set
-    ssize_t sendData(int clientSocket, std::string data);
-    /// @brief Close and clean up a client connection. This is only safe to call from the main epoll thread.
-    /// @param clientSocket The socket file descriptor of the client to close.
-    void closeConnection(int clientSocket);
+    void setupReactor(Reactor& reactor, bool watchStaticFiles);
+    void setupSocket(Reactor& reactor);
+    /// @brief Run one reactor's event loop until the shutdown signal. This will block.
+    void runReactor(Reactor& reactor);
+    void acceptConnection(Reactor& reactor);
+    /// @brief Handles parsing and responding to a client request. This is run in a worker thread,
+    /// or on the reactor's own thread in MULTI_REACTOR mode.
+    void handleClient(Reactor& reactor, Connection& conn);
+    /// @brief Answer every complete request in the input buffer, in order, and write out what the socket takes.
+    /// @return false if the connection was closed, or handed to an async handler that has to wait.
+    bool answerRequests(Reactor& reactor, Connection& conn);
+    /// @brief Run an async handler's task until it has to wait.
+    /// @return true if it finished right away and its response is queued, false if the connection was handed to it.
+    bool startAsync(Reactor& reactor, Connection& conn, Async::Task<HTTPResponse> task);
+    /// @brief Carry on with a connection once its async handler has finished, on the thread that resumed it.
+    void resumeClient(Reactor& reactor, Connection& conn);
+    /// @brief Publish the connection's next deadline and rearm its fd, handing it back to the reactor.
+    void releaseClient(Reactor& reactor, Connection& conn, bool interestChanged);
+    /// @brief Route a request to its handler or a static file, counting it.
+    Answer routeRequest(RequestView& request) const;
+    /// @brief Turn a handler's response into a 304 if the client has it already, or compress it.
+    HTTPResponse finishResponse(const RequestView& request, HTTPResponse response) const;
+    /// @brief Run an async handler with its own copy of the request, answering an exception with 500.
+    Async::Task<HTTPResponse> respondAsync(const AsyncHandler& handler, HTTPRequest request) const;
+    /// @brief Write queued output without blocking, closing the connection if it failed, or if it
+    /// drained and was meant to close afterwards.
+    /// @return false if the connection was closed.
+    bool flushOutput(Reactor& reactor, Connection& conn);
+    /// @brief Rearm a oneshot client fd in epoll for the given events. In MULTI_REACTOR mode fds are
+    /// never disarmed, so this only touches epoll when interestChanged is set.
+    void rearmClient(Reactor& reactor, int clientSocket, uint32_t generation, uint32_t interest, bool interestChanged);
+    /// @brief Read what the client has sent into its input buffer, parsing as it goes. This is always run
+    /// in a worker thread, or on the reactor thread in MULTI_REACTOR mode.
+    /// @return false if the connection was closed.
+    bool receiveData(Reactor& reactor, Connection& conn);
+    /// @brief Close and clean up a client connection. Only the thread that owns the connection may call this.
+    void closeConnection(Reactor& reactor, Connection& conn);
     /// @brief Set a socket to non-blocking mode.
     void setNonBlocking(int fd);
-    /// @brief Update the last active time for a client connection. This is only safe to call from the main epoll thread.
-    void updateLastActive(int clientSocket);
-    /// @brief Check for and time out idle connections. This is only safe to call from the main epoll thread.
-    void timeOutConnections();
-    /// @brief Add data to the buffer for a client connection. This is only safe to call from the main epoll thread.
-    /// @param buffer The data to add.
-    /// @param clientSocket The socket file descriptor of the client.
-    void addToBuffer(std::string buffer, int clientSocket);
-    /// @brief Get and clear the buffer for a client connection. This is only safe to call from the main epoll thread.
-    /// @param clientSocket The socket file descriptor of the client.
-    /// @return The buffered data. Can be empty if no data is buffered.
-    std::string getFromBuffer(int clientSocket);
+    /// @brief Close every connection whose deadline has passed, and check back later on the ones that
+    /// were busy or got a new deadline. This is only safe to call from the main epoll thread.
+    void timeOutConnections(Reactor& reactor);
 };
     
\ No newline at end of file
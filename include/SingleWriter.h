@@ -0,0 +1,13 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+// Counters with one thread writing to them and any thread reading them meanwhile, like the
+// per-thread metrics shards, histograms and log rings.
+namespace SingleWriter {
+    /// @brief Add to a counter only the calling thread writes to. A plain load and store instead of an
+    /// atomic read-modify-write, which is all it takes with one writer, and readers never see a torn value.
+    inline void bump(std::atomic<uint64_t>& counter, uint64_t amount) {
+        counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include "ClockCache.h"
+#include "HTTPResponse.h"
+#include "OpenFileCache.h"
+#include "ResponseGenerator.h"
+
+// Bounded in-memory cache of serialized static file responses, everything but the status line and
+// Date header, keyed by URL path.
+// Entries are evicted with the CLOCK algorithm once the byte limit is reached, and are
+// invalidated through inotify whenever something under the root directory changes, together
+// with the open files the responses were made from.
+class StaticFileCache {
+public:
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        uint64_t invalidations;
+        size_t entries;
+        size_t bytes;
+    };
+
+    /// @param rootDir The directory to watch for changes, this should be canonical.
+    /// @param maxBytes The total size of all cached responses. 0 disables the cache.
+    /// @param maxEntryBytes Files whose response is larger than this are never cached.
+    StaticFileCache(const std::filesystem::path& rootDir, size_t maxBytes = 64 << 20, size_t maxEntryBytes = 1 << 20);
+    ~StaticFileCache();
+    StaticFileCache(const StaticFileCache&) = delete;
+    StaticFileCache& operator=(const StaticFileCache&) = delete;
+
+    /// @brief Look up a cached response. A hit does no filesystem access and no formatting.
+    /// @param conditions The client's validators. If its copy is current, the cached 304 is returned instead.
+    std::optional<HTTPResponse> find(std::string_view urlPath, const ResponseGenerator::Conditions& conditions = {});
+    /// @brief Read this before resolving a file, and pass it to insert(). If anything was
+    /// invalidated in between, the possibly stale file is not cached.
+    uint64_t getGeneration() const { return m_responses.getGeneration(); }
+    /// @brief Serialize and cache a file response, or one with an in-memory body, for the given key if it is small enough.
+    /// @param urlPath The URL path, with the variant appended for a compressed response.
+    /// @param filePath The canonical file the response was generated from. Changes to a ".gz" or ".br"
+    /// file next to it invalidate the entry too.
+    void insert(const std::string& urlPath, const std::filesystem::path& filePath, const HTTPResponse& response, uint64_t generation);
+    /// @brief The largest response that would be cached right now, 0 if the cache is disabled.
+    size_t getMaxEntryBytes() const;
+    /// @brief Change the size limits, evicting entries as needed. A maxBytes of 0 disables the cache.
+    void setLimits(size_t maxBytes, size_t maxEntryBytes);
+    Stats getStats() const;
+
+    /// @brief What URL paths resolved to, for requests the content cache can't answer. Invalidated
+    /// together with the cached responses, and disabled along with them if changes can't be watched.
+    OpenFileCache& getOpenFiles() { return m_files; }
+
+    /// @brief The inotify descriptor. It becomes readable when processEvents() has work to do.
+    int getNotifyFd() const { return m_notifyFd; }
+    /// @brief Drain pending inotify events and invalidate the affected entries. Never blocks, and only
+    /// ever called from one thread.
+    void processEvents();
+
+private:
+    struct Response {
+        std::shared_ptr<const std::string> serialized;
+        HTTPResponse::Status status;
+        // Validators, and the 304 that answers a request carrying matching ones
+        std::string etag;
+        std::string lastModified;
+        std::shared_ptr<const std::string> notModified;
+    };
+
+    std::filesystem::path m_rootDir;
+    int m_notifyFd = -1;
+    std::unordered_map<int, std::filesystem::path> m_watches;
+    // Costed by size in bytes
+    ClockCache<Response> m_responses;
+    OpenFileCache m_files;
+
+    void watchTree(const std::filesystem::path& dir);
+    /// @brief Forget every response and open file made from this path or from anything below it.
+    void invalidate(const std::filesystem::path& path);
+    /// @brief Stop caching for good, for when changes can't be watched.
+    void disable();
+};
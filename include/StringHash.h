@@ -0,0 +1,11 @@
+#pragma once
+#include <functional>
+#include <string>
+#include <string_view>
+
+// Lets unordered containers keyed by std::string be searched with a string_view, without
+// building a temporary string. Use together with std::equal_to<>.
+struct StringHash {
+    using is_transparent = void;
+    size_t operator()(std::string_view str) const { return std::hash<std::string_view>{}(str); }
+};
@@ -0,0 +1,85 @@
+#pragma once
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// A move-only void() callable for the worker pool. Callables up to INLINE_SIZE bytes, like a lambda
+// capturing a few pointers, are stored inside the Task, so queueing one doesn't allocate the way a
+// std::function can. Bigger ones are moved to the heap.
+class Task {
+public:
+    static constexpr size_t INLINE_SIZE = 48;
+
+    Task() = default;
+    template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, Task>>>
+    Task(F&& function) {
+        using Callable = std::decay_t<F>;
+        if constexpr (sizeof(Callable) <= INLINE_SIZE && alignof(Callable) <= alignof(std::max_align_t) &&
+                      std::is_nothrow_move_constructible_v<Callable>) {
+            new (m_storage) Callable(std::forward<F>(function));
+            m_ops = &INLINE_OPS<Callable>;
+        } else {
+            *reinterpret_cast<Callable**>(m_storage) = new Callable(std::forward<F>(function));
+            m_ops = &HEAP_OPS<Callable>;
+        }
+    }
+    Task(Task&& other) noexcept { moveFrom(other); }
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            reset();
+            moveFrom(other);
+        }
+        return *this;
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() { reset(); }
+
+    void operator()() { m_ops->invoke(m_storage); }
+    explicit operator bool() const { return m_ops != nullptr; }
+    /// @brief Whether the callable fit in the Task itself instead of on the heap.
+    bool isInline() const { return m_ops && m_ops->isInline; }
+
+private:
+    struct Ops {
+        void (*invoke)(void* storage);
+        // Moves the callable to another Task's storage and destroys what's left behind
+        void (*relocate)(void* from, void* to);
+        void (*destroy)(void* storage);
+        bool isInline;
+    };
+
+    template <typename Callable>
+    static constexpr Ops INLINE_OPS = {
+        [](void* storage) { (*std::launder(static_cast<Callable*>(storage)))(); },
+        [](void* from, void* to) {
+            Callable* callable = std::launder(static_cast<Callable*>(from));
+            new (to) Callable(std::move(*callable));
+            callable->~Callable();
+        },
+        [](void* storage) { std::launder(static_cast<Callable*>(storage))->~Callable(); },
+        true
+    };
+    template <typename Callable>
+    static constexpr Ops HEAP_OPS = {
+        [](void* storage) { (**static_cast<Callable**>(storage))(); },
+        [](void* from, void* to) { *static_cast<Callable**>(to) = *static_cast<Callable**>(from); },
+        [](void* storage) { delete *static_cast<Callable**>(storage); },
+        false
+    };
+
+    alignas(std::max_align_t) unsigned char m_storage[INLINE_SIZE];
+    const Ops* m_ops = nullptr;
+
+    void moveFrom(Task& other) noexcept {
+        if (!other.m_ops)
+            return;
+        other.m_ops->relocate(other.m_storage, m_storage);
+        m_ops = std::exchange(other.m_ops, nullptr);
+    }
+    void reset() noexcept {
+        if (m_ops)
+            std::exchange(m_ops, nullptr)->destroy(m_storage);
+    }
+};
@@ -0,0 +1,72 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "Task.h"
+
+// A bounded lock-free queue for any number of producers and consumers (Vyukov's MPMC ring).
+// Every cell has a sequence number that says whose turn it is, so a Task is moved in and out
+// of its cell by exactly one thread and nothing is allocated after construction.
+class InjectionQueue {
+public:
+    /// @param capacity Rounded up to a power of two.
+    explicit InjectionQueue(size_t capacity);
+    /// @brief Move task into the queue.
+    /// @return false, leaving task alone, if the queue is full.
+    bool tryPush(Task& task);
+    /// @return false if the queue is empty.
+    bool tryPop(Task& task);
+    /// @brief How many tasks are queued. Only a hint while other threads push and pop.
+    size_t sizeApprox() const;
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        Task task;
+    };
+
+    std::unique_ptr<Cell[]> m_cells;
+    size_t m_mask;
+    // On separate cache lines, producers and consumers would otherwise slow each other down
+    alignas(64) std::atomic<size_t> m_pushPosition = 0;
+    alignas(64) std::atomic<size_t> m_popPosition = 0;
+};
+
+// A Chase-Lev work-stealing deque. Its owner pushes and pops at the bottom without contention,
+// other threads steal from the top with a single compare-and-swap. Tasks are boxed so a thief can
+// take one with an atomic load. The ring doubles when it fills up, and old rings are kept until
+// the deque is destroyed since a thief may still be reading one.
+class WorkStealingDeque {
+public:
+    explicit WorkStealingDeque(size_t capacity = 256);
+    ~WorkStealingDeque();
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    /// @brief Only called by the owner.
+    void push(std::unique_ptr<Task> task);
+    /// @brief Take the newest task. Only called by the owner.
+    /// @return nullptr if the deque is empty.
+    std::unique_ptr<Task> pop();
+    /// @brief Take the oldest task. Safe from any thread.
+    /// @return nullptr if the deque is empty or another thread won the race for the task.
+    std::unique_ptr<Task> steal();
+    /// @brief How many tasks are queued. Only a hint while other threads push and pop.
+    size_t sizeApprox() const;
+
+private:
+    struct Ring {
+        size_t mask;
+        std::unique_ptr<std::atomic<Task*>[]> slots;
+
+        explicit Ring(size_t capacity) : mask(capacity - 1), slots(new std::atomic<Task*>[capacity]) {}
+        std::atomic<Task*>& at(int64_t index) { return slots[static_cast<size_t>(index) & mask]; }
+    };
+
+    alignas(64) std::atomic<int64_t> m_top = 0;
+    alignas(64) std::atomic<int64_t> m_bottom = 0;
+    std::atomic<Ring*> m_ring;
+    // Every ring this deque has used, only touched by the owner
+    std::vector<std::unique_ptr<Ring>> m_rings;
+};
@@ -0,0 +1,85 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+// Connection deadlines in a hashed timing wheel. Time is cut into ticks, and every tick has a slot
+// holding the connections due in it, linked through a table indexed by fd. Scheduling, moving and
+// cancelling a deadline are O(1), and expiring only visits the slots that have come due.
+// Deadlines further out than one turn of the wheel stay in their slot until their turn comes.
+// Not thread-safe, the owner locks around it if it is shared.
+class TimerWheel {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // What a connection is waiting for. Each kind has its own timeout.
+    enum class Deadline {
+        HEADER_READ,    // The rest of a request's headers
+        BODY_READ,      // The rest of a request's body
+        KEEP_ALIVE,     // The next request on an idle connection
+        WRITE_STALL     // The client to read more of its responses
+    };
+
+    struct Timeouts {
+        std::chrono::milliseconds headerRead{30000};
+        std::chrono::milliseconds bodyRead{30000};
+        std::chrono::milliseconds keepAlive{30000};
+        std::chrono::milliseconds writeStall{30000};
+
+        std::chrono::milliseconds get(Deadline kind) const;
+        std::chrono::milliseconds shortest() const;
+    };
+
+    struct Expired {
+        int fd;
+        Deadline kind;
+    };
+
+    static constexpr size_t SLOTS = 1024;
+
+    /// @param tick How finely deadlines are told apart. A deadline fires up to one tick late, never early.
+    /// @param start The time the first tick begins.
+    explicit TimerWheel(std::chrono::milliseconds tick = std::chrono::milliseconds(100), Clock::time_point start = Clock::now());
+
+    /// @brief Set a connection's deadline, replacing any it had.
+    void schedule(int fd, Deadline kind, Clock::time_point deadline);
+    /// @brief Give a connection the timeout for kind, starting now. Header and body reads keep the
+    /// deadline they already have while the connection stays in the same state, so a client trickling
+    /// in one byte at a time can't hold a connection open forever.
+    void touch(int fd, Deadline kind, std::chrono::milliseconds timeout, Clock::time_point now = Clock::now());
+    /// @brief Stop tracking a connection.
+    void cancel(int fd);
+
+    /// @return The kind of the connection's deadline, or nullopt if it isn't tracked.
+    std::optional<Deadline> getKind(int fd) const;
+
+    /// @brief Stop tracking and return every connection whose deadline has passed.
+    std::vector<Expired> advance(Clock::time_point now = Clock::now());
+    /// @return How long until the next slot holding a deadline comes due in milliseconds, for epoll_wait().
+    /// -1 if nothing is on the wheel.
+    int getWaitMillis(Clock::time_point now = Clock::now()) const;
+
+private:
+    struct Node {
+        int prev = -1;
+        int next = -1;
+        uint64_t tick = 0;
+        Deadline kind = Deadline::HEADER_READ;
+        bool scheduled = false;
+    };
+
+    std::chrono::milliseconds m_tick;
+    Clock::time_point m_start;
+    // Every tick up to and including this one has been expired
+    uint64_t m_currentTick = 0;
+    std::vector<Node> m_nodes;
+    std::vector<int> m_slots;
+    // One bit per slot that isn't empty, so the next deadline is found without walking empty slots
+    std::vector<uint64_t> m_occupied;
+
+    uint64_t toTick(Clock::time_point time) const;
+    Node& getNode(int fd);
+    void link(int fd, Node& node);
+    void unlink(Node& node);
+};
@@ -0,0 +1,149 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Follows a sample of connection events through the pipeline, to show where each one waited and which
+// threads it crossed. Off until start(), then one in every so many events is traced: a Scope makes its
+// thread part of the trace, and every Span on that thread records into a ring buffer of the thread's own
+// with plain stores. toChromeTrace() writes the rings out in the Chrome trace event format, which
+// chrome://tracing and Perfetto load. A full ring overwrites its oldest events.
+class Tracer {
+    struct Ring;
+    // What a thread records into while it's in a trace
+    struct Context {
+        Ring* ring = nullptr;
+        uint64_t traceId = 0;
+    };
+
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Events each thread keeps
+    static constexpr size_t RING_EVENTS = 8192;
+
+    enum class Kind : uint8_t {
+        SPAN,
+        INSTANT,
+        // Both ends of an arrow from one thread to another, bound to the spans around them
+        FLOW_START,
+        FLOW_END
+    };
+
+    // Records how long it lived, if its thread is in a trace. It has to end on the thread it started on,
+    // so it mustn't live across a co_await.
+    class Span {
+    public:
+        explicit Span(const char* name) : m_context(t_current), m_name(name) {
+            if (m_context.ring)
+                m_start = Clock::now();
+        }
+        ~Span() {
+            if (m_context.ring)
+                add(m_context, Kind::SPAN, m_name, m_start, Clock::now() - m_start);
+        }
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+
+    private:
+        Context m_context;
+        const char* m_name;
+        Clock::time_point m_start;
+    };
+
+    // Makes its thread part of a trace while it lives, and records itself as a span of it.
+    // Does nothing for trace 0, the one sample() hands out for events that aren't traced.
+    class Scope {
+    public:
+        Scope(Tracer& tracer, uint64_t traceId, const char* name);
+        ~Scope();
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        Context m_previous;
+        std::optional<Span> m_span;
+    };
+
+    Tracer();
+    ~Tracer();
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    /// @brief Start tracing, dropping what was recorded before. Safe to call from any thread while the server runs.
+    /// @param every Trace one in this many events on each thread.
+    void start(uint32_t every = 100);
+    /// @brief Stop starting new traces. What was recorded stays until the next start().
+    void stop();
+    bool isTracing() const { return m_every.load(std::memory_order_relaxed) != 0; }
+    /// @return A new trace's id if this event should be traced, 0 otherwise.
+    uint64_t sample() {
+        uint32_t every = m_every.load(std::memory_order_relaxed);
+        if (every == 0 || ++t_ticks % every != 0)
+            return 0;
+        return m_nextTraceId.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /// @brief Mark a moment in the calling thread's trace, like the wakeup that led to it.
+    static void addInstant(const char* name, Clock::time_point at);
+    /// @brief Start an arrow from the span around this call to the one around the matching addFlowEnd(), on another thread.
+    static void addFlowStart(const char* name);
+    static void addFlowEnd(const char* name);
+
+    /// @return Every event recorded since start(), in the Chrome trace event JSON format.
+    std::string toChromeTrace() const;
+    /// @throws std::runtime_error if the file can't be written.
+    void writeChromeTrace(const std::filesystem::path& file) const;
+
+private:
+    // The fields are only written by the ring's thread. They are atomics so they can be copied out while it records,
+    // any the thread might have been overwriting are dropped afterwards.
+    struct Event {
+        std::atomic<int64_t> start;
+        std::atomic<int64_t> duration;
+        std::atomic<uint64_t> traceId;
+        std::atomic<const char*> name;
+        std::atomic<Kind> kind;
+    };
+
+    struct Ring {
+        int tid;
+        std::string threadName;
+        // How many events were ever added, the next one goes at head % RING_EVENTS
+        std::atomic<uint64_t> head = 0;
+        std::unique_ptr<Event[]> events = std::make_unique<Event[]>(RING_EVENTS);
+    };
+
+    struct Recorded {
+        int64_t start;
+        int64_t duration;
+        uint64_t traceId;
+        const char* name;
+        Kind kind;
+    };
+
+    static thread_local Context t_current;
+    static thread_local uint32_t t_ticks;
+
+    std::atomic<uint32_t> m_every = 0;
+    std::atomic<uint64_t> m_nextTraceId = 1;
+    // Events from before the last start() are left out
+    std::atomic<int64_t> m_startedAt = 0;
+    // Tells instances apart in each thread's list of its rings, addresses can be reused
+    uint64_t m_id;
+    mutable std::mutex m_mutex;
+    // Only ever appended to, and freed with the Tracer
+    std::vector<std::unique_ptr<Ring>> m_rings;
+
+    static void add(const Context& context, Kind kind, const char* name, Clock::time_point start, Clock::duration duration);
+    /// @brief The calling thread's ring, made on its first use.
+    Ring& getRing();
+    /// @brief Copy out what a ring holds now, oldest first.
+    static std::vector<Recorded> read(const Ring& ring);
+};
@@ -0,0 +1,134 @@
+#pragma once
+#include <array>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <linux/time_types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "Async.h"
+#include "Connection.h"
+#include "HTTPResponse.h"
+#include "IoUring.h"
+#include "Metrics.h"
+#include "OutputQueue.h"
+#include "RequestLoop.h"
+#include "RequestParser.h"
+#include "StaticFileCache.h"
+#include "TimerWheel.h"
+#include "Tracer.h"
+
+// An io_uring event loop for one thread, the alternative to an epoll Reactor.
+// Connections are accepted with multishot accept and read with multishot recv into a
+// provided buffer ring, so a keep-alive request costs no syscalls of its own. Static
+// files are moved to the socket with linked splices through a pipe, never entering userspace.
+class UringReactor {
+public:
+    /// @param serverSocket A bound listening socket owned by the caller.
+    /// @param shutdownFd An eventfd that becomes readable when the loop should stop.
+    /// @param timeouts How long a connection may wait for each kind of deadline, read whenever one is set.
+    /// @param requestLimits The largest requests accepted, read whenever a connection is accepted.
+    /// @param outputHighWaterMark A connection isn't read from while this many response bytes wait for it.
+    /// @param requests Answers the requests a connection sent, shared with the epoll reactors.
+    /// @param watchedCache A static file cache to drive invalidation for, or null.
+    /// @param loop Where the handler's tasks wait, run from this reactor's thread.
+    /// @param metrics Where to count connections, bytes and responses. Sends are timed from submission to completion,
+    /// accepts and receives aren't timed since the kernel does them on its own.
+    /// @param tracer Samples receive completions to trace handling the requests that came with them.
+    /// @throws std::runtime_error if the ring can't be set up.
+    UringReactor(int serverSocket, int shutdownFd, const TimerWheel::Timeouts& timeouts, const RequestParser::Limits& requestLimits,
+                 const size_t& outputHighWaterMark, const RequestLoop& requests, StaticFileCache* watchedCache, Async::EventLoop& loop,
+                 Metrics& metrics, Tracer& tracer);
+    ~UringReactor();
+    /// @brief Run the event loop until the shutdown eventfd fires. This will block.
+    void run();
+
+private:
+    // The operation a completion belongs to lives in the top bits of its user_data, the fd in the bottom
+    enum Op : uint64_t {
+        ACCEPT = 1,
+        RECV,
+        SEND,
+        SPLICE_IN,
+        SPLICE_OUT,
+        SHUTDOWN_POLL,
+        NOTIFY_POLL,
+        ASYNC_POLL,
+        TICK,
+        CANCEL
+    };
+
+    // A connection along with what the ring needs while operations on it are in flight. Only this
+    // reactor's thread touches it, and it isn't published or handed to other threads like the epoll ones.
+    struct Client : Connection {
+        // The kernel reads these while a sendmsg is in flight, so they live as long as the connection
+        std::array<iovec, OutputQueue::MAX_IOVECS> iov;
+        msghdr msg;
+        // Only taken from m_pipes while a file is being spliced, -1 otherwise
+        int pipe[2] = {-1, -1};
+        size_t spliceChunk = 0;
+        // When the send in flight was submitted, if metrics are timing it
+        Metrics::Clock::time_point sendStarted;
+        // Counts a running async handler too, so the connection outlives it
+        unsigned inflight = 0;
+        // A multishot recv is armed, and whether it was asked to stop
+        bool receiving = false;
+        bool recvCancelled = false;
+        bool sending = false;
+        bool closing = false;
+
+        // An async handler is answering a request, nothing after it is answered until it's done
+        bool isWaiting() const { return asyncState.load(std::memory_order_relaxed) != AsyncState::IDLE; }
+    };
+
+    IoUring m_ring;
+    int m_serverSocket;
+    int m_shutdownFd;
+    const TimerWheel::Timeouts& m_timeouts;
+    const RequestParser::Limits& m_requestLimits;
+    const size_t& m_outputHighWaterMark;
+    const RequestLoop& m_requests;
+    StaticFileCache* m_watchedCache;
+    Async::EventLoop& m_loop;
+    Metrics& m_metrics;
+    Tracer& m_tracer;
+    bool m_running = true;
+    __kernel_timespec m_tick{1, 0};
+    std::unordered_map<int, Client> m_connections;
+    TimerWheel m_timers;
+    // Idle pipes for splicing, reused so a file send doesn't cost a pipe() call
+    std::vector<std::pair<int, int>> m_pipes;
+
+    static uint64_t userData(Op op, int fd) { return (static_cast<uint64_t>(op) << 32) | static_cast<uint32_t>(fd); }
+
+    void armAccept();
+    void armRecv(Client& conn);
+    /// @brief Arm or cancel the connection's recv, depending on whether it should be read from.
+    void updateReading(Client& conn);
+    void armPoll(int fd, Op op);
+    void armTick();
+    void handleCompletion(const io_uring_cqe& cqe);
+    void onAccept(const io_uring_cqe& cqe);
+    void onRecv(Client& conn, const io_uring_cqe& cqe);
+    void onSend(Client& conn, int result);
+    void onSpliceIn(Client& conn, int result);
+    void onSpliceOut(Client& conn, int result);
+    /// @brief Parse and answer every complete request in the connection's input buffer.
+    void processInput(Client& conn);
+    /// @brief Hand the connection to an async handler, sending the responses before it in the meantime.
+    void startAsync(Client& conn, Async::Task<HTTPResponse> task);
+    /// @brief Queue what an async handler answered with, and carry on with the requests after it.
+    void onAsyncDone(int fd, HTTPResponse response);
+    /// @brief Carry on after some of the output queue was sent.
+    void afterSend(Client& conn);
+    /// @brief Start sending the front of the output queue unless a send is already in flight.
+    void pumpOutput(Client& conn);
+    /// @brief Give a connection the timeout for what it is waiting for next.
+    void touchDeadline(Client& conn);
+    void timeOutConnections();
+    /// @brief Shut the socket down so in-flight operations finish. The fd is closed once they have.
+    void startClose(Client& conn);
+    /// @brief Close the connection for good if it is closing and nothing is in flight anymore.
+    void finishClose(Client& conn);
+    void releasePipe(Client& conn, bool reusable);
+};
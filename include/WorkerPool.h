@@ -1,23 +1,43 @@
 #pragma once
-#include <vector>
+#include <atomic>
+#include <memory>
 #include <thread>
-#include <queue>
-#include <functional>
-#include <mutex>
-#include <condition_variable>
+#include <vector>
+#include "Task.h"
+#include "TaskQueues.h"
 
+// A work-stealing thread pool. Tasks queued from outside the pool, like the epoll thread's, go on a
+// shared lock-free injection queue. Tasks a worker queues itself go on its own deque, and workers
+// that run out of work steal from the others. An idle worker spins for a moment before it parks,
+// so a steady stream of tasks doesn't pay for a wakeup each.
 class WorkerPool {
 public:
     WorkerPool(size_t numThreads);
+    ~WorkerPool();
+    /// @brief Finish every queued task and join the workers.
     void stop();
-    void enqueue(std::function<void()> task);
+    /// @brief Run a task on one of the workers. A pool without workers runs it right away instead.
+    void enqueue(Task task);
+    /// @brief How many tasks are waiting for a worker, summed over the queues without stopping them.
+    size_t getQueueDepth() const;
+    size_t getThreadCount() const { return m_workers.size(); }
 
 private:
-    std::vector<std::thread> m_workers;
-    std::queue<std::function<void()>> m_tasks;
-    std::mutex m_queueMutex;
-    std::condition_variable m_cv;
-    bool m_stop = false;
+    struct Worker {
+        WorkStealingDeque deque;
+        std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    InjectionQueue m_injected;
+    std::atomic<bool> m_stop = false;
+    // Parked workers, and a counter they wait on that changes whenever there may be work for them
+    std::atomic<uint32_t> m_parked = 0;
+    std::atomic<uint32_t> m_wakeups = 0;
 
-    void run();
-};
\ No newline at end of file
+    void run(size_t index);
+    /// @brief Take a task from this worker's deque, the injection queue or another worker, in that order.
+    bool findTask(size_t index, Task& task);
+    /// @brief Wake a parked worker, if there is one, after queueing a task.
+    void wakeOne();
+};
@@ -0,0 +1,235 @@
+#include "Async.h"
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include "WorkerPool.h"
+
+namespace {
+    // Blocking file reads are short, a few threads keep the disk busy without competing with the server's own
+    constexpr size_t BLOCKING_THREADS = 4;
+
+    thread_local Async::EventLoop* currentLoop = nullptr;
+}
+
+Async::EventLoop::EventLoop()
+{
+    m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+    m_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    m_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_epollFd == -1 || m_timerFd == -1 || m_wakeFd == -1) {
+        std::string error = strerror(errno);
+        for (int fd : {m_epollFd, m_timerFd, m_wakeFd}) {
+            if (fd != -1)
+                close(fd);
+        }
+        throw std::runtime_error("Failed to create event loop: " + error);
+    }
+    // The loop's own fds are told apart from waiters by their addresses
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.ptr = &m_timerFd;
+    epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_timerFd, &ev);
+    ev.data.ptr = &m_wakeFd;
+    epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_wakeFd, &ev);
+}
+
+Async::EventLoop::~EventLoop()
+{
+    // Tasks still waiting are abandoned along with the loop
+    close(m_epollFd);
+    close(m_timerFd);
+    close(m_wakeFd);
+}
+
+void Async::EventLoop::processEvents(int timeoutMillis)
+{
+    epoll_event events[64];
+    std::vector<std::coroutine_handle<>> ready;
+    int n;
+    do {
+        n = epoll_wait(m_epollFd, events, 64, timeoutMillis);
+        timeoutMillis = 0;
+        for (int i = 0; i < n; i++) {
+            void* source = events[i].data.ptr;
+            if (source == &m_timerFd) {
+                uint64_t expirations;
+                read(m_timerFd, &expirations, sizeof(expirations));
+                std::lock_guard lock(m_mutex);
+                auto now = Clock::now();
+                while (!m_timers.empty() && m_timers.top().deadline <= now) {
+                    ready.push_back(m_timers.top().handle);
+                    m_timers.pop();
+                }
+                armTimer();
+            } else if (source == &m_wakeFd) {
+                uint64_t count;
+                read(m_wakeFd, &count, sizeof(count));
+                std::lock_guard lock(m_mutex);
+                ready.insert(ready.end(), m_posted.begin(), m_posted.end());
+                m_posted.clear();
+            } else {
+                // Oneshot, so it's removed before the task can wait on the fd again
+                FdWaiter* waiter = static_cast<FdWaiter*>(source);
+                epoll_ctl(m_epollFd, EPOLL_CTL_DEL, waiter->fd, nullptr);
+                ready.push_back(waiter->handle);
+            }
+        }
+    } while (n == 64);
+
+    for (std::coroutine_handle<> handle : ready)
+        resume(handle);
+}
+
+void Async::EventLoop::addTimer(Clock::time_point deadline, std::coroutine_handle<> handle)
+{
+    std::lock_guard lock(m_mutex);
+    bool earliest = m_timers.empty() || deadline < m_timers.top().deadline;
+    m_timers.push(Timer{deadline, m_sequence++, handle});
+    if (earliest)
+        armTimer();
+}
+
+bool Async::EventLoop::addWaiter(FdWaiter &waiter)
+{
+    epoll_event ev{};
+    ev.events = waiter.events | EPOLLONESHOT;
+    ev.data.ptr = &waiter;
+    return epoll_ctl(m_epollFd, EPOLL_CTL_ADD, waiter.fd, &ev) == 0;
+}
+
+void Async::EventLoop::post(std::coroutine_handle<> handle)
+{
+    {
+        std::lock_guard lock(m_mutex);
+        m_posted.push_back(handle);
+    }
+    uint64_t one = 1;
+    write(m_wakeFd, &one, sizeof(one));
+}
+
+Async::EventLoop *Async::EventLoop::current()
+{
+    return currentLoop;
+}
+
+Async::EventLoop *Async::EventLoop::setCurrent(EventLoop *loop)
+{
+    return std::exchange(currentLoop, loop);
+}
+
+void Async::EventLoop::armTimer()
+{
+    itimerspec spec{};
+    if (!m_timers.empty()) {
+        // An absolute time on the steady clock. All zeros would disarm it instead.
+        auto since = m_timers.top().deadline.time_since_epoch();
+        auto seconds = std::chrono::duration_cast<std::chrono::seconds>(since);
+        auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(since - seconds);
+        spec.it_value.tv_sec = seconds.count();
+        spec.it_value.tv_nsec = nanoseconds.count();
+        if (spec.it_value.tv_sec <= 0 && spec.it_value.tv_nsec <= 0)
+            spec.it_value.tv_nsec = 1;
+    }
+    timerfd_settime(m_timerFd, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+void Async::EventLoop::resume(std::coroutine_handle<> handle)
+{
+    if (m_executor)
+        m_executor(handle);
+    else
+        handle.resume();
+}
+
+Async::EventLoop &Async::detail::currentLoop()
+{
+    EventLoop* loop = EventLoop::current();
+    if (!loop)
+        throw std::runtime_error("Async tasks can only wait on a thread with an event loop");
+    return *loop;
+}
+
+void Async::detail::runBlocking(::Task task)
+{
+    static WorkerPool pool(BLOCKING_THREADS);
+    pool.enqueue(std::move(task));
+}
+
+Async::FdWait Async::readable(int fd)
+{
+    return FdWait(fd, EPOLLIN | EPOLLRDHUP);
+}
+
+Async::FdWait Async::writable(int fd)
+{
+    return FdWait(fd, EPOLLOUT);
+}
+
+Async::Task<ssize_t> Async::recv(int fd, void *buffer, size_t size)
+{
+    while (true) {
+        ssize_t bytes = ::recv(fd, buffer, size, MSG_DONTWAIT);
+        if (bytes >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+            co_return bytes;
+        if (errno != EINTR && !co_await readable(fd))
+            co_return -1;
+    }
+}
+
+Async::Task<bool> Async::send(int fd, std::string_view data)
+{
+    while (!data.empty()) {
+        ssize_t bytes = ::send(fd, data.data(), data.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (bytes >= 0) {
+            data.remove_prefix(bytes);
+            continue;
+        }
+        if (errno == EINTR)
+            continue;
+        if ((errno != EAGAIN && errno != EWOULDBLOCK) || !co_await writable(fd))
+            co_return false;
+    }
+    co_return true;
+}
+
+Async::Task<int> Async::connect(const sockaddr *address, socklen_t length)
+{
+    int fd = socket(address->sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        co_return -1;
+    if (::connect(fd, address, length) == 0)
+        co_return fd;
+    int error = errno;
+    // The handshake is done once the socket is writable, and SO_ERROR says how it went
+    if (error == EINPROGRESS && co_await writable(fd)) {
+        socklen_t size = sizeof(error);
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &size) == -1)
+            error = errno;
+        if (error == 0)
+            co_return fd;
+    }
+    close(fd);
+    errno = error;
+    co_return -1;
+}
+
+Async::Task<std::optional<std::string>> Async::readFile(std::filesystem::path path)
+{
+    // Named, GCC 12 moves temporaries in a co_await expression around without their move constructor
+    auto read = offload([path = std::move(path)]() -> std::optional<std::string> {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            return std::nullopt;
+        std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if (file.bad())
+            return std::nullopt;
+        return contents;
+    });
+    co_return co_await read;
+}
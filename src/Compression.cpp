@@ -0,0 +1,253 @@
+#include "Compression.h"
+#include <algorithm>
+#include <stdexcept>
+#include <strings.h>
+#ifdef MYHTTP_WITH_ZLIB
+#include <zlib.h>
+#endif
+#ifdef MYHTTP_WITH_BROTLI
+#include <brotli/encode.h>
+#endif
+
+namespace {
+    // Output is produced in pieces of this size, so memory follows the compressed size rather than the input
+    constexpr size_t OUTPUT_CHUNK = 16 * 1024;
+
+    std::string_view trim(std::string_view text) {
+        while (!text.empty() && (text.front() == ' ' || text.front() == '\t'))
+            text.remove_prefix(1);
+        while (!text.empty() && (text.back() == ' ' || text.back() == '\t'))
+            text.remove_suffix(1);
+        return text;
+    }
+
+    bool equalsIgnoreCase(std::string_view a, std::string_view b) {
+        return a.size() == b.size() && strncasecmp(a.data(), b.data(), a.size()) == 0;
+    }
+}
+
+int Compression::parseAcceptEncoding(std::string_view header)
+{
+    int accepted = IDENTITY;
+    while (!header.empty()) {
+        size_t comma = std::min(header.find(','), header.size());
+        std::string_view item = header.substr(0, comma);
+        header.remove_prefix(std::min(comma + 1, header.size()));
+
+        // "gzip;q=0.8", a q of 0 means the client refuses it
+        size_t semicolon = std::min(item.find(';'), item.size());
+        std::string_view coding = trim(item.substr(0, semicolon));
+        bool refused = false;
+        for (std::string_view params = item.substr(semicolon); !params.empty(); ) {
+            params.remove_prefix(1);
+            size_t next = std::min(params.find(';'), params.size());
+            std::string_view param = trim(params.substr(0, next));
+            params.remove_prefix(next);
+            if (param.size() >= 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=')
+                refused = std::all_of(param.begin() + 2, param.end(), [](char c) { return c == '0' || c == '.'; });
+        }
+        if (refused)
+            continue;
+        if (equalsIgnoreCase(coding, "gzip") || equalsIgnoreCase(coding, "x-gzip"))
+            accepted |= GZIP;
+        else if (equalsIgnoreCase(coding, "br"))
+            accepted |= BROTLI;
+        else if (coding == "*")
+            accepted |= GZIP | BROTLI;
+    }
+    return accepted;
+}
+
+int Compression::getAvailable()
+{
+    int available = IDENTITY;
+#ifdef MYHTTP_WITH_ZLIB
+    available |= GZIP;
+#endif
+#ifdef MYHTTP_WITH_BROTLI
+    available |= BROTLI;
+#endif
+    return available;
+}
+
+Compression::Encoding Compression::choose(int accepted)
+{
+    accepted &= getAvailable();
+    // Brotli is smaller at the same speed for the text we send
+    if (accepted & BROTLI)
+        return BROTLI;
+    if (accepted & GZIP)
+        return GZIP;
+    return IDENTITY;
+}
+
+std::string_view Compression::getName(Encoding encoding)
+{
+    switch (encoding) {
+        case GZIP: return "gzip";
+        case BROTLI: return "br";
+        default: return "identity";
+    }
+}
+
+std::string_view Compression::getSuffix(Encoding encoding)
+{
+    switch (encoding) {
+        case GZIP: return ".gz";
+        case BROTLI: return ".br";
+        default: return "";
+    }
+}
+
+bool Compression::isCompressible(std::string_view contentType, const Settings &settings)
+{
+    contentType = trim(contentType.substr(0, contentType.find(';')));
+    return std::any_of(settings.mimeTypes.begin(), settings.mimeTypes.end(), [contentType](const std::string& type) {
+        return equalsIgnoreCase(type, contentType);
+    });
+}
+
+struct Compression::Compressor::State {
+    Encoding encoding;
+#ifdef MYHTTP_WITH_ZLIB
+    z_stream zlib{};
+#endif
+#ifdef MYHTTP_WITH_BROTLI
+    BrotliEncoderState* brotli = nullptr;
+#endif
+};
+
+Compression::Compressor::Compressor(Encoding encoding, const Settings &settings)
+    : m_state(std::make_unique<State>())
+{
+    m_state->encoding = encoding;
+    if (!(getAvailable() & encoding) || encoding == IDENTITY)
+        throw std::runtime_error("Content encoding " + std::string(getName(encoding)) + " is not available");
+#ifdef MYHTTP_WITH_ZLIB
+    // 15 window bits plus 16 asks for a gzip header and trailer instead of a raw zlib stream
+    if (encoding == GZIP && deflateInit2(&m_state->zlib, settings.gzipLevel, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        throw std::runtime_error("Failed to start gzip stream");
+#endif
+#ifdef MYHTTP_WITH_BROTLI
+    if (encoding == BROTLI) {
+        m_state->brotli = BrotliEncoderCreateInstance(nullptr, nullptr, nullptr);
+        if (!m_state->brotli)
+            throw std::runtime_error("Failed to start brotli stream");
+        BrotliEncoderSetParameter(m_state->brotli, BROTLI_PARAM_QUALITY, settings.brotliQuality);
+        BrotliEncoderSetParameter(m_state->brotli, BROTLI_PARAM_MODE, BROTLI_MODE_TEXT);
+    }
+#endif
+}
+
+Compression::Compressor::~Compressor()
+{
+#ifdef MYHTTP_WITH_ZLIB
+    if (m_state->encoding == GZIP)
+        deflateEnd(&m_state->zlib);
+#endif
+#ifdef MYHTTP_WITH_BROTLI
+    if (m_state->brotli)
+        BrotliEncoderDestroyInstance(m_state->brotli);
+#endif
+}
+
+void Compression::Compressor::write(std::string_view input, std::string &out)
+{
+#ifdef MYHTTP_WITH_ZLIB
+    if (m_state->encoding == GZIP) {
+        z_stream& stream = m_state->zlib;
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+        stream.avail_in = input.size();
+        while (stream.avail_in > 0) {
+            size_t used = out.size();
+            out.resize(used + OUTPUT_CHUNK);
+            stream.next_out = reinterpret_cast<Bytef*>(out.data() + used);
+            stream.avail_out = OUTPUT_CHUNK;
+            deflate(&stream, Z_NO_FLUSH);
+            out.resize(used + OUTPUT_CHUNK - stream.avail_out);
+        }
+    }
+#endif
+#ifdef MYHTTP_WITH_BROTLI
+    if (m_state->encoding == BROTLI) {
+        size_t availableIn = input.size();
+        const uint8_t* nextIn = reinterpret_cast<const uint8_t*>(input.data());
+        while (availableIn > 0 || BrotliEncoderHasMoreOutput(m_state->brotli)) {
+            size_t used = out.size();
+            out.resize(used + OUTPUT_CHUNK);
+            size_t availableOut = OUTPUT_CHUNK;
+            uint8_t* nextOut = reinterpret_cast<uint8_t*>(out.data() + used);
+            BrotliEncoderCompressStream(m_state->brotli, BROTLI_OPERATION_PROCESS, &availableIn, &nextIn, &availableOut, &nextOut, nullptr);
+            out.resize(used + OUTPUT_CHUNK - availableOut);
+        }
+    }
+#endif
+}
+
+void Compression::Compressor::finish(std::string &out)
+{
+#ifdef MYHTTP_WITH_ZLIB
+    if (m_state->encoding == GZIP) {
+        z_stream& stream = m_state->zlib;
+        stream.avail_in = 0;
+        int result = Z_OK;
+        while (result != Z_STREAM_END) {
+            size_t used = out.size();
+            out.resize(used + OUTPUT_CHUNK);
+            stream.next_out = reinterpret_cast<Bytef*>(out.data() + used);
+            stream.avail_out = OUTPUT_CHUNK;
+            result = deflate(&stream, Z_FINISH);
+            out.resize(used + OUTPUT_CHUNK - stream.avail_out);
+        }
+    }
+#endif
+#ifdef MYHTTP_WITH_BROTLI
+    if (m_state->encoding == BROTLI) {
+        size_t availableIn = 0;
+        const uint8_t* nextIn = nullptr;
+        while (!BrotliEncoderIsFinished(m_state->brotli)) {
+            size_t used = out.size();
+            out.resize(used + OUTPUT_CHUNK);
+            size_t availableOut = OUTPUT_CHUNK;
+            uint8_t* nextOut = reinterpret_cast<uint8_t*>(out.data() + used);
+            BrotliEncoderCompressStream(m_state->brotli, BROTLI_OPERATION_FINISH, &availableIn, &nextIn, &availableOut, &nextOut, nullptr);
+            out.resize(used + OUTPUT_CHUNK - availableOut);
+        }
+    }
+#endif
+}
+
+std::optional<std::string> Compression::compress(std::string_view input, Encoding encoding, const Settings &settings)
+{
+    if (encoding == IDENTITY || !(getAvailable() & encoding))
+        return std::nullopt;
+    Compressor compressor(encoding, settings);
+    std::string out;
+    // Text usually shrinks to well under half
+    out.reserve(input.size() / 3);
+    compressor.write(input, out);
+    compressor.finish(out);
+    return out;
+}
+
+bool Compression::compressResponse(HTTPResponse &response, int accepted, const Settings &settings)
+{
+    if (!settings.enabled || response.getBody().size() < settings.minSize || response.getHeader("Content-Encoding"))
+        return false;
+    std::optional<std::string> contentType = response.getHeader("Content-Type");
+    if (!contentType || !isCompressible(*contentType, settings))
+        return false;
+    // Whatever the client accepts, caches in between have to know the response depends on it
+    response.setHeader("Vary", "Accept-Encoding");
+    Encoding encoding = choose(accepted);
+    if (encoding == IDENTITY)
+        return false;
+
+    std::optional<std::string> compressed = compress(response.getBody(), encoding, settings);
+    // Random or already compressed data can come out bigger
+    if (!compressed || compressed->size() >= response.getBody().size())
+        return false;
+    response.setBody(std::move(*compressed));
+    response.setHeader("Content-Encoding", std::string(getName(encoding)));
+    return true;
+}
@@ -0,0 +1,115 @@
+#include "Connection.h"
+#include <sys/resource.h>
+
+namespace {
+    // A buffer this big is given back when the connection goes idle instead of being kept for the next request
+    constexpr size_t MAX_IDLE_INPUT_CAPACITY = 64 * 1024;
+    // Past this, a fd limit is as good as unlimited and the table would only waste page pointers
+    constexpr size_t MAX_FDS = 1 << 20;
+}
+
+void Connection::open(int socket, const RequestParser::Limits &limits)
+{
+    // Pairs with the store at the end of release(), the last owner may have been another thread
+    m_open.load(std::memory_order_acquire);
+    fd = socket;
+    generation++;
+    input.clear();
+    parser = RequestParser(limits);
+    output.clear();
+    closeWhenDrained = false;
+    asyncState.store(AsyncState::IDLE, std::memory_order_relaxed);
+    asyncResponse.reset();
+    closeAfterAsync = false;
+    stats = Stats{.acceptedAt = Clock::now()};
+    remoteAddress.clear();
+    access.cancel();
+    // Anything but a read, so the first deadline starts fresh instead of carrying over from the last client
+    m_deadlineKind = TimerWheel::Deadline::KEEP_ALIVE;
+    m_open.store(true, std::memory_order_release);
+}
+
+void Connection::release()
+{
+    fd = -1;
+    if (input.capacity() > MAX_IDLE_INPUT_CAPACITY)
+        std::string().swap(input);
+    input.clear();
+    parser.reset();
+    output.clear();
+    closeWhenDrained = false;
+    m_open.store(false, std::memory_order_release);
+}
+
+void Connection::setDeadline(TimerWheel::Deadline kind, std::chrono::milliseconds timeout, Clock::time_point now)
+{
+    bool reading = kind == TimerWheel::Deadline::HEADER_READ || kind == TimerWheel::Deadline::BODY_READ;
+    if (!reading || kind != m_deadlineKind)
+        m_deadline = now + timeout;
+    m_deadlineKind = kind;
+    int64_t millis = std::chrono::ceil<std::chrono::milliseconds>(m_deadline.time_since_epoch()).count();
+    m_published.store(millis << 2 | static_cast<int64_t>(kind), std::memory_order_release);
+}
+
+std::optional<Connection::Timeout> Connection::getTimeout() const
+{
+    int64_t published = m_published.load(std::memory_order_acquire);
+    if (published == BUSY)
+        return std::nullopt;
+    auto kind = static_cast<TimerWheel::Deadline>(published & 3);
+    return Timeout{kind, Clock::time_point(std::chrono::milliseconds(published >> 2))};
+}
+
+ConnectionTable::ConnectionTable(size_t maxFds)
+    : m_pages((maxFds + PAGE_SIZE - 1) / PAGE_SIZE)
+{
+}
+
+ConnectionTable::~ConnectionTable()
+{
+    for (auto& page : m_pages)
+        delete[] page.load();
+}
+
+Connection *ConnectionTable::get(int fd)
+{
+    size_t index = fd / PAGE_SIZE;
+    if (fd < 0 || index >= m_pages.size())
+        return nullptr;
+    Connection* page = m_pages[index].load(std::memory_order_acquire);
+    if (!page) {
+        page = new Connection[PAGE_SIZE];
+        m_pages[index].store(page, std::memory_order_release);
+    }
+    return &page[fd % PAGE_SIZE];
+}
+
+Connection *ConnectionTable::find(int fd) const
+{
+    size_t index = fd / PAGE_SIZE;
+    if (fd < 0 || index >= m_pages.size())
+        return nullptr;
+    Connection* page = m_pages[index].load(std::memory_order_acquire);
+    return page ? &page[fd % PAGE_SIZE] : nullptr;
+}
+
+std::vector<Connection *> ConnectionTable::getOpen() const
+{
+    std::vector<Connection*> open;
+    for (auto& entry : m_pages) {
+        Connection* page = entry.load(std::memory_order_acquire);
+        for (size_t i = 0; page && i < PAGE_SIZE; i++) {
+            if (page[i].isOpen())
+                open.push_back(&page[i]);
+        }
+    }
+    return open;
+}
+
+size_t ConnectionTable::getFdLimit()
+{
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == -1 || limit.rlim_cur == RLIM_INFINITY || limit.rlim_cur > MAX_FDS)
+        return MAX_FDS;
+    return limit.rlim_cur;
+}
@@ -1,7 +1,117 @@
 #include "HTTPResponse.h"
+#include <array>
+#include <cstdio>
+#include <ctime>
 
-void HTTPResponse::setBody(const std::string &body)
+void HTTPResponse::setBody(std::string body)
 {
-    m_body = body;
     m_headers["Content-Length"] = std::to_string(body.size());
-}
\ No newline at end of file
+    m_body = std::move(body);
+    m_fileBody.reset();
+    m_parts.clear();
+}
+
+void HTTPResponse::setFileBody(FileBody body)
+{
+    m_body.clear();
+    m_parts.clear();
+    m_headers["Content-Length"] = std::to_string(body.length);
+    m_fileBody = std::move(body);
+}
+
+void HTTPResponse::setBodyParts(std::vector<BodyPart> parts)
+{
+    size_t length = 0;
+    for (const BodyPart& part : parts)
+        length += part.data.size() + (part.file ? part.file->length : 0);
+    m_body.clear();
+    m_fileBody.reset();
+    m_headers["Content-Length"] = std::to_string(length);
+    m_parts = std::move(parts);
+}
+
+void HTTPResponse::dropBody()
+{
+    m_body.clear();
+    m_fileBody.reset();
+    m_parts.clear();
+    // Both end their header section with a blank line before the body
+    size_t end = m_canned.find("\r\n\r\n");
+    if (end != std::string_view::npos)
+        m_canned = m_canned.substr(0, end + 4);
+    if (m_serialized) {
+        end = m_serialized->find("\r\n\r\n");
+        if (end != std::string::npos)
+            m_serialized = std::make_shared<const std::string>(m_serialized->substr(0, end + 4));
+    }
+}
+
+void HTTPResponse::appendHeaders(std::string &out) const
+{
+    for (const auto& [key, value] : m_headers) {
+        out.append(key);
+        out.append(": ");
+        out.append(value);
+        out.append("\r\n");
+    }
+    out.append("\r\n");
+}
+
+std::string_view HTTPResponse::getStatusLine(Status status)
+{
+    // One line per status, built on first use and never freed
+    static const auto lines = [] {
+        std::array<std::string, 600> table;
+        for (size_t code = 0; code < table.size(); code++) {
+            auto status = static_cast<Status>(code);
+            table[code] = "HTTP/1.1 " + std::to_string(code) + " " + std::string(getStatusText(status)) + "\r\n";
+        }
+        return table;
+    }();
+    size_t code = static_cast<size_t>(status);
+    // Only reachable by casting a made-up code to Status
+    if (code >= lines.size())
+        code = static_cast<size_t>(Status::INTERNAL_SERVER_ERROR);
+    return lines[code];
+}
+
+std::string_view HTTPResponse::getDateHeader()
+{
+    thread_local time_t formattedAt = -1;
+    thread_local char line[64];
+    thread_local size_t length = 0;
+
+    time_t now = time(nullptr);
+    if (now != formattedAt) {
+        length = snprintf(line, sizeof(line), "Date: %s\r\n", formatDate(now).c_str());
+        formattedAt = now;
+    }
+    return std::string_view(line, length);
+}
+
+std::string HTTPResponse::formatDate(time_t time)
+{
+    static constexpr const char* DAYS[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+    static constexpr const char* MONTHS[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+    tm utc;
+    gmtime_r(&time, &utc);
+    // IMF-fixdate, always 29 characters, so it fits in the small string buffer
+    char date[32];
+    snprintf(date, sizeof(date), "%s, %02d %s %04d %02d:%02d:%02d GMT",
+        DAYS[utc.tm_wday], utc.tm_mday, MONTHS[utc.tm_mon], utc.tm_year + 1900, utc.tm_hour, utc.tm_min, utc.tm_sec);
+    return date;
+}
+
+std::optional<time_t> HTTPResponse::parseDate(std::string_view date)
+{
+    if (date.size() != 29)
+        return std::nullopt;
+    char text[30];
+    date.copy(text, date.size());
+    text[date.size()] = '\0';
+    tm utc{};
+    const char* end = strptime(text, "%a, %d %b %Y %H:%M:%S GMT", &utc);
+    if (!end || *end != '\0')
+        return std::nullopt;
+    return timegm(&utc);
+}
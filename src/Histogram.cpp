@@ -0,0 +1,74 @@
+#include "Histogram.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+Histogram &Histogram::operator=(const Histogram &other)
+{
+    if (this != &other) {
+        for (size_t i = 0; i < BUCKETS; i++)
+            m_counts[i].store(other.m_counts[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        m_count.store(other.getCount(), std::memory_order_relaxed);
+        m_sum.store(other.getSum(), std::memory_order_relaxed);
+    }
+    return *this;
+}
+
+void Histogram::add(const Histogram &other)
+{
+    for (size_t i = 0; i < BUCKETS; i++) {
+        uint64_t count = other.m_counts[i].load(std::memory_order_relaxed);
+        if (count)
+            SingleWriter::bump(m_counts[i], count);
+    }
+    SingleWriter::bump(m_count, other.getCount());
+    SingleWriter::bump(m_sum, other.getSum());
+}
+
+uint64_t Histogram::getQuantile(double quantile) const
+{
+    // The buckets are read one at a time while they may still change, so go by their own total
+    uint64_t total = 0;
+    for (const auto& count : m_counts)
+        total += count.load(std::memory_order_relaxed);
+    if (total == 0)
+        return 0;
+    uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(quantile * total)));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; i++) {
+        seen += m_counts[i].load(std::memory_order_relaxed);
+        if (seen >= rank)
+            return getHighestValue(i);
+    }
+    return getHighestValue(BUCKETS - 1);
+}
+
+uint64_t Histogram::countAtMost(uint64_t value) const
+{
+    uint64_t count = 0;
+    for (size_t i = 0; i < BUCKETS && getHighestValue(i) <= value; i++)
+        count += m_counts[i].load(std::memory_order_relaxed);
+    return count;
+}
+
+size_t Histogram::getIndex(uint64_t value)
+{
+    // Below 2 * SUB_BUCKETS every value has a bucket of its own. Above, the top SUB_BUCKET_BITS + 1
+    // bits of the value pick the bucket within its power of two.
+    if (value < 2 * SUB_BUCKETS)
+        return value;
+    int exponent = std::bit_width(value) - 1;
+    if (exponent > MAX_EXPONENT)
+        return BUCKETS - 1;
+    int shift = exponent - SUB_BUCKET_BITS;
+    return static_cast<size_t>(shift) * SUB_BUCKETS + (value >> shift);
+}
+
+uint64_t Histogram::getHighestValue(size_t index)
+{
+    if (index < 2 * SUB_BUCKETS)
+        return index;
+    int shift = static_cast<int>(index / SUB_BUCKETS) - 1;
+    uint64_t top = index % SUB_BUCKETS + SUB_BUCKETS;
+    return ((top + 1) << shift) - 1;
+}
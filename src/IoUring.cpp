@@ -0,0 +1,195 @@
+#include "IoUring.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+    int ioUringSetup(unsigned entries, io_uring_params* params) {
+        return syscall(__NR_io_uring_setup, entries, params);
+    }
+
+    int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+        return syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+    }
+
+    int ioUringRegister(int fd, unsigned opcode, void* arg, unsigned nrArgs) {
+        return syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs);
+    }
+}
+
+IoUring::IoUring(unsigned entries)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    // Completions are only reaped when we ask for them, so the kernel doesn't need to interrupt us.
+    // No SINGLE_ISSUER, since the ring is created on a different thread than the one that drives it.
+    params.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+    m_fd = ioUringSetup(entries, &params);
+    if (m_fd == -1 && errno == EINVAL) {
+        // Older kernel, fall back to the plain setup
+        memset(&params, 0, sizeof(params));
+        m_fd = ioUringSetup(entries, &params);
+    }
+    if (m_fd == -1) {
+        throw std::runtime_error("Failed to create io_uring: " + std::string(strerror(errno)));
+    }
+
+    m_ringSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMmap)
+        m_ringSize = std::max(m_ringSize, m_cqRingSize);
+
+    m_ringPtr = mmap(nullptr, m_ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if (m_ringPtr == MAP_FAILED) {
+        m_ringPtr = nullptr;
+        unmap();
+        throw std::runtime_error("Failed to map io_uring submission queue: " + std::string(strerror(errno)));
+    }
+    if (singleMmap) {
+        m_cqRingPtr = m_ringPtr;
+    } else {
+        m_cqRingPtr = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+        if (m_cqRingPtr == MAP_FAILED) {
+            m_cqRingPtr = nullptr;
+            unmap();
+            throw std::runtime_error("Failed to map io_uring completion queue: " + std::string(strerror(errno)));
+        }
+    }
+    m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        unmap();
+        throw std::runtime_error("Failed to map io_uring entries: " + std::string(strerror(errno)));
+    }
+    m_sqes = static_cast<io_uring_sqe*>(sqes);
+
+    char* sq = static_cast<char*>(m_ringPtr);
+    m_sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    m_sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    m_sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    m_sqEntries = params.sq_entries;
+    m_sqLocalTail = *m_sqTail;
+    // Entry i always sits in slot i, so the index array never changes after this
+    unsigned* array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    for (unsigned i = 0; i < m_sqEntries; i++) {
+        array[i] = i;
+    }
+
+    char* cq = static_cast<char*>(m_cqRingPtr);
+    m_cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    m_cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    m_cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    m_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+}
+
+IoUring::~IoUring()
+{
+    unmap();
+}
+
+bool IoUring::isSupported()
+{
+    static const bool supported = [] {
+        try {
+            IoUring ring(8);
+            ring.setupBufferRing(0, 2, 64);
+            return true;
+        } catch (const std::runtime_error&) {
+            return false;
+        }
+    }();
+    return supported;
+}
+
+io_uring_sqe *IoUring::getSqe()
+{
+    unsigned head = std::atomic_ref<unsigned>(*m_sqHead).load(std::memory_order_acquire);
+    if (m_sqLocalTail - head >= m_sqEntries) {
+        // Queue is full, hand what we have to the kernel to make room
+        submitAndWait(0);
+        head = std::atomic_ref<unsigned>(*m_sqHead).load(std::memory_order_acquire);
+        if (m_sqLocalTail - head >= m_sqEntries)
+            throw std::runtime_error("io_uring submission queue is full: " + std::string(strerror(errno)));
+    }
+    io_uring_sqe* sqe = &m_sqes[m_sqLocalTail & m_sqMask];
+    memset(sqe, 0, sizeof(*sqe));
+    m_sqLocalTail++;
+    m_toSubmit++;
+    return sqe;
+}
+
+int IoUring::submitAndWait(unsigned waitNr)
+{
+    std::atomic_ref<unsigned>(*m_sqTail).store(m_sqLocalTail, std::memory_order_release);
+    int submitted = ioUringEnter(m_fd, m_toSubmit, waitNr, waitNr > 0 ? IORING_ENTER_GETEVENTS : 0);
+    if (submitted > 0)
+        m_toSubmit -= submitted;
+    return submitted;
+}
+
+void IoUring::setupBufferRing(uint16_t groupId, uint16_t count, uint32_t size)
+{
+    m_bufRingSize = count * sizeof(io_uring_buf);
+    void* ring = mmap(nullptr, m_bufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) {
+        throw std::runtime_error("Failed to allocate io_uring buffer ring: " + std::string(strerror(errno)));
+    }
+    m_bufRing = static_cast<io_uring_buf_ring*>(ring);
+
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(m_bufRing);
+    reg.ring_entries = count;
+    reg.bgid = groupId;
+    if (ioUringRegister(m_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        int error = errno;
+        munmap(m_bufRing, m_bufRingSize);
+        m_bufRing = nullptr;
+        throw std::runtime_error("Failed to register io_uring buffer ring: " + std::string(strerror(error)));
+    }
+
+    m_bufMask = count - 1;
+    m_bufferSize = size;
+    m_bufferMemory.resize(static_cast<size_t>(count) * size);
+    for (uint16_t id = 0; id < count; id++) {
+        recycleBuffer(id);
+    }
+}
+
+void IoUring::recycleBuffer(uint16_t id)
+{
+    // Not m_bufRing->bufs, in C++ the kernel's flexible array macro puts it 8 bytes past the start of the ring
+    io_uring_buf& buf = reinterpret_cast<io_uring_buf*>(m_bufRing)[m_bufTail & m_bufMask];
+    buf.addr = reinterpret_cast<uint64_t>(getBuffer(id));
+    buf.len = m_bufferSize;
+    buf.bid = id;
+    m_bufTail++;
+    // The tail lives in the same memory as the first buffer entry's reserved field
+    std::atomic_ref<uint16_t>(m_bufRing->tail).store(m_bufTail, std::memory_order_release);
+}
+
+void IoUring::unmap()
+{
+    // Closing the ring cancels anything still in flight before its memory goes away
+    if (m_fd != -1)
+        close(m_fd);
+    if (m_bufRing)
+        munmap(m_bufRing, m_bufRingSize);
+    if (m_sqes)
+        munmap(m_sqes, m_sqesSize);
+    if (m_cqRingPtr && m_cqRingPtr != m_ringPtr)
+        munmap(m_cqRingPtr, m_cqRingSize);
+    if (m_ringPtr)
+        munmap(m_ringPtr, m_ringSize);
+    m_fd = -1;
+    m_bufRing = nullptr;
+    m_sqes = nullptr;
+    m_cqRingPtr = nullptr;
+    m_ringPtr = nullptr;
+}
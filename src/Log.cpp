@@ -0,0 +1,518 @@
+#include "Log.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+#include "SingleWriter.h"
+
+namespace {
+    using namespace std::chrono_literals;
+
+    enum class Kind : uint8_t { PADDING, MESSAGE, ACCESS };
+
+    // Starts every record in a ring. Records are padded to a multiple of its size, so one always fits before the end.
+    struct Header {
+        // Of the whole record, padding included
+        uint32_t size;
+        // Of what follows the header
+        uint16_t length;
+        Kind kind;
+        uint8_t level;
+        // Nanoseconds since the epoch
+        int64_t time;
+    };
+    static_assert(sizeof(Header) == 16 && Log::RING_BYTES % sizeof(Header) == 0);
+
+    // The start of an access record, followed by the fields Access::begin() copied
+    struct AccessResult {
+        int32_t status;
+        uint64_t bytes;
+        int64_t duration;
+    };
+
+    constexpr const char* LEVEL_NAMES[] = {"DEBUG", "INFO", "WARNING", "ERROR"};
+    // How long the flusher sleeps once the rings are empty, and while they keep filling up
+    constexpr auto IDLE_WAIT = 100ms;
+    constexpr auto BUSY_WAIT = 1ms;
+
+    std::atomic<Log::Level> g_level = Log::Level::INFO;
+    std::atomic<uint32_t> g_rateLimit = 10;
+    std::atomic<bool> g_accessLogOpen = false;
+
+    // A single producer, single consumer queue of variable sized records
+    struct Ring {
+        // Only written by the thread that owns the ring
+        std::atomic<uint64_t> head = 0;
+        std::atomic<uint64_t> dropped = 0;
+        std::atomic<uint64_t> suppressed = 0;
+        // Set once the thread has exited, the ring is freed after it's drained
+        std::atomic<bool> retired = false;
+        // Only written by the flusher
+        alignas(64) std::atomic<uint64_t> tail = 0;
+        std::unique_ptr<char[]> bytes = std::make_unique<char[]>(Log::RING_BYTES);
+
+        /// @return false if there was no room, and the record was dropped.
+        bool push(const Header& header, std::string_view first, std::string_view second);
+    };
+
+    class Logger {
+    public:
+        Logger();
+
+        Ring& getRing();
+        void flush();
+        void setErrorFd(int fd);
+        void setAccessFd(int fd, Log::Format format);
+        Log::Stats getStats();
+        void wake() { m_wake.notify_one(); }
+
+    private:
+        std::mutex m_mutex;
+        std::condition_variable m_wake;
+        std::condition_variable m_flushed;
+        std::vector<std::unique_ptr<Ring>> m_rings;
+        int m_errorFd = STDERR_FILENO;
+        int m_accessFd = -1;
+        Log::Format m_format = Log::Format::COMBINED;
+        uint64_t m_flushRequested = 0;
+        uint64_t m_flushDone = 0;
+        uint64_t m_written = 0;
+        // Counted by rings that were freed since
+        uint64_t m_retiredDropped = 0;
+        uint64_t m_retiredSuppressed = 0;
+        // Reused between batches
+        std::string m_errors;
+        std::string m_access;
+        std::thread m_thread;
+
+        void run();
+        /// @return Whether anything was written.
+        bool drain();
+        void format(const Header& header, const char* payload);
+    };
+
+    // Never destroyed, threads the server didn't join may still log while the process exits
+    Logger& getLogger() {
+        static Logger* logger = new Logger();
+        return *logger;
+    }
+
+    struct RingHandle {
+        Ring* ring = nullptr;
+        ~RingHandle() {
+            if (ring)
+                ring->retired.store(true, std::memory_order_release);
+            ring = nullptr;
+        }
+    };
+    thread_local RingHandle t_ring;
+
+    int64_t nowNanoseconds() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    void appendField(std::string& out, std::string_view field) {
+        uint16_t length = static_cast<uint16_t>(std::min(field.size(), Log::MAX_MESSAGE));
+        out.append(reinterpret_cast<const char*>(&length), sizeof(length));
+        out.append(field.data(), length);
+    }
+
+    std::string_view readField(const char*& in) {
+        uint16_t length;
+        memcpy(&length, in, sizeof(length));
+        std::string_view field(in + sizeof(length), length);
+        in += sizeof(length) + length;
+        return field;
+    }
+
+    // Only the flusher formats times. Lines come in order, so the seconds are only formatted when they change.
+    void appendTime(std::string& out, int64_t nanoseconds, bool iso) {
+        struct Cached {
+            time_t second = -1;
+            char text[40];
+            size_t length = 0;
+        };
+        static Cached cached[2];
+        Cached& entry = cached[iso];
+        time_t second = nanoseconds / 1'000'000'000;
+        if (entry.second != second) {
+            tm utc;
+            gmtime_r(&second, &utc);
+            entry.second = second;
+            entry.length = iso ? strftime(entry.text, sizeof(entry.text), "%Y-%m-%dT%H:%M:%S", &utc)
+                               : strftime(entry.text, sizeof(entry.text), "%d/%b/%Y:%H:%M:%S +0000", &utc);
+        }
+        out.append(entry.text, entry.length);
+        if (iso) {
+            char millis[8];
+            snprintf(millis, sizeof(millis), ".%03dZ", static_cast<int>(nanoseconds / 1'000'000 % 1000));
+            out += millis;
+        }
+    }
+
+    // Like nginx, quotes and anything unprintable become \xHH
+    void appendCombined(std::string& out, std::string_view field) {
+        if (field.empty()) {
+            out += '-';
+            return;
+        }
+        for (char c : field) {
+            unsigned char byte = static_cast<unsigned char>(c);
+            if (byte < 0x20 || byte >= 0x7f || c == '"' || c == '\\') {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\x%02X", byte);
+                out += escaped;
+            } else {
+                out += c;
+            }
+        }
+    }
+
+    void appendJson(std::string& out, std::string_view field) {
+        out += '"';
+        for (char c : field) {
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                out += escaped;
+            } else {
+                out += c;
+            }
+        }
+        out += '"';
+    }
+
+    void writeAll(int fd, const std::string& data) {
+        size_t written = 0;
+        while (written < data.size()) {
+            ssize_t result = ::write(fd, data.data() + written, data.size() - written);
+            if (result < 0 && errno == EINTR)
+                continue;
+            // Nowhere left to report it
+            if (result <= 0)
+                return;
+            written += result;
+        }
+    }
+
+    int openForAppending(const std::filesystem::path& file) {
+        int fd = open(file.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd == -1)
+            throw std::runtime_error("Failed to open log file " + file.string() + ": " + strerror(errno));
+        return fd;
+    }
+
+    bool Ring::push(const Header& header, std::string_view first, std::string_view second)
+    {
+        size_t size = sizeof(Header) + first.size() + second.size();
+        size = (size + sizeof(Header) - 1) / sizeof(Header) * sizeof(Header);
+        uint64_t position = head.load(std::memory_order_relaxed);
+        uint64_t used = position - tail.load(std::memory_order_acquire);
+        size_t offset = position % Log::RING_BYTES;
+        // A record never wraps around, the space up to the end is skipped instead
+        size_t skipped = Log::RING_BYTES - offset < size ? Log::RING_BYTES - offset : 0;
+        if (used + skipped + size > Log::RING_BYTES) {
+            SingleWriter::bump(dropped, 1);
+            return false;
+        }
+        if (skipped) {
+            Header padding{static_cast<uint32_t>(skipped), 0, Kind::PADDING, 0, 0};
+            memcpy(&bytes[offset], &padding, sizeof(padding));
+            offset = 0;
+        }
+        Header sized = header;
+        sized.size = static_cast<uint32_t>(size);
+        sized.length = static_cast<uint16_t>(first.size() + second.size());
+        memcpy(&bytes[offset], &sized, sizeof(sized));
+        memcpy(&bytes[offset + sizeof(Header)], first.data(), first.size());
+        memcpy(&bytes[offset + sizeof(Header) + first.size()], second.data(), second.size());
+        head.store(position + skipped + size, std::memory_order_release);
+        // Don't let the flusher sleep through a burst
+        if (used < Log::RING_BYTES / 2 && used + skipped + size >= Log::RING_BYTES / 2)
+            getLogger().wake();
+        return true;
+    }
+
+    Logger::Logger()
+    {
+        m_thread = std::thread([this] { run(); });
+        // What was logged right before exiting still gets written
+        std::atexit([] { getLogger().flush(); });
+    }
+
+    Ring &Logger::getRing()
+    {
+        if (t_ring.ring)
+            return *t_ring.ring;
+        std::lock_guard lock(m_mutex);
+        m_rings.push_back(std::make_unique<Ring>());
+        t_ring.ring = m_rings.back().get();
+        return *t_ring.ring;
+    }
+
+    void Logger::flush()
+    {
+        std::unique_lock lock(m_mutex);
+        uint64_t ticket = ++m_flushRequested;
+        m_wake.notify_one();
+        m_flushed.wait(lock, [&] { return m_flushDone >= ticket; });
+    }
+
+    void Logger::setErrorFd(int fd)
+    {
+        std::lock_guard lock(m_mutex);
+        if (m_errorFd != STDERR_FILENO)
+            close(m_errorFd);
+        m_errorFd = fd;
+    }
+
+    void Logger::setAccessFd(int fd, Log::Format format)
+    {
+        std::lock_guard lock(m_mutex);
+        if (m_accessFd != -1)
+            close(m_accessFd);
+        m_accessFd = fd;
+        m_format = format;
+    }
+
+    Log::Stats Logger::getStats()
+    {
+        std::lock_guard lock(m_mutex);
+        Log::Stats stats;
+        stats.written = m_written;
+        stats.dropped = m_retiredDropped;
+        stats.suppressed = m_retiredSuppressed;
+        for (const auto& ring : m_rings) {
+            stats.dropped += ring->dropped.load(std::memory_order_relaxed);
+            stats.suppressed += ring->suppressed.load(std::memory_order_relaxed);
+        }
+        return stats;
+    }
+
+    void Logger::run()
+    {
+        std::unique_lock lock(m_mutex);
+        while (true) {
+            uint64_t requested = m_flushRequested;
+            bool busy = drain();
+            if (requested > m_flushDone) {
+                m_flushDone = requested;
+                m_flushed.notify_all();
+            }
+            m_wake.wait_for(lock, busy ? BUSY_WAIT : IDLE_WAIT, [this] { return m_flushRequested > m_flushDone; });
+        }
+    }
+
+    bool Logger::drain()
+    {
+        m_errors.clear();
+        m_access.clear();
+        for (const auto& ring : m_rings) {
+            uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+            uint64_t head = ring->head.load(std::memory_order_acquire);
+            while (tail < head) {
+                Header header;
+                const char* record = &ring->bytes[tail % Log::RING_BYTES];
+                memcpy(&header, record, sizeof(header));
+                if (header.kind != Kind::PADDING)
+                    format(header, record + sizeof(Header));
+                tail += header.size;
+            }
+            ring->tail.store(tail, std::memory_order_release);
+        }
+        // A retired ring's thread is gone, so nothing can have been added since it was drained
+        std::erase_if(m_rings, [this](const std::unique_ptr<Ring>& ring) {
+            if (!ring->retired.load(std::memory_order_acquire) ||
+                ring->head.load(std::memory_order_relaxed) != ring->tail.load(std::memory_order_relaxed))
+                return false;
+            m_retiredDropped += ring->dropped.load(std::memory_order_relaxed);
+            m_retiredSuppressed += ring->suppressed.load(std::memory_order_relaxed);
+            return true;
+        });
+        if (!m_errors.empty())
+            writeAll(m_errorFd, m_errors);
+        if (!m_access.empty() && m_accessFd != -1)
+            writeAll(m_accessFd, m_access);
+        return !m_errors.empty() || !m_access.empty();
+    }
+
+    void Logger::format(const Header& header, const char* payload)
+    {
+        if (header.kind == Kind::MESSAGE) {
+            appendTime(m_errors, header.time, true);
+            m_errors += ' ';
+            m_errors += LEVEL_NAMES[static_cast<int>(header.level)];
+            m_errors += ' ';
+            m_errors.append(payload, header.length);
+            m_errors += '\n';
+            m_written++;
+            return;
+        }
+        if (m_accessFd == -1)
+            return;
+        AccessResult result;
+        memcpy(&result, payload, sizeof(result));
+        const char* in = payload + sizeof(result);
+        std::string_view remoteAddress = readField(in);
+        std::string_view method = readField(in);
+        std::string_view target = readField(in);
+        std::string_view version = readField(in);
+        std::string_view referer = readField(in);
+        std::string_view userAgent = readField(in);
+        if (m_format == Log::Format::COMBINED) {
+            appendCombined(m_access, remoteAddress);
+            m_access += " - - [";
+            appendTime(m_access, header.time, false);
+            m_access += "] \"";
+            appendCombined(m_access, method);
+            m_access += ' ';
+            appendCombined(m_access, target);
+            m_access += ' ';
+            appendCombined(m_access, version);
+            m_access += "\" " + std::to_string(result.status) + " " + std::to_string(result.bytes) + " \"";
+            appendCombined(m_access, referer);
+            m_access += "\" \"";
+            appendCombined(m_access, userAgent);
+            m_access += "\"\n";
+        } else {
+            m_access += "{\"time\":\"";
+            appendTime(m_access, header.time, true);
+            m_access += "\",\"remote_addr\":";
+            appendJson(m_access, remoteAddress);
+            m_access += ",\"method\":";
+            appendJson(m_access, method);
+            m_access += ",\"target\":";
+            appendJson(m_access, target);
+            m_access += ",\"version\":";
+            appendJson(m_access, version);
+            m_access += ",\"status\":" + std::to_string(result.status) + ",\"bytes\":" + std::to_string(result.bytes) +
+                        ",\"duration_us\":" + std::to_string(result.duration / 1000) + ",\"referer\":";
+            appendJson(m_access, referer);
+            m_access += ",\"user_agent\":";
+            appendJson(m_access, userAgent);
+            m_access += "}\n";
+        }
+        m_written++;
+    }
+}
+
+namespace Log {
+
+    void setLevel(Level level) {
+        g_level.store(level, std::memory_order_relaxed);
+    }
+
+    bool isEnabled(Level level) {
+        return level != Level::OFF && level >= g_level.load(std::memory_order_relaxed);
+    }
+
+    void setRateLimit(uint32_t perSecond) {
+        g_rateLimit.store(perSecond, std::memory_order_relaxed);
+    }
+
+    void setErrorLog(const std::filesystem::path &file) {
+        getLogger().setErrorFd(file.empty() ? STDERR_FILENO : openForAppending(file));
+    }
+
+    void openAccessLog(const std::filesystem::path &file, Format format) {
+        getLogger().setAccessFd(openForAppending(file), format);
+        g_accessLogOpen.store(true, std::memory_order_relaxed);
+    }
+
+    void closeAccessLog() {
+        g_accessLogOpen.store(false, std::memory_order_relaxed);
+        getLogger().flush();
+        getLogger().setAccessFd(-1, Format::COMBINED);
+    }
+
+    bool isAccessLogOpen() {
+        return g_accessLogOpen.load(std::memory_order_relaxed);
+    }
+
+    void flush() {
+        getLogger().flush();
+    }
+
+    Stats getStats() {
+        return getLogger().getStats();
+    }
+
+    std::string formatAddress(const sockaddr_storage &address) {
+        char buffer[INET6_ADDRSTRLEN] = {};
+        if (address.ss_family == AF_INET)
+            inet_ntop(AF_INET, &reinterpret_cast<const sockaddr_in&>(address).sin_addr, buffer, sizeof(buffer));
+        else if (address.ss_family == AF_INET6)
+            inet_ntop(AF_INET6, &reinterpret_cast<const sockaddr_in6&>(address).sin6_addr, buffer, sizeof(buffer));
+        return buffer;
+    }
+
+    void write(Level level, const char *message, std::string_view text) {
+        Ring& ring = getLogger().getRing();
+        int64_t now = nowNanoseconds();
+
+        // Messages from one place in one second, counted per thread so logging never contends
+        struct Site {
+            int64_t second = 0;
+            uint32_t count = 0;
+            uint64_t suppressed = 0;
+        };
+        thread_local std::unordered_map<const char*, Site> t_sites;
+        uint32_t limit = g_rateLimit.load(std::memory_order_relaxed);
+        std::string note;
+        if (limit != 0) {
+            Site& site = t_sites[message];
+            if (site.second != now / 1'000'000'000) {
+                site.second = now / 1'000'000'000;
+                site.count = 0;
+            }
+            if (++site.count > limit) {
+                site.suppressed++;
+                SingleWriter::bump(ring.suppressed, 1);
+                return;
+            }
+            if (site.suppressed) {
+                note = " (" + std::to_string(site.suppressed) + " more like this were suppressed)";
+                site.suppressed = 0;
+            }
+        }
+        ring.push(Header{0, 0, Kind::MESSAGE, static_cast<uint8_t>(level), now}, text.substr(0, MAX_MESSAGE), note);
+    }
+
+    void Access::begin(std::string_view remoteAddress, std::string_view method, std::string_view target, std::string_view version,
+                       std::string_view referer, std::string_view userAgent) {
+        m_fields.clear();
+        for (std::string_view field : {remoteAddress, method, target, version, referer, userAgent})
+            appendField(m_fields, field);
+        m_started = std::chrono::steady_clock::now();
+        m_pending = true;
+    }
+
+    void Access::begin(std::string_view remoteAddress, const RequestView &request) {
+        begin(remoteAddress, HTTPRequest::getMethodString(request.getMethod()), request.getRoute(), request.getVersion(),
+              request.getHeader("Referer").value_or(""), request.getHeader("User-Agent").value_or(""));
+    }
+
+    void Access::finish(int status, uint64_t bytes) {
+        m_pending = false;
+        if (!isAccessLogOpen())
+            return;
+        AccessResult result{status, bytes, std::chrono::nanoseconds(std::chrono::steady_clock::now() - m_started).count()};
+        std::string_view first(reinterpret_cast<const char*>(&result), sizeof(result));
+        getLogger().getRing().push(Header{0, 0, Kind::ACCESS, static_cast<uint8_t>(Level::INFO), nowNanoseconds()}, first, m_fields);
+    }
+}
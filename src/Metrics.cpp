@@ -0,0 +1,182 @@
+#include "Metrics.h"
+#include <bit>
+#include <cstdio>
+#include <utility>
+
+namespace {
+    std::atomic<uint64_t> nextId = 1;
+
+    struct CounterInfo {
+        const char* name;
+        const char* help;
+        const char* labels;
+    };
+
+    // Indexed by Metrics::Counter. Consecutive counters with the same name are one family.
+    constexpr CounterInfo COUNTERS[] = {
+        {"myhttp_requests_total", "Requests answered.", ""},
+        {"myhttp_responses_total", "Responses queued, by status class.", "{code=\"1xx\"}"},
+        {"myhttp_responses_total", "Responses queued, by status class.", "{code=\"2xx\"}"},
+        {"myhttp_responses_total", "Responses queued, by status class.", "{code=\"3xx\"}"},
+        {"myhttp_responses_total", "Responses queued, by status class.", "{code=\"4xx\"}"},
+        {"myhttp_responses_total", "Responses queued, by status class.", "{code=\"5xx\"}"},
+        {"myhttp_parse_errors_total", "Requests that couldn't be parsed.", ""},
+        {"myhttp_connections_accepted_total", "Connections accepted.", ""},
+        {"myhttp_connections_closed_total", "Connections closed, for any reason.", ""},
+        {"myhttp_connections_timed_out_total", "Connections closed because a deadline passed.", ""},
+        {"myhttp_received_bytes_total", "Bytes read from clients.", ""},
+        {"myhttp_sent_bytes_total", "Bytes written to clients.", ""},
+    };
+    static_assert(std::size(COUNTERS) == static_cast<size_t>(Metrics::Counter::COUNT));
+
+    // Indexed by Metrics::Stage
+    constexpr const char* STAGES[] = {"accept", "receive", "parse", "route", "handler", "serialize", "send", "queue_wait"};
+    static_assert(std::size(STAGES) == static_cast<size_t>(Metrics::Stage::COUNT));
+
+    // The exported histogram buckets, in seconds. Dashboards want fixed bounds, the quantiles are exported separately.
+    constexpr double BUCKET_BOUNDS[] = {1e-6, 2.5e-6, 5e-6, 1e-5, 2.5e-5, 5e-5, 1e-4, 2.5e-4, 5e-4, 1e-3, 2.5e-3,
+                                        5e-3, 1e-2, 2.5e-2, 5e-2, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+    constexpr std::pair<double, const char*> QUANTILES[] = {{0.5, "0.5"}, {0.9, "0.9"}, {0.99, "0.99"}, {0.999, "0.999"}};
+
+    std::string formatNumber(double value) {
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%.9g", value);
+        return buffer;
+    }
+
+    void appendHeader(std::string& out, const std::string& name, const std::string& help, const char* type) {
+        out += "# HELP " + name + " " + help + "\n";
+        out += "# TYPE " + name + " " + type + "\n";
+    }
+}
+
+Metrics::Metrics()
+    : m_id(nextId.fetch_add(1, std::memory_order_relaxed))
+{
+}
+
+Metrics::~Metrics() = default;
+
+thread_local std::array<uint32_t, static_cast<size_t>(Metrics::Stage::COUNT)> Metrics::t_ticks{};
+
+void Metrics::enable(uint32_t timeEvery)
+{
+    m_sampleMask = std::bit_ceil(std::max<uint32_t>(timeEvery, 1)) - 1;
+    m_enabled = true;
+}
+
+void Metrics::addResponse(int status)
+{
+    if (status < 100 || status > 599)
+        return;
+    add(static_cast<Counter>(static_cast<int>(Counter::RESPONSES_1XX) + status / 100 - 1));
+}
+
+void Metrics::addValue(Type type, std::string name, std::string help, std::function<double()> read)
+{
+    std::lock_guard lock(m_mutex);
+    m_values.push_back(Value{type, std::move(name), std::move(help), std::move(read)});
+}
+
+uint64_t Metrics::get(Counter counter) const
+{
+    std::lock_guard lock(m_mutex);
+    uint64_t total = 0;
+    for (const auto& shard : m_shards)
+        total += shard->counters[static_cast<size_t>(counter)].load(std::memory_order_relaxed);
+    return total;
+}
+
+Histogram Metrics::getHistogram(Stage stage) const
+{
+    std::lock_guard lock(m_mutex);
+    Histogram merged;
+    for (const auto& shard : m_shards)
+        merged.add(shard->stages[static_cast<size_t>(stage)]);
+    return merged;
+}
+
+std::string Metrics::toPrometheus() const
+{
+    std::string out;
+    std::array<uint64_t, static_cast<size_t>(Counter::COUNT)> counters;
+    for (size_t i = 0; i < counters.size(); i++) {
+        counters[i] = get(static_cast<Counter>(i));
+        if (i == 0 || std::string_view(COUNTERS[i].name) != COUNTERS[i - 1].name)
+            appendHeader(out, COUNTERS[i].name, COUNTERS[i].help, "counter");
+        out += std::string(COUNTERS[i].name) + COUNTERS[i].labels + " " + std::to_string(counters[i]) + "\n";
+    }
+    // Closes are counted on other threads than accepts and read a moment later, so this can briefly be behind
+    uint64_t accepted = counters[static_cast<size_t>(Counter::CONNECTIONS_ACCEPTED)];
+    uint64_t closed = counters[static_cast<size_t>(Counter::CONNECTIONS_CLOSED)];
+    appendHeader(out, "myhttp_connections_active", "Connections open right now.", "gauge");
+    out += "myhttp_connections_active " + std::to_string(accepted > closed ? accepted - closed : 0) + "\n";
+
+    std::array<Histogram, static_cast<size_t>(Stage::COUNT)> stages;
+    for (size_t i = 0; i < stages.size(); i++)
+        stages[i] = getHistogram(static_cast<Stage>(i));
+
+    appendHeader(out, "myhttp_stage_duration_seconds", "Time spent in each stage of handling requests, for the sampled ones.", "histogram");
+    for (size_t i = 0; i < stages.size(); i++) {
+        std::string labels = std::string("stage=\"") + STAGES[i] + "\"";
+        for (double bound : BUCKET_BOUNDS) {
+            out += "myhttp_stage_duration_seconds_bucket{" + labels + ",le=\"" + formatNumber(bound) + "\"} " +
+                   std::to_string(stages[i].countAtMost(static_cast<uint64_t>(bound * 1e9))) + "\n";
+        }
+        out += "myhttp_stage_duration_seconds_bucket{" + labels + ",le=\"+Inf\"} " + std::to_string(stages[i].getCount()) + "\n";
+        out += "myhttp_stage_duration_seconds_sum{" + labels + "} " + formatNumber(stages[i].getSum() / 1e9) + "\n";
+        out += "myhttp_stage_duration_seconds_count{" + labels + "} " + std::to_string(stages[i].getCount()) + "\n";
+    }
+
+    appendHeader(out, "myhttp_stage_duration_quantile_seconds",
+                 "Quantiles of the time spent in each stage since the server started, within 3% of the sampled ones.", "gauge");
+    for (size_t i = 0; i < stages.size(); i++) {
+        for (auto [quantile, label] : QUANTILES) {
+            out += std::string("myhttp_stage_duration_quantile_seconds{stage=\"") + STAGES[i] + "\",quantile=\"" + label + "\"} " +
+                   formatNumber(stages[i].getQuantile(quantile) / 1e9) + "\n";
+        }
+    }
+
+    std::lock_guard lock(m_mutex);
+    for (const Value& value : m_values) {
+        appendHeader(out, value.name, value.help, value.type == Type::COUNTER ? "counter" : "gauge");
+        out += value.name + " " + formatNumber(value.read()) + "\n";
+    }
+    return out;
+}
+
+const char *Metrics::getName(Stage stage)
+{
+    return STAGES[static_cast<size_t>(stage)];
+}
+
+Metrics::Shard &Metrics::getShard()
+{
+    // Nearly every thread only ever records into one instance
+    thread_local uint64_t t_owner = 0;
+    thread_local Shard* t_shard = nullptr;
+    if (t_owner == m_id)
+        return *t_shard;
+
+    // The shards of every instance this thread recorded into, like the servers of a test run one after another
+    thread_local std::vector<std::pair<uint64_t, Shard*>> t_shards;
+    Shard* shard = nullptr;
+    for (auto [owner, known] : t_shards) {
+        if (owner == m_id)
+            shard = known;
+    }
+    if (!shard) {
+        shard = &addShard();
+        t_shards.emplace_back(m_id, shard);
+    }
+    t_owner = m_id;
+    t_shard = shard;
+    return *shard;
+}
+
+Metrics::Shard &Metrics::addShard()
+{
+    std::lock_guard lock(m_mutex);
+    m_shards.push_back(std::make_unique<Shard>());
+    return *m_shards.back();
+}
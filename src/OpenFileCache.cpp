@@ -0,0 +1,19 @@
+#include "OpenFileCache.h"
+
+std::optional<OpenFileCache::File> OpenFileCache::find(std::string_view urlPath)
+{
+    return m_files.find(urlPath, [](const File& file) { return file; });
+}
+
+void OpenFileCache::insert(const std::string &urlPath, File file, uint64_t generation)
+{
+    // Every entry holds a descriptor, so they're counted rather than sized
+    std::filesystem::path path = file.path;
+    m_files.insert(urlPath, path, std::move(file), 1, generation);
+}
+
+OpenFileCache::Stats OpenFileCache::getStats() const
+{
+    ClockCache<File>::Stats stats = m_files.getStats();
+    return Stats{stats.hits, stats.misses, stats.evictions, stats.invalidations, stats.entries};
+}
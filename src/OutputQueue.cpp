@@ -0,0 +1,176 @@
+#include "OutputQueue.h"
+#include <cerrno>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+namespace {
+    // How many written chunks may pile up at the front before they are erased
+    constexpr size_t COMPACT_AFTER = 64;
+}
+
+void OutputQueue::push(std::string data)
+{
+    if (data.empty())
+        return;
+    m_bytes += data.size();
+    m_chunks.push_back(Chunk{.data = std::move(data)});
+}
+
+void OutputQueue::push(std::shared_ptr<const std::string> data)
+{
+    if (!data || data->empty())
+        return;
+    m_bytes += data->size();
+    m_chunks.push_back(Chunk{.shared = std::move(data)});
+}
+
+void OutputQueue::push(FileBody file)
+{
+    if (file.length == 0)
+        return;
+    m_bytes += file.length;
+    m_chunks.push_back(Chunk{.file = std::move(file)});
+}
+
+void OutputQueue::pushFixed(std::string_view data)
+{
+    if (data.empty())
+        return;
+    m_bytes += data.size();
+    m_chunks.push_back(Chunk{.fixed = data});
+}
+
+void OutputQueue::push(HTTPResponse response)
+{
+    pushFixed(HTTPResponse::getStatusLine(response.getStatus()));
+    size_t offset = m_headers.size();
+    m_headers.append(HTTPResponse::getDateHeader());
+    // Cached and canned responses bring their own header fields and body, already serialized
+    bool serialized = response.getSerialized() || !response.getCanned().empty();
+    if (!serialized)
+        response.appendHeaders(m_headers);
+    m_bytes += m_headers.size() - offset;
+    m_chunks.push_back(Chunk{.headerOffset = offset, .headerSize = m_headers.size() - offset});
+    // Cached ones are sent straight from the shared buffer
+    if (response.getSerialized())
+        push(response.getSerialized());
+    else if (serialized)
+        pushFixed(response.getCanned());
+    else
+        push(response.releaseBody());
+    if (response.getFileBody())
+        push(*response.getFileBody());
+    for (HTTPResponse::BodyPart& part : response.releaseBodyParts()) {
+        push(std::move(part.data));
+        if (part.file)
+            push(std::move(*part.file));
+    }
+}
+
+std::string_view OutputQueue::remaining(const Chunk &chunk) const
+{
+    if (chunk.file)
+        return std::string_view();
+    if (chunk.shared)
+        return std::string_view(*chunk.shared).substr(chunk.sent);
+    if (chunk.headerOffset != NO_HEADERS)
+        return std::string_view(m_headers).substr(chunk.headerOffset + chunk.sent, chunk.headerSize - chunk.sent);
+    if (chunk.fixed.data())
+        return chunk.fixed.substr(chunk.sent);
+    return std::string_view(chunk.data).substr(chunk.sent);
+}
+
+void OutputQueue::clear()
+{
+    m_chunks.clear();
+    m_head = 0;
+    m_headers.clear();
+    m_bytes = 0;
+}
+
+void OutputQueue::consume(size_t bytes)
+{
+    m_bytes -= bytes;
+    while (bytes > 0) {
+        Chunk& chunk = m_chunks[m_head];
+        size_t left = chunk.size() - chunk.sent;
+        if (bytes < left) {
+            chunk.sent += bytes;
+            return;
+        }
+        bytes -= left;
+        chunk = Chunk();
+        m_head++;
+    }
+    if (empty())
+        clear();
+    else if (m_head >= COMPACT_AFTER && m_head * 2 >= m_chunks.size())
+        compact();
+}
+
+void OutputQueue::compact()
+{
+    // A client that never quite catches up never lets the queue drain, so drop what's written from the front
+    m_chunks.erase(m_chunks.begin(), m_chunks.begin() + m_head);
+    m_head = 0;
+    size_t firstHeader = m_headers.size();
+    for (const Chunk& chunk : m_chunks) {
+        if (chunk.headerOffset != NO_HEADERS) {
+            firstHeader = chunk.headerOffset;
+            break;
+        }
+    }
+    m_headers.erase(0, firstHeader);
+    for (Chunk& chunk : m_chunks) {
+        if (chunk.headerOffset != NO_HEADERS)
+            chunk.headerOffset -= firstHeader;
+    }
+}
+
+size_t OutputQueue::gather(iovec *iov, size_t maxCount) const
+{
+    size_t count = 0;
+    for (auto it = m_chunks.begin() + m_head; it != m_chunks.end() && !it->file && count < maxCount; ++it) {
+        std::string_view bytes = remaining(*it);
+        iov[count].iov_base = const_cast<char*>(bytes.data());
+        iov[count].iov_len = bytes.size();
+        count++;
+    }
+    return count;
+}
+
+OutputQueue::Status OutputQueue::flush(int socket)
+{
+    while (!empty()) {
+        const Chunk& chunk = front();
+        if (chunk.file) {
+            // The kernel copies straight from the page cache
+            off_t offset = chunk.file->offset + chunk.sent;
+            ssize_t sent = sendfile(socket, chunk.file->file->get(), &offset, chunk.size() - chunk.sent);
+            if (sent == -1)
+                return errno == EAGAIN || errno == EWOULDBLOCK ? Status::BLOCKED : Status::ERROR;
+            // The file was truncated underneath us, we can't fulfill the Content-Length we promised
+            if (sent == 0) {
+                errno = EIO;
+                return Status::ERROR;
+            }
+            consume(sent);
+            continue;
+        }
+
+        // Gather every memory chunk up to the next file chunk into one write
+        iovec iov[MAX_IOVECS];
+        size_t count = gather(iov, MAX_IOVECS);
+        msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        // MSG_MORE lets the kernel coalesce the headers with the file segment that follows
+        int flags = MSG_NOSIGNAL | (m_head + count < m_chunks.size() ? MSG_MORE : 0);
+        ssize_t sent = sendmsg(socket, &msg, flags);
+        if (sent == -1)
+            return errno == EAGAIN || errno == EWOULDBLOCK ? Status::BLOCKED : Status::ERROR;
+        consume(sent);
+    }
+    return Status::DRAINED;
+}
@@ -0,0 +1,36 @@
+#include "RequestLoop.h"
+#include "ResponseGenerator.h"
+
+void RequestLoop::queueResponse(Connection &conn, HTTPResponse response) const
+{
+    int status = static_cast<int>(response.getStatus());
+    m_metrics.addResponse(status);
+    size_t queued = conn.output.size();
+    {
+        Metrics::Span span(m_metrics, Metrics::Stage::SERIALIZE);
+        Tracer::Span trace("serialize");
+        conn.output.push(std::move(response));
+    }
+    if (conn.access.isPending())
+        conn.access.finish(status, conn.output.size() - queued);
+}
+
+void RequestLoop::takeAsyncResponse(Connection &conn) const
+{
+    queueResponse(conn, std::move(*conn.asyncResponse));
+    conn.asyncResponse.reset();
+    conn.stats.requests++;
+    if (conn.closeAfterAsync)
+        conn.closeWhenDrained = true;
+    conn.asyncState.store(Connection::AsyncState::IDLE, std::memory_order_release);
+}
+
+void RequestLoop::rejectRequest(Connection &conn, RequestParser::Result result) const
+{
+    Log::warning("Failed to parse HTTP request, fd=", conn.fd);
+    m_metrics.add(Metrics::Counter::PARSE_ERRORS);
+    if (Log::isAccessLogOpen())
+        conn.access.begin(conn.remoteAddress, "", "", "", "", "");
+    queueResponse(conn, ResponseGenerator::generateParseErrorResponse(result));
+    conn.closeWhenDrained = true;
+}
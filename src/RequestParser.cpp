@@ -0,0 +1,163 @@
+#include "RequestParser.h"
+#include <charconv>
+#include <cstring>
+#include <strings.h>
+#include "Parser.h"
+#include "Scanner.h"
+
+namespace {
+    bool isWhitespace(char c) {
+        return c == ' ' || c == '\t';
+    }
+}
+
+RequestParser::Result RequestParser::parse(std::string_view buf)
+{
+    if (m_state == State::DONE)
+        return m_result;
+
+    while (m_state != State::BODY) {
+        const void* newline = memchr(buf.data() + m_position, '\n', buf.size() - m_position);
+        if (!newline) {
+            m_position = buf.size();
+            if (m_position > m_limits.maxHeaderBytes)
+                return finish(Result::HEADERS_TOO_LARGE);
+            return Result::INCOMPLETE;
+        }
+        size_t end = static_cast<const char*>(newline) - buf.data();
+        if (end + 1 > m_limits.maxHeaderBytes)
+            return finish(Result::HEADERS_TOO_LARGE);
+
+        Span line{m_lineStart, end - m_lineStart};
+        if (line.length > 0 && buf[end - 1] == '\r')
+            line.length--;
+        m_position = m_lineStart = end + 1;
+
+        Result result = m_state == State::REQUEST_LINE ? parseRequestLine(buf, line) : parseHeaderLine(buf, line);
+        if (result != Result::INCOMPLETE)
+            return finish(result);
+    }
+
+    if (buf.size() < m_headerEnd + m_contentLength)
+        return Result::INCOMPLETE;
+    return finish(Result::COMPLETE);
+}
+
+std::optional<RequestView> RequestParser::getView(std::string_view buf) const
+{
+    if (m_result != Result::COMPLETE)
+        return std::nullopt;
+
+    RequestView view(m_method, m_target.in(buf), m_version.in(buf), buf.substr(m_headerEnd, m_contentLength));
+    for (const Header& header : m_headers) {
+        view.addHeader(header.name.in(buf), header.value.in(buf));
+    }
+    return view;
+}
+
+std::optional<HTTPRequest> RequestParser::getRequest(std::string_view buf) const
+{
+    auto view = getView(buf);
+    if (!view)
+        return std::nullopt;
+    return view->toRequest();
+}
+
+void RequestParser::reset()
+{
+    m_state = State::REQUEST_LINE;
+    m_result = Result::INCOMPLETE;
+    m_position = 0;
+    m_lineStart = 0;
+    m_headerEnd = 0;
+    m_contentLength = 0;
+    m_hasContentLength = false;
+    m_hasTransferEncoding = false;
+    m_method = HTTPRequest::Method::NONE;
+    m_headers.clear();
+}
+
+RequestParser::Result RequestParser::parseRequestLine(std::string_view buf, Span line)
+{
+    // Clients may send a stray blank line between requests, e.g. after a POST body
+    if (line.length == 0)
+        return Result::INCOMPLETE;
+
+    std::string_view text = line.in(buf);
+    size_t methodEnd = Scanner::findTokenEnd(text.data(), text.size());
+    if (methodEnd == 0 || methodEnd == text.size() || text[methodEnd] != ' ')
+        return Result::BAD_REQUEST;
+    size_t targetEnd = methodEnd + 1 + Scanner::findTargetEnd(text.data() + methodEnd + 1, text.size() - methodEnd - 1);
+    if (targetEnd == methodEnd + 1 || targetEnd == text.size() || text[targetEnd] != ' ')
+        return Result::BAD_REQUEST;
+    if (!text.substr(targetEnd + 1).starts_with("HTTP/"))
+        return Result::BAD_REQUEST;
+
+    auto method = Parser::getMethod(text.substr(0, methodEnd));
+    if (!method)
+        return Result::BAD_REQUEST;
+    m_method = *method;
+    m_target = Span{line.offset + methodEnd + 1, targetEnd - methodEnd - 1};
+    m_version = Span{line.offset + targetEnd + 1, text.size() - targetEnd - 1};
+    m_state = State::HEADERS;
+    return Result::INCOMPLETE;
+}
+
+RequestParser::Result RequestParser::parseHeaderLine(std::string_view buf, Span line)
+{
+    // A blank line ends the headers
+    if (line.length == 0) {
+        m_headerEnd = m_position;
+        // Framing a chunked body by its Content-Length, or not at all, would let what follows
+        // the headers be read as another request. A message with both is always refused (RFC 9112 6.1).
+        if (m_hasTransferEncoding)
+            return m_hasContentLength ? Result::BAD_REQUEST : Result::NOT_IMPLEMENTED;
+        if (m_contentLength > m_limits.maxBodyBytes)
+            return Result::BODY_TOO_LARGE;
+        m_state = State::BODY;
+        return Result::INCOMPLETE;
+    }
+    if (m_headers.size() >= m_limits.maxHeaderCount)
+        return Result::HEADERS_TOO_LARGE;
+
+    // The name has to run right up to the colon, whitespace before it isn't allowed
+    std::string_view text = line.in(buf);
+    size_t colon = Scanner::findTokenEnd(text.data(), text.size());
+    if (colon == 0 || colon == text.size() || text[colon] != ':')
+        return Result::BAD_REQUEST;
+    size_t valueStart = colon + 1;
+    size_t valueEnd = text.size();
+    if (Scanner::findValueEnd(text.data() + valueStart, valueEnd - valueStart) != valueEnd - valueStart)
+        return Result::BAD_REQUEST;
+    while (valueStart < valueEnd && isWhitespace(text[valueStart]))
+        valueStart++;
+    while (valueEnd > valueStart && isWhitespace(text[valueEnd - 1]))
+        valueEnd--;
+
+    Header header{Span{line.offset, colon}, Span{line.offset + valueStart, valueEnd - valueStart}};
+    if (header.name.length == 14 && strncasecmp(text.data(), "Content-Length", 14) == 0) {
+        std::string_view value = header.value.in(buf);
+        size_t contentLength = 0;
+        auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), contentLength);
+        if (error == std::errc::result_out_of_range)
+            return Result::BODY_TOO_LARGE;
+        if (error != std::errc() || end != value.data() + value.size() || value.empty())
+            return Result::BAD_REQUEST;
+        // Repeating the same length is harmless, two different ones leave the body's end in doubt
+        if (m_hasContentLength && contentLength != m_contentLength)
+            return Result::BAD_REQUEST;
+        m_contentLength = contentLength;
+        m_hasContentLength = true;
+    } else if (header.name.length == 17 && strncasecmp(text.data(), "Transfer-Encoding", 17) == 0) {
+        m_hasTransferEncoding = true;
+    }
+    m_headers.push_back(header);
+    return Result::INCOMPLETE;
+}
+
+RequestParser::Result RequestParser::finish(Result result)
+{
+    m_state = State::DONE;
+    m_result = result;
+    return result;
+}
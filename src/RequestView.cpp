@@ -0,0 +1,66 @@
+#include "RequestView.h"
+#include <algorithm>
+#include <strings.h>
+
+RequestView::RequestView(const HTTPRequest &request)
+    : RequestView(request.getMethod(), request.getRoute().native(), request.getVersion(), request.getBody())
+{
+    for (const auto& [name, value] : request.getAllHeaders()) {
+        addHeader(name, value);
+    }
+}
+
+std::optional<std::string_view> RequestView::getHeader(std::string_view name) const
+{
+    for (size_t i = 0; i < m_headerCount; i++) {
+        const Header& header = getHeaderAt(i);
+        if (header.name.size() == name.size() && strncasecmp(header.name.data(), name.data(), name.size()) == 0)
+            return header.value;
+    }
+    return std::nullopt;
+}
+
+bool RequestView::wantsClose() const
+{
+    auto connection = getHeader("Connection");
+    return connection && connection->size() == 5 && strncasecmp(connection->data(), "close", 5) == 0;
+}
+
+void RequestView::addHeader(std::string_view name, std::string_view value)
+{
+    if (m_headerCount < INLINE_HEADERS)
+        m_headers[m_headerCount] = Header{name, value};
+    else
+        m_extraHeaders.push_back(Header{name, value});
+    m_headerCount++;
+}
+
+std::optional<std::string_view> RequestView::getParam(std::string_view name) const
+{
+    for (size_t i = 0; i < m_paramCount; i++) {
+        if (m_params[i].name == name)
+            return m_params[i].value;
+    }
+    return std::nullopt;
+}
+
+void RequestView::setParams(const Param *params, size_t count)
+{
+    m_paramCount = std::min(count, MAX_PARAMS);
+    std::copy(params, params + m_paramCount, m_params.begin());
+}
+
+HTTPRequest RequestView::toRequest() const
+{
+    std::unordered_map<std::string, std::string> headers;
+    for (size_t i = 0; i < m_headerCount; i++) {
+        const Header& header = getHeaderAt(i);
+        headers.emplace(header.name, header.value);
+    }
+    HTTPRequest request(m_method, Route(std::string(m_route)), std::string(m_version), std::move(headers));
+    if (!m_body.empty())
+        request.setBody(std::string(m_body));
+    for (size_t i = 0; i < m_paramCount; i++)
+        request.setParam(std::string(m_params[i].name), std::string(m_params[i].value));
+    return request;
+}
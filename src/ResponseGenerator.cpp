@@ -1,75 +1,283 @@
 #include "ResponseGenerator.h"
-#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cinttypes>
+#include <cstdio>
+#include <deque>
+#include <fcntl.h>
+#include <mutex>
+#include <strings.h>
+#include <sys/stat.h>
+
+HTTPResponse ResponseGenerator::makeCannedResponse(HTTPResponse::Status status, const std::string &contentType, const std::string &body)
+{
+    // Never freed, every canned response may still be referenced. A deque never moves what it holds.
+    static std::deque<std::string> buffers;
+    static std::mutex buffersMutex;
+
+    HTTPResponse response(status, {{"Content-Type", contentType}});
+    response.setBody(body);
+    std::string serialized;
+    response.appendHeaders(serialized);
+    serialized += body;
+
+    std::lock_guard<std::mutex> lock(buffersMutex);
+    return HTTPResponse::fromCanned(status, buffers.emplace_back(std::move(serialized)));
+}
 
 HTTPResponse ResponseGenerator::generateNotFoundResponse()
 {
-    std::string message = "404 Not Found";
-    std::unordered_map<std::string, std::string> headers = {
-        {"Content-Type", "text/plain"}
-    };
-    HTTPResponse response(HTTPResponse::Status::NOT_FOUND, std::move(headers));
-    response.setBody(message);
+    static const HTTPResponse response = makeCannedResponse(HTTPResponse::Status::NOT_FOUND, "text/plain", "404 Not Found");
     return response;
 }
 
 HTTPResponse ResponseGenerator::generateBadRequestResponse()
 {
-    std::string message = "400 Bad Request";
-    std::unordered_map<std::string, std::string> headers = {
-        {"Content-Type", "text/plain"}
-    };
-    HTTPResponse response(HTTPResponse::Status::BAD_REQUEST, std::move(headers));
-    response.setBody(message);
+    static const HTTPResponse response = makeCannedResponse(HTTPResponse::Status::BAD_REQUEST, "text/plain", "400 Bad Request");
     return response;
 }
 
 HTTPResponse ResponseGenerator::generateForbiddenResponse()
 {
-    std::string message = "403 Forbidden";
-    std::unordered_map<std::string, std::string> headers = {
-        {"Content-Type", "text/plain"}
-    };
-    HTTPResponse response(HTTPResponse::Status::FORBIDDEN, std::move(headers));
-    response.setBody(message);
+    static const HTTPResponse response = makeCannedResponse(HTTPResponse::Status::FORBIDDEN, "text/plain", "403 Forbidden");
     return response;
 }
 
 HTTPResponse ResponseGenerator::generateInternalServerErrorResponse()
 {
-    std::string message = "500 Internal Server Error";
-    std::unordered_map<std::string, std::string> headers = {
-        {"Content-Type", "text/plain"}
-    };
-    HTTPResponse response(HTTPResponse::Status::INTERNAL_SERVER_ERROR, std::move(headers));
-    response.setBody(message);
+    static const HTTPResponse response = makeCannedResponse(HTTPResponse::Status::INTERNAL_SERVER_ERROR, "text/plain", "500 Internal Server Error");
     return response;
 }
 
 HTTPResponse ResponseGenerator::generateNotImplementedResponse()
 {
-    std::string message = "501 Not Implemented";
-    std::unordered_map<std::string, std::string> headers = {
-        {"Content-Type", "text/plain"}
-    };
-    HTTPResponse response(HTTPResponse::Status::NOT_IMPLEMENTED, std::move(headers));
-    response.setBody(message);
+    static const HTTPResponse response = makeCannedResponse(HTTPResponse::Status::NOT_IMPLEMENTED, "text/plain", "501 Not Implemented");
+    return response;
+}
+
+HTTPResponse ResponseGenerator::generatePayloadTooLargeResponse()
+{
+    static const HTTPResponse response = makeCannedResponse(HTTPResponse::Status::PAYLOAD_TOO_LARGE, "text/plain", "413 Payload Too Large");
+    return response;
+}
+
+HTTPResponse ResponseGenerator::generateHeaderFieldsTooLargeResponse()
+{
+    static const HTTPResponse response = makeCannedResponse(HTTPResponse::Status::REQUEST_HEADER_FIELDS_TOO_LARGE, "text/plain", "431 Request Header Fields Too Large");
     return response;
 }
 
+HTTPResponse ResponseGenerator::generateParseErrorResponse(RequestParser::Result result)
+{
+    switch (result) {
+        case RequestParser::Result::HEADERS_TOO_LARGE: return generateHeaderFieldsTooLargeResponse();
+        case RequestParser::Result::BODY_TOO_LARGE: return generatePayloadTooLargeResponse();
+        case RequestParser::Result::NOT_IMPLEMENTED: return generateNotImplementedResponse();
+        default: return generateBadRequestResponse();
+    }
+}
+
 HTTPResponse ResponseGenerator::generateFileResponse(const std::filesystem::path &filePath)
 {
-    // Right now, this is sort of slow. We copy file contents into memory and then copy from 
-    // there into the response body. Then we copy from the response body into the socket buffer.
-    // For large files, we should consider using sendfile or
-    // memory-mapped files to avoid extra copies.
-    std::ifstream file(filePath, std::ios::binary);
-    std::string fileContent((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    // The file is never read into memory. The response holds the open descriptor and the
+    // server sends it straight from the page cache with sendfile() after the headers.
+    int fd = open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return generateNotFoundResponse();
+    auto file = std::make_shared<FileHandle>(fd);
 
+    struct stat info;
+    if (fstat(fd, &info) == -1 || !S_ISREG(info.st_mode))
+        return generateNotFoundResponse();
+    return generateFileResponse(filePath, std::move(file), info);
+}
+
+HTTPResponse ResponseGenerator::generateFileResponse(const std::filesystem::path &filePath, std::shared_ptr<FileHandle> file, const struct stat &info)
+{
+    // Any change to the file, or a different file put in its place, changes the tag
+    char etag[64];
+    snprintf(etag, sizeof(etag), "\"%" PRIx64 "-%" PRIx64 "-%" PRIx64 "\"", static_cast<uint64_t>(info.st_ino),
+        static_cast<uint64_t>(info.st_size), static_cast<uint64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec);
     std::unordered_map<std::string, std::string> headers = {
-        {"Content-Type", getContentType(filePath)}
+        {"Content-Type", getContentType(filePath)},
+        {"ETag", etag},
+        {"Last-Modified", HTTPResponse::formatDate(info.st_mtim.tv_sec)},
+        {"Accept-Ranges", "bytes"}
     };
     HTTPResponse response(HTTPResponse::Status::OK, std::move(headers));
-    response.setBody(fileContent);
+    response.setFileBody(FileBody{std::move(file), 0, static_cast<size_t>(info.st_size)});
+    return response;
+}
+
+bool ResponseGenerator::isNotModified(const Conditions &conditions, std::string_view etag, std::string_view lastModified)
+{
+    // A weak comparison, "W/" only says the server doesn't promise byte for byte equality
+    auto opaque = [](std::string_view tag) { return tag.starts_with("W/") ? tag.substr(2) : tag; };
+    if (conditions.ifNoneMatch) {
+        if (etag.empty())
+            return false;
+        std::string_view list = *conditions.ifNoneMatch;
+        while (!list.empty()) {
+            size_t comma = std::min(list.find(','), list.size());
+            std::string_view tag = list.substr(0, comma);
+            list.remove_prefix(std::min(comma + 1, list.size()));
+            while (!tag.empty() && (tag.front() == ' ' || tag.front() == '\t'))
+                tag.remove_prefix(1);
+            while (!tag.empty() && (tag.back() == ' ' || tag.back() == '\t'))
+                tag.remove_suffix(1);
+            if (tag == "*" || opaque(tag) == opaque(etag))
+                return true;
+        }
+        return false;
+    }
+    if (conditions.ifModifiedSince && !lastModified.empty()) {
+        std::optional<time_t> since = HTTPResponse::parseDate(*conditions.ifModifiedSince);
+        std::optional<time_t> modified = HTTPResponse::parseDate(lastModified);
+        return since && modified && *modified <= *since;
+    }
+    return false;
+}
+
+HTTPResponse ResponseGenerator::generateNotModifiedResponse(const HTTPResponse &full)
+{
+    HTTPResponse response(HTTPResponse::Status::NOT_MODIFIED, std::unordered_map<std::string, std::string>());
+    for (const char* name : {"ETag", "Last-Modified", "Cache-Control", "Vary"}) {
+        if (auto value = full.getHeader(name))
+            response.setHeader(name, *value);
+    }
+    return response;
+}
+
+std::optional<std::vector<ResponseGenerator::ByteRange>> ResponseGenerator::parseRange(std::string_view header, size_t length)
+{
+    constexpr std::string_view UNIT = "bytes=";
+    if (header.size() < UNIT.size() || strncasecmp(header.data(), UNIT.data(), UNIT.size()) != 0)
+        return std::nullopt;
+    header.remove_prefix(UNIT.size());
+
+    auto parseNumber = [](std::string_view text) -> std::optional<size_t> {
+        size_t value = 0;
+        auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+        if (text.empty() || error != std::errc() || end != text.data() + text.size())
+            return std::nullopt;
+        return value;
+    };
+
+    std::vector<ByteRange> ranges;
+    size_t specs = 0;
+    while (!header.empty()) {
+        size_t comma = std::min(header.find(','), header.size());
+        std::string_view spec = header.substr(0, comma);
+        header.remove_prefix(std::min(comma + 1, header.size()));
+        while (!spec.empty() && (spec.front() == ' ' || spec.front() == '\t'))
+            spec.remove_prefix(1);
+        while (!spec.empty() && (spec.back() == ' ' || spec.back() == '\t'))
+            spec.remove_suffix(1);
+        // Empty list elements are allowed, "bytes=0-1,,5-6"
+        if (spec.empty())
+            continue;
+        if (++specs > MAX_RANGES)
+            return std::nullopt;
+
+        size_t dash = spec.find('-');
+        if (dash == std::string_view::npos)
+            return std::nullopt;
+        std::optional<size_t> first, last;
+        if (dash > 0 && !(first = parseNumber(spec.substr(0, dash))))
+            return std::nullopt;
+        if (dash + 1 < spec.size() && !(last = parseNumber(spec.substr(dash + 1))))
+            return std::nullopt;
+        if (!first && !last)
+            return std::nullopt;
+
+        if (!first) {
+            // "-500" is the last 500 bytes
+            if (*last == 0 || length == 0)
+                continue;
+            ranges.push_back(ByteRange{length - std::min(*last, length), length - 1});
+            continue;
+        }
+        if (last && *last < *first)
+            return std::nullopt;
+        if (*first >= length)
+            continue;
+        ranges.push_back(ByteRange{*first, std::min(last.value_or(length - 1), length - 1)});
+    }
+    if (specs == 0)
+        return std::nullopt;
+
+    // Overlapping ranges would only make us send the same bytes again
+    std::sort(ranges.begin(), ranges.end(), [](const ByteRange& a, const ByteRange& b) { return a.first < b.first; });
+    std::vector<ByteRange> merged;
+    for (const ByteRange& range : ranges) {
+        if (!merged.empty() && range.first <= merged.back().last + 1)
+            merged.back().last = std::max(merged.back().last, range.last);
+        else
+            merged.push_back(range);
+    }
+    return merged;
+}
+
+HTTPResponse ResponseGenerator::generateRangeResponse(const HTTPResponse &full, std::string_view range, std::optional<std::string_view> ifRange)
+{
+    const std::optional<FileBody>& body = full.getFileBody();
+    if (!body || full.getStatus() != HTTPResponse::Status::OK)
+        return full;
+    // The client's partial copy is only usable if it's of the same file, else it needs all of it
+    if (ifRange) {
+        std::optional<std::string> etag = full.getHeader("ETag");
+        std::optional<std::string> lastModified = full.getHeader("Last-Modified");
+        bool current = ifRange->starts_with('"') ? etag && *etag == *ifRange : lastModified && *lastModified == *ifRange;
+        if (!current)
+            return full;
+    }
+    std::optional<std::vector<ByteRange>> ranges = parseRange(range, body->length);
+    if (!ranges)
+        return full;
+
+    std::string total = std::to_string(body->length);
+    if (ranges->empty()) {
+        HTTPResponse response(HTTPResponse::Status::RANGE_NOT_SATISFIABLE, {{"Content-Range", "bytes */" + total}});
+        response.setBody("");
+        return response;
+    }
+
+    HTTPResponse response(HTTPResponse::Status::PARTIAL_CONTENT, std::unordered_map<std::string, std::string>());
+    for (const char* name : {"ETag", "Last-Modified", "Cache-Control", "Vary", "Accept-Ranges"}) {
+        if (auto value = full.getHeader(name))
+            response.setHeader(name, *value);
+    }
+    auto region = [&body](const ByteRange& range) {
+        return FileBody{body->file, body->offset + static_cast<off_t>(range.first), range.last - range.first + 1};
+    };
+    auto contentRange = [&total](const ByteRange& range) {
+        return "bytes " + std::to_string(range.first) + "-" + std::to_string(range.last) + "/" + total;
+    };
+    std::string contentType = full.getHeader("Content-Type").value_or("application/octet-stream");
+
+    if (ranges->size() == 1) {
+        response.setHeader("Content-Type", contentType);
+        response.setHeader("Content-Range", contentRange(ranges->front()));
+        response.setFileBody(region(ranges->front()));
+        return response;
+    }
+
+    // Only has to be unlikely to show up in the file, a counter is enough
+    static std::atomic<uint64_t> counter{0};
+    char boundary[40];
+    snprintf(boundary, sizeof(boundary), "MYHTTP_BYTERANGES_%016" PRIx64, counter.fetch_add(1, std::memory_order_relaxed));
+    std::vector<HTTPResponse::BodyPart> parts;
+    parts.reserve(ranges->size() + 1);
+    for (const ByteRange& range : *ranges) {
+        std::string header = parts.empty() ? "--" : "\r\n--";
+        header.append(boundary).append("\r\nContent-Type: ").append(contentType);
+        header.append("\r\nContent-Range: ").append(contentRange(range)).append("\r\n\r\n");
+        parts.push_back(HTTPResponse::BodyPart{std::move(header), region(range)});
+    }
+    parts.push_back(HTTPResponse::BodyPart{std::string("\r\n--").append(boundary).append("--\r\n"), std::nullopt});
+    response.setHeader("Content-Type", std::string("multipart/byteranges; boundary=") + boundary);
+    response.setBodyParts(std::move(parts));
     return response;
 }
 
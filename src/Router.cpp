@@ -1,53 +1,355 @@
 #include "Router.h"
 #include "ResponseGenerator.h"
+#include <algorithm>
 #include <fstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 void Router::addRoute(Route route, int method, Handler handler)
 {
-    m_routes[route].push_back(std::make_pair(method, handler));
+    addRoute(std::move(route), method, [handler = std::move(handler)](const RequestView& request) {
+        return handler(request.toRequest());
+    });
 }
 
-std::optional<Handler> Router::getHandler(const Route &route, HTTPRequest::Method method) const
+void Router::addRoute(Route route, int method, ViewHandler handler)
 {
-    auto it = m_routes.find(route);
-    if (it == m_routes.end()) return std::nullopt;
-    for (const auto &pair : it->second) {
-        if (pair.first == method) return pair.second;
+    addEndpoint(std::move(route), method, Endpoint{std::move(handler), nullptr});
+}
+
+void Router::addAsyncRoute(Route route, int method, AsyncHandler handler)
+{
+    addEndpoint(std::move(route), method, Endpoint{nullptr, std::move(handler)});
+}
+
+void Router::addEndpoint(Route route, int method, Endpoint endpoint)
+{
+    std::string pattern = route.string();
+    // Parameters take up a whole segment, anywhere else ':' and '*' are literal
+    auto startsParam = [&pattern](size_t i) {
+        return (pattern[i] == ':' || pattern[i] == '*') && i > 0 && pattern[i - 1] == '/';
+    };
+
+    // Split the route into literal text and parameters (with their ':' or '*'), checking all of it before the tree is touched
+    std::vector<std::pair<std::string_view, bool>> pieces;
+    size_t params = 0;
+    size_t position = 0;
+    while (position < pattern.size()) {
+        size_t end = position;
+        bool param = startsParam(position);
+        if (param) {
+            end = pattern[position] == '*' ? pattern.size() : std::min(pattern.find('/', position), pattern.size());
+            std::string_view name = std::string_view(pattern).substr(position + 1, end - position - 1);
+            if (name.empty())
+                throw std::runtime_error("Route " + pattern + " has a parameter without a name");
+            if (pattern[position] == '*' && name.find('/') != std::string_view::npos)
+                throw std::runtime_error("Route " + pattern + " has a wildcard that isn't the last segment");
+            if (++params > RequestView::MAX_PARAMS)
+                throw std::runtime_error("Route " + pattern + " has more than " + std::to_string(RequestView::MAX_PARAMS) + " parameters");
+        } else {
+            while (end < pattern.size() && !startsParam(end))
+                end++;
+        }
+        pieces.emplace_back(std::string_view(pattern).substr(position, end - position), param);
+        position = end;
     }
-    return std::nullopt;
+
+    Node* node = m_root.get();
+    for (auto [piece, param] : pieces) {
+        if (!param) {
+            node = insertLiteral(node, piece);
+            continue;
+        }
+        std::unique_ptr<Node>& child = piece[0] == '*' ? node->wildcard : node->param;
+        std::string name(piece.substr(1));
+        if (!child) {
+            child = std::make_unique<Node>();
+            child->name = name;
+        } else if (child->name != name) {
+            throw std::runtime_error("Route " + pattern + " names a parameter " + name + " where another route has " + child->name);
+        }
+        node = child.get();
+    }
+    node->handlers.push_back(std::make_pair(method, std::move(endpoint)));
+}
+
+Router::Node *Router::insertLiteral(Node *node, std::string_view text)
+{
+    while (!text.empty()) {
+        size_t index = node->firstChars.find(text[0]);
+        if (index == std::string::npos) {
+            auto child = std::make_unique<Node>();
+            child->prefix = text;
+            node->firstChars.push_back(text[0]);
+            node->children.push_back(std::move(child));
+            return node->children.back().get();
+        }
+
+        std::unique_ptr<Node>& child = node->children[index];
+        size_t common = 0;
+        while (common < text.size() && common < child->prefix.size() && text[common] == child->prefix[common])
+            common++;
+        // Split the child where the new text parts from it
+        if (common < child->prefix.size()) {
+            auto split = std::make_unique<Node>();
+            split->prefix = child->prefix.substr(0, common);
+            child->prefix.erase(0, common);
+            split->firstChars.push_back(child->prefix[0]);
+            split->children.push_back(std::move(child));
+            child = std::move(split);
+        }
+        node = child.get();
+        text.remove_prefix(common);
+    }
+    return node;
+}
+
+const ViewHandler *Router::getHandler(std::string_view route, HTTPRequest::Method method) const
+{
+    Match found;
+    const Endpoint* endpoint = match(m_root.get(), route.substr(0, route.find('?')), method, found);
+    return endpoint && endpoint->handler ? &endpoint->handler : nullptr;
+}
+
+const ViewHandler *Router::getHandler(RequestView &request) const
+{
+    const Endpoint* endpoint = getEndpoint(request);
+    return endpoint && endpoint->handler ? &endpoint->handler : nullptr;
+}
+
+const Router::Endpoint *Router::getEndpoint(RequestView &request) const
+{
+    std::string_view route = request.getRoute();
+    Match found;
+    const Endpoint* endpoint = match(m_root.get(), route.substr(0, route.find('?')), request.getMethod(), found);
+    if (endpoint)
+        request.setParams(found.params.data(), found.paramCount);
+    return endpoint;
+}
+
+const Router::Endpoint *Router::match(const Node *node, std::string_view path, HTTPRequest::Method method, Match &found)
+{
+    if (path.empty()) {
+        if (const Endpoint* endpoint = findEndpoint(node, method))
+            return endpoint;
+    } else {
+        // Literal text first, then a parameter, backing out of whichever doesn't lead to a handler
+        size_t index = node->firstChars.find(path[0]);
+        if (index != std::string::npos) {
+            const Node* child = node->children[index].get();
+            if (path.starts_with(child->prefix)) {
+                if (const Endpoint* endpoint = match(child, path.substr(child->prefix.size()), method, found))
+                    return endpoint;
+            }
+        }
+        size_t end = std::min(path.find('/'), path.size());
+        if (node->param && end > 0) {
+            found.params[found.paramCount++] = RequestView::Param{node->param->name, path.substr(0, end)};
+            if (const Endpoint* endpoint = match(node->param.get(), path.substr(end), method, found))
+                return endpoint;
+            found.paramCount--;
+        }
+    }
+
+    if (node->wildcard) {
+        if (const Endpoint* endpoint = findEndpoint(node->wildcard.get(), method)) {
+            found.params[found.paramCount++] = RequestView::Param{node->wildcard->name, path};
+            return endpoint;
+        }
+    }
+    return nullptr;
+}
+
+const Router::Endpoint *Router::findEndpoint(const Node *node, HTTPRequest::Method method)
+{
+    for (const auto &pair : node->handlers) {
+        if (pair.first & method) return &pair.second;
+    }
+    return nullptr;
 }
 
 std::optional<HTTPResponse> Router::getStaticFile(const HTTPRequest &request) const
 {
-    if (request.getMethod() != HTTPRequest::Method::GET)
+    return getStaticFile(request.getMethod(), request.getRoute().native());
+}
+
+void Router::setCacheControl(const std::string &prefix, const std::string &value)
+{
+    auto it = std::find_if(m_cacheControl.begin(), m_cacheControl.end(), [&prefix](const auto& pair) { return pair.first == prefix; });
+    if (it != m_cacheControl.end()) {
+        it->second = value;
+        return;
+    }
+    it = std::find_if(m_cacheControl.begin(), m_cacheControl.end(), [&prefix](const auto& pair) { return pair.first.size() < prefix.size(); });
+    m_cacheControl.insert(it, std::make_pair(prefix, value));
+}
+
+std::optional<HTTPResponse> Router::getStaticFile(HTTPRequest::Method method, std::string_view route, int acceptedEncodings,
+                                                  const ResponseGenerator::Conditions &conditions) const
+{
+    if (method != HTTPRequest::Method::GET)
         return std::nullopt;
-    Route route = request.getRoute();
 
-    // Add leading "/" so its consistent
-    std::string urlPath = route.string();
-    if (!urlPath.empty() && urlPath.front() != '/')
-        urlPath.insert(0, "/");   
-    
-    std::filesystem::path fullPath = m_rootDir.string() + urlPath;
+    // Add leading "/" so its consistent. Requests nearly always have one already, so this rarely copies
+    std::string prefixed;
+    std::string_view urlPath = route;
+    if (!urlPath.empty() && urlPath.front() != '/') {
+        prefixed = "/" + std::string(route);
+        urlPath = prefixed;
+    }
 
-    // Security check: canonical must start with rootDir
-    std::filesystem::path canonical = std::filesystem::weakly_canonical(fullPath);
-    if (canonical.string().rfind(m_rootDir.string(), 0) != 0) {
-        return ResponseGenerator::generateForbiddenResponse();
+    // Ranges are of the file itself, a compressed copy is never split up
+    if (conditions.range)
+        acceptedEncodings = Compression::IDENTITY;
+    // The content type goes by the extension, so whether it's worth compressing is known before touching the disk
+    if (acceptedEncodings != Compression::IDENTITY && m_compression.enabled) {
+        std::string_view name = urlPath.ends_with('/') ? std::string_view("index.html") : urlPath.substr(urlPath.rfind('/') + 1);
+        size_t dot = name.rfind('.');
+        // Extensions are short enough that the lookup key doesn't allocate
+        auto type = dot == std::string_view::npos ? ResponseGenerator::MIME_TYPES.end() : ResponseGenerator::MIME_TYPES.find(std::string(name.substr(dot)));
+        if (type == ResponseGenerator::MIME_TYPES.end() || !Compression::isCompressible(type->second, m_compression))
+            acceptedEncodings = Compression::IDENTITY;
+    } else {
+        acceptedEncodings = Compression::IDENTITY;
+    }
+    // Whatever a set of accepted encodings is answered with gets cached under that set, compressed or not.
+    // Not under the preferred one, a gzip sidecar sent to "br, gzip" must not reach a client that only takes br.
+    std::string variantKey;
+    std::string_view key = urlPath;
+    if (acceptedEncodings != Compression::IDENTITY) {
+        // A newline can't be part of a requested path
+        variantKey = std::string(urlPath) + "\n";
+        for (Compression::Encoding encoding : {Compression::BROTLI, Compression::GZIP}) {
+            if (acceptedEncodings & encoding)
+                variantKey.append(Compression::getName(encoding)).append(",");
+        }
+        key = variantKey;
     }
 
-    // Handle directory requests
-    if (std::filesystem::is_directory(canonical)) {
-        // Fixes bugs where the client doesn't realize it's a directory
-        if (!urlPath.empty() && urlPath.back() != '/')
-            return ResponseGenerator::generateRedirectResponse(urlPath + "/");
-        canonical.concat("/index.html");
+    // Hits skip all of the path resolution below, the URL was already checked when it was cached. A cached
+    // response is one serialized buffer, so ranges are cut from the file instead.
+    if (!conditions.range) {
+        if (auto cached = m_cache.find(key, conditions))
+            return cached;
+    }
+    uint64_t generation = m_cache.getGeneration();
+
+    bool forbidden = false;
+    std::optional<OpenFileCache::File> file = resolveFile(urlPath, forbidden);
+    if (forbidden)
+        return ResponseGenerator::generateForbiddenResponse();
+    if (!file)
+        return std::nullopt;
+    // Fixes bugs where the client doesn't realize it's a directory
+    if (file->redirect)
+        return ResponseGenerator::generateRedirectResponse(std::string(urlPath) + "/");
+    const std::filesystem::path& canonical = file->path;
+
+    HTTPResponse response = ResponseGenerator::generateFileResponse(canonical, file->file, file->info);
+    if (acceptedEncodings != Compression::IDENTITY && response.getStatus() == HTTPResponse::Status::OK) {
+        response.setHeader("Vary", "Accept-Encoding");
+        if (auto encoded = getEncodedFile(canonical, response, file->info, acceptedEncodings))
+            response = std::move(*encoded);
     }
+    if (response.getStatus() == HTTPResponse::Status::OK) {
+        for (const auto& [prefix, value] : m_cacheControl) {
+            if (urlPath.starts_with(prefix)) {
+                response.setHeader("Cache-Control", value);
+                break;
+            }
+        }
+    }
+    m_cache.insert(std::string(key), canonical, response, generation);
+    if (response.getStatus() == HTTPResponse::Status::OK && (conditions.ifNoneMatch || conditions.ifModifiedSince) &&
+        ResponseGenerator::isNotModified(conditions, response.getHeader("ETag").value_or(""), response.getHeader("Last-Modified").value_or("")))
+        return ResponseGenerator::generateNotModifiedResponse(response);
+    if (conditions.range)
+        return ResponseGenerator::generateRangeResponse(response, *conditions.range, conditions.ifRange);
+    return response;
+}
+
+std::optional<OpenFileCache::File> Router::resolveFile(std::string_view urlPath, bool &forbidden) const
+{
+    OpenFileCache& files = m_cache.getOpenFiles();
+    if (auto cached = files.find(urlPath))
+        return cached;
+    uint64_t generation = files.getGeneration();
+
+    std::filesystem::path fullPath = m_rootDir.string() + std::string(urlPath);
 
-    // Check if file exists
-    if (!std::filesystem::exists(canonical)) {
+    // Security check: canonical must start with rootDir
+    OpenFileCache::File file;
+    file.path = std::filesystem::weakly_canonical(fullPath);
+    if (file.path.string().rfind(m_rootDir.string(), 0) != 0) {
+        forbidden = true;
         return std::nullopt;
     }
 
-    return ResponseGenerator::generateFileResponse(canonical);
+    // Handle directory requests
+    if (std::filesystem::is_directory(file.path)) {
+        file.redirect = !urlPath.empty() && urlPath.back() != '/';
+        if (!file.redirect)
+            file.path.concat("/index.html");
+    }
+    if (!file.redirect) {
+        int fd = open(file.path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            return std::nullopt;
+        file.file = std::make_shared<FileHandle>(fd);
+        if (fstat(fd, &file.info) == -1 || !S_ISREG(file.info.st_mode))
+            return std::nullopt;
+    }
+    files.insert(std::string(urlPath), file, generation);
+    return file;
+}
+
+std::optional<HTTPResponse> Router::getEncodedFile(const std::filesystem::path &filePath, const HTTPResponse &response,
+                                                   const struct stat &original, int acceptedEncodings) const
+{
+    const FileBody& body = *response.getFileBody();
+    std::string contentType = response.getHeader("Content-Type").value_or("application/octet-stream");
+
+    for (Compression::Encoding encoding : {Compression::BROTLI, Compression::GZIP}) {
+        if (!(acceptedEncodings & encoding))
+            continue;
+
+        // A sidecar written by the build is usually smaller than what we'd make, but only if it's not older than the file
+        std::filesystem::path sidecar = filePath;
+        sidecar += Compression::getSuffix(encoding);
+        struct stat info;
+        if (stat(sidecar.c_str(), &info) == 0 && S_ISREG(info.st_mode) && info.st_mtim.tv_sec >= original.st_mtim.tv_sec) {
+            HTTPResponse encoded = ResponseGenerator::generateFileResponse(sidecar);
+            if (encoded.getStatus() == HTTPResponse::Status::OK) {
+                encoded.setHeader("Content-Type", contentType);
+                encoded.setHeader("Content-Encoding", std::string(Compression::getName(encoding)));
+                encoded.setHeader("Vary", "Accept-Encoding");
+                return encoded;
+            }
+        }
+
+        // Otherwise compress it ourselves, but only if the cache keeps the result, so it's done once per file
+        if (!(Compression::getAvailable() & encoding) || body.length < m_compression.minSize || body.length > m_cache.getMaxEntryBytes())
+            continue;
+        std::string contents(body.length, '\0');
+        size_t done = 0;
+        while (done < body.length) {
+            ssize_t n = pread(body.file->get(), contents.data() + done, body.length - done, body.offset + done);
+            if (n <= 0)
+                return std::nullopt;
+            done += n;
+        }
+        HTTPResponse encoded(HTTPResponse::Status::OK, {{"Content-Type", contentType}});
+        encoded.setBody(std::move(contents));
+        if (Compression::compressResponse(encoded, encoding, m_compression)) {
+            // Made from the file, so it changes with it, but its tag can't be the same as the uncompressed one's
+            std::string etag = response.getHeader("ETag").value_or("\"\"");
+            etag.insert(etag.size() - 1, "-" + std::string(Compression::getName(encoding)));
+            encoded.setHeader("ETag", etag);
+            if (auto lastModified = response.getHeader("Last-Modified"))
+                encoded.setHeader("Last-Modified", *lastModified);
+            return encoded;
+        }
+    }
+    return std::nullopt;
 }
@@ -0,0 +1,231 @@
+#include "Scanner.h"
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCANNER_X86 1
+#endif
+
+namespace {
+    constexpr bool isTokenChar(unsigned char c) {
+        if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
+            return true;
+        for (char symbol : std::string_view("!#$%&'*+-.^_`|~")) {
+            if (c == static_cast<unsigned char>(symbol))
+                return true;
+        }
+        return false;
+    }
+
+    constexpr std::array<bool, 256> TOKEN_CHARS = [] {
+        std::array<bool, 256> table{};
+        for (int c = 0; c < 256; c++)
+            table[c] = isTokenChar(c);
+        return table;
+    }();
+
+    size_t findTokenEndScalar(const char* data, size_t size) {
+        for (size_t i = 0; i < size; i++) {
+            if (!TOKEN_CHARS[static_cast<unsigned char>(data[i])])
+                return i;
+        }
+        return size;
+    }
+
+    size_t findTargetEndScalar(const char* data, size_t size) {
+        for (size_t i = 0; i < size; i++) {
+            unsigned char c = data[i];
+            if (c <= ' ' || c >= 0x7f)
+                return i;
+        }
+        return size;
+    }
+
+    size_t findValueEndScalar(const char* data, size_t size) {
+        for (size_t i = 0; i < size; i++) {
+            unsigned char c = data[i];
+            if ((c < ' ' && c != '\t') || c == 0x7f)
+                return i;
+        }
+        return size;
+    }
+
+#ifdef SCANNER_X86
+    // SSE4.2 can test 16 bytes against up to 8 byte ranges in one instruction. The kernels
+    // below list the ranges that stop a scan, and fall back to scalar code for the tail.
+    constexpr int RANGE_FLAGS = _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT;
+
+    __attribute__((target("sse4.2")))
+    size_t findTokenEndSse42(const char* data, size_t size) {
+        // Every non-token byte falls in one of these. '|' and '~' don't fit in 8 ranges, so they
+        // stop the scan too and are let through by the table.
+        static const char ranges[16] = {'\0', ' ', '"', '"', '(', ')', ',', ',', '/', '/', ':', '@', '[', ']', '{', '\xff'};
+        const __m128i stop = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ranges));
+        size_t i = 0;
+        while (i + 16 <= size) {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            int index = _mm_cmpestri(stop, 16, bytes, 16, RANGE_FLAGS);
+            if (index == 16) {
+                i += 16;
+                continue;
+            }
+            if (!TOKEN_CHARS[static_cast<unsigned char>(data[i + index])])
+                return i + index;
+            i += index + 1;
+        }
+        return i + findTokenEndScalar(data + i, size - i);
+    }
+
+    __attribute__((target("sse4.2")))
+    size_t findTargetEndSse42(const char* data, size_t size) {
+        static const char ranges[16] = {'\0', ' ', '\x7f', '\xff'};
+        const __m128i stop = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ranges));
+        size_t i = 0;
+        for (; i + 16 <= size; i += 16) {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            int index = _mm_cmpestri(stop, 4, bytes, 16, RANGE_FLAGS);
+            if (index != 16)
+                return i + index;
+        }
+        return i + findTargetEndScalar(data + i, size - i);
+    }
+
+    __attribute__((target("sse4.2")))
+    size_t findValueEndSse42(const char* data, size_t size) {
+        static const char ranges[16] = {'\0', '\x08', '\x0a', '\x1f', '\x7f', '\x7f'};
+        const __m128i stop = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ranges));
+        size_t i = 0;
+        for (; i + 16 <= size; i += 16) {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            int index = _mm_cmpestri(stop, 6, bytes, 16, RANGE_FLAGS);
+            if (index != 16)
+                return i + index;
+        }
+        return i + findValueEndScalar(data + i, size - i);
+    }
+
+    // AVX2 has no range compare, so token membership uses the nibble lookup trick: the low
+    // nibble of a byte picks a bitmask of the high nibbles that make it a token, and the high
+    // nibble picks its own bit. Bytes of 0x80 and up get no bit and are never tokens.
+    // Every AVX2 CPU has SSE4.2, which handles the last 16 to 31 bytes.
+    constexpr std::array<uint8_t, 16> TOKEN_LOW_NIBBLE = [] {
+        std::array<uint8_t, 16> table{};
+        for (int c = 0; c < 128; c++) {
+            if (TOKEN_CHARS[c])
+                table[c & 0x0f] |= 1 << (c >> 4);
+        }
+        return table;
+    }();
+    constexpr std::array<uint8_t, 16> TOKEN_HIGH_NIBBLE = {1, 2, 4, 8, 16, 32, 64, 128, 0, 0, 0, 0, 0, 0, 0, 0};
+
+    __attribute__((target("avx2")))
+    size_t findTokenEndAvx2(const char* data, size_t size) {
+        const __m256i lowTable = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(TOKEN_LOW_NIBBLE.data())));
+        const __m256i highTable = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(TOKEN_HIGH_NIBBLE.data())));
+        const __m256i nibble = _mm256_set1_epi8(0x0f);
+        size_t i = 0;
+        for (; i + 32 <= size; i += 32) {
+            __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            __m256i low = _mm256_shuffle_epi8(lowTable, _mm256_and_si256(bytes, nibble));
+            __m256i high = _mm256_shuffle_epi8(highTable, _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibble));
+            __m256i member = _mm256_and_si256(low, high);
+            uint32_t stop = _mm256_movemask_epi8(_mm256_cmpeq_epi8(member, _mm256_setzero_si256()));
+            if (stop)
+                return i + __builtin_ctz(stop);
+        }
+        return i + findTokenEndSse42(data + i, size - i);
+    }
+
+    __attribute__((target("avx2")))
+    size_t findTargetEndAvx2(const char* data, size_t size) {
+        const __m256i space = _mm256_set1_epi8(' ');
+        const __m256i del = _mm256_set1_epi8(0x7f);
+        size_t i = 0;
+        for (; i + 32 <= size; i += 32) {
+            __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            // Unsigned <= and >= through min and max, AVX2 only compares signed bytes
+            __m256i low = _mm256_cmpeq_epi8(_mm256_min_epu8(bytes, space), bytes);
+            __m256i high = _mm256_cmpeq_epi8(_mm256_max_epu8(bytes, del), bytes);
+            uint32_t stop = _mm256_movemask_epi8(_mm256_or_si256(low, high));
+            if (stop)
+                return i + __builtin_ctz(stop);
+        }
+        return i + findTargetEndSse42(data + i, size - i);
+    }
+
+    __attribute__((target("avx2")))
+    size_t findValueEndAvx2(const char* data, size_t size) {
+        const __m256i lastControl = _mm256_set1_epi8(0x1f);
+        const __m256i tab = _mm256_set1_epi8('\t');
+        const __m256i del = _mm256_set1_epi8(0x7f);
+        size_t i = 0;
+        for (; i + 32 <= size; i += 32) {
+            __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            __m256i control = _mm256_cmpeq_epi8(_mm256_min_epu8(bytes, lastControl), bytes);
+            control = _mm256_andnot_si256(_mm256_cmpeq_epi8(bytes, tab), control);
+            uint32_t stop = _mm256_movemask_epi8(_mm256_or_si256(control, _mm256_cmpeq_epi8(bytes, del)));
+            if (stop)
+                return i + __builtin_ctz(stop);
+        }
+        return i + findValueEndSse42(data + i, size - i);
+    }
+#endif
+
+    constexpr Scanner::Kernels SCALAR_KERNELS = {findTokenEndScalar, findTargetEndScalar, findValueEndScalar};
+#ifdef SCANNER_X86
+    constexpr Scanner::Kernels SSE42_KERNELS = {findTokenEndSse42, findTargetEndSse42, findValueEndSse42};
+    constexpr Scanner::Kernels AVX2_KERNELS = {findTokenEndAvx2, findTargetEndAvx2, findValueEndAvx2};
+#endif
+
+    const Scanner::Kernels& activeKernels() {
+        static const Scanner::Kernels& kernels = *Scanner::getKernels(Scanner::getBestIsa());
+        return kernels;
+    }
+}
+
+Scanner::Isa Scanner::getBestIsa()
+{
+#ifdef SCANNER_X86
+    static const Isa best = [] {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return Isa::AVX2;
+        if (__builtin_cpu_supports("sse4.2"))
+            return Isa::SSE42;
+        return Isa::SCALAR;
+    }();
+    return best;
+#else
+    return Isa::SCALAR;
+#endif
+}
+
+const Scanner::Kernels* Scanner::getKernels(Isa isa)
+{
+    if (static_cast<int>(isa) > static_cast<int>(getBestIsa()))
+        return nullptr;
+    switch (isa) {
+#ifdef SCANNER_X86
+        case Isa::AVX2: return &AVX2_KERNELS;
+        case Isa::SSE42: return &SSE42_KERNELS;
+#endif
+        default: return &SCALAR_KERNELS;
+    }
+}
+
+size_t Scanner::findTokenEnd(const char *data, size_t size)
+{
+    return activeKernels().findTokenEnd(data, size);
+}
+
+size_t Scanner::findTargetEnd(const char *data, size_t size)
+{
+    return activeKernels().findTargetEnd(data, size);
+}
+
+size_t Scanner::findValueEnd(const char *data, size_t size)
+{
+    return activeKernels().findValueEnd(data, size);
+}
@@ -1,73 +1,170 @@
 #include "Server.h"
 #include <cstring>
 #include <unistd.h>
-#include <iostream>
 #include "Parser.h"
 #include "ResponseGenerator.h"
 #include <sys/epoll.h>
 #include <sys/eventfd.h>
 #include "WorkerPool.h"
 #include <fcntl.h>
-#include <queue>
+#include <pthread.h>
 
 int Server::m_shutdownEventFd = -1;
 
-Server::Server(int port, const std::filesystem::path &rootDir, int numThreads, int timeoutSeconds) 
-    : m_timeoutSeconds(timeoutSeconds), m_port(port), m_router(rootDir), m_pool(WorkerPool(numThreads))
+Server::Server(int port, const std::filesystem::path &rootDir, int numThreads, int timeoutSeconds, Mode mode) 
+    : m_timeouts{std::chrono::seconds(timeoutSeconds), std::chrono::seconds(timeoutSeconds),
+                 std::chrono::seconds(timeoutSeconds), std::chrono::seconds(timeoutSeconds)},
+      m_port(port), m_mode(mode), m_router(rootDir),
+      m_pool(WorkerPool(mode == Mode::THREAD_POOL ? numThreads : 0)),
+      m_requests([this](RequestView& request) { return startRequest(request); }, m_outputHighWaterMark, m_metrics)
 {
-    m_epollFd = epoll_create1(0);
-    if (m_epollFd == -1) {
+    if (m_shutdownEventFd == -1)
+        m_shutdownEventFd = eventfd(0, EFD_NONBLOCK);
+
+    if (m_mode == Mode::IO_URING && !IoUring::isSupported()) {
+        Log::warning("io_uring is not available, falling back to epoll reactors");
+        m_mode = Mode::MULTI_REACTOR;
+    }
+
+    // Without a pool the kernel spreads incoming connections over one listening socket per thread
+    int numReactors = m_mode == Mode::THREAD_POOL ? 1 : std::max(numThreads, 1);
+    for (int i = 0; i < numReactors; i++) {
+        m_reactors.push_back(std::make_unique<Reactor>());
+        setupReactor(*m_reactors.back(), i == 0);
+    }
+
+    std::signal(SIGINT, signalHandler);
+}
+
+void Server::setupReactor(Reactor &reactor, bool watchStaticFiles)
+{
+    reactor.loop = std::make_unique<Async::EventLoop>();
+    // Async handlers run where the requests do, so with a pool they're resumed on its workers too
+    if (m_mode == Mode::THREAD_POOL) {
+        reactor.loop->setExecutor([this, loop = reactor.loop.get()](std::coroutine_handle<> handle) {
+            m_pool.enqueue([loop, handle] {
+                Async::EventLoop::setCurrent(loop);
+                handle.resume();
+            });
+        });
+    }
+
+    if (m_mode == Mode::IO_URING) {
+        setupSocket(reactor);
+        StaticFileCache* cache = watchStaticFiles ? &m_router.getStaticFileCache() : nullptr;
+        reactor.uring = std::make_unique<UringReactor>(reactor.serverSocket, m_shutdownEventFd, m_timeouts, m_requestLimits, m_outputHighWaterMark,
+            m_requests, cache, *reactor.loop, m_metrics, m_tracer);
+        return;
+    }
+
+    reactor.epollFd = epoll_create1(0);
+    if (reactor.epollFd == -1) {
         throw std::runtime_error("Failed to create epoll file descriptor: " + std::string(strerror(errno)));
     }
-    setupSocket();
+    setupSocket(reactor);
     epoll_event ev;
     ev.events = EPOLLIN | EPOLLET;  // interested in read events, edge-triggered
-    ev.data.fd = m_serverSocket;
-    setNonBlocking(m_serverSocket);
-    epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_serverSocket, &ev);
+    ev.data.u64 = reactor.serverSocket;
+    setNonBlocking(reactor.serverSocket);
+    epoll_ctl(reactor.epollFd, EPOLL_CTL_ADD, reactor.serverSocket, &ev);
 
+    // Every reactor gets its own edge on the shared shutdown eventfd
     ev.events = EPOLLIN | EPOLLET;
-    if (m_shutdownEventFd == -1)
-        m_shutdownEventFd = eventfd(0, EFD_NONBLOCK);
-    ev.data.fd = m_shutdownEventFd;
-    epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_shutdownEventFd, &ev);
+    ev.data.u64 = m_shutdownEventFd;
+    epoll_ctl(reactor.epollFd, EPOLL_CTL_ADD, m_shutdownEventFd, &ev);
+
+    // Static file cache invalidation is driven from the first reactor's thread
+    int notifyFd = m_router.getStaticFileCache().getNotifyFd();
+    if (watchStaticFiles && notifyFd != -1) {
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.u64 = notifyFd;
+        epoll_ctl(reactor.epollFd, EPOLL_CTL_ADD, notifyFd, &ev);
+    }
 
-    std::signal(SIGINT, signalHandler);
+    // Level-triggered, the loop may leave events for the next round
+    ev.events = EPOLLIN;
+    ev.data.u64 = reactor.loop->getFd();
+    epoll_ctl(reactor.epollFd, EPOLL_CTL_ADD, reactor.loop->getFd(), &ev);
 }
 
 void Server::start()
 {
-    listen(m_serverSocket, 10);
+    // The calling thread runs the first reactor, the rest get their own threads
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < m_reactors.size(); i++) {
+        threads.emplace_back([this, i] {
+            pthread_setname_np(pthread_self(), "myhttp-reactor");
+            runReactor(*m_reactors[i]);
+        });
+    }
+    runReactor(*m_reactors[0]);
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+void Server::runReactor(Reactor &reactor)
+{
+    // A short backlog makes a burst of new clients wait on SYN retransmits, so take what the kernel allows
+    listen(reactor.serverSocket, SOMAXCONN);
+    Async::EventLoop::setCurrent(reactor.loop.get());
+    if (reactor.uring) {
+        reactor.uring->run();
+        return;
+    }
     // m_running = 1;
     epoll_event events[64];
     bool running = true;
     while (running) {
-        // Calculate wait time for epoll based on next connection timeout
-        int waitTime = -1;
-        if (!m_activeConnections.empty()) {
-            auto now = std::chrono::steady_clock::now();
-            auto& conn = m_activeConnections.top();
-            double duration = 5 - std::chrono::duration<double>(now - conn.lastActive).count();
-            waitTime = std::max(0.0, duration) * 1000; // convert to milliseconds
-        }
+        // Sleep until the next deadline comes due
+        int waitTime = reactor.timers.getWaitMillis();
         // Wait for events, this will block until an event occurs or timeout
-        int n = epoll_wait(m_epollFd, events, 64, waitTime);
-        timeOutConnections();
+        int n = epoll_wait(reactor.epollFd, events, 64, waitTime);
+        Tracer::Clock::time_point wokeAt = m_tracer.isTracing() ? Tracer::Clock::now() : Tracer::Clock::time_point();
+        timeOutConnections(reactor);
         for (int i = 0; i < n; i++) {
-            if (events[i].data.fd == m_serverSocket) {
-                acceptConnection();
+            // Client fds carry their connection's generation in the top half
+            int fd = static_cast<int>(events[i].data.u64 & 0xffffffff);
+            uint32_t generation = events[i].data.u64 >> 32;
+            if (fd == reactor.serverSocket) {
+                acceptConnection(reactor);
             }
             // If we have received shutdown signal
-            else if (events[i].data.fd == m_shutdownEventFd)
+            else if (fd == m_shutdownEventFd)
                 running = false;
+            // Something changed under the static file root
+            else if (fd == m_router.getStaticFileCache().getNotifyFd())
+                m_router.getStaticFileCache().processEvents();
+            // Async handlers that can carry on
+            else if (fd == reactor.loop->getFd())
+                reactor.loop->processEvents();
             else {
-                int clientFd = events[i].data.fd;
-                uint32_t ev = events[i].events;
-                updateLastActive(clientFd);
-
-                // push client work onto pool
-                m_pool.enqueue([this, clientFd, ev]() {
-                    handleClient(clientFd, ev);
+                // Left over from a connection that was closed earlier in this batch, and maybe reaccepted since
+                Connection* conn = reactor.connections.find(fd);
+                if (!conn || !conn->isOpen() || conn->generation != generation)
+                    continue;
+                // A hangup while an async handler has the connection, it finds out when it writes the response
+                if (conn->asyncState.load(std::memory_order_acquire) != Connection::AsyncState::IDLE)
+                    continue;
+                // Whoever handles the event sets the next deadline, it can't time out in the meantime
+                conn->hold();
+                uint64_t traceId = m_tracer.sample();
+                Tracer::Scope scope(m_tracer, traceId, "dispatch");
+                Tracer::addInstant("epoll_wait returned", wokeAt);
+
+                // No cross thread hop in MULTI_REACTOR mode, this thread owns the connection
+                if (m_mode == Mode::MULTI_REACTOR) {
+                    handleClient(reactor, *conn);
+                    continue;
+                }
+                // push client work onto pool, which owns the connection until it rearms the fd
+                Tracer::Span span("enqueue");
+                Tracer::addFlowStart("queue");
+                m_pool.enqueue([this, &reactor, conn, queuedAt = m_metrics.startTiming(Metrics::Stage::QUEUE_WAIT), traceId]() {
+                    m_metrics.recordSince(Metrics::Stage::QUEUE_WAIT, queuedAt);
+                    Tracer::Scope scope(m_tracer, traceId, "task");
+                    Tracer::addFlowEnd("queue");
+                    handleClient(reactor, *conn);
                 });
             }
         }
@@ -76,21 +173,21 @@ void Server::start()
 
 Server::~Server()
 {
-    // Close server socket
-    close(m_serverSocket);
     // Join all worker threads
     m_pool.stop();
-    for (auto& [socket, time]: m_lastActiveTimes) {
-        close(socket);
+    for (auto& reactor : m_reactors) {
+        // Closes its own connections
+        reactor->uring.reset();
+        // Close server socket
+        close(reactor->serverSocket);
+        for (Connection* conn : reactor->connections.getOpen()) {
+            close(conn->fd);
+        }
+        // Close epoll instance
+        if (reactor->epollFd != -1)
+            close(reactor->epollFd);
     }
-    m_connectionBuffers.clear();
-    m_activeConnections = std::priority_queue<ClientConnection, std::vector<ClientConnection>, std::greater<ClientConnection>>();
-
-    // Close epoll instance
-    close(m_epollFd);
-
-    int m_serverSocket = -1;
-    int m_epollFd = -1;
+    m_reactors.clear();
 }
 
 void Server::signalHandler(int signal) {
@@ -104,29 +201,183 @@ void Server::addRoute(Route route, int method, Handler handler) {
     m_router.addRoute(route, method, handler);
 }
 
+void Server::addRoute(Route route, int method, ViewHandler handler) {
+    m_router.addRoute(route, method, handler);
+}
+
+void Server::addAsyncRoute(Route route, int method, AsyncHandler handler) {
+    m_router.addAsyncRoute(route, method, handler);
+}
+
+void Server::enableMetrics(const std::string &path) {
+    m_metrics.enable();
+    m_metrics.addValue(Metrics::Type::GAUGE, "myhttp_worker_threads", "Threads in the worker pool.",
+                       [this] { return static_cast<double>(m_pool.getThreadCount()); });
+    m_metrics.addValue(Metrics::Type::GAUGE, "myhttp_worker_queue_depth", "Tasks waiting for a worker.",
+                       [this] { return static_cast<double>(m_pool.getQueueDepth()); });
+    m_metrics.addValue(Metrics::Type::COUNTER, "myhttp_static_file_cache_hits_total", "Static file requests answered from memory.",
+                       [this] { return static_cast<double>(getStaticFileCacheStats().hits); });
+    m_metrics.addValue(Metrics::Type::COUNTER, "myhttp_static_file_cache_misses_total", "Static file requests read from disk.",
+                       [this] { return static_cast<double>(getStaticFileCacheStats().misses); });
+    m_metrics.addValue(Metrics::Type::GAUGE, "myhttp_static_file_cache_bytes", "Size of the cached static file responses.",
+                       [this] { return static_cast<double>(getStaticFileCacheStats().bytes); });
+    m_metrics.addValue(Metrics::Type::COUNTER, "myhttp_log_dropped_total", "Log lines lost because a thread's log buffer was full.",
+                       [] { return static_cast<double>(Log::getStats().dropped); });
+    m_metrics.addValue(Metrics::Type::COUNTER, "myhttp_log_suppressed_total", "Log messages left out by the rate limit.",
+                       [] { return static_cast<double>(Log::getStats().suppressed); });
+    m_router.addRoute(Route(path), HTTPRequest::Method::GET, ViewHandler([this](const RequestView&) {
+        HTTPResponse response(HTTPResponse::Status::OK, {{"Content-Type", "text/plain; version=0.0.4; charset=utf-8"}});
+        response.setBody(m_metrics.toPrometheus());
+        return response;
+    }));
+}
+
+void Server::startTracing(uint32_t sampleEvery) {
+    m_tracer.start(sampleEvery);
+}
+
+void Server::stopTracing(const std::filesystem::path &file) {
+    m_tracer.stop();
+    m_tracer.writeChromeTrace(file);
+}
+
+void Server::setRequestLimits(const RequestParser::Limits &limits) {
+    m_requestLimits = limits;
+}
+
+void Server::setTimeouts(const TimerWheel::Timeouts &timeouts) {
+    m_timeouts = timeouts;
+}
+
+void Server::setOutputHighWaterMark(size_t bytes) {
+    m_outputHighWaterMark = bytes;
+}
+
+void Server::setCompression(const Compression::Settings &settings) {
+    m_router.setCompression(settings);
+}
+
+void Server::setCacheControl(const std::string &prefix, const std::string &value) {
+    m_router.setCacheControl(prefix, value);
+}
+
+void Server::setStaticFileCacheLimits(size_t maxBytes, size_t maxEntryBytes) {
+    m_router.getStaticFileCache().setLimits(maxBytes, maxEntryBytes);
+}
+
+void Server::setOpenFileCacheLimit(size_t maxEntries) {
+    m_router.getStaticFileCache().getOpenFiles().setMaxEntries(maxEntries);
+}
+
+StaticFileCache::Stats Server::getStaticFileCacheStats() const {
+    return m_router.getStaticFileCache().getStats();
+}
+
 HTTPResponse Server::handleRequest(const std::optional<HTTPRequest> &request) const
 {
-    // Simple routing logic
     if (!request) {
         return ResponseGenerator::generateBadRequestResponse();
     }
-    std::optional<Handler> handler = m_router.getHandler(request->getRoute(), request->getMethod());
-    if (handler) {
-        return (*handler)(*request);
+    RequestView view(*request);
+    return handleRequest(view);
+}
+
+HTTPResponse Server::handleRequest(RequestView &request) const
+{
+    Answer answer = startRequest(request);
+    if (HTTPResponse* response = std::get_if<HTTPResponse>(&answer))
+        return std::move(*response);
+    return Async::run(std::get<Async::Task<HTTPResponse>>(std::move(answer)));
+}
+
+Answer Server::startRequest(RequestView &request) const
+{
+    Answer answer = routeRequest(request);
+    // HEAD gets what GET would, Content-Length and all, without the body. Async handlers drop theirs in respondAsync().
+    if (request.getMethod() == HTTPRequest::Method::HEAD) {
+        if (HTTPResponse* response = std::get_if<HTTPResponse>(&answer))
+            response->dropBody();
+    }
+    return answer;
+}
+
+Answer Server::routeRequest(RequestView &request) const
+{
+    m_metrics.add(Metrics::Counter::REQUESTS);
+    // Simple routing logic
+    const Router::Endpoint* endpoint;
+    {
+        Metrics::Span span(m_metrics, Metrics::Stage::ROUTE);
+        Tracer::Span trace("route");
+        endpoint = m_router.getEndpoint(request);
     }
-    std::optional<HTTPResponse> staticFile = m_router.getStaticFile(*request);
+    if (endpoint && endpoint->asyncHandler)
+        return respondAsync(endpoint->asyncHandler, request.toRequest());
+    Metrics::Span span(m_metrics, Metrics::Stage::HANDLER);
+    if (endpoint) {
+        Tracer::Span trace("handler");
+        return finishResponse(request, endpoint->handler(request));
+    }
+
+    Tracer::Span trace("getStaticFile");
+
+    int acceptedEncodings = Compression::IDENTITY;
+    if (auto acceptEncoding = request.getHeader("Accept-Encoding"))
+        acceptedEncodings = Compression::parseAcceptEncoding(*acceptEncoding);
+    ResponseGenerator::Conditions conditions{.ifNoneMatch = request.getHeader("If-None-Match"),
+                                             .ifModifiedSince = request.getHeader("If-Modified-Since"),
+                                             .range = request.getHeader("Range"), .ifRange = request.getHeader("If-Range")};
+    std::optional<HTTPResponse> staticFile = m_router.getStaticFile(request.getMethod(), request.getRoute(), acceptedEncodings, conditions);
     if (staticFile) {
-        return *staticFile;
+        return std::move(*staticFile);
     }
     return ResponseGenerator::generateNotFoundResponse();
 }
 
-void Server::setupSocket()
+HTTPResponse Server::finishResponse(const RequestView &request, HTTPResponse response) const
+{
+    // Handlers that tag what they return get conditional requests for free
+    if (request.getMethod() == HTTPRequest::Method::GET && response.getStatus() == HTTPResponse::Status::OK) {
+        ResponseGenerator::Conditions conditions{.ifNoneMatch = request.getHeader("If-None-Match"),
+                                                 .ifModifiedSince = request.getHeader("If-Modified-Since")};
+        std::optional<std::string> etag = response.getHeader("ETag");
+        std::optional<std::string> lastModified = response.getHeader("Last-Modified");
+        if ((conditions.ifNoneMatch || conditions.ifModifiedSince) && (etag || lastModified) &&
+            ResponseGenerator::isNotModified(conditions, etag.value_or(""), lastModified.value_or("")))
+            return ResponseGenerator::generateNotModifiedResponse(response);
+    }
+    int acceptedEncodings = Compression::IDENTITY;
+    if (auto acceptEncoding = request.getHeader("Accept-Encoding"))
+        acceptedEncodings = Compression::parseAcceptEncoding(*acceptEncoding);
+    Compression::compressResponse(response, acceptedEncodings, m_router.getCompression());
+    return response;
+}
+
+Async::Task<HTTPResponse> Server::respondAsync(const AsyncHandler &handler, HTTPRequest request) const
+{
+    // Until the response is ready, however long the handler waits
+    Metrics::Span span(m_metrics, Metrics::Stage::HANDLER);
+    std::optional<HTTPResponse> response;
+    try {
+        response = co_await handler(request);
+    } catch (const std::exception& e) {
+        Log::error("Async handler failed for ", request.getRoute().string(), ": ", e.what());
+    } catch (...) {
+        Log::error("Async handler failed for ", request.getRoute().string());
+    }
+    HTTPResponse result = response ? finishResponse(RequestView(request), std::move(*response)) :
+                                     ResponseGenerator::generateInternalServerErrorResponse();
+    if (request.getMethod() == HTTPRequest::Method::HEAD)
+        result.dropBody();
+    co_return result;
+}
+
+void Server::setupSocket(Reactor &reactor)
 {
     // Creating socket
-    m_serverSocket = socket(AF_INET, SOCK_STREAM, 0);
+    reactor.serverSocket = socket(AF_INET, SOCK_STREAM, 0);
 
-    if (m_serverSocket < 0) {
+    if (reactor.serverSocket < 0) {
         throw std::runtime_error("Failed to create socket" + std::string(strerror(errno)));
     }
 
@@ -138,180 +389,252 @@ void Server::setupSocket()
 
     // Binding socket.
     int opt = 1;
-    setsockopt(m_serverSocket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
-    int result = bind(m_serverSocket, (struct sockaddr*)&serverAddress, sizeof(serverAddress));
+    setsockopt(reactor.serverSocket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    // Lets every reactor bind its own socket to the same port, the kernel load balances between them
+    if (m_mode != Mode::THREAD_POOL)
+        setsockopt(reactor.serverSocket, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+    int result = bind(reactor.serverSocket, (struct sockaddr*)&serverAddress, sizeof(serverAddress));
     if (result < 0) {
         throw std::runtime_error("Failed to bind socket: " + std::string(strerror(errno)));
     }
 }
 
-void Server::acceptConnection()
+void Server::acceptConnection(Reactor &reactor)
 {
     // Accepting connection request
     while (true) {
-        int clientSocket = accept(m_serverSocket, nullptr, nullptr);
+        Metrics::Clock::time_point started = m_metrics.now();
+        sockaddr_storage address;
+        socklen_t addressLength = sizeof(address);
+        int clientSocket = accept(reactor.serverSocket, reinterpret_cast<sockaddr*>(&address), &addressLength);
         if (clientSocket < 0) {
             if (errno == EAGAIN || errno == EWOULDBLOCK)
                 break; // no more connections to accept
-            std::cerr << "Failed to accept client connection: " << strerror(errno) << std::endl;
+            Log::error("Failed to accept client connection: ", strerror(errno));
+            continue;
+        }
+        Connection* conn = reactor.connections.get(clientSocket);
+        if (!conn) {
+            Log::error("No room for client connection, fd=", clientSocket);
+            close(clientSocket);
             continue;
         }
 
         setNonBlocking(clientSocket);
+        conn->open(clientSocket, m_requestLimits);
+        if (Log::isAccessLogOpen())
+            conn->remoteAddress = Log::formatAddress(address);
+        conn->setDeadline(TimerWheel::Deadline::HEADER_READ, m_timeouts.headerRead);
+        reactor.timers.schedule(clientSocket, TimerWheel::Deadline::HEADER_READ, conn->getTimeout()->deadline);
+
         epoll_event ev;
         // interested in read events, edge-triggered, and only let one thread access a socket at a time (epolloneshot)
-        ev.events = EPOLLIN | EPOLLET | EPOLLONESHOT;
-        ev.data.fd = clientSocket;
-
-        if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, clientSocket, &ev) == -1) {
-            std::cerr << "Failed to add client to epoll" << strerror(errno) << std::endl;
+        // A reactor handles its clients itself, so there is no other thread to guard against. It uses level-triggered
+        // events instead, so bytes left unread after a request are reported again without a rearm.
+        ev.events = m_mode == Mode::MULTI_REACTOR ? EPOLLIN : EPOLLIN | EPOLLET | EPOLLONESHOT;
+        ev.data.u64 = static_cast<uint64_t>(conn->generation) << 32 | static_cast<uint32_t>(clientSocket);
+
+        if (epoll_ctl(reactor.epollFd, EPOLL_CTL_ADD, clientSocket, &ev) == -1) {
+            Log::error("Failed to add client to epoll: ", strerror(errno));
+            conn->release();
             close(clientSocket);
             continue;
         }
-        updateLastActive(clientSocket);
-        // std::cout << "Accepted new client, fd=" << clientSocket << "\n";
+        m_metrics.add(Metrics::Counter::CONNECTIONS_ACCEPTED);
+        m_metrics.recordSince(Metrics::Stage::ACCEPT, started);
+        Log::debug("Accepted new client, fd=", clientSocket);
     }
 }
 
-// This is run in a worker thread
-void Server::handleClient(int clientSocket, uint32_t events)
+// This is run in a worker thread, or on the reactor thread in MULTI_REACTOR mode
+void Server::handleClient(Reactor &reactor, Connection &conn)
 {
-    epoll_event ev;
-    ev.events = EPOLLIN | EPOLLET | EPOLLONESHOT;
-    ev.data.fd = clientSocket;
+    // Async handlers started from here wait on this reactor's loop
+    Async::EventLoop::setCurrent(reactor.loop.get());
+    Tracer::Span trace("handleClient");
+    bool wasBlocked = !conn.output.empty();
 
-    // Receiving message from client
-    auto optBuffer = receiveData(clientSocket);
-    if (!optBuffer) {
-        // Rearm the fd in epoll, this will fail if receiveData closed the connection due to malformed data
-        epoll_ctl(m_epollFd, EPOLL_CTL_MOD, clientSocket, &ev);
+    // Finish what we couldn't write last time before reading anything new
+    if (wasBlocked && !flushOutput(reactor, conn))
         return;
+
+    // Stop reading from a client that isn't reading its responses until it catches up
+    if (conn.output.size() < m_outputHighWaterMark && !conn.closeWhenDrained) {
+        // Receiving message from client
+        if (!receiveData(reactor, conn))
+            return;
+        if (!answerRequests(reactor, conn))
+            return;
     }
-    std::string buffer = std::move(*optBuffer);
-
-    // Parse the request string into an HTTPRequest object
-    auto request = Parser::parseRequest(buffer);
-    // Handle the request and generate a response
-    auto response = handleRequest(request);
-    std::string responseStr = response.toString();
-
-    // Debug output
-    // std::cout << "Parsed HTTP request from fd=" << clientSocket << std::endl;
-    // if (request)
-    //     std::cout << HTTPRequest::getMethodString(request->getMethod()) << " " << request->getRoute() << std::endl;
-    // std::cout << "Response: \n" << responseStr << std::endl;
-    
-    // Send data, this will block if the kernel send buffer is filled up
-    if (sendData(clientSocket, std::move(responseStr)) == -1) {
-        std::cerr << "Failed to send response to client: " << strerror(errno) << std::endl;
-        closeConnection(clientSocket);
-        return;
+    releaseClient(reactor, conn, wasBlocked);
+}
+
+bool Server::answerRequests(Reactor &reactor, Connection &conn)
+{
+    bool answered = m_requests.answer(conn,
+        [this, &reactor, &conn](Connection&) { return flushOutput(reactor, conn); },
+        [this, &reactor, &conn](Connection&, Async::Task<HTTPResponse> task) { return startAsync(reactor, conn, std::move(task)); });
+    // Send as much as the socket takes, the rest waits for EPOLLOUT
+    return answered && flushOutput(reactor, conn);
+}
+
+bool Server::startAsync(Reactor &reactor, Connection &conn, Async::Task<HTTPResponse> task)
+{
+    using State = Connection::AsyncState;
+    conn.asyncState.store(State::RUNNING, std::memory_order_relaxed);
+    Async::spawn(std::move(task), [this, &reactor, &conn](HTTPResponse response) {
+        conn.asyncResponse.emplace(std::move(response));
+        // Whichever of this and the thread that started the task comes last carries on with the connection
+        if (conn.asyncState.exchange(State::DONE, std::memory_order_acq_rel) == State::PARKED)
+            resumeClient(reactor, conn);
+    });
+    if (conn.asyncState.exchange(State::PARKED, std::memory_order_acq_rel) == State::DONE) {
+        m_requests.takeAsyncResponse(conn);
+        return true;
     }
+    // Level-triggered fds stay armed, so stop listening until the response is ready. A hangup is still
+    // reported once, and ignored. The task is resumed on this thread, so it can't have finished yet.
+    if (m_mode == Mode::MULTI_REACTOR) {
+        epoll_event ev;
+        ev.events = EPOLLONESHOT;
+        ev.data.u64 = static_cast<uint64_t>(conn.generation) << 32 | static_cast<uint32_t>(conn.fd);
+        epoll_ctl(reactor.epollFd, EPOLL_CTL_MOD, conn.fd, &ev);
+    }
+    return false;
+}
 
-    // If we failed to parse the request, close the connection after sending BadRequest response
-    if (!request) {
-        std::cerr << "Failed to parse HTTP request" << std::endl;
-        closeConnection(clientSocket);
+void Server::resumeClient(Reactor &reactor, Connection &conn)
+{
+    m_requests.takeAsyncResponse(conn);
+    // Pipelined requests that came in with the one it answered
+    if (!answerRequests(reactor, conn))
         return;
-    }
+    // The fd was left disarmed while the handler had the connection
+    releaseClient(reactor, conn, true);
+}
+
+void Server::releaseClient(Reactor &reactor, Connection &conn, bool interestChanged)
+{
+    bool wantRead = conn.output.size() < m_outputHighWaterMark && !conn.closeWhenDrained;
+    bool wantWrite = !conn.output.empty();
+    TimerWheel::Deadline deadline = TimerWheel::Deadline::KEEP_ALIVE;
+    if (wantWrite)
+        deadline = TimerWheel::Deadline::WRITE_STALL;
+    else if (!conn.input.empty() && !conn.closeWhenDrained)
+        deadline = conn.parser.isReadingBody() ? TimerWheel::Deadline::BODY_READ : TimerWheel::Deadline::HEADER_READ;
+    // Publishing the deadline hands the connection back, so it must not be touched after this
+    int clientSocket = conn.fd;
+    uint32_t generation = conn.generation;
+    conn.setDeadline(deadline, m_timeouts.get(deadline));
+    // Rearm the fd in epoll
+    uint32_t interest = (wantRead ? static_cast<uint32_t>(EPOLLIN) : 0) | (wantWrite ? static_cast<uint32_t>(EPOLLOUT) : 0);
+    rearmClient(reactor, clientSocket, generation, interest, interestChanged || wantWrite);
+}
 
-    // Close connection if "Connection: close" header is present
-    auto connectionHeader = request->getHeader("Connection");
-    if (connectionHeader && *connectionHeader == "close") {
-        closeConnection(clientSocket);
+bool Server::flushOutput(Reactor &reactor, Connection &conn)
+{
+    size_t queued = conn.output.size();
+    OutputQueue::Status status;
+    {
+        Metrics::Span span(m_metrics, Metrics::Stage::SEND);
+        Tracer::Span trace("send");
+        status = conn.output.flush(conn.fd);
+    }
+    m_metrics.add(Metrics::Counter::BYTES_SENT, queued - conn.output.size());
+    if (status == OutputQueue::Status::ERROR) {
+        Log::warning("Failed to send response to client: ", strerror(errno));
+        closeConnection(reactor, conn);
+        return false;
     }
-    else {      // Rearm the fd in epoll
-        epoll_ctl(m_epollFd, EPOLL_CTL_MOD, clientSocket, &ev);
+    if (conn.output.empty() && conn.closeWhenDrained) {
+        closeConnection(reactor, conn);
+        return false;
     }
+    return true;
 }
 
-// This is always run in a worker thread
-std::optional<std::string> Server::receiveData(int clientSocket)
+void Server::rearmClient(Reactor &reactor, int clientSocket, uint32_t generation, uint32_t interest, bool interestChanged)
 {
-    std::string contentLength = "Content-Length: ";
-    std::string endHeaders = "\r\n\r\n";
+    epoll_event ev;
+    if (m_mode == Mode::MULTI_REACTOR) {
+        // Level-triggered fds stay armed, they only need updating when we start or stop waiting to write
+        if (!interestChanged)
+            return;
+        ev.events = interest;
+    } else {
+        ev.events = interest | EPOLLET | EPOLLONESHOT;
+    }
+    ev.data.u64 = static_cast<uint64_t>(generation) << 32 | static_cast<uint32_t>(clientSocket);
+    epoll_ctl(reactor.epollFd, EPOLL_CTL_MOD, clientSocket, &ev);
+}
 
+// This is always run in a worker thread, or on the reactor thread in MULTI_REACTOR mode
+bool Server::receiveData(Reactor &reactor, Connection &conn)
+{
+    Tracer::Span trace("receiveData");
     // Receiving message from client
-    std::string buffer = getFromBuffer(clientSocket);
+    std::string& buffer = conn.input;
     size_t oldSize;
-    int bytesToReceive = 1024;
+    int bytesToReceive = 16384;
     while (true) {
-        size_t end = buffer.find(endHeaders);
-        // Make sure we have received the full body before we consider the transmission finished
-        size_t contentLengthIndex = buffer.find(contentLength);
-        if (contentLengthIndex != std::string::npos) {
-            int bodySize = std::stoi(buffer.substr(contentLengthIndex + contentLength.size()));
-            if (end + endHeaders.size() + bodySize == buffer.size())
-                break;
-        }
-        else if (end != std::string::npos)
-            break;
-
         oldSize = buffer.size();
         buffer.resize(buffer.size() + bytesToReceive);
-        // This is a non-blocking recv due to non-blocking socket, exits thread if not done receiving data
-        int bytes = recv(clientSocket, buffer.data() + oldSize, bytesToReceive, 0);
+        // This is a non-blocking recv due to non-blocking socket
+        int bytes;
+        {
+            Metrics::Span span(m_metrics, Metrics::Stage::RECEIVE);
+            Tracer::Span trace("recv");
+            bytes = recv(conn.fd, buffer.data() + oldSize, bytesToReceive, 0);
+        }
         if (bytes == -1) {
             buffer.resize(oldSize);
-            // No more data, store data in buffer for next time
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                addToBuffer(std::move(buffer), clientSocket);
-                return std::nullopt;
-            }
+            // No more data for now
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return true;
             if (errno == ECONNRESET) {
-                closeConnection(clientSocket);
-                return std::nullopt;
+                closeConnection(reactor, conn);
+                return false;
             }
 
             // Other errors
-            std::cerr << "Failed to read from client: " << strerror(errno) << std::endl;
-            closeConnection(clientSocket);
-            return std::nullopt;
+            Log::warning("Failed to read from client: ", strerror(errno));
+            closeConnection(reactor, conn);
+            return false;
         }
         // Client closed connection before completing transmission
         if (bytes == 0) {
-            // std::cout << "Client disconnected, fd=" << clientSocket << "\n";
-            closeConnection(clientSocket);
-            return std::nullopt;
+            Log::debug("Client disconnected, fd=", conn.fd);
+            buffer.resize(oldSize);
+            closeConnection(reactor, conn);
+            return false;
         }
         // Resize buffer to get rid of unused data (very cheap, just updates internal size)
         buffer.resize(oldSize + bytes);
-    }
-
-    return buffer;
-}
-
-ssize_t Server::sendData(int clientSocket, std::string data)
-{
-    // Simple send; if we need to block just keep trying until it gets sent
-    // Not a good solution, but we so rarely block that its almost a non issue
-    size_t sent = 0;
-    while (sent < data.size()) {
-        if (sent != 0)
-            std::cout << "Send blocked, fd=" << clientSocket << std::endl;
-        int bytesSent = send(clientSocket, data.c_str() + sent, data.size() - sent, 0);
-        if (bytesSent == -1) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                continue;
-            }
-            return -1;
+        conn.stats.bytesReceived += bytes;
+        m_metrics.add(Metrics::Counter::BYTES_RECEIVED, bytes);
+
+        // The parser only looks at the new bytes. Once it has a request, or the socket is drained, we're done
+        RequestParser::Result result;
+        {
+            Metrics::Stopwatch stopwatch(m_metrics, Metrics::Stage::PARSE, conn.stats.parseTime);
+            Tracer::Span trace("parse");
+            result = conn.parser.parse(buffer);
         }
-        sent += bytesSent;
+        if (result != RequestParser::Result::INCOMPLETE || bytes < bytesToReceive)
+            return true;
     }
-    return sent;
 }
 
-void Server::closeConnection(int clientSocket)
+void Server::closeConnection(Reactor &reactor, Connection &conn)
 {
-    epoll_ctl(m_epollFd, EPOLL_CTL_DEL, clientSocket, nullptr);
+    int clientSocket = conn.fd;
+    epoll_ctl(reactor.epollFd, EPOLL_CTL_DEL, clientSocket, nullptr);
+    // The fd can be accepted again as soon as it's closed, so the slot has to be cleaned up first.
+    // Its timer is left to fire, the reactor sees the connection is gone and drops it.
+    conn.release();
     close(clientSocket);
-    m_lastActiveMutex.lock();
-    m_lastActiveTimes.erase(clientSocket);
-    m_lastActiveMutex.unlock();
-    m_bufferMutex.lock();
-    m_connectionBuffers.erase(clientSocket);
-    m_bufferMutex.unlock();
-    // std::cout << "Closed connection, fd=" << clientSocket << "\n";
+    m_metrics.add(Metrics::Counter::CONNECTIONS_CLOSED);
+    Log::debug("Closed connection, fd=", clientSocket);
 }
 
 // Helper: set socket to be non-blocking
@@ -321,55 +644,27 @@ void Server::setNonBlocking(int fd)
     fcntl(fd, F_SETFL, flags | O_NONBLOCK);
 }
 
-void Server::updateLastActive(int clientSocket)
-{
-    std::lock_guard<std::mutex> lock(m_lastActiveMutex);
-    auto now = std::chrono::steady_clock::now();
-    m_lastActiveTimes[clientSocket] = now;
-    m_activeConnections.push(ClientConnection{clientSocket, now});
-}
-
-void Server::timeOutConnections()
+void Server::timeOutConnections(Reactor &reactor)
 {
     auto now = std::chrono::steady_clock::now();
-    while (!m_activeConnections.empty()) {
-        auto& conn = m_activeConnections.top();
-        auto duration = std::chrono::duration_cast<std::chrono::seconds>(now - conn.lastActive).count();
-        if (duration > m_timeoutSeconds) {
-            // Look up to see if this is still the last active time for this socket
-            // or if the socket is already closed
-            m_lastActiveMutex.lock();
-            auto it = m_lastActiveTimes.find(conn.socket);
-            if (it == m_lastActiveTimes.end() || it->second != conn.lastActive) {
-                m_activeConnections.pop(); // stale entry, skip it
-                m_lastActiveMutex.unlock();
-                continue;
-            }
-            m_lastActiveMutex.unlock();
-            std::cout << "Timing out connection, fd=" << conn.socket << "\n";
-            // Remove from epoll and close socket
-            closeConnection(conn.socket);
-            m_activeConnections.pop();
-        } else {
-            break; // since the queue is ordered, we can stop checking further
+    for (const TimerWheel::Expired& expired : reactor.timers.advance(now)) {
+        Connection* conn = reactor.connections.find(expired.fd);
+        if (!conn || !conn->isOpen())
+            continue;
+        std::optional<Connection::Timeout> timeout = conn->getTimeout();
+        // Still being handled, whoever has it will have set a new deadline by the time we look again
+        if (!timeout) {
+            reactor.timers.schedule(expired.fd, expired.kind, now + m_timeouts.shortest());
+            continue;
         }
+        // Moved on since the timer was set
+        if (timeout->deadline > now) {
+            reactor.timers.schedule(expired.fd, timeout->kind, timeout->deadline);
+            continue;
+        }
+        Log::info("Timing out connection, fd=", expired.fd, " after ", conn->stats.requests, " requests");
+        m_metrics.add(Metrics::Counter::CONNECTIONS_TIMED_OUT);
+        // Remove from epoll and close socket
+        closeConnection(reactor, *conn);
     }
 }
-
-void Server::addToBuffer(std::string buffer, int clientSocket)
-{
-    std::lock_guard<std::mutex> lock(m_bufferMutex);
-    m_connectionBuffers[clientSocket] += buffer;
-}
-
-std::string Server::getFromBuffer(int clientSocket)
-{
-    std::lock_guard<std::mutex> lock(m_bufferMutex);
-    auto it = m_connectionBuffers.find(clientSocket);
-    if (it == m_connectionBuffers.end()) {
-        return "";
-    }
-    std::string buffer = std::move(it->second);
-    m_connectionBuffers.erase(it);
-    return buffer;
-}
@@ -0,0 +1,173 @@
+#include "StaticFileCache.h"
+#include "Log.h"
+#include <cstring>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace {
+    // Anything that can change what a cached URL path resolves to, or the contents behind it
+    constexpr uint32_t WATCH_MASK = IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE |
+                                    IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+    constexpr std::string_view SIDECAR_SUFFIXES[] = {".gz", ".br"};
+}
+
+StaticFileCache::StaticFileCache(const std::filesystem::path &rootDir, size_t maxBytes, size_t maxEntryBytes)
+    : m_rootDir(rootDir), m_responses(maxBytes, maxEntryBytes)
+{
+    m_notifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_notifyFd == -1) {
+        Log::error("Failed to create inotify instance, static file cache disabled: ", strerror(errno));
+        disable();
+        return;
+    }
+    watchTree(m_rootDir);
+}
+
+StaticFileCache::~StaticFileCache()
+{
+    if (m_notifyFd != -1)
+        close(m_notifyFd);
+}
+
+std::optional<HTTPResponse> StaticFileCache::find(std::string_view urlPath, const ResponseGenerator::Conditions &conditions)
+{
+    return m_responses.find(urlPath, [&conditions](const Response& cached) {
+        if ((conditions.ifNoneMatch || conditions.ifModifiedSince) && ResponseGenerator::isNotModified(conditions, cached.etag, cached.lastModified))
+            return HTTPResponse(HTTPResponse::Status::NOT_MODIFIED, cached.notModified);
+        return HTTPResponse(cached.status, cached.serialized);
+    });
+}
+
+void StaticFileCache::insert(const std::string &urlPath, const std::filesystem::path &filePath, const HTTPResponse &response, uint64_t generation)
+{
+    // Either a file, or a body built in memory such as a compressed copy of one
+    const std::optional<FileBody>& body = response.getFileBody();
+    if ((!body && response.getBody().empty()) || response.getStatus() != HTTPResponse::Status::OK)
+        return;
+
+    // Without the status line, the Date header goes before the fields when it is sent
+    std::string headers;
+    response.appendHeaders(headers);
+    size_t bodySize = body ? body->length : response.getBody().size();
+    size_t size = headers.size() + bodySize;
+    if (size > m_responses.getMaxEntryCost())
+        return;
+
+    // Read the file outside the lock, the generation check below catches any change that raced with us
+    std::string serialized = std::move(headers);
+    size_t headerSize = serialized.size();
+    serialized.resize(size);
+    size_t done = 0;
+    if (!body)
+        serialized.replace(headerSize, bodySize, response.getBody());
+    while (body && done < body->length) {
+        ssize_t n = pread(body->file->get(), serialized.data() + headerSize + done, body->length - done, body->offset + done);
+        if (n <= 0)
+            return;
+        done += n;
+    }
+
+    Response cached;
+    cached.serialized = std::make_shared<const std::string>(std::move(serialized));
+    cached.status = response.getStatus();
+    cached.etag = response.getHeader("ETag").value_or("");
+    cached.lastModified = response.getHeader("Last-Modified").value_or("");
+    std::string notModified;
+    ResponseGenerator::generateNotModifiedResponse(response).appendHeaders(notModified);
+    cached.notModified = std::make_shared<const std::string>(std::move(notModified));
+    m_responses.insert(urlPath, filePath, std::move(cached), size, generation);
+}
+
+size_t StaticFileCache::getMaxEntryBytes() const
+{
+    return m_responses.getMaxEntryCost();
+}
+
+void StaticFileCache::setLimits(size_t maxBytes, size_t maxEntryBytes)
+{
+    // A cache without inotify stays disabled
+    m_responses.setLimits(maxBytes, maxEntryBytes);
+}
+
+StaticFileCache::Stats StaticFileCache::getStats() const
+{
+    ClockCache<Response>::Stats stats = m_responses.getStats();
+    return Stats{stats.hits, stats.misses, stats.evictions, stats.invalidations, stats.entries, stats.cost};
+}
+
+void StaticFileCache::processEvents()
+{
+    alignas(inotify_event) char buffer[4096];
+    while (true) {
+        ssize_t n = read(m_notifyFd, buffer, sizeof(buffer));
+        if (n <= 0)
+            return; // EAGAIN, all events drained
+
+        for (char* ptr = buffer; ptr < buffer + n; ) {
+            auto* event = reinterpret_cast<inotify_event*>(ptr);
+            ptr += sizeof(inotify_event) + event->len;
+
+            // We lost events, the only safe thing to do is start over
+            if (event->mask & IN_Q_OVERFLOW) {
+                invalidate(m_rootDir);
+                continue;
+            }
+            auto watch = m_watches.find(event->wd);
+            if (watch == m_watches.end())
+                continue;
+            if (event->mask & IN_IGNORED) {
+                m_watches.erase(watch);
+                continue;
+            }
+
+            std::filesystem::path path = watch->second;
+            if (event->len > 0)
+                path /= event->name;
+            invalidate(path);
+
+            // New directories need their own watch, inotify is not recursive
+            if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO)))
+                watchTree(path);
+        }
+    }
+}
+
+void StaticFileCache::watchTree(const std::filesystem::path &dir)
+{
+    std::error_code ec;
+    auto addWatch = [this](const std::filesystem::path& path) {
+        int wd = inotify_add_watch(m_notifyFd, path.c_str(), WATCH_MASK);
+        if (wd == -1) {
+            Log::error("Failed to watch ", path, ", static file cache disabled: ", strerror(errno));
+            disable();
+            return;
+        }
+        m_watches[wd] = path;
+    };
+    addWatch(dir);
+    for (auto it = std::filesystem::recursive_directory_iterator(dir, ec);
+         !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+        if (it->is_directory(ec))
+            addWatch(it->path());
+    }
+}
+
+void StaticFileCache::invalidate(const std::filesystem::path &path)
+{
+    m_files.invalidate(path);
+    m_responses.invalidate(path);
+    // A precompressed ".gz" or ".br" file is cached under the file it is a copy of
+    for (std::string_view suffix : SIDECAR_SUFFIXES) {
+        if (path.native().ends_with(suffix)) {
+            m_responses.invalidate(path.native().substr(0, path.native().size() - suffix.size()));
+            break;
+        }
+    }
+}
+
+void StaticFileCache::disable()
+{
+    // Without invalidation we could serve stale files forever, so don't cache at all
+    m_responses.disable();
+    m_files.disable();
+}
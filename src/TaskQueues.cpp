@@ -0,0 +1,139 @@
+#include "TaskQueues.h"
+#include <bit>
+
+InjectionQueue::InjectionQueue(size_t capacity)
+    : m_cells(new Cell[std::bit_ceil(std::max<size_t>(capacity, 2))]), m_mask(std::bit_ceil(std::max<size_t>(capacity, 2)) - 1)
+{
+    for (size_t i = 0; i <= m_mask; i++)
+        m_cells[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+bool InjectionQueue::tryPush(Task &task)
+{
+    size_t position = m_pushPosition.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+        cell = &m_cells[position & m_mask];
+        size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+        // The cell is free, claim it
+        if (difference == 0) {
+            if (m_pushPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                break;
+        }
+        // Still holds the task from one lap ago
+        else if (difference < 0)
+            return false;
+        // Another producer got there first
+        else
+            position = m_pushPosition.load(std::memory_order_relaxed);
+    }
+    cell->task = std::move(task);
+    cell->sequence.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+bool InjectionQueue::tryPop(Task &task)
+{
+    size_t position = m_popPosition.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+        cell = &m_cells[position & m_mask];
+        size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+        if (difference == 0) {
+            if (m_popPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                break;
+        }
+        // Nothing has been pushed here yet
+        else if (difference < 0)
+            return false;
+        else
+            position = m_popPosition.load(std::memory_order_relaxed);
+    }
+    task = std::move(cell->task);
+    // Free for the push one lap from now
+    cell->sequence.store(position + m_mask + 1, std::memory_order_release);
+    return true;
+}
+
+size_t InjectionQueue::sizeApprox() const
+{
+    // A push that has claimed its position but not stored its task yet is counted a little early
+    size_t popped = m_popPosition.load(std::memory_order_relaxed);
+    size_t pushed = m_pushPosition.load(std::memory_order_relaxed);
+    return pushed > popped ? pushed - popped : 0;
+}
+
+WorkStealingDeque::WorkStealingDeque(size_t capacity)
+{
+    m_rings.push_back(std::make_unique<Ring>(std::bit_ceil(std::max<size_t>(capacity, 2))));
+    m_ring.store(m_rings.back().get(), std::memory_order_relaxed);
+}
+
+WorkStealingDeque::~WorkStealingDeque()
+{
+    Ring* ring = m_ring.load(std::memory_order_relaxed);
+    for (int64_t i = m_top.load(); i < m_bottom.load(); i++)
+        delete ring->at(i).load(std::memory_order_relaxed);
+}
+
+void WorkStealingDeque::push(std::unique_ptr<Task> task)
+{
+    int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+    int64_t top = m_top.load(std::memory_order_acquire);
+    Ring* ring = m_ring.load(std::memory_order_relaxed);
+    if (bottom - top > static_cast<int64_t>(ring->mask)) {
+        m_rings.push_back(std::make_unique<Ring>((ring->mask + 1) * 2));
+        Ring* bigger = m_rings.back().get();
+        for (int64_t i = top; i < bottom; i++)
+            bigger->at(i).store(ring->at(i).load(std::memory_order_relaxed), std::memory_order_relaxed);
+        m_ring.store(bigger, std::memory_order_release);
+        ring = bigger;
+    }
+    ring->at(bottom).store(task.release(), std::memory_order_relaxed);
+    // Publishes the task to thieves that see the new bottom
+    m_bottom.store(bottom + 1, std::memory_order_release);
+}
+
+std::unique_ptr<Task> WorkStealingDeque::pop()
+{
+    int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+    Ring* ring = m_ring.load(std::memory_order_relaxed);
+    // Reserve the bottom task before looking at top, so a thief can't take it at the same time unnoticed
+    m_bottom.store(bottom, std::memory_order_seq_cst);
+    int64_t top = m_top.load(std::memory_order_seq_cst);
+    if (top > bottom) {
+        m_bottom.store(bottom + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    Task* task = ring->at(bottom).load(std::memory_order_relaxed);
+    // The last task, race the thieves for it
+    if (top == bottom) {
+        if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            task = nullptr;
+        m_bottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+    return std::unique_ptr<Task>(task);
+}
+
+std::unique_ptr<Task> WorkStealingDeque::steal()
+{
+    int64_t top = m_top.load(std::memory_order_seq_cst);
+    int64_t bottom = m_bottom.load(std::memory_order_seq_cst);
+    if (top >= bottom)
+        return nullptr;
+    Ring* ring = m_ring.load(std::memory_order_acquire);
+    Task* task = ring->at(top).load(std::memory_order_relaxed);
+    if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        return nullptr;
+    return std::unique_ptr<Task>(task);
+}
+
+size_t WorkStealingDeque::sizeApprox() const
+{
+    // The owner's pop moves bottom below top for a moment when it races a thief for the last task
+    int64_t top = m_top.load(std::memory_order_relaxed);
+    int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+    return bottom > top ? static_cast<size_t>(bottom - top) : 0;
+}
@@ -0,0 +1,146 @@
+#include "TimerWheel.h"
+#include <algorithm>
+
+std::chrono::milliseconds TimerWheel::Timeouts::get(Deadline kind) const
+{
+    switch (kind) {
+        case Deadline::HEADER_READ: return headerRead;
+        case Deadline::BODY_READ: return bodyRead;
+        case Deadline::KEEP_ALIVE: return keepAlive;
+        case Deadline::WRITE_STALL: return writeStall;
+    }
+    return keepAlive;
+}
+
+std::chrono::milliseconds TimerWheel::Timeouts::shortest() const
+{
+    return std::min({headerRead, bodyRead, keepAlive, writeStall});
+}
+
+TimerWheel::TimerWheel(std::chrono::milliseconds tick, Clock::time_point start)
+    : m_tick(tick), m_start(start), m_slots(SLOTS, -1), m_occupied(SLOTS / 64, 0)
+{
+}
+
+void TimerWheel::schedule(int fd, Deadline kind, Clock::time_point deadline)
+{
+    Node& node = getNode(fd);
+    if (node.scheduled)
+        unlink(node);
+    node.kind = kind;
+    // Rounded up, so nothing fires before its deadline
+    node.tick = toTick(deadline) + 1;
+    link(fd, node);
+}
+
+void TimerWheel::touch(int fd, Deadline kind, std::chrono::milliseconds timeout, Clock::time_point now)
+{
+    bool reading = kind == Deadline::HEADER_READ || kind == Deadline::BODY_READ;
+    if (reading && getKind(fd) == kind)
+        return;
+    schedule(fd, kind, now + timeout);
+}
+
+void TimerWheel::cancel(int fd)
+{
+    if (fd < 0 || static_cast<size_t>(fd) >= m_nodes.size())
+        return;
+    Node& node = m_nodes[fd];
+    if (node.scheduled)
+        unlink(node);
+}
+
+std::optional<TimerWheel::Deadline> TimerWheel::getKind(int fd) const
+{
+    if (fd < 0 || static_cast<size_t>(fd) >= m_nodes.size() || !m_nodes[fd].scheduled)
+        return std::nullopt;
+    return m_nodes[fd].kind;
+}
+
+std::vector<TimerWheel::Expired> TimerWheel::advance(Clock::time_point now)
+{
+    std::vector<Expired> expired;
+    uint64_t nowTick = toTick(now);
+    if (nowTick <= m_currentTick)
+        return expired;
+
+    // After a full turn every slot has been visited, so a long gap costs no more than that
+    uint64_t steps = std::min<uint64_t>(nowTick - m_currentTick, SLOTS);
+    for (uint64_t step = 1; step <= steps; step++) {
+        int fd = m_slots[(m_currentTick + step) % SLOTS];
+        while (fd != -1) {
+            Node& node = m_nodes[fd];
+            int next = node.next;
+            // Later turns of the wheel share the slot
+            if (node.tick <= nowTick) {
+                unlink(node);
+                expired.push_back(Expired{fd, node.kind});
+            }
+            fd = next;
+        }
+    }
+    m_currentTick = nowTick;
+    return expired;
+}
+
+int TimerWheel::getWaitMillis(Clock::time_point now) const
+{
+    // Find the first occupied slot after the current tick, a word of the bitmap at a time
+    size_t first = (m_currentTick + 1) % SLOTS;
+    for (size_t scanned = 0; scanned < SLOTS;) {
+        size_t slot = (first + scanned) % SLOTS;
+        uint64_t bits = m_occupied[slot / 64] >> (slot % 64);
+        if (bits) {
+            uint64_t due = m_currentTick + scanned + __builtin_ctzll(bits) + 1;
+            auto wait = m_start + static_cast<int64_t>(due) * m_tick - now;
+            if (wait <= Clock::duration::zero())
+                return 0;
+            return std::chrono::ceil<std::chrono::milliseconds>(wait).count();
+        }
+        scanned += 64 - slot % 64;
+    }
+    return -1;
+}
+
+uint64_t TimerWheel::toTick(Clock::time_point time) const
+{
+    if (time <= m_start)
+        return 0;
+    return (time - m_start) / m_tick;
+}
+
+TimerWheel::Node &TimerWheel::getNode(int fd)
+{
+    if (static_cast<size_t>(fd) >= m_nodes.size())
+        m_nodes.resize(fd + 1);
+    return m_nodes[fd];
+}
+
+void TimerWheel::link(int fd, Node &node)
+{
+    // A deadline that has already passed fires on the next advance()
+    node.tick = std::max(node.tick, m_currentTick + 1);
+    size_t slot = node.tick % SLOTS;
+    node.prev = -1;
+    node.next = m_slots[slot];
+    if (node.next != -1)
+        m_nodes[node.next].prev = fd;
+    m_slots[slot] = fd;
+    m_occupied[slot / 64] |= uint64_t(1) << (slot % 64);
+    node.scheduled = true;
+}
+
+void TimerWheel::unlink(Node &node)
+{
+    size_t slot = node.tick % SLOTS;
+    if (node.prev != -1)
+        m_nodes[node.prev].next = node.next;
+    else
+        m_slots[slot] = node.next;
+    if (node.next != -1)
+        m_nodes[node.next].prev = node.prev;
+    if (m_slots[slot] == -1)
+        m_occupied[slot / 64] &= ~(uint64_t(1) << (slot % 64));
+    node.prev = node.next = -1;
+    node.scheduled = false;
+}
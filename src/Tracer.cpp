@@ -0,0 +1,198 @@
+#include "Tracer.h"
+#include <cstdio>
+#include <fstream>
+#include <pthread.h>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace {
+    std::atomic<uint64_t> nextId = 1;
+
+    int64_t toNanoseconds(Tracer::Clock::time_point time) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+    }
+
+    // Trace event timestamps are in microseconds
+    std::string formatMicros(int64_t nanoseconds) {
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%.3f", nanoseconds / 1000.0);
+        return buffer;
+    }
+
+    std::string escape(const std::string& text) {
+        std::string escaped;
+        for (char c : text) {
+            if (c == '"' || c == '\\')
+                escaped += '\\';
+            if (static_cast<unsigned char>(c) >= 0x20)
+                escaped += c;
+        }
+        return escaped;
+    }
+}
+
+thread_local Tracer::Context Tracer::t_current;
+thread_local uint32_t Tracer::t_ticks = 0;
+
+Tracer::Scope::Scope(Tracer &tracer, uint64_t traceId, const char *name)
+    : m_previous(t_current)
+{
+    if (traceId == 0)
+        return;
+    t_current = Context{&tracer.getRing(), traceId};
+    m_span.emplace(name);
+}
+
+Tracer::Scope::~Scope()
+{
+    if (!m_span)
+        return;
+    m_span.reset();
+    t_current = m_previous;
+}
+
+Tracer::Tracer()
+    : m_id(nextId.fetch_add(1, std::memory_order_relaxed))
+{
+}
+
+Tracer::~Tracer() = default;
+
+void Tracer::start(uint32_t every)
+{
+    m_startedAt.store(toNanoseconds(Clock::now()), std::memory_order_relaxed);
+    m_every.store(std::max<uint32_t>(every, 1), std::memory_order_relaxed);
+}
+
+void Tracer::stop()
+{
+    m_every.store(0, std::memory_order_relaxed);
+}
+
+void Tracer::addInstant(const char *name, Clock::time_point at)
+{
+    if (t_current.ring && at != Clock::time_point())
+        add(t_current, Kind::INSTANT, name, at, Clock::duration());
+}
+
+void Tracer::addFlowStart(const char *name)
+{
+    if (t_current.ring)
+        add(t_current, Kind::FLOW_START, name, Clock::now(), Clock::duration());
+}
+
+void Tracer::addFlowEnd(const char *name)
+{
+    if (t_current.ring)
+        add(t_current, Kind::FLOW_END, name, Clock::now(), Clock::duration());
+}
+
+std::string Tracer::toChromeTrace() const
+{
+    int pid = getpid();
+    int64_t startedAt = m_startedAt.load(std::memory_order_relaxed);
+    std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+    auto append = [&](const std::string& event) {
+        out += first ? "\n" : ",\n";
+        out += event;
+        first = false;
+    };
+
+    std::lock_guard lock(m_mutex);
+    for (const auto& ring : m_rings) {
+        std::string thread = ",\"pid\":" + std::to_string(pid) + ",\"tid\":" + std::to_string(ring->tid);
+        std::vector<Recorded> events = read(*ring);
+        std::erase_if(events, [startedAt](const Recorded& event) { return event.start < startedAt; });
+        if (events.empty())
+            continue;
+        append("{\"name\":\"thread_name\",\"ph\":\"M\"" + thread + ",\"args\":{\"name\":\"" + escape(ring->threadName) + "\"}}");
+        for (const Recorded& event : events) {
+            std::string common = "{\"name\":\"" + escape(event.name) + "\",\"cat\":\"myhttp\",\"ts\":" +
+                                 formatMicros(event.start - startedAt) + thread;
+            std::string trace = std::to_string(event.traceId);
+            switch (event.kind) {
+                case Kind::SPAN:
+                    append(common + ",\"ph\":\"X\",\"dur\":" + formatMicros(event.duration) + ",\"args\":{\"trace\":" + trace + "}}");
+                    break;
+                case Kind::INSTANT:
+                    append(common + ",\"ph\":\"i\",\"s\":\"t\",\"args\":{\"trace\":" + trace + "}}");
+                    break;
+                case Kind::FLOW_START:
+                    append(common + ",\"ph\":\"s\",\"id\":" + trace + "}");
+                    break;
+                case Kind::FLOW_END:
+                    append(common + ",\"ph\":\"f\",\"bp\":\"e\",\"id\":" + trace + "}");
+                    break;
+            }
+        }
+    }
+    out += "\n]}\n";
+    return out;
+}
+
+void Tracer::writeChromeTrace(const std::filesystem::path &file) const
+{
+    std::ofstream out(file, std::ios::binary | std::ios::trunc);
+    if (!out)
+        throw std::runtime_error("Failed to open trace file " + file.string());
+    out << toChromeTrace();
+    if (!out)
+        throw std::runtime_error("Failed to write trace file " + file.string());
+}
+
+void Tracer::add(const Context &context, Kind kind, const char *name, Clock::time_point start, Clock::duration duration)
+{
+    Ring& ring = *context.ring;
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+    // A reader that sees any of these stores also sees the head from before them, and drops the slot
+    std::atomic_thread_fence(std::memory_order_release);
+    Event& event = ring.events[head % RING_EVENTS];
+    event.start.store(toNanoseconds(start), std::memory_order_relaxed);
+    event.duration.store(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count(), std::memory_order_relaxed);
+    event.traceId.store(context.traceId, std::memory_order_relaxed);
+    event.name.store(name, std::memory_order_relaxed);
+    event.kind.store(kind, std::memory_order_relaxed);
+    ring.head.store(head + 1, std::memory_order_release);
+}
+
+Tracer::Ring &Tracer::getRing()
+{
+    // The rings of every instance this thread recorded into, like the servers of a test run one after another
+    thread_local std::vector<std::pair<uint64_t, Ring*>> t_rings;
+    for (auto [owner, ring] : t_rings) {
+        if (owner == m_id)
+            return *ring;
+    }
+
+    auto ring = std::make_unique<Ring>();
+    ring->tid = gettid();
+    char name[16] = {};
+    pthread_getname_np(pthread_self(), name, sizeof(name));
+    ring->threadName = name;
+    std::lock_guard lock(m_mutex);
+    m_rings.push_back(std::move(ring));
+    t_rings.emplace_back(m_id, m_rings.back().get());
+    return *m_rings.back();
+}
+
+std::vector<Tracer::Recorded> Tracer::read(const Ring &ring)
+{
+    uint64_t end = ring.head.load(std::memory_order_acquire);
+    uint64_t begin = end > RING_EVENTS ? end - RING_EVENTS : 0;
+    std::vector<Recorded> events;
+    events.reserve(end - begin);
+    for (uint64_t i = begin; i < end; i++) {
+        const Event& event = ring.events[i % RING_EVENTS];
+        events.push_back(Recorded{event.start.load(std::memory_order_relaxed), event.duration.load(std::memory_order_relaxed),
+                                  event.traceId.load(std::memory_order_relaxed), event.name.load(std::memory_order_relaxed),
+                                  event.kind.load(std::memory_order_relaxed)});
+    }
+    // The thread may have overwritten the oldest ones while they were copied, and be writing over the next one
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t after = ring.head.load(std::memory_order_relaxed);
+    uint64_t firstIntact = after >= RING_EVENTS ? after - RING_EVENTS + 1 : 0;
+    if (firstIntact > begin)
+        events.erase(events.begin(), events.begin() + std::min<uint64_t>(firstIntact - begin, events.size()));
+    return events;
+}
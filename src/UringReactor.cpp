@@ -0,0 +1,479 @@
+#include "UringReactor.h"
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "Log.h"
+
+namespace {
+    constexpr unsigned RING_ENTRIES = 1024;
+    constexpr uint16_t BUFFER_GROUP = 0;
+    constexpr uint16_t BUFFER_COUNT = 512;
+    constexpr uint32_t BUFFER_SIZE = 4096;
+    // Default pipe capacity, a splice into the pipe can't move more than this at once
+    constexpr size_t SPLICE_CHUNK = 64 * 1024;
+    // The pipe holds 16 page buffers rather than a byte count, so a chunk starting inside a page must end on a page boundary
+    constexpr size_t PAGE = 4096;
+    // Tells splice to use the current position, which is the only option for pipes and sockets
+    constexpr uint64_t NO_OFFSET = static_cast<uint64_t>(-1);
+}
+
+UringReactor::UringReactor(int serverSocket, int shutdownFd, const TimerWheel::Timeouts& timeouts, const RequestParser::Limits& requestLimits,
+                           const size_t& outputHighWaterMark, const RequestLoop& requests, StaticFileCache* watchedCache,
+                           Async::EventLoop& loop, Metrics& metrics, Tracer& tracer)
+    : m_ring(RING_ENTRIES), m_serverSocket(serverSocket), m_shutdownFd(shutdownFd), m_timeouts(timeouts),
+      m_requestLimits(requestLimits), m_outputHighWaterMark(outputHighWaterMark), m_requests(requests),
+      m_watchedCache(watchedCache), m_loop(loop), m_metrics(metrics), m_tracer(tracer)
+{
+    m_ring.setupBufferRing(BUFFER_GROUP, BUFFER_COUNT, BUFFER_SIZE);
+}
+
+UringReactor::~UringReactor()
+{
+    for (auto& [fd, conn] : m_connections) {
+        shutdown(fd, SHUT_RDWR);
+        close(fd);
+        releasePipe(conn, false);
+    }
+    for (auto [readEnd, writeEnd] : m_pipes) {
+        close(readEnd);
+        close(writeEnd);
+    }
+}
+
+void UringReactor::run()
+{
+    armAccept();
+    armPoll(m_shutdownFd, SHUTDOWN_POLL);
+    if (m_watchedCache && m_watchedCache->getNotifyFd() != -1)
+        armPoll(m_watchedCache->getNotifyFd(), NOTIFY_POLL);
+    armPoll(m_loop.getFd(), ASYNC_POLL);
+    armTick();
+
+    while (m_running) {
+        // One syscall submits everything queued since the last round and waits for more work
+        if (m_ring.submitAndWait(1) == -1 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            Log::error("io_uring_enter failed: ", strerror(errno));
+            return;
+        }
+        m_ring.forEachCqe([this](const io_uring_cqe& cqe) {
+            handleCompletion(cqe);
+        });
+    }
+}
+
+void UringReactor::armAccept()
+{
+    io_uring_sqe* sqe = m_ring.getSqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = m_serverSocket;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = userData(ACCEPT, m_serverSocket);
+}
+
+void UringReactor::armRecv(Client &conn)
+{
+    // The kernel picks a buffer from the ring for every chunk it receives, until we cancel it
+    io_uring_sqe* sqe = m_ring.getSqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn.fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->user_data = userData(RECV, conn.fd);
+    conn.inflight++;
+    conn.receiving = true;
+    conn.recvCancelled = false;
+}
+
+void UringReactor::updateReading(Client &conn)
+{
+    if (conn.closing)
+        return;
+    // Stop reading from a client that isn't reading its responses until it catches up, or while an
+    // async handler has the connection, so pipelined input can't pile up behind it
+    bool wantRead = conn.output.size() < m_outputHighWaterMark && !conn.closeWhenDrained && !conn.isWaiting();
+    if (wantRead && !conn.receiving) {
+        armRecv(conn);
+    } else if (!wantRead && conn.receiving && !conn.recvCancelled) {
+        // Its last completion comes back with -ECANCELED, and anything received until then is kept
+        io_uring_sqe* sqe = m_ring.getSqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = userData(RECV, conn.fd);
+        sqe->user_data = userData(CANCEL, conn.fd);
+        conn.recvCancelled = true;
+    }
+}
+
+void UringReactor::armPoll(int fd, Op op)
+{
+    io_uring_sqe* sqe = m_ring.getSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = userData(op, fd);
+}
+
+void UringReactor::armTick()
+{
+    io_uring_sqe* sqe = m_ring.getSqe();
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->addr = reinterpret_cast<uint64_t>(&m_tick);
+    sqe->len = 1;
+    sqe->user_data = userData(TICK, 0);
+}
+
+void UringReactor::handleCompletion(const io_uring_cqe &cqe)
+{
+    Op op = static_cast<Op>(cqe.user_data >> 32);
+    int fd = static_cast<int>(cqe.user_data & 0xffffffff);
+    switch (op) {
+        case ACCEPT:
+            onAccept(cqe);
+            return;
+        case SHUTDOWN_POLL:
+            m_running = false;
+            return;
+        case NOTIFY_POLL:
+            m_watchedCache->processEvents();
+            armPoll(fd, NOTIFY_POLL);
+            return;
+        case ASYNC_POLL:
+            // Tasks are resumed right here, and whatever they answer is queued before the next submit
+            armPoll(fd, ASYNC_POLL);
+            m_loop.processEvents();
+            return;
+        case TICK:
+            timeOutConnections();
+            armTick();
+            return;
+        case CANCEL:
+            // The recv it cancelled reports that itself
+            return;
+        default:
+            break;
+    }
+
+    auto it = m_connections.find(fd);
+    if (it == m_connections.end()) {
+        // Never happens since fds are only closed once nothing is in flight, but don't leak the buffer
+        if (op == RECV && (cqe.flags & IORING_CQE_F_BUFFER))
+            m_ring.recycleBuffer(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        return;
+    }
+    Client& conn = it->second;
+    switch (op) {
+        case RECV: {
+            Tracer::Scope scope(m_tracer, m_tracer.sample(), "recv completion");
+            onRecv(conn, cqe);
+            break;
+        }
+        case SEND: onSend(conn, cqe.res); break;
+        case SPLICE_IN: onSpliceIn(conn, cqe.res); break;
+        case SPLICE_OUT: onSpliceOut(conn, cqe.res); break;
+        default: break;
+    }
+}
+
+void UringReactor::onAccept(const io_uring_cqe &cqe)
+{
+    // Multishot accept stays armed until the kernel says otherwise
+    if (!(cqe.flags & IORING_CQE_F_MORE) && m_running)
+        armAccept();
+    if (cqe.res < 0) {
+        Log::error("Failed to accept client connection: ", strerror(-cqe.res));
+        return;
+    }
+    Client& conn = m_connections[cqe.res];
+    conn.open(cqe.res, m_requestLimits);
+    // Multishot accept doesn't say who connected
+    sockaddr_storage address;
+    socklen_t addressLength = sizeof(address);
+    if (Log::isAccessLogOpen() && getpeername(conn.fd, reinterpret_cast<sockaddr*>(&address), &addressLength) == 0)
+        conn.remoteAddress = Log::formatAddress(address);
+    m_metrics.add(Metrics::Counter::CONNECTIONS_ACCEPTED);
+    touchDeadline(conn);
+    armRecv(conn);
+}
+
+void UringReactor::onRecv(Client &conn, const io_uring_cqe &cqe)
+{
+    bool more = cqe.flags & IORING_CQE_F_MORE;
+    if (cqe.res > 0 && (cqe.flags & IORING_CQE_F_BUFFER)) {
+        uint16_t id = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+        if (!conn.closing)
+            conn.input.append(m_ring.getBuffer(id), cqe.res);
+        conn.stats.bytesReceived += cqe.res;
+        m_metrics.add(Metrics::Counter::BYTES_RECEIVED, cqe.res);
+        m_ring.recycleBuffer(id);
+    }
+    if (!more) {
+        conn.inflight--;
+        conn.receiving = false;
+    }
+    if (conn.closing) {
+        finishClose(conn);
+        return;
+    }
+    // Running out of buffers or being cancelled just ends the multishot, anything else means the client is gone
+    if (cqe.res == 0 || (cqe.res < 0 && cqe.res != -ENOBUFS && cqe.res != -ECANCELED)) {
+        startClose(conn);
+        finishClose(conn);
+        return;
+    }
+
+    processInput(conn);
+    updateReading(conn);
+}
+
+void UringReactor::processInput(Client &conn)
+{
+    // What arrived before the recv was cancelled waits for the async handler's response
+    if (conn.isWaiting())
+        return;
+    // Sends are only submitted here, so there's nothing to write out before the high water mark
+    // stops it. If an async handler takes over, onAsyncDone() carries on with the rest of the input.
+    bool answered = m_requests.answer(conn, [](Connection&) { return true; },
+        [this, &conn](Connection&, Async::Task<HTTPResponse> task) {
+            startAsync(conn, std::move(task));
+            return false;
+        });
+    if (!answered)
+        return;
+    touchDeadline(conn);
+    updateReading(conn);
+    pumpOutput(conn);
+}
+
+void UringReactor::startAsync(Client &conn, Async::Task<HTTPResponse> task)
+{
+    conn.asyncState.store(Connection::AsyncState::RUNNING, std::memory_order_relaxed);
+    conn.inflight++;
+    touchDeadline(conn);
+    updateReading(conn);
+    pumpOutput(conn);
+    // If it finishes right away, onAsyncDone() carries on with the rest of the input before this returns
+    Async::spawn(std::move(task), [this, fd = conn.fd](HTTPResponse response) {
+        onAsyncDone(fd, std::move(response));
+    });
+}
+
+void UringReactor::onAsyncDone(int fd, HTTPResponse response)
+{
+    // Still here, since the handler counts as in flight
+    Client& conn = m_connections.at(fd);
+    conn.inflight--;
+    if (conn.closing) {
+        finishClose(conn);
+        return;
+    }
+    conn.asyncResponse.emplace(std::move(response));
+    m_requests.takeAsyncResponse(conn);
+    processInput(conn);
+}
+
+void UringReactor::pumpOutput(Client &conn)
+{
+    if (conn.sending || conn.closing)
+        return;
+    if (conn.output.empty()) {
+        if (conn.closeWhenDrained) {
+            startClose(conn);
+            finishClose(conn);
+        }
+        return;
+    }
+
+    // The send itself happens in the kernel after this returns
+    Tracer::Span trace("submit send");
+    const OutputQueue::Chunk& piece = conn.output.front();
+    if (piece.file) {
+        if (conn.pipe[0] == -1) {
+            if (!m_pipes.empty()) {
+                conn.pipe[0] = m_pipes.back().first;
+                conn.pipe[1] = m_pipes.back().second;
+                m_pipes.pop_back();
+            } else if (pipe2(conn.pipe, O_CLOEXEC) == -1) {
+                Log::error("Failed to create splice pipe: ", strerror(errno));
+                startClose(conn);
+                finishClose(conn);
+                return;
+            }
+        }
+        // file -> pipe -> socket, linked so both halves go to the kernel in the same submission
+        off_t offset = piece.file->offset + piece.sent;
+        conn.spliceChunk = std::min(piece.file->length - piece.sent, SPLICE_CHUNK - offset % PAGE);
+        io_uring_sqe* in = m_ring.getSqe();
+        in->opcode = IORING_OP_SPLICE;
+        in->splice_fd_in = piece.file->file->get();
+        in->splice_off_in = offset;
+        in->fd = conn.pipe[1];
+        in->off = NO_OFFSET;
+        in->len = conn.spliceChunk;
+        in->flags = IOSQE_IO_LINK;
+        in->user_data = userData(SPLICE_IN, conn.fd);
+
+        io_uring_sqe* out = m_ring.getSqe();
+        out->opcode = IORING_OP_SPLICE;
+        out->splice_fd_in = conn.pipe[0];
+        out->splice_off_in = NO_OFFSET;
+        out->fd = conn.fd;
+        out->off = NO_OFFSET;
+        out->len = conn.spliceChunk;
+        out->user_data = userData(SPLICE_OUT, conn.fd);
+        conn.inflight += 2;
+    } else {
+        // Every response queued by the last batch of requests goes out in one sendmsg
+        size_t count = conn.output.gather(conn.iov.data(), conn.iov.size());
+        size_t bytes = 0;
+        for (size_t i = 0; i < count; i++)
+            bytes += conn.iov[i].iov_len;
+        conn.msg = msghdr{};
+        conn.msg.msg_iov = conn.iov.data();
+        conn.msg.msg_iovlen = count;
+        io_uring_sqe* sqe = m_ring.getSqe();
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = conn.fd;
+        sqe->addr = reinterpret_cast<uint64_t>(&conn.msg);
+        // MSG_MORE lets the kernel coalesce the headers with the file body that follows
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL | (conn.output.size() > bytes ? MSG_MORE : 0);
+        sqe->user_data = userData(SEND, conn.fd);
+        conn.inflight++;
+    }
+    conn.sending = true;
+    conn.sendStarted = m_metrics.startTiming(Metrics::Stage::SEND);
+}
+
+void UringReactor::onSend(Client &conn, int result)
+{
+    conn.inflight--;
+    conn.sending = false;
+    m_metrics.recordSince(Metrics::Stage::SEND, conn.sendStarted);
+    if (conn.closing) {
+        finishClose(conn);
+        return;
+    }
+    if (result <= 0) {
+        startClose(conn);
+        finishClose(conn);
+        return;
+    }
+
+    m_metrics.add(Metrics::Counter::BYTES_SENT, result);
+    conn.output.consume(result);
+    afterSend(conn);
+}
+
+void UringReactor::onSpliceIn(Client &conn, int result)
+{
+    conn.inflight--;
+    // On an error the linked half is cancelled and reports it. A short read means the file was
+    // truncated, and closing the pipe's write end is the only way to unblock the other half.
+    if (result >= 0 && static_cast<size_t>(result) < conn.spliceChunk) {
+        releasePipe(conn, false);
+        startClose(conn);
+    }
+    finishClose(conn);
+}
+
+void UringReactor::onSpliceOut(Client &conn, int result)
+{
+    conn.inflight--;
+    conn.sending = false;
+    m_metrics.recordSince(Metrics::Stage::SEND, conn.sendStarted);
+    if (conn.closing) {
+        finishClose(conn);
+        return;
+    }
+    // Anything left behind in the pipe would end up in the next response, so it can't be reused
+    if (result < 0 || static_cast<size_t>(result) != conn.spliceChunk) {
+        releasePipe(conn, false);
+        startClose(conn);
+        finishClose(conn);
+        return;
+    }
+
+    // The send itself happens in the kernel after this returns
+    Tracer::Span trace("submit send");
+    const OutputQueue::Chunk& piece = conn.output.front();
+    bool fileDone = piece.sent + result == piece.file->length;
+    m_metrics.add(Metrics::Counter::BYTES_SENT, result);
+    conn.output.consume(result);
+    if (fileDone)
+        releasePipe(conn, true);
+    afterSend(conn);
+}
+
+void UringReactor::afterSend(Client &conn)
+{
+    // Requests held back by the high water mark are answered once the queue drains below it
+    if (!conn.isWaiting() && !conn.input.empty() && conn.output.size() < m_outputHighWaterMark) {
+        processInput(conn);
+        return;
+    }
+    touchDeadline(conn);
+    updateReading(conn);
+    pumpOutput(conn);
+}
+
+void UringReactor::touchDeadline(Client &conn)
+{
+    // Not waiting on the client while an async handler answers it
+    if (conn.isWaiting()) {
+        m_timers.cancel(conn.fd);
+        return;
+    }
+    TimerWheel::Deadline kind = TimerWheel::Deadline::KEEP_ALIVE;
+    if (!conn.output.empty())
+        kind = TimerWheel::Deadline::WRITE_STALL;
+    else if (!conn.input.empty())
+        kind = conn.parser.isReadingBody() ? TimerWheel::Deadline::BODY_READ : TimerWheel::Deadline::HEADER_READ;
+    m_timers.touch(conn.fd, kind, m_timeouts.get(kind));
+}
+
+void UringReactor::timeOutConnections()
+{
+    for (const TimerWheel::Expired& expired : m_timers.advance()) {
+        Client& conn = m_connections.at(expired.fd);
+        m_metrics.add(Metrics::Counter::CONNECTIONS_TIMED_OUT);
+        startClose(conn);
+        finishClose(conn);
+    }
+}
+
+void UringReactor::startClose(Client &conn)
+{
+    if (conn.closing)
+        return;
+    conn.closing = true;
+    m_timers.cancel(conn.fd);
+    // Completes the multishot recv and fails any pending send, so their completions come back to us
+    shutdown(conn.fd, SHUT_RDWR);
+}
+
+void UringReactor::finishClose(Client &conn)
+{
+    if (!conn.closing || conn.inflight > 0)
+        return;
+    releasePipe(conn, !conn.sending && conn.output.empty());
+    int fd = conn.fd;
+    conn.release();
+    close(fd);
+    m_connections.erase(fd);
+    m_metrics.add(Metrics::Counter::CONNECTIONS_CLOSED);
+}
+
+void UringReactor::releasePipe(Client &conn, bool reusable)
+{
+    if (conn.pipe[0] == -1)
+        return;
+    if (reusable) {
+        m_pipes.emplace_back(conn.pipe[0], conn.pipe[1]);
+    } else {
+        close(conn.pipe[0]);
+        close(conn.pipe[1]);
+    }
+    conn.pipe[0] = conn.pipe[1] = -1;
+}
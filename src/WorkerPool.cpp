@@ -1,49 +1,146 @@
 #include "WorkerPool.h"
 #include <iostream>
+#include <pthread.h>
+
+namespace {
+    // Big enough that the epoll thread practically never waits for room
+    constexpr size_t INJECTION_CAPACITY = 4096;
+    // How many times an idle worker looks for work again before it parks
+    constexpr int SPIN_ROUNDS = 64;
+
+    // Which pool and worker the current thread is, so a task queued from a worker stays on its deque
+    thread_local const WorkerPool* t_pool = nullptr;
+    thread_local size_t t_index = 0;
+
+    void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#else
+        std::this_thread::yield();
+#endif
+    }
+}
 
 WorkerPool::WorkerPool(size_t numThreads)
+    : m_injected(INJECTION_CAPACITY)
 {
+    // Every deque exists before any worker starts stealing from it
+    for (size_t i = 0; i < numThreads; ++i) {
+        m_workers.push_back(std::make_unique<Worker>());
+    }
     for (size_t i = 0; i < numThreads; ++i) {
-        m_workers.emplace_back([this] { this->run(); });
+        m_workers[i]->thread = std::thread([this, i] { this->run(i); });
     }
 }
 
+WorkerPool::~WorkerPool()
+{
+    stop();
+}
+
 void WorkerPool::stop()
 {
     // Join all threads
-    m_queueMutex.lock();
-    m_stop = true;
-    m_queueMutex.unlock();
-    m_cv.notify_all();
-    for (std::thread &worker : m_workers) {
-        if (worker.joinable())
-            worker.join();
+    m_stop.store(true);
+    m_wakeups.fetch_add(1);
+    m_wakeups.notify_all();
+    for (auto &worker : m_workers) {
+        if (worker->thread.joinable())
+            worker->thread.join();
     }
 }
 
-void WorkerPool::enqueue(std::function<void()> task)
+void WorkerPool::enqueue(Task task)
 {
-    m_queueMutex.lock();
-    m_tasks.push(std::move(task));
-    m_queueMutex.unlock();
-    m_cv.notify_one();
+    if (m_workers.empty()) {
+        task();
+        return;
+    }
+    if (t_pool == this) {
+        m_workers[t_index]->deque.push(std::make_unique<Task>(std::move(task)));
+    } else {
+        // Only full if the workers are far behind, give them a moment
+        while (!m_injected.tryPush(task)) {
+            wakeOne();
+            std::this_thread::yield();
+        }
+    }
+    wakeOne();
 }
 
-void WorkerPool::run()
+size_t WorkerPool::getQueueDepth() const
 {
-    std::function<void()> task;
+    size_t depth = m_injected.sizeApprox();
+    for (const auto& worker : m_workers)
+        depth += worker->deque.sizeApprox();
+    return depth;
+}
+
+void WorkerPool::run(size_t index)
+{
+    t_pool = this;
+    t_index = index;
+    // Shows up in top, gdb and traces
+    pthread_setname_np(pthread_self(), "myhttp-worker");
+    Task task;
     while (true) {
-        {
-            std::unique_lock<std::mutex> lock(m_queueMutex);
-            // Wait until we are notified and there is a task or we are stopping
-            m_cv.wait(lock, [&]{ return m_stop || !m_tasks.empty(); });
-            
-            // Handle shutdown
-            if (m_stop && m_tasks.empty()) return;
-
-            task = std::move(m_tasks.front());
-            m_tasks.pop();
-        } // unlock before running the task
+        bool found = findTask(index, task);
+        for (int round = 0; !found && round < SPIN_ROUNDS; round++) {
+            // Spin a little, then give the CPU to anyone else who can use it
+            if (round < SPIN_ROUNDS / 2)
+                cpuRelax();
+            else
+                std::this_thread::yield();
+            found = findTask(index, task);
+        }
+
+        if (!found) {
+            // Announce we're about to park, then look once more. A task queued after this
+            // look sees us parked and bumps m_wakeups, so the wait below returns right away.
+            uint32_t wakeups = m_wakeups.load();
+            m_parked.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            found = findTask(index, task);
+            if (!found) {
+                if (m_stop.load()) {
+                    m_parked.fetch_sub(1);
+                    return;
+                }
+                m_wakeups.wait(wakeups);
+            }
+            m_parked.fetch_sub(1);
+            if (!found)
+                continue;
+        }
         task(); // run the job
+        task = Task();
+    }
+}
+
+bool WorkerPool::findTask(size_t index, Task &task)
+{
+    if (std::unique_ptr<Task> own = m_workers[index]->deque.pop()) {
+        task = std::move(*own);
+        return true;
+    }
+    if (m_injected.tryPop(task))
+        return true;
+    // Start with the next worker over, so thieves don't all pile onto the same victim
+    for (size_t i = 1; i < m_workers.size(); i++) {
+        if (std::unique_ptr<Task> stolen = m_workers[(index + i) % m_workers.size()]->deque.steal()) {
+            task = std::move(*stolen);
+            return true;
+        }
     }
-}
\ No newline at end of file
+    return false;
+}
+
+void WorkerPool::wakeOne()
+{
+    // Pairs with the fence in run(), either the worker sees the task or we see the worker
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_parked.load(std::memory_order_relaxed) == 0)
+        return;
+    m_wakeups.fetch_add(1);
+    m_wakeups.notify_one();
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+
+// A fixture with an empty directory of its own for the files a test serves, removed afterwards
+class TempDirTest : public ::testing::Test {
+protected:
+    std::filesystem::path m_dir;
+
+    /// @param name Part of the directory's name, so fixtures running at once don't share one.
+    explicit TempDirTest(const std::string& name)
+        : m_dir(std::filesystem::weakly_canonical(std::filesystem::temp_directory_path()) / ("myhttp_" + name + "_" + std::to_string(getpid()))) {}
+
+    void SetUp() override {
+        std::filesystem::create_directories(m_dir);
+    }
+
+    void TearDown() override {
+        std::filesystem::remove_all(m_dir);
+    }
+
+    void writeFile(const std::string& name, const std::string& content) {
+        std::ofstream file(m_dir / name, std::ios::binary | std::ios::trunc);
+        file << content;
+    }
+};
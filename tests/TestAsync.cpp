@@ -0,0 +1,104 @@
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "Async.h"
+
+using namespace std::chrono_literals;
+
+namespace {
+    Async::Task<int> square(int value) {
+        co_return value * value;
+    }
+
+    Async::Task<int> sumOfSquares(int a, int b) {
+        int first = co_await square(a);
+        co_return first + co_await square(b);
+    }
+
+    Async::Task<int> fail() {
+        throw std::runtime_error("failed");
+        co_return 0;
+    }
+
+    Async::Task<void> sleepAndRecord(std::chrono::milliseconds duration, int id, std::vector<int>& order) {
+        co_await Async::sleep(duration);
+        order.push_back(id);
+    }
+}
+
+TEST(AsyncTest, ChainsTasks) {
+    EXPECT_EQ(Async::run(sumOfSquares(3, 4)), 25);
+    EXPECT_THROW(Async::run(fail()), std::runtime_error);
+
+    // A task that never waits finishes before spawn returns
+    int result = 0;
+    Async::spawn(square(5), [&result](int value) { result = value; });
+    EXPECT_EQ(result, 25);
+}
+
+TEST(AsyncTest, SleepsConcurrently) {
+    std::vector<int> order;
+    auto start = std::chrono::steady_clock::now();
+    Async::run([](std::vector<int>& order) -> Async::Task<void> {
+        Async::spawn(sleepAndRecord(60ms, 3, order), [] {});
+        Async::spawn(sleepAndRecord(20ms, 1, order), [] {});
+        Async::spawn(sleepAndRecord(40ms, 2, order), [] {});
+        co_await Async::sleep(80ms);
+    }(order));
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    EXPECT_EQ(order, (std::vector<int>{1, 2, 3}));
+    EXPECT_GE(elapsed, 80ms);
+    EXPECT_LT(elapsed, 150ms);
+}
+
+TEST(AsyncTest, WaitsOnSockets) {
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds), 0);
+    std::string received = Async::run([](int reader, int writer) -> Async::Task<std::string> {
+        // Nothing to read until the other task has slept
+        Async::spawn([](int writer) -> Async::Task<void> {
+            co_await Async::sleep(20ms);
+            co_await Async::send(writer, "hello");
+        }(writer), [] {});
+        char buffer[16];
+        ssize_t bytes = co_await Async::recv(reader, buffer, sizeof(buffer));
+        co_return std::string(buffer, std::max<ssize_t>(bytes, 0));
+    }(fds[0], fds[1]));
+    EXPECT_EQ(received, "hello");
+
+    // Regular files are always ready as far as epoll is concerned, so it refuses them
+    FILE* file = tmpfile();
+    bool waited = Async::run([](int fd) -> Async::Task<bool> {
+        co_return co_await Async::readable(fd);
+    }(fileno(file)));
+    EXPECT_FALSE(waited);
+    fclose(file);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(AsyncTest, ReadsFiles) {
+    std::filesystem::path path = std::filesystem::temp_directory_path() / ("myhttp_async_" + std::to_string(getpid()));
+    std::ofstream(path) << "file contents";
+    EXPECT_EQ(Async::run(Async::readFile(path)), "file contents");
+    std::filesystem::remove(path);
+    EXPECT_EQ(Async::run(Async::readFile(path)), std::nullopt);
+}
+
+TEST(AsyncTest, NeedsALoopToWait) {
+    // Waiting outside a loop throws into the task instead of hanging
+    bool threw = false;
+    Async::spawn([]() -> Async::Task<bool> {
+        try {
+            co_await Async::sleep(1ms);
+        } catch (const std::runtime_error&) {
+            co_return true;
+        }
+        co_return false;
+    }(), [&threw](bool value) { threw = value; });
+    EXPECT_TRUE(threw);
+}
@@ -0,0 +1,173 @@
+#include <gtest/gtest.h>
+#include "Compression.h"
+#include "Router.h"
+#include "TempDirTest.h"
+#ifdef MYHTTP_WITH_ZLIB
+#include <zlib.h>
+#endif
+#ifdef MYHTTP_WITH_BROTLI
+#include <brotli/decode.h>
+#endif
+
+namespace {
+    std::string sampleText() {
+        std::string text;
+        for (int i = 0; i < 200; i++)
+            text += "<li class=\"item\"><a href=\"/items/" + std::to_string(i) + "\">Item number " + std::to_string(i) + "</a></li>\n";
+        return text;
+    }
+
+    std::string decompress(std::string_view data, Compression::Encoding encoding) {
+        std::string out(1 << 20, '\0');
+#ifdef MYHTTP_WITH_ZLIB
+        if (encoding == Compression::GZIP) {
+            z_stream stream{};
+            inflateInit2(&stream, 15 + 16);
+            stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+            stream.avail_in = data.size();
+            stream.next_out = reinterpret_cast<Bytef*>(out.data());
+            stream.avail_out = out.size();
+            int result = inflate(&stream, Z_FINISH);
+            out.resize(stream.total_out);
+            inflateEnd(&stream);
+            return result == Z_STREAM_END ? out : "";
+        }
+#endif
+#ifdef MYHTTP_WITH_BROTLI
+        if (encoding == Compression::BROTLI) {
+            size_t size = out.size();
+            auto result = BrotliDecoderDecompress(data.size(), reinterpret_cast<const uint8_t*>(data.data()), &size, reinterpret_cast<uint8_t*>(out.data()));
+            out.resize(size);
+            return result == BROTLI_DECODER_RESULT_SUCCESS ? out : "";
+        }
+#endif
+        return "";
+    }
+}
+
+TEST(CompressionTest, ParsesAcceptEncoding) {
+    using namespace Compression;
+    EXPECT_EQ(parseAcceptEncoding("gzip, deflate, br, zstd"), GZIP | BROTLI);
+    EXPECT_EQ(parseAcceptEncoding("GZIP;q=0.5"), GZIP);
+    EXPECT_EQ(parseAcceptEncoding("gzip;q=0, br;q=0.1"), BROTLI);
+    EXPECT_EQ(parseAcceptEncoding("br; q=0.000 , gzip"), GZIP);
+    EXPECT_EQ(parseAcceptEncoding("*"), GZIP | BROTLI);
+    EXPECT_EQ(parseAcceptEncoding("identity"), IDENTITY);
+    EXPECT_EQ(parseAcceptEncoding(""), IDENTITY);
+}
+
+TEST(CompressionTest, StreamsRoundTrip) {
+    std::string text = sampleText();
+    for (Compression::Encoding encoding : {Compression::GZIP, Compression::BROTLI}) {
+        if (!(Compression::getAvailable() & encoding))
+            continue;
+        // Fed in uneven pieces, the result must be one valid stream
+        Compression::Compressor compressor(encoding, Compression::Settings());
+        std::string compressed;
+        for (size_t offset = 0; offset < text.size(); offset += 777)
+            compressor.write(std::string_view(text).substr(offset, 777), compressed);
+        compressor.finish(compressed);
+        EXPECT_LT(compressed.size(), text.size() / 4) << Compression::getName(encoding);
+        EXPECT_EQ(decompress(compressed, encoding), text) << Compression::getName(encoding);
+    }
+}
+
+TEST(CompressionTest, CompressesOnlyWhatIsWorthIt) {
+    if (Compression::getAvailable() == Compression::IDENTITY)
+        GTEST_SKIP() << "Built without any compression library";
+    Compression::Settings settings;
+
+    HTTPResponse page(HTTPResponse::Status::OK, {{"Content-Type", "text/html; charset=utf-8"}});
+    page.setBody(sampleText());
+    EXPECT_TRUE(Compression::compressResponse(page, Compression::GZIP | Compression::BROTLI, settings));
+    Compression::Encoding used = Compression::choose(Compression::GZIP | Compression::BROTLI);
+    EXPECT_EQ(page.getHeader("Content-Encoding"), std::string(Compression::getName(used)));
+    EXPECT_EQ(page.getHeader("Vary"), "Accept-Encoding");
+    EXPECT_EQ(page.getHeader("Content-Length"), std::to_string(page.getBody().size()));
+    EXPECT_EQ(decompress(page.getBody(), used), sampleText());
+
+    HTTPResponse small(HTTPResponse::Status::OK, {{"Content-Type", "text/html"}});
+    small.setBody("<p>hi</p>");
+    EXPECT_FALSE(Compression::compressResponse(small, Compression::GZIP | Compression::BROTLI, settings));
+
+    HTTPResponse image(HTTPResponse::Status::OK, {{"Content-Type", "image/png"}});
+    image.setBody(sampleText());
+    EXPECT_FALSE(Compression::compressResponse(image, Compression::GZIP | Compression::BROTLI, settings));
+
+    HTTPResponse refused(HTTPResponse::Status::OK, {{"Content-Type", "text/html"}});
+    refused.setBody(sampleText());
+    EXPECT_FALSE(Compression::compressResponse(refused, Compression::IDENTITY, settings));
+    EXPECT_EQ(refused.getBody(), sampleText());
+}
+
+class StaticCompressionTest : public TempDirTest {
+protected:
+    StaticCompressionTest() : TempDirTest("compression") {}
+};
+
+TEST_F(StaticCompressionTest, PrefersSidecarFiles) {
+    writeFile("app.js", sampleText());
+    writeFile("app.js.gz", "precompressed");
+    Router router(m_dir);
+
+    auto encoded = router.getStaticFile(HTTPRequest::Method::GET, "/app.js", Compression::GZIP);
+    ASSERT_TRUE(encoded.has_value());
+    EXPECT_EQ(encoded->getHeader("Content-Encoding"), "gzip");
+    EXPECT_EQ(encoded->getHeader("Content-Type"), "application/javascript");
+    ASSERT_TRUE(encoded->getFileBody().has_value());
+    EXPECT_EQ(encoded->getFileBody()->length, std::string("precompressed").size());
+
+    // Served from the cache the second time, still the sidecar
+    auto cached = router.getStaticFile(HTTPRequest::Method::GET, "/app.js", Compression::GZIP);
+    ASSERT_TRUE(cached.has_value());
+    EXPECT_TRUE(cached->toString().ends_with("\r\n\r\nprecompressed"));
+
+    // A client without gzip still gets the original
+    auto plain = router.getStaticFile(HTTPRequest::Method::GET, "/app.js");
+    ASSERT_TRUE(plain.has_value());
+    EXPECT_FALSE(plain->getHeader("Content-Encoding").has_value());
+    ASSERT_TRUE(plain->getFileBody().has_value());
+    EXPECT_EQ(plain->getFileBody()->length, sampleText().size());
+}
+
+TEST_F(StaticCompressionTest, CachesEachSetOfEncodingsApart) {
+    // Too small to be compressed on the fly, so the sidecar is the only encoded copy
+    writeFile("app.js", "let a = 1;");
+    writeFile("app.js.gz", "precompressed");
+    Router router(m_dir);
+
+    // Brotli is preferred, but only the gzip sidecar exists
+    auto both = router.getStaticFile(HTTPRequest::Method::GET, "/app.js", Compression::BROTLI | Compression::GZIP);
+    ASSERT_TRUE(both.has_value());
+    EXPECT_EQ(both->getHeader("Content-Encoding"), "gzip");
+
+    // A client that only takes brotli must not be handed what was cached for the one above
+    auto brotli = router.getStaticFile(HTTPRequest::Method::GET, "/app.js", Compression::BROTLI);
+    ASSERT_TRUE(brotli.has_value());
+    EXPECT_EQ(brotli->toString().find("Content-Encoding: gzip"), std::string::npos);
+    brotli = router.getStaticFile(HTTPRequest::Method::GET, "/app.js", Compression::BROTLI);
+    ASSERT_TRUE(brotli.has_value());
+    EXPECT_EQ(brotli->toString().find("Content-Encoding: gzip"), std::string::npos);
+}
+
+TEST_F(StaticCompressionTest, CompressesTextFilesOnce) {
+    if (!(Compression::getAvailable() & Compression::GZIP))
+        GTEST_SKIP() << "Built without zlib";
+    writeFile("page.html", sampleText());
+    writeFile("photo.png", sampleText());
+    Router router(m_dir);
+
+    auto first = router.getStaticFile(HTTPRequest::Method::GET, "/page.html", Compression::GZIP);
+    ASSERT_TRUE(first.has_value());
+    EXPECT_EQ(first->getHeader("Content-Encoding"), "gzip");
+    EXPECT_EQ(decompress(first->getBody(), Compression::GZIP), sampleText());
+    auto second = router.getStaticFile(HTTPRequest::Method::GET, "/page.html", Compression::GZIP);
+    ASSERT_TRUE(second.has_value());
+    EXPECT_NE(second->getSerialized(), nullptr);
+    EXPECT_EQ(router.getStaticFileCache().getStats().hits, 1);
+
+    // Not on the allow-list, sent as is
+    auto image = router.getStaticFile(HTTPRequest::Method::GET, "/photo.png", Compression::GZIP);
+    ASSERT_TRUE(image.has_value());
+    EXPECT_FALSE(image->getHeader("Content-Encoding").has_value());
+}
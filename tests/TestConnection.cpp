@@ -0,0 +1,77 @@
+#include <gtest/gtest.h>
+#include "Connection.h"
+
+using namespace std::chrono_literals;
+using Deadline = TimerWheel::Deadline;
+
+TEST(ConnectionTest, ReuseStartsClean) {
+    ConnectionTable table(1024);
+    Connection* conn = table.get(7);
+    ASSERT_NE(conn, nullptr);
+    conn->open(7, RequestParser::Limits());
+    uint32_t generation = conn->generation;
+    conn->input = "GET / HTTP/1.1\r\nHost: half";
+    conn->output.push(std::string("queued"));
+    conn->closeWhenDrained = true;
+    conn->release();
+    EXPECT_FALSE(conn->isOpen());
+
+    // The same fd accepted again is a new client, nothing of the old one may leak into it
+    conn->open(7, RequestParser::Limits());
+    EXPECT_TRUE(conn->isOpen());
+    EXPECT_NE(conn->generation, generation);
+    EXPECT_TRUE(conn->input.empty());
+    EXPECT_TRUE(conn->output.empty());
+    EXPECT_FALSE(conn->closeWhenDrained);
+    EXPECT_EQ(conn->stats.requests, 0);
+}
+
+TEST(ConnectionTest, PublishesDeadlines) {
+    Connection conn;
+    conn.open(3, RequestParser::Limits());
+    auto start = Connection::Clock::now();
+    conn.setDeadline(Deadline::HEADER_READ, 1s, start);
+    auto timeout = conn.getTimeout();
+    ASSERT_TRUE(timeout.has_value());
+    EXPECT_EQ(timeout->kind, Deadline::HEADER_READ);
+    EXPECT_GE(timeout->deadline, start + 1s);
+    EXPECT_LT(timeout->deadline, start + 1s + 1ms);
+
+    conn.hold();
+    EXPECT_FALSE(conn.getTimeout().has_value());
+
+    // More of the same headers don't move the deadline, a new state does
+    conn.setDeadline(Deadline::HEADER_READ, 1s, start + 500ms);
+    EXPECT_LT(conn.getTimeout()->deadline, start + 1s + 1ms);
+    conn.setDeadline(Deadline::WRITE_STALL, 2s, start + 500ms);
+    EXPECT_EQ(conn.getTimeout()->kind, Deadline::WRITE_STALL);
+    EXPECT_GE(conn.getTimeout()->deadline, start + 2500ms);
+
+    // A reused slot doesn't keep the last client's header deadline
+    conn.release();
+    conn.open(3, RequestParser::Limits());
+    conn.setDeadline(Deadline::HEADER_READ, 1s, start + 10s);
+    EXPECT_GE(conn.getTimeout()->deadline, start + 11s);
+}
+
+TEST(ConnectionTest, TableSlotsStayPut) {
+    ConnectionTable table(1000);
+    EXPECT_EQ(table.find(5), nullptr);
+    Connection* first = table.get(5);
+    ASSERT_NE(first, nullptr);
+    EXPECT_EQ(table.find(5), first);
+
+    // Growing into a new page doesn't move the old one
+    Connection* far = table.get(900);
+    ASSERT_NE(far, nullptr);
+    EXPECT_EQ(table.get(5), first);
+    EXPECT_EQ(table.get(1024), nullptr);
+    EXPECT_EQ(table.get(-1), nullptr);
+
+    first->open(5, RequestParser::Limits());
+    far->open(900, RequestParser::Limits());
+    EXPECT_EQ(table.getOpen().size(), 2);
+    far->release();
+    ASSERT_EQ(table.getOpen().size(), 1);
+    EXPECT_EQ(table.getOpen()[0]->fd, 5);
+}
@@ -4,10 +4,139 @@
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <filesystem>
+#include <fstream>
+#include <utility>
 #include "Server.h"
 
 const int PORT = 8081;
 
+// Reads one response with a Content-Length body. Anything received after it, like the
+// next pipelined response, is left in pending for the next call.
+static std::string readResponse(int sock, std::string& pending) {
+    char buffer[4096];
+    while (true) {
+        size_t end = pending.find("\r\n\r\n");
+        if (end != std::string::npos) {
+            size_t index = pending.find("Content-Length: ");
+            size_t length = index < end ? std::stoul(pending.substr(index + 16)) : 0;
+            if (pending.size() >= end + 4 + length) {
+                std::string response = pending.substr(0, end + 4 + length);
+                pending.erase(0, end + 4 + length);
+                return response;
+            }
+        }
+        int n = recv(sock, buffer, sizeof(buffer), 0);
+        if (n <= 0)
+            return std::exchange(pending, std::string());
+        pending.append(buffer, n);
+    }
+}
+
+// Answers after a delay without holding a thread, for every server below
+static void addSlowRoute(Server& server) {
+    server.addAsyncRoute("/slow/:millis", HTTPRequest::Method::GET | HTTPRequest::Method::HEAD, [](const HTTPRequest& req) -> Async::Task<HTTPResponse> {
+        std::string millis = req.getParam("millis").value_or("0");
+        co_await Async::sleep(std::chrono::milliseconds(std::stoi(millis)));
+        co_return ResponseGenerator::generateHTMLResponse("slow " + millis);
+    });
+}
+
+// HEAD gets the Content-Length GET would, but no body, so the pipelined GET's response follows its header section
+static void expectHeadThenGet(int sock, const std::string& route) {
+    std::string request = " " + route + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    std::string requests = "HEAD" + request + "GET" + request;
+    send(sock, requests.data(), requests.size(), 0);
+    std::string pending;
+    char buffer[4096];
+    while (pending.find("\r\n\r\n") == std::string::npos) {
+        int n = recv(sock, buffer, sizeof(buffer), 0);
+        ASSERT_GT(n, 0);
+        pending.append(buffer, n);
+    }
+    size_t end = pending.find("\r\n\r\n") + 4;
+    std::string head = pending.substr(0, end);
+    pending.erase(0, end);
+    EXPECT_TRUE(head.starts_with("HTTP/1.1 200 OK"));
+    size_t index = head.find("Content-Length: ");
+    ASSERT_NE(index, std::string::npos);
+    EXPECT_GT(std::stoul(head.substr(index + 16)), 0);
+    EXPECT_TRUE(readResponse(sock, pending).starts_with("HTTP/1.1 200 OK"));
+}
+
+// Answers GET and HEAD alike, the server drops the body for HEAD
+static void addHelloRoute(Server& server) {
+    server.addRoute("/hello", HTTPRequest::Method::GET | HTTPRequest::Method::HEAD, [](const HTTPRequest&) {
+        return ResponseGenerator::generateHTMLResponse("hello-body");
+    });
+}
+
+// Sends a pipelined async request between two plain ones, the responses have to come back in order
+static void expectPipelinedAsyncInOrder(int sock) {
+    std::string pending;
+    std::string get = "GET /test.txt HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    std::string requests = get + "GET /slow/50 HTTP/1.1\r\nHost: localhost\r\n\r\n" + get;
+    send(sock, requests.data(), requests.size(), 0);
+    EXPECT_TRUE(readResponse(sock, pending).find("EndOfTest") != std::string::npos);
+    std::string slow = readResponse(sock, pending);
+    EXPECT_TRUE(slow.starts_with("HTTP/1.1 200 OK"));
+    EXPECT_TRUE(slow.ends_with("slow 50"));
+    EXPECT_TRUE(readResponse(sock, pending).find("EndOfTest") != std::string::npos);
+}
+
+// Makes a request, then checks that /metrics counted it
+static void expectMetricsServed(int sock) {
+    std::string pending;
+    std::string requests = "GET /test.txt HTTP/1.1\r\nHost: localhost\r\n\r\nGET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    send(sock, requests.data(), requests.size(), 0);
+    EXPECT_TRUE(readResponse(sock, pending).find("EndOfTest") != std::string::npos);
+    std::string metrics = readResponse(sock, pending);
+    EXPECT_TRUE(metrics.find("Content-Type: text/plain; version=0.0.4") != std::string::npos);
+    size_t index = metrics.find("\nmyhttp_requests_total ");
+    ASSERT_NE(index, std::string::npos);
+    EXPECT_GE(std::stoul(metrics.substr(index + 23)), 2u);
+    EXPECT_TRUE(metrics.find("myhttp_stage_duration_seconds_count{stage=\"handler\"} ") != std::string::npos);
+    EXPECT_TRUE(metrics.find("myhttp_responses_total{code=\"2xx\"} ") != std::string::npos);
+}
+
+// Far more than the socket buffers hold. Written into the served directory by the tests that read it slowly,
+// and removed by their fixture's TearDown() whether they pass or not.
+static const std::filesystem::path SLOW_READER_FILE = "../../public_html/slow_reader.bin";
+
+static std::string writeSlowReaderFile() {
+    std::string contents(1 << 20, '\0');
+    for (size_t i = 0; i < contents.size(); i++)
+        contents[i] = 'a' + i % 26;
+    std::ofstream(SLOW_READER_FILE, std::ios::binary) << contents;
+    return contents;
+}
+
+// A client with a small receive buffer, so the server has to park what doesn't fit
+static int connectSlowReader(int port) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    int size = 4096;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    EXPECT_EQ(connect(sock, (struct sockaddr*)&addr, sizeof(addr)), 0);
+    return sock;
+}
+
+// A sample from a server's /metrics, given its name and labels
+static uint64_t readMetric(int port, const std::string& sample) {
+    int sock = connectSlowReader(port);
+    std::string pending;
+    const char* request = "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    send(sock, request, strlen(request), 0);
+    std::string metrics = readResponse(sock, pending);
+    close(sock);
+    // At the start of a line, not in its # HELP comment
+    size_t index = metrics.find("\n" + sample + " ");
+    return index == std::string::npos ? 0 : std::stoull(metrics.substr(index + sample.size() + 2));
+}
+
 class IntegrationTest : public ::testing::Test {
 protected:
     static void runServer() {
@@ -27,9 +156,15 @@ protected:
             );
             return res;
         });
+        addSlowRoute(server);
+        addHelloRoute(server);
+        server.enableMetrics();
+        s_server = &server;
         server.start();
     }
     static std::thread serverThread;
+    // For switching things on while it runs
+    static Server* s_server;
 
     // Runs once before any test in this suite
     static void SetUpTestSuite() {
@@ -43,6 +178,10 @@ protected:
         serverThread.detach();
     }
 
+    void TearDown() override {
+        std::filesystem::remove(SLOW_READER_FILE);
+    }
+
     // Utility function to open a client connection
     int connectClient() {
         int sock = socket(AF_INET, SOCK_STREAM, 0);
@@ -60,6 +199,7 @@ protected:
 };
 
 std::thread IntegrationTest::serverThread;
+Server* IntegrationTest::s_server = nullptr;
 
 TEST_F(IntegrationTest, SimpleGET) {
     // Connect as a client
@@ -149,4 +289,447 @@ TEST_F(IntegrationTest, PostRequest) {
     EXPECT_TRUE(response.find("200 OK") != std::string::npos);
     EXPECT_TRUE(response.find("name=Jake&email=jake@jake.com") != std::string::npos);
     close(sock);
-}
\ No newline at end of file
+}
+
+TEST_F(IntegrationTest, PipelinedRequests) {
+    int sock = connectClient();
+    std::string pending;
+
+    // Three requests in one segment, the last one arriving split across two sends
+    std::string get = "GET /test.txt HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    std::string body = "name=Jake";
+    std::string post = "POST /cs290/HW3-moleskij/contact.html HTTP/1.1\r\nHost: localhost\r\nContent-Length: " +
+                       std::to_string(body.size()) + "\r\n\r\n" + body;
+    std::string requests = get + post + get;
+    send(sock, requests.data(), requests.size() - 10, 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    send(sock, requests.data() + requests.size() - 10, 10, 0);
+
+    std::string first = readResponse(sock, pending);
+    EXPECT_TRUE(first.starts_with("HTTP/1.1 200 OK"));
+    EXPECT_TRUE(first.find("EndOfTest") != std::string::npos);
+    std::string second = readResponse(sock, pending);
+    EXPECT_TRUE(second.starts_with("HTTP/1.1 200 OK"));
+    EXPECT_TRUE(second.find("name=Jake") != std::string::npos);
+    std::string third = readResponse(sock, pending);
+    EXPECT_TRUE(third.starts_with("HTTP/1.1 200 OK"));
+    EXPECT_TRUE(third.find("EndOfTest") != std::string::npos);
+    close(sock);
+}
+
+TEST_F(IntegrationTest, HeadHasNoBody) {
+    int sock = connectClient();
+    expectHeadThenGet(sock, "/hello");
+    expectHeadThenGet(sock, "/slow/0");
+    close(sock);
+}
+
+TEST_F(IntegrationTest, ChunkedBodyIsNeverAnsweredAsARequest) {
+    // A chunk hides a second request. Framed by its Content-Length, which only covers the chunk size line,
+    // the body would end there and the hidden request would be answered next.
+    std::string smuggled = "GET /test.txt HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    char sizeLine[16];
+    snprintf(sizeLine, sizeof(sizeLine), "%zx\r\n", smuggled.size());
+    std::string body = sizeLine + smuggled + "\r\n0\r\n\r\n";
+    std::string post = "POST /cs290/HW3-moleskij/contact.html HTTP/1.1\r\nHost: localhost\r\n";
+    std::string chunked = post + "Transfer-Encoding: chunked\r\n\r\n" + body;
+    std::string both = post + "Content-Length: " + std::to_string(strlen(sizeLine)) + "\r\nTransfer-Encoding: chunked\r\n\r\n" + body;
+    for (const auto& [request, status] : {std::pair(chunked, "HTTP/1.1 501 Not Implemented"),
+                                          std::pair(both, "HTTP/1.1 400 Bad Request")}) {
+        int sock = connectClient();
+        std::string pending;
+        send(sock, request.data(), request.size(), 0);
+        EXPECT_TRUE(readResponse(sock, pending).starts_with(status));
+        // Nothing else is answered, the server hangs up
+        EXPECT_EQ(readResponse(sock, pending), "");
+        close(sock);
+    }
+}
+
+TEST_F(IntegrationTest, OversizedRequestIsRejected) {
+    int sock = connectClient();
+    std::string pending;
+    std::string request = "POST /cs290/HW3-moleskij/contact.html HTTP/1.1\r\nHost: localhost\r\nContent-Length: 1000000000\r\n\r\n";
+    send(sock, request.c_str(), request.size(), 0);
+    std::string response = readResponse(sock, pending);
+    EXPECT_TRUE(response.starts_with("HTTP/1.1 413 Payload Too Large"));
+    close(sock);
+
+    sock = connectClient();
+    // Just over the default 16 KiB limit, small enough that the server reads all of it before hanging up
+    request = "GET /test.txt HTTP/1.1\r\nHost: localhost\r\nCookie: " + std::string(17000, 'a') + "\r\n\r\n";
+    send(sock, request.c_str(), request.size(), 0);
+    response = readResponse(sock, pending);
+    EXPECT_TRUE(response.starts_with("HTTP/1.1 431 Request Header Fields Too Large"));
+    close(sock);
+}
+
+TEST_F(IntegrationTest, ConnectionHeaderIgnoresCase) {
+    int sock = connectClient();
+    std::string pending;
+    const char* request = "GET /test.txt HTTP/1.1\r\nhost: localhost\r\nconnection: close\r\n\r\n";
+    send(sock, request, strlen(request), 0);
+    std::string response = readResponse(sock, pending);
+    EXPECT_TRUE(response.starts_with("HTTP/1.1 200 OK"));
+
+    // The server hangs up once the response is sent
+    char buffer[16];
+    EXPECT_EQ(recv(sock, buffer, sizeof(buffer), 0), 0);
+    close(sock);
+}
+
+TEST_F(IntegrationTest, SlowReader) {
+    std::string expected = writeSlowReaderFile();
+
+    // A small receive buffer and a late read make the server park the rest of the file and wait for EPOLLOUT
+    int sock = connectSlowReader(PORT);
+    std::string pending;
+
+    const char* request = "GET /slow_reader.bin HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    send(sock, request, strlen(request), 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    std::string response = readResponse(sock, pending);
+    ASSERT_TRUE(response.starts_with("HTTP/1.1 200 OK"));
+    EXPECT_EQ(response.substr(response.find("\r\n\r\n") + 4), expected);
+
+    // The connection is still usable once the queue has drained
+    const char* next = "GET /test.txt HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    send(sock, next, strlen(next), 0);
+    response = readResponse(sock, pending);
+    EXPECT_TRUE(response.find("EndOfTest") != std::string::npos);
+    close(sock);
+}
+
+TEST_F(IntegrationTest, AsyncRoutesDontHoldWorkers) {
+    // Twice as many waiting requests as the pool has threads, all answered in about one delay
+    int numConnections = 64;
+    std::vector<int> socks;
+    for (int i = 0; i < numConnections; i++) {
+        socks.push_back(connectClient());
+        // The listen backlog is short, don't outrun the accepts
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    auto start = std::chrono::steady_clock::now();
+    const char* request = "GET /slow/300 HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    for (int sock : socks)
+        send(sock, request, strlen(request), 0);
+    for (int sock : socks) {
+        std::string pending;
+        EXPECT_TRUE(readResponse(sock, pending).ends_with("slow 300"));
+        close(sock);
+    }
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(500));
+}
+
+TEST_F(IntegrationTest, PipelinedAsyncRoute) {
+    int sock = connectClient();
+    expectPipelinedAsyncInOrder(sock);
+    close(sock);
+}
+
+TEST_F(IntegrationTest, ServesMetrics) {
+    int sock = connectClient();
+    expectMetricsServed(sock);
+    close(sock);
+}
+
+TEST_F(IntegrationTest, TracesRequests) {
+    s_server->startTracing(1);
+    int sock = connectClient();
+    std::string pending;
+    std::string request = "GET /test.txt HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    send(sock, request.data(), request.size(), 0);
+    EXPECT_TRUE(readResponse(sock, pending).find("EndOfTest") != std::string::npos);
+    close(sock);
+    // The worker records its outermost span after the response is sent
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    std::filesystem::path path = std::filesystem::temp_directory_path() / ("myhttp_trace_" + std::to_string(getpid()) + ".json");
+    s_server->stopTracing(path);
+    std::ifstream file(path);
+    std::string trace((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    std::filesystem::remove(path);
+    for (const char* name : {"dispatch", "enqueue", "task", "handleClient", "receiveData", "parse", "route", "getStaticFile", "send"})
+        EXPECT_NE(trace.find(std::string("\"name\":\"") + name + "\""), std::string::npos) << name;
+    // The hop from the reactor to a worker
+    EXPECT_NE(trace.find("\"ph\":\"s\""), std::string::npos);
+    EXPECT_NE(trace.find("\"ph\":\"f\""), std::string::npos);
+    EXPECT_NE(trace.find("\"myhttp-worker\""), std::string::npos);
+}
+
+TEST_F(IntegrationTest, WritesAccessLog) {
+    std::filesystem::path path = std::filesystem::temp_directory_path() / ("myhttp_access_" + std::to_string(getpid()) + ".log");
+    // Before connecting, the client's address is looked up when it's accepted
+    Log::openAccessLog(path, Log::Format::JSON);
+    int sock = connectClient();
+    std::string pending;
+    std::string requests = "GET /test.txt HTTP/1.1\r\nHost: localhost\r\nUser-Agent: integration\r\n\r\n"
+                           "GET /slow/10 HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    send(sock, requests.data(), requests.size(), 0);
+    EXPECT_TRUE(readResponse(sock, pending).find("EndOfTest") != std::string::npos);
+    EXPECT_TRUE(readResponse(sock, pending).ends_with("slow 10"));
+    close(sock);
+    Log::closeAccessLog();
+
+    std::ifstream file(path);
+    std::string log((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    std::filesystem::remove(path);
+    EXPECT_NE(log.find("\"remote_addr\":\"127.0.0.1\",\"method\":\"GET\",\"target\":\"/test.txt\",\"version\":\"HTTP/1.1\",\"status\":200"),
+              std::string::npos);
+    EXPECT_NE(log.find("\"user_agent\":\"integration\"}"), std::string::npos);
+    // Logged once the async handler answered
+    EXPECT_NE(log.find("\"target\":\"/slow/10\",\"version\":\"HTTP/1.1\",\"status\":200"), std::string::npos);
+}
+
+const int REACTOR_PORT = 8082;
+
+class MultiReactorTest : public ::testing::Test {
+protected:
+    static void runServer() {
+        Server server(REACTOR_PORT, "../../public_html/", 4, 30, Server::Mode::MULTI_REACTOR);
+        addSlowRoute(server);
+        addHelloRoute(server);
+        server.start();
+    }
+    static std::thread serverThread;
+
+    static void SetUpTestSuite() {
+        serverThread = std::thread(runServer);
+        std::this_thread::sleep_for(std::chrono::milliseconds(200)); // Give server time to start
+    }
+
+    static void TearDownTestSuite() {
+        serverThread.detach();
+    }
+
+    int connectClient() {
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        EXPECT_NE(sock, -1);
+
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(REACTOR_PORT);
+        addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+        int ret = connect(sock, (struct sockaddr*)&addr, sizeof(addr));
+        EXPECT_EQ(ret, 0);
+        return sock;
+    }
+};
+
+std::thread MultiReactorTest::serverThread;
+
+TEST_F(MultiReactorTest, KeepAliveAcrossReactors) {
+    // Enough connections that SO_REUSEPORT spreads them over several reactors
+    const char* request = "GET /test.txt HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    int numConnections = 16;
+    std::vector<int> socks;
+    for (int i = 0; i < numConnections; i++) {
+        socks.push_back(connectClient());
+    }
+    for (int round = 0; round < 3; round++) {
+        for (int sock : socks) {
+            send(sock, request, strlen(request), 0);
+            std::string response;
+            char buffer[1024];
+            while (response.find("EndOfTest") == std::string::npos) {
+                int n = recv(sock, buffer, sizeof(buffer), 0);
+                ASSERT_GT(n, 0);
+                response.append(buffer, n);
+            }
+            EXPECT_TRUE(response.starts_with("HTTP/1.1 200 OK"));
+        }
+    }
+    for (int sock : socks) {
+        close(sock);
+    }
+}
+
+
+const int URING_PORT = 8083;
+
+class UringTest : public ::testing::Test {
+protected:
+    static void runServer() {
+        Server server(URING_PORT, "../../public_html/", 2, 30, Server::Mode::IO_URING);
+        addSlowRoute(server);
+        addHelloRoute(server);
+        server.enableMetrics();
+        server.start();
+    }
+    static std::thread serverThread;
+
+    static void SetUpTestSuite() {
+        if (!IoUring::isSupported())
+            return;
+        serverThread = std::thread(runServer);
+        std::this_thread::sleep_for(std::chrono::milliseconds(200)); // Give server time to start
+    }
+
+    static void TearDownTestSuite() {
+        if (serverThread.joinable())
+            serverThread.detach();
+    }
+
+    void SetUp() override {
+        if (!IoUring::isSupported())
+            GTEST_SKIP() << "io_uring is not available";
+    }
+
+    void TearDown() override {
+        std::filesystem::remove(SLOW_READER_FILE);
+    }
+
+    int connectClient() {
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        EXPECT_NE(sock, -1);
+
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(URING_PORT);
+        addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+        int ret = connect(sock, (struct sockaddr*)&addr, sizeof(addr));
+        EXPECT_EQ(ret, 0);
+        return sock;
+    }
+};
+
+std::thread UringTest::serverThread;
+
+TEST_F(UringTest, KeepAliveRequests) {
+    const char* request = "GET /test.txt HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    int sock = connectClient();
+    std::string pending;
+    for (int i = 0; i < 3; i++) {
+        send(sock, request, strlen(request), 0);
+        std::string response = readResponse(sock, pending);
+        EXPECT_TRUE(response.starts_with("HTTP/1.1 200 OK"));
+        EXPECT_TRUE(response.find("EndOfTest") != std::string::npos);
+    }
+    close(sock);
+}
+
+TEST_F(UringTest, LargeFileIsSpliced) {
+    // Bigger than one splice chunk, so it takes several linked splices through the pipe
+    std::filesystem::path path = "../../public_html/images/TressOfTheEmeraldSea.jpg";
+    std::ifstream file(path, std::ios::binary);
+    std::string expected((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    int sock = connectClient();
+    std::string pending;
+    const char* request = "GET /images/TressOfTheEmeraldSea.jpg HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    for (int i = 0; i < 2; i++) {
+        send(sock, request, strlen(request), 0);
+        std::string response = readResponse(sock, pending);
+        ASSERT_TRUE(response.starts_with("HTTP/1.1 200 OK"));
+        EXPECT_EQ(response.substr(response.find("\r\n\r\n") + 4), expected);
+    }
+    close(sock);
+}
+
+TEST_F(UringTest, SlowReader) {
+    std::string expected = writeSlowReaderFile();
+    int sock = connectSlowReader(URING_PORT);
+    std::string pending;
+
+    const char* request = "GET /slow_reader.bin HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    send(sock, request, strlen(request), 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    std::string response = readResponse(sock, pending);
+    ASSERT_TRUE(response.starts_with("HTTP/1.1 200 OK"));
+    EXPECT_EQ(response.substr(response.find("\r\n\r\n") + 4), expected);
+
+    // Pipelined requests from a client that isn't reading are only answered as far as the
+    // 1 MiB high water mark and the socket buffers go, the rest wait until it catches up
+    int count = 16;
+    std::string requests;
+    for (int i = 0; i < count; i++)
+        requests += request;
+    std::string ok = "myhttp_responses_total{code=\"2xx\"}";
+    uint64_t before = readMetric(URING_PORT, ok);
+    send(sock, requests.data(), requests.size(), 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    // Less the /metrics response itself
+    EXPECT_LT(readMetric(URING_PORT, ok) - before - 1, count / 2);
+
+    for (int i = 0; i < count; i++) {
+        response = readResponse(sock, pending);
+        ASSERT_TRUE(response.starts_with("HTTP/1.1 200 OK")) << "response " << i;
+        EXPECT_EQ(response.size() - response.find("\r\n\r\n") - 4, expected.size());
+    }
+    const char* next = "GET /test.txt HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    send(sock, next, strlen(next), 0);
+    response = readResponse(sock, pending);
+    EXPECT_TRUE(response.find("EndOfTest") != std::string::npos);
+    close(sock);
+}
+
+TEST_F(UringTest, PipelinedRequests) {
+    int sock = connectClient();
+    std::string pending;
+    std::string requests;
+    for (int i = 0; i < 8; i++)
+        requests += "GET /test.txt HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    send(sock, requests.data(), requests.size(), 0);
+    for (int i = 0; i < 8; i++) {
+        std::string response = readResponse(sock, pending);
+        EXPECT_TRUE(response.starts_with("HTTP/1.1 200 OK"));
+        EXPECT_TRUE(response.find("EndOfTest") != std::string::npos);
+    }
+    close(sock);
+}
+
+TEST_F(MultiReactorTest, PipelinedAsyncRoute) {
+    int sock = connectClient();
+    expectPipelinedAsyncInOrder(sock);
+    // Still usable afterwards
+    expectPipelinedAsyncInOrder(sock);
+    close(sock);
+}
+
+TEST_F(UringTest, PipelinedAsyncRoute) {
+    int sock = connectClient();
+    expectPipelinedAsyncInOrder(sock);
+    expectPipelinedAsyncInOrder(sock);
+    close(sock);
+}
+
+TEST_F(UringTest, InputWaitsWhileAsyncRouteRuns) {
+    int sock = connectClient();
+    std::string pending;
+    uint64_t before = readMetric(URING_PORT, "myhttp_received_bytes_total");
+    std::string request = "GET /slow/200 HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    send(sock, request.data(), request.size(), 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    // Flood it while the handler waits, the server shouldn't read any of it into memory until it's done
+    std::string junk(64 * 1024, 'x');
+    for (size_t sent = 0; sent < 8 * junk.size();) {
+        ssize_t result = send(sock, junk.data(), junk.size(), MSG_DONTWAIT);
+        if (result <= 0)
+            break;
+        sent += result;
+    }
+    // Counting the requests themselves, which are a few hundred bytes
+    uint64_t received = readMetric(URING_PORT, "myhttp_received_bytes_total") - before;
+    EXPECT_LT(received, junk.size());
+
+    // Answered once the handler is done, then the junk after it is refused
+    EXPECT_TRUE(readResponse(sock, pending).find("slow 200") != std::string::npos);
+    EXPECT_TRUE(readResponse(sock, pending).starts_with("HTTP/1.1 4"));
+    close(sock);
+}
+
+TEST_F(UringTest, HeadHasNoBody) {
+    int sock = connectClient();
+    expectHeadThenGet(sock, "/hello");
+    expectHeadThenGet(sock, "/slow/0");
+    close(sock);
+}
+
+TEST_F(UringTest, ServesMetrics) {
+    int sock = connectClient();
+    expectMetricsServed(sock);
+    close(sock);
+}
@@ -0,0 +1,117 @@
+#include <gtest/gtest.h>
+#include <fstream>
+#include <thread>
+#include <unistd.h>
+#include "Log.h"
+
+static std::string readFile(const std::filesystem::path& path) {
+    std::ifstream file(path);
+    return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
+static size_t countLines(const std::string& text) {
+    return std::count(text.begin(), text.end(), '\n');
+}
+
+class LogTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        m_path = std::filesystem::temp_directory_path() / ("myhttp_log_" + std::to_string(getpid()));
+        std::filesystem::remove(m_path);
+    }
+
+    void TearDown() override {
+        Log::setErrorLog("");
+        Log::setLevel(Log::Level::INFO);
+        Log::setRateLimit(10);
+        std::filesystem::remove(m_path);
+    }
+
+    std::filesystem::path m_path;
+};
+
+TEST_F(LogTest, WritesEnabledLevels) {
+    Log::setErrorLog(m_path);
+    Log::setLevel(Log::Level::WARNING);
+    EXPECT_FALSE(Log::isEnabled(Log::Level::INFO));
+    Log::debug("hidden debug");
+    Log::info("hidden info");
+    Log::warning("shown warning, fd=", 7);
+    Log::error("shown error: ", std::string("reason"), ' ', 1.5);
+    Log::flush();
+
+    std::string log = readFile(m_path);
+    EXPECT_EQ(countLines(log), 2);
+    EXPECT_EQ(log.find("hidden"), std::string::npos);
+    EXPECT_NE(log.find("Z WARNING shown warning, fd=7\n"), std::string::npos);
+    EXPECT_NE(log.find("Z ERROR shown error: reason 1.5\n"), std::string::npos);
+}
+
+TEST_F(LogTest, RateLimitsRepeatedMessages) {
+    Log::setErrorLog(m_path);
+    Log::setRateLimit(3);
+    uint64_t suppressed = Log::getStats().suppressed;
+    for (int i = 0; i < 10; i++)
+        Log::error("repeated ", i);
+    // Counted apart from the message above
+    Log::error("another one");
+    Log::flush();
+
+    std::string log = readFile(m_path);
+    // Unless the second turned over halfway through
+    EXPECT_GE(countLines(log), 4);
+    EXPECT_LE(countLines(log), 7);
+    EXPECT_NE(log.find("another one"), std::string::npos);
+    EXPECT_EQ(Log::getStats().suppressed - suppressed, 11 - countLines(log));
+}
+
+TEST_F(LogTest, CountsEveryMessageWrittenOrDropped) {
+    Log::setErrorLog(m_path);
+    Log::setRateLimit(0);
+    Log::Stats before = Log::getStats();
+    std::string big(Log::MAX_MESSAGE, 'x');
+    // A fresh thread gets an empty ring, which this fills much faster than it's written out
+    std::thread([&big] {
+        for (int i = 0; i < 1000; i++)
+            Log::error("big ", big);
+    }).join();
+    Log::flush();
+
+    Log::Stats after = Log::getStats();
+    EXPECT_EQ(after.written - before.written + after.dropped - before.dropped, 1000);
+    EXPECT_EQ(countLines(readFile(m_path)), after.written - before.written);
+}
+
+TEST_F(LogTest, WritesCombinedAccessLog) {
+    Log::openAccessLog(m_path);
+    EXPECT_TRUE(Log::isAccessLogOpen());
+    Log::Access access;
+    access.begin("127.0.0.1", "GET", "/search?q=\"x\"", "HTTP/1.1", "", "curl/8.0");
+    EXPECT_TRUE(access.isPending());
+    access.finish(200, 1234);
+    EXPECT_FALSE(access.isPending());
+    Log::closeAccessLog();
+
+    std::string log = readFile(m_path);
+    EXPECT_TRUE(log.starts_with("127.0.0.1 - - ["));
+    EXPECT_TRUE(log.ends_with(" +0000] \"GET /search?q=\\x22x\\x22 HTTP/1.1\" 200 1234 \"-\" \"curl/8.0\"\n"));
+}
+
+TEST_F(LogTest, WritesJsonAccessLog) {
+    Log::openAccessLog(m_path, Log::Format::JSON);
+    Log::Access access;
+    access.begin("::1", "POST", "/api/\"items\"", "HTTP/1.1", "http://example.com/", "");
+    access.finish(404, 0);
+    Log::closeAccessLog();
+    // Nothing is queued while it's closed
+    access.begin("::1", "GET", "/", "HTTP/1.1", "", "");
+    access.finish(200, 0);
+    Log::flush();
+
+    std::string log = readFile(m_path);
+    EXPECT_EQ(countLines(log), 1);
+    EXPECT_TRUE(log.starts_with("{\"time\":\""));
+    EXPECT_NE(log.find("\"remote_addr\":\"::1\",\"method\":\"POST\",\"target\":\"/api/\\\"items\\\"\",\"version\":\"HTTP/1.1\","
+                       "\"status\":404,\"bytes\":0,\"duration_us\":"), std::string::npos);
+    EXPECT_NE(log.find(",\"referer\":\"http://example.com/\",\"user_agent\":\"\"}\n"), std::string::npos);
+}
@@ -0,0 +1,124 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include "Metrics.h"
+
+using namespace std::chrono_literals;
+
+TEST(HistogramTest, BucketsStayWithinAFewPercent) {
+    for (uint64_t value = 0; value < (uint64_t(1) << 40); value = value * 3 / 2 + 1) {
+        uint64_t highest = Histogram::getHighestValue(Histogram::getIndex(value));
+        EXPECT_GE(highest, value);
+        EXPECT_LE(highest - value, value / Histogram::SUB_BUCKETS);
+    }
+    // Too big to tell apart, they all go in the last bucket
+    EXPECT_EQ(Histogram::getIndex(UINT64_MAX), Histogram::BUCKETS - 1);
+}
+
+TEST(HistogramTest, FindsQuantiles) {
+    Histogram histogram;
+    EXPECT_EQ(histogram.getQuantile(0.5), 0);
+    for (uint64_t value = 1; value <= 10000; value++)
+        histogram.record(value * 1000);
+    EXPECT_EQ(histogram.getCount(), 10000);
+    EXPECT_EQ(histogram.getSum(), 1000ull * 10000 * 10001 / 2);
+    EXPECT_NEAR(histogram.getQuantile(0.5), 5'000'000, 5'000'000 * 0.035);
+    EXPECT_NEAR(histogram.getQuantile(0.99), 9'900'000, 9'900'000 * 0.035);
+    EXPECT_NEAR(histogram.countAtMost(2'500'000), 2500, 2500 * 0.035);
+
+    Histogram copy = histogram;
+    copy.add(histogram);
+    EXPECT_EQ(copy.getCount(), 20000);
+    EXPECT_EQ(copy.getQuantile(0.5), histogram.getQuantile(0.5));
+}
+
+TEST(MetricsTest, MergesThreads) {
+    Metrics metrics;
+    metrics.enable();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; i++) {
+        threads.emplace_back([&metrics] {
+            for (int j = 0; j < 1000; j++) {
+                metrics.add(Metrics::Counter::REQUESTS);
+                metrics.add(Metrics::Counter::BYTES_SENT, 10);
+                metrics.record(Metrics::Stage::HANDLER, 1us);
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+
+    EXPECT_EQ(metrics.get(Metrics::Counter::REQUESTS), 4000);
+    EXPECT_EQ(metrics.get(Metrics::Counter::BYTES_SENT), 40000);
+    Histogram handler = metrics.getHistogram(Metrics::Stage::HANDLER);
+    EXPECT_EQ(handler.getCount(), 4000);
+    EXPECT_NEAR(handler.getQuantile(0.99), 1000, 1000 / Histogram::SUB_BUCKETS);
+}
+
+TEST(MetricsTest, RecordsNothingUntilEnabled) {
+    Metrics metrics;
+    metrics.add(Metrics::Counter::REQUESTS);
+    {
+        Metrics::Span span(metrics, Metrics::Stage::ROUTE);
+    }
+    EXPECT_EQ(metrics.get(Metrics::Counter::REQUESTS), 0);
+    EXPECT_EQ(metrics.getHistogram(Metrics::Stage::ROUTE).getCount(), 0);
+
+    metrics.enable(1);
+    {
+        Metrics::Span span(metrics, Metrics::Stage::ROUTE);
+    }
+    metrics.addResponse(404);
+    metrics.addResponse(999);
+    EXPECT_EQ(metrics.getHistogram(Metrics::Stage::ROUTE).getCount(), 1);
+    EXPECT_EQ(metrics.get(Metrics::Counter::RESPONSES_4XX), 1);
+}
+
+TEST(MetricsTest, TimesOneInEvery) {
+    Metrics metrics;
+    metrics.enable(3);
+    for (int i = 0; i < 100; i++) {
+        Metrics::Span span(metrics, Metrics::Stage::SERIALIZE);
+        metrics.recordSince(Metrics::Stage::SEND, metrics.startTiming(Metrics::Stage::SEND));
+    }
+    // Rounded up to every 4th
+    EXPECT_EQ(metrics.getHistogram(Metrics::Stage::SERIALIZE).getCount(), 25);
+    EXPECT_EQ(metrics.getHistogram(Metrics::Stage::SEND).getCount(), 25);
+
+    // A total spread over several calls is timed all the way through, or not at all
+    int timed = 0;
+    Metrics::Total total;
+    for (int i = 0; i < 100; i++) {
+        for (int call = 0; call < 3; call++) {
+            Metrics::Stopwatch stopwatch(metrics, Metrics::Stage::PARSE, total);
+        }
+        timed += total.state == Metrics::Total::State::TIMED;
+        metrics.recordTotal(Metrics::Stage::PARSE, total);
+    }
+    EXPECT_EQ(timed, 25);
+    EXPECT_EQ(metrics.getHistogram(Metrics::Stage::PARSE).getCount(), 25);
+}
+
+TEST(MetricsTest, WritesPrometheusText) {
+    Metrics metrics;
+    metrics.enable();
+    metrics.add(Metrics::Counter::REQUESTS, 3);
+    metrics.addResponse(200);
+    metrics.add(Metrics::Counter::CONNECTIONS_ACCEPTED, 5);
+    metrics.add(Metrics::Counter::CONNECTIONS_CLOSED, 2);
+    metrics.record(Metrics::Stage::PARSE, 2ms);
+    metrics.addValue(Metrics::Type::GAUGE, "myhttp_test_value", "A test value.", [] { return 1.5; });
+
+    std::string text = metrics.toPrometheus();
+    EXPECT_NE(text.find("# TYPE myhttp_requests_total counter\nmyhttp_requests_total 3\n"), std::string::npos);
+    EXPECT_NE(text.find("myhttp_responses_total{code=\"2xx\"} 1\n"), std::string::npos);
+    // One header for the whole family
+    EXPECT_EQ(text.find("# TYPE myhttp_responses_total"), text.rfind("# TYPE myhttp_responses_total"));
+    EXPECT_NE(text.find("myhttp_connections_active 3\n"), std::string::npos);
+    EXPECT_NE(text.find("# TYPE myhttp_stage_duration_seconds histogram\n"), std::string::npos);
+    EXPECT_NE(text.find("myhttp_stage_duration_seconds_bucket{stage=\"parse\",le=\"0.001\"} 0\n"), std::string::npos);
+    EXPECT_NE(text.find("myhttp_stage_duration_seconds_bucket{stage=\"parse\",le=\"0.0025\"} 1\n"), std::string::npos);
+    EXPECT_NE(text.find("myhttp_stage_duration_seconds_bucket{stage=\"parse\",le=\"+Inf\"} 1\n"), std::string::npos);
+    EXPECT_NE(text.find("myhttp_stage_duration_seconds_sum{stage=\"parse\"} 0.002\n"), std::string::npos);
+    EXPECT_NE(text.find("myhttp_stage_duration_quantile_seconds{stage=\"parse\",quantile=\"0.99\"} 0.002"), std::string::npos);
+    EXPECT_NE(text.find("# TYPE myhttp_test_value gauge\nmyhttp_test_value 1.5\n"), std::string::npos);
+}
@@ -0,0 +1,125 @@
+#include <gtest/gtest.h>
+#include <fcntl.h>
+#include "OpenFileCache.h"
+#include "Router.h"
+#include "TempDirTest.h"
+
+namespace {
+    OpenFileCache::File openFile(const std::filesystem::path& path) {
+        OpenFileCache::File file;
+        file.path = path;
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        file.file = std::make_shared<FileHandle>(fd);
+        fstat(fd, &file.info);
+        return file;
+    }
+}
+
+class OpenFileCacheTest : public TempDirTest {
+protected:
+    OpenFileCacheTest() : TempDirTest("open") {}
+
+    void SetUp() override {
+        TempDirTest::SetUp();
+        std::filesystem::create_directories(m_dir / "docs");
+        writeFile("a.txt", "first");
+        writeFile("docs/b.txt", "second");
+        writeFile("docs/index.html", "<p>docs</p>");
+    }
+};
+
+TEST_F(OpenFileCacheTest, KeepsFilesOpen) {
+    OpenFileCache cache;
+    EXPECT_FALSE(cache.find("/a.txt").has_value());
+    cache.insert("/a.txt", openFile(m_dir / "a.txt"), cache.getGeneration());
+
+    auto file = cache.find("/a.txt");
+    ASSERT_TRUE(file.has_value());
+    EXPECT_EQ(file->path, m_dir / "a.txt");
+    EXPECT_EQ(file->info.st_size, 5);
+    char buffer[5];
+    EXPECT_EQ(pread(file->file->get(), buffer, sizeof(buffer), 0), 5);
+
+    auto stats = cache.getStats();
+    EXPECT_EQ(stats.hits, 1);
+    EXPECT_EQ(stats.misses, 1);
+    EXPECT_EQ(stats.entries, 1);
+}
+
+TEST_F(OpenFileCacheTest, InvalidatesPathsAndDirectories) {
+    OpenFileCache cache;
+    uint64_t generation = cache.getGeneration();
+    cache.insert("/a.txt", openFile(m_dir / "a.txt"), generation);
+    cache.insert("/docs/b.txt", openFile(m_dir / "docs/b.txt"), generation);
+
+    cache.invalidate(m_dir / "docs");
+    EXPECT_TRUE(cache.find("/a.txt").has_value());
+    EXPECT_FALSE(cache.find("/docs/b.txt").has_value());
+    EXPECT_EQ(cache.getStats().invalidations, 1);
+
+    // Resolved before the change, so not cached
+    cache.insert("/docs/b.txt", openFile(m_dir / "docs/b.txt"), generation);
+    EXPECT_FALSE(cache.find("/docs/b.txt").has_value());
+}
+
+TEST_F(OpenFileCacheTest, InvalidationSparesSiblingsWithTheSamePrefix) {
+    std::filesystem::create_directories(m_dir / "docs/b");
+    writeFile("docs/b/c.txt", "third");
+    writeFile("docs.txt", "fourth");
+    OpenFileCache cache;
+    uint64_t generation = cache.getGeneration();
+    cache.insert("/docs/b.txt", openFile(m_dir / "docs/b.txt"), generation);
+    cache.insert("/docs/b/c.txt", openFile(m_dir / "docs/b/c.txt"), generation);
+    cache.insert("/docs.txt", openFile(m_dir / "docs.txt"), generation);
+
+    cache.invalidate(m_dir / "docs/b");
+    EXPECT_TRUE(cache.find("/docs/b.txt").has_value());
+    EXPECT_FALSE(cache.find("/docs/b/c.txt").has_value());
+
+    cache.invalidate(m_dir / "docs");
+    EXPECT_FALSE(cache.find("/docs/b.txt").has_value());
+    EXPECT_TRUE(cache.find("/docs.txt").has_value());
+    EXPECT_EQ(cache.getStats().invalidations, 2);
+}
+
+TEST_F(OpenFileCacheTest, EvictsByCount) {
+    OpenFileCache cache(2);
+    uint64_t generation = cache.getGeneration();
+    cache.insert("/a.txt", openFile(m_dir / "a.txt"), generation);
+    cache.insert("/docs/b.txt", openFile(m_dir / "docs/b.txt"), generation);
+    cache.insert("/docs/index.html", openFile(m_dir / "docs/index.html"), generation);
+    auto stats = cache.getStats();
+    EXPECT_EQ(stats.entries, 2);
+    EXPECT_EQ(stats.evictions, 1);
+
+    cache.disable();
+    cache.setMaxEntries(10);
+    cache.insert("/a.txt", openFile(m_dir / "a.txt"), cache.getGeneration());
+    EXPECT_EQ(cache.getStats().entries, 0);
+}
+
+TEST_F(OpenFileCacheTest, RouterSkipsResolvingHotPaths) {
+    Router router(m_dir);
+    // Only the open file cache is left to answer repeat requests
+    router.getStaticFileCache().setLimits(0, 0);
+    OpenFileCache& files = router.getStaticFileCache().getOpenFiles();
+
+    auto first = router.getStaticFile(HTTPRequest::Method::GET, "/docs/");
+    auto second = router.getStaticFile(HTTPRequest::Method::GET, "/docs/");
+    ASSERT_TRUE(first.has_value() && second.has_value());
+    EXPECT_EQ(second->getFileBody()->file, first->getFileBody()->file);
+    EXPECT_EQ(second->getFileBody()->length, std::string("<p>docs</p>").size());
+    EXPECT_EQ(files.getStats().hits, 1);
+
+    // Redirects for directories are remembered too
+    EXPECT_EQ(router.getStaticFile(HTTPRequest::Method::GET, "/docs")->getStatus(), HTTPResponse::Status::MOVED_PERMANENTLY);
+    EXPECT_EQ(router.getStaticFile(HTTPRequest::Method::GET, "/docs")->getStatus(), HTTPResponse::Status::MOVED_PERMANENTLY);
+    EXPECT_EQ(files.getStats().hits, 2);
+
+    // A changed file is opened again
+    writeFile("docs/index.html", "<p>changed docs</p>");
+    router.getStaticFileCache().processEvents();
+    auto changed = router.getStaticFile(HTTPRequest::Method::GET, "/docs/");
+    ASSERT_TRUE(changed.has_value());
+    EXPECT_EQ(changed->getFileBody()->length, std::string("<p>changed docs</p>").size());
+}
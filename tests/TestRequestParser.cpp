@@ -0,0 +1,91 @@
+#include <gtest/gtest.h>
+#include "RequestParser.h"
+
+using Result = RequestParser::Result;
+
+TEST(RequestParserTest, ResumesOneByteAtATime) {
+    std::string raw = "POST /submit HTTP/1.1\r\nHost: localhost\r\ncontent-length: 5\r\n\r\nhello";
+    RequestParser parser;
+    std::string buffer;
+    for (size_t i = 0; i + 1 < raw.size(); i++) {
+        buffer += raw[i];
+        ASSERT_EQ(parser.parse(buffer), Result::INCOMPLETE) << "at byte " << i;
+    }
+    buffer += raw.back();
+    ASSERT_EQ(parser.parse(buffer), Result::COMPLETE);
+    EXPECT_EQ(parser.getRequestSize(), raw.size());
+
+    auto request = parser.getRequest(buffer);
+    ASSERT_TRUE(request.has_value());
+    EXPECT_EQ(request->getMethod(), HTTPRequest::Method::POST);
+    EXPECT_EQ(request->getRoute(), "/submit");
+    EXPECT_EQ(request->getVersion(), "HTTP/1.1");
+    EXPECT_EQ(request->getHeader("Host"), "localhost");
+    EXPECT_EQ(request->getBody(), "hello");
+}
+
+TEST(RequestParserTest, FramesPipelinedRequests) {
+    std::string first = "GET /a HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    std::string second = "GET /b HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    std::string buffer = first + second;
+    std::string_view unread = buffer;
+
+    RequestParser parser;
+    ASSERT_EQ(parser.parse(unread), Result::COMPLETE);
+    EXPECT_EQ(parser.getRequestSize(), first.size());
+    EXPECT_EQ(parser.getRequest(unread)->getRoute(), "/a");
+
+    unread.remove_prefix(parser.getRequestSize());
+    parser.reset();
+    ASSERT_EQ(parser.parse(unread), Result::COMPLETE);
+    EXPECT_EQ(parser.getRequest(unread)->getRoute(), "/b");
+}
+
+TEST(RequestParserTest, AcceptsBareNewlinesAndLeadingBlankLine) {
+    std::string buffer = "\r\nGET /a HTTP/1.1\nHost:   localhost  \n\n";
+    RequestParser parser;
+    ASSERT_EQ(parser.parse(buffer), Result::COMPLETE);
+    EXPECT_EQ(parser.getRequestSize(), buffer.size());
+    EXPECT_EQ(parser.getRequest(buffer)->getHeader("Host"), "localhost");
+}
+
+TEST(RequestParserTest, RejectsMalformedRequests) {
+    EXPECT_EQ(RequestParser().parse("BREW /pot HTTP/1.1\r\n\r\n"), Result::BAD_REQUEST);
+    EXPECT_EQ(RequestParser().parse("GET /\r\n\r\n"), Result::BAD_REQUEST);
+    EXPECT_EQ(RequestParser().parse("GET / HTTP/1.1\r\nNoColon\r\n\r\n"), Result::BAD_REQUEST);
+    EXPECT_EQ(RequestParser().parse("GET / HTTP/1.1\r\nContent-Length: 12abc\r\n\r\n"), Result::BAD_REQUEST);
+}
+
+TEST(RequestParserTest, RejectsConflictingContentLengths) {
+    std::string same = "POST / HTTP/1.1\r\nContent-Length: 5\r\ncontent-length: 5\r\n\r\nhello";
+    RequestParser parser;
+    ASSERT_EQ(parser.parse(same), Result::COMPLETE);
+    EXPECT_EQ(parser.getRequestSize(), same.size());
+    EXPECT_EQ(RequestParser().parse("POST / HTTP/1.1\r\nContent-Length: 5\r\nContent-Length: 50\r\n\r\nhello"), Result::BAD_REQUEST);
+    EXPECT_EQ(RequestParser().parse("POST / HTTP/1.1\r\nContent-Length: 50\r\nContent-Length: 5\r\n\r\nhello"), Result::BAD_REQUEST);
+}
+
+TEST(RequestParserTest, RejectsTransferEncoding) {
+    // No transfer coding is implemented, so the body's end can't be found
+    EXPECT_EQ(RequestParser().parse("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"), Result::NOT_IMPLEMENTED);
+    EXPECT_EQ(RequestParser().parse("POST / HTTP/1.1\r\ntransfer-encoding: gzip, chunked\r\n\r\n"), Result::NOT_IMPLEMENTED);
+    // Both at once is how requests get smuggled, in either order
+    EXPECT_EQ(RequestParser().parse("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nContent-Length: 5\r\n\r\n"), Result::BAD_REQUEST);
+    EXPECT_EQ(RequestParser().parse("POST / HTTP/1.1\r\nContent-Length: 5\r\nTransfer-Encoding: chunked\r\n\r\nhello"), Result::BAD_REQUEST);
+}
+
+TEST(RequestParserTest, EnforcesLimits) {
+    RequestParser::Limits limits;
+    limits.maxHeaderBytes = 64;
+    limits.maxHeaderCount = 2;
+    limits.maxBodyBytes = 10;
+
+    // Rejected as soon as the limit is crossed, even without a line ending
+    std::string longLine = "GET /" + std::string(100, 'a');
+    EXPECT_EQ(RequestParser(limits).parse(longLine), Result::HEADERS_TOO_LARGE);
+    EXPECT_EQ(RequestParser(limits).parse("GET / HTTP/1.1\r\nA: 1\r\nB: 2\r\nC: 3\r\n\r\n"), Result::HEADERS_TOO_LARGE);
+    // The body doesn't need to arrive for its size to be rejected
+    EXPECT_EQ(RequestParser(limits).parse("POST / HTTP/1.1\r\nContent-Length: 11\r\n\r\n"), Result::BODY_TOO_LARGE);
+    EXPECT_EQ(RequestParser(limits).parse("POST / HTTP/1.1\r\nContent-Length: 99999999999999999999999\r\n\r\n"), Result::BODY_TOO_LARGE);
+    EXPECT_EQ(RequestParser(limits).parse("POST / HTTP/1.1\r\nContent-Length: 10\r\n\r\n0123456789"), Result::COMPLETE);
+}
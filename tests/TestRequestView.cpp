@@ -0,0 +1,86 @@
+#include <gtest/gtest.h>
+#include "RequestParser.h"
+#include "ResponseGenerator.h"
+#include "Router.h"
+
+TEST(RequestViewTest, PointsIntoTheBuffer) {
+    std::string buffer = "POST /form HTTP/1.1\r\nHost: localhost\r\nContent-Length: 3\r\n\r\nabc";
+    RequestParser parser;
+    ASSERT_EQ(parser.parse(buffer), RequestParser::Result::COMPLETE);
+    auto view = parser.getView(buffer);
+    ASSERT_TRUE(view.has_value());
+
+    EXPECT_EQ(view->getMethod(), HTTPRequest::Method::POST);
+    EXPECT_EQ(view->getRoute(), "/form");
+    EXPECT_EQ(view->getVersion(), "HTTP/1.1");
+    EXPECT_EQ(view->getBody(), "abc");
+    EXPECT_EQ(view->getRoute().data(), buffer.data() + 5);
+    EXPECT_EQ(view->getBody().data(), buffer.data() + buffer.size() - 3);
+}
+
+TEST(RequestViewTest, HeaderLookupIgnoresCase) {
+    std::string buffer = "GET / HTTP/1.1\r\nconnection: Close\r\nX-Custom: one\r\n\r\n";
+    RequestParser parser;
+    ASSERT_EQ(parser.parse(buffer), RequestParser::Result::COMPLETE);
+    auto view = parser.getView(buffer);
+
+    EXPECT_EQ(view->getHeader("Connection"), "Close");
+    EXPECT_EQ(view->getHeader("x-custom"), "one");
+    EXPECT_FALSE(view->getHeader("Host").has_value());
+    EXPECT_TRUE(view->wantsClose());
+
+    // Owning requests find headers regardless of case too
+    HTTPRequest request = view->toRequest();
+    EXPECT_EQ(request.getHeader("Connection"), "Close");
+}
+
+TEST(RequestViewTest, SpillsExtraHeadersToTheHeap) {
+    std::string buffer = "GET / HTTP/1.1\r\n";
+    size_t count = RequestView::INLINE_HEADERS + 5;
+    for (size_t i = 0; i < count; i++)
+        buffer += "H" + std::to_string(i) + ": " + std::to_string(i) + "\r\n";
+    buffer += "\r\n";
+
+    RequestParser parser;
+    ASSERT_EQ(parser.parse(buffer), RequestParser::Result::COMPLETE);
+    auto view = parser.getView(buffer);
+    ASSERT_EQ(view->getHeaderCount(), count);
+    EXPECT_EQ(view->getHeaderAt(0).name, "H0");
+    EXPECT_EQ(view->getHeaderAt(count - 1).value, std::to_string(count - 1));
+    EXPECT_EQ(view->getHeader("h" + std::to_string(count - 1)), std::to_string(count - 1));
+}
+
+TEST(RequestViewTest, CopyOutlivesTheBuffer) {
+    std::optional<HTTPRequest> request;
+    {
+        std::string buffer = "GET /kept HTTP/1.1\r\nHost: localhost\r\n\r\n";
+        RequestParser parser;
+        ASSERT_EQ(parser.parse(buffer), RequestParser::Result::COMPLETE);
+        request = parser.getView(buffer)->toRequest();
+        buffer.assign(buffer.size(), 'x');
+    }
+    EXPECT_EQ(request->getRoute(), "/kept");
+    EXPECT_EQ(request->getHeader("Host"), "localhost");
+}
+
+TEST(RequestViewTest, RouterDispatchesBothHandlerKinds) {
+    Router router(std::filesystem::temp_directory_path());
+    router.addRoute("/view", HTTPRequest::Method::GET, [](const RequestView& request) {
+        return ResponseGenerator::generateHTMLResponse(std::string(request.getRoute()));
+    });
+    router.addRoute("/owned", HTTPRequest::Method::GET, [](const HTTPRequest& request) {
+        return ResponseGenerator::generateHTMLResponse(request.getRoute().string());
+    });
+
+    RequestView view(HTTPRequest::Method::GET, "/view", "HTTP/1.1", "");
+    const ViewHandler* handler = router.getHandler("/view", HTTPRequest::Method::GET);
+    ASSERT_NE(handler, nullptr);
+    EXPECT_EQ((*handler)(view).getBody(), "/view");
+
+    RequestView owned(HTTPRequest::Method::GET, "/owned", "HTTP/1.1", "");
+    handler = router.getHandler("/owned", HTTPRequest::Method::GET);
+    ASSERT_NE(handler, nullptr);
+    EXPECT_EQ((*handler)(owned).getBody(), "/owned");
+
+    EXPECT_EQ(router.getHandler("/view", HTTPRequest::Method::POST), nullptr);
+}
@@ -5,5 +5,183 @@
 TEST(ResponseGeneratorTest, StaticFile) {
     std::cout << std::filesystem::current_path();
     HTTPResponse res = ResponseGenerator::generateFileResponse("../../public_html/test.txt");
-    EXPECT_TRUE(res.getBody().find("EndOfTest") != std::string::npos);
-}
\ No newline at end of file
+    // File responses are sent with sendfile(), so the body stays in the file
+    ASSERT_TRUE(res.getFileBody().has_value());
+    const FileBody& body = *res.getFileBody();
+    EXPECT_EQ(body.length, std::filesystem::file_size("../../public_html/test.txt"));
+    EXPECT_EQ(res.getHeader("Content-Length"), std::to_string(body.length));
+
+    std::string content(body.length, '\0');
+    ASSERT_EQ(pread(body.file->get(), content.data(), content.size(), body.offset), body.length);
+    EXPECT_TRUE(content.find("EndOfTest") != std::string::npos);
+}
+
+TEST(ResponseGeneratorTest, MissingFile) {
+    HTTPResponse res = ResponseGenerator::generateFileResponse("../../public_html/does-not-exist.txt");
+    EXPECT_EQ(res.getStatus(), HTTPResponse::Status::NOT_FOUND);
+    EXPECT_FALSE(res.getFileBody().has_value());
+}
+
+TEST(HTTPResponseTest, StatusLines) {
+    EXPECT_EQ(HTTPResponse::getStatusLine(HTTPResponse::Status::OK), "HTTP/1.1 200 OK\r\n");
+    EXPECT_EQ(HTTPResponse::getStatusLine(HTTPResponse::Status::REQUEST_HEADER_FIELDS_TOO_LARGE), "HTTP/1.1 431 Request Header Fields Too Large\r\n");
+    // Handed out in place, so the same status must always give the same bytes
+    EXPECT_EQ(HTTPResponse::getStatusLine(HTTPResponse::Status::NOT_FOUND).data(), HTTPResponse::getStatusLine(HTTPResponse::Status::NOT_FOUND).data());
+}
+
+TEST(HTTPResponseTest, DateHeader) {
+    std::string_view date = HTTPResponse::getDateHeader();
+    // "Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n"
+    ASSERT_EQ(date.size(), 37u);
+    EXPECT_TRUE(date.starts_with("Date: "));
+    EXPECT_TRUE(date.ends_with(" GMT\r\n"));
+    EXPECT_EQ(date[9], ',');
+}
+
+TEST(HTTPResponseTest, FormatsAndParsesDates) {
+    EXPECT_EQ(HTTPResponse::formatDate(784111777), "Sun, 06 Nov 1994 08:49:37 GMT");
+    EXPECT_EQ(HTTPResponse::parseDate("Sun, 06 Nov 1994 08:49:37 GMT"), 784111777);
+    EXPECT_FALSE(HTTPResponse::parseDate("Sunday, 06-Nov-94 08:49:37 GMT").has_value());
+    EXPECT_FALSE(HTTPResponse::parseDate("not a date").has_value());
+}
+
+TEST(ResponseGeneratorTest, ConditionalRequests) {
+    using ResponseGenerator::isNotModified;
+    std::string_view date = "Sun, 06 Nov 1994 08:49:37 GMT";
+    EXPECT_TRUE(isNotModified({.ifNoneMatch = "\"a\", \"b\""}, "\"b\"", date));
+    EXPECT_TRUE(isNotModified({.ifNoneMatch = "W/\"b\""}, "\"b\"", date));
+    EXPECT_TRUE(isNotModified({.ifNoneMatch = "*"}, "\"b\"", date));
+    EXPECT_FALSE(isNotModified({.ifNoneMatch = "\"a\""}, "\"b\"", date));
+    EXPECT_TRUE(isNotModified({.ifModifiedSince = "Mon, 07 Nov 1994 00:00:00 GMT"}, "\"b\"", date));
+    EXPECT_FALSE(isNotModified({.ifModifiedSince = "Sat, 05 Nov 1994 00:00:00 GMT"}, "\"b\"", date));
+    EXPECT_FALSE(isNotModified({.ifModifiedSince = "yesterday"}, "\"b\"", date));
+    EXPECT_FALSE(isNotModified({}, "\"b\"", date));
+
+    HTTPResponse full(HTTPResponse::Status::OK, {{"Content-Type", "text/plain"}, {"ETag", "\"b\""}, {"Cache-Control", "no-cache"}});
+    full.setBody("hello");
+    HTTPResponse notModified = ResponseGenerator::generateNotModifiedResponse(full);
+    EXPECT_EQ(notModified.getStatus(), HTTPResponse::Status::NOT_MODIFIED);
+    EXPECT_EQ(notModified.getHeader("ETag"), "\"b\"");
+    EXPECT_EQ(notModified.getHeader("Cache-Control"), "no-cache");
+    EXPECT_FALSE(notModified.getHeader("Content-Length").has_value());
+    EXPECT_TRUE(notModified.getBody().empty());
+}
+
+TEST(ResponseGeneratorTest, ParsesRanges) {
+    using ResponseGenerator::parseRange;
+    auto ranges = parseRange("bytes=0-99", 1000);
+    ASSERT_TRUE(ranges.has_value());
+    ASSERT_EQ(ranges->size(), 1u);
+    EXPECT_EQ((*ranges)[0].first, 0u);
+    EXPECT_EQ((*ranges)[0].last, 99u);
+
+    // Open ended, suffix, clamped to the end
+    ranges = parseRange("bytes=900-, -50, 990-5000", 1000);
+    ASSERT_TRUE(ranges.has_value());
+    ASSERT_EQ(ranges->size(), 1u);
+    EXPECT_EQ((*ranges)[0].first, 900u);
+    EXPECT_EQ((*ranges)[0].last, 999u);
+
+    // Sorted, overlapping and adjacent ones merged
+    ranges = parseRange("bytes=500-599,0-9,10-19,550-700", 1000);
+    ASSERT_TRUE(ranges.has_value());
+    ASSERT_EQ(ranges->size(), 2u);
+    EXPECT_EQ((*ranges)[0].last, 19u);
+    EXPECT_EQ((*ranges)[1].first, 500u);
+    EXPECT_EQ((*ranges)[1].last, 700u);
+
+    EXPECT_EQ(parseRange("bytes=1000-", 1000)->size(), 0u);
+    EXPECT_EQ(parseRange("bytes=-0", 1000)->size(), 0u);
+    EXPECT_FALSE(parseRange("bytes=5-3", 1000).has_value());
+    EXPECT_FALSE(parseRange("items=0-1", 1000).has_value());
+    EXPECT_FALSE(parseRange("bytes=a-b", 1000).has_value());
+    EXPECT_FALSE(parseRange("bytes=", 1000).has_value());
+    std::string many = "bytes=0-0";
+    for (int i = 1; i <= 16; i++)
+        many += "," + std::to_string(i * 10) + "-" + std::to_string(i * 10);
+    EXPECT_FALSE(parseRange(many, 1000).has_value());
+}
+
+TEST(ResponseGeneratorTest, RangeResponses) {
+    char path[] = "/tmp/myhttp_range_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_NE(fd, -1);
+    ASSERT_EQ(write(fd, "0123456789", 10), 10);
+    close(fd);
+    HTTPResponse full = ResponseGenerator::generateFileResponse(path);
+    unlink(path);
+    EXPECT_EQ(full.getHeader("Accept-Ranges"), "bytes");
+
+    HTTPResponse single = ResponseGenerator::generateRangeResponse(full, "bytes=2-5", std::nullopt);
+    EXPECT_EQ(single.getStatus(), HTTPResponse::Status::PARTIAL_CONTENT);
+    EXPECT_EQ(single.getHeader("Content-Range"), "bytes 2-5/10");
+    EXPECT_EQ(single.getHeader("Content-Length"), "4");
+    EXPECT_EQ(single.getHeader("ETag"), full.getHeader("ETag"));
+    ASSERT_TRUE(single.getFileBody().has_value());
+    EXPECT_EQ(single.getFileBody()->offset, 2);
+    EXPECT_EQ(single.getFileBody()->length, 4u);
+
+    HTTPResponse multi = ResponseGenerator::generateRangeResponse(full, "bytes=0-1,-2", std::nullopt);
+    EXPECT_EQ(multi.getStatus(), HTTPResponse::Status::PARTIAL_CONTENT);
+    std::string contentType = multi.getHeader("Content-Type").value_or("");
+    ASSERT_TRUE(contentType.starts_with("multipart/byteranges; boundary="));
+    const auto& parts = multi.getBodyParts();
+    ASSERT_EQ(parts.size(), 3u);
+    EXPECT_NE(parts[0].data.find("Content-Range: bytes 0-1/10\r\n\r\n"), std::string::npos);
+    EXPECT_EQ(parts[1].file->offset, 8);
+    EXPECT_FALSE(parts[2].file.has_value());
+    size_t length = 0;
+    for (const auto& part : parts)
+        length += part.data.size() + (part.file ? part.file->length : 0);
+    EXPECT_EQ(multi.getHeader("Content-Length"), std::to_string(length));
+
+    HTTPResponse unsatisfiable = ResponseGenerator::generateRangeResponse(full, "bytes=10-20", std::nullopt);
+    EXPECT_EQ(unsatisfiable.getStatus(), HTTPResponse::Status::RANGE_NOT_SATISFIABLE);
+    EXPECT_EQ(unsatisfiable.getHeader("Content-Range"), "bytes */10");
+
+    // If-Range only gets a part of the file it was taken from
+    EXPECT_EQ(ResponseGenerator::generateRangeResponse(full, "bytes=2-5", full.getHeader("ETag")).getStatus(), HTTPResponse::Status::PARTIAL_CONTENT);
+    EXPECT_EQ(ResponseGenerator::generateRangeResponse(full, "bytes=2-5", full.getHeader("Last-Modified")).getStatus(), HTTPResponse::Status::PARTIAL_CONTENT);
+    EXPECT_EQ(ResponseGenerator::generateRangeResponse(full, "bytes=2-5", "\"old\"").getStatus(), HTTPResponse::Status::OK);
+    EXPECT_EQ(ResponseGenerator::generateRangeResponse(full, "bytes=oops", std::nullopt).getStatus(), HTTPResponse::Status::OK);
+}
+
+TEST(ResponseGeneratorTest, CannedResponses) {
+    HTTPResponse health = ResponseGenerator::makeCannedResponse(HTTPResponse::Status::OK, "text/plain", "ok");
+    std::string wire = health.toString();
+    EXPECT_TRUE(wire.starts_with("HTTP/1.1 200 OK\r\nDate: ")) << wire;
+    EXPECT_TRUE(wire.ends_with("Content-Length: 2\r\n\r\nok") || wire.ends_with("Content-Type: text/plain\r\n\r\nok")) << wire;
+    EXPECT_NE(wire.find("Content-Type: text/plain\r\n"), std::string::npos);
+
+    // Every error response shares the same bytes instead of building its own
+    HTTPResponse first = ResponseGenerator::generateNotFoundResponse();
+    HTTPResponse second = ResponseGenerator::generateNotFoundResponse();
+    EXPECT_EQ(first.getStatus(), HTTPResponse::Status::NOT_FOUND);
+    EXPECT_FALSE(first.getCanned().empty());
+    EXPECT_EQ(first.getCanned().data(), second.getCanned().data());
+    EXPECT_TRUE(first.getCanned().ends_with("\r\n\r\n404 Not Found"));
+}
+
+TEST(HTTPResponseTest, DropsBodyForHead) {
+    HTTPResponse html = ResponseGenerator::generateHTMLResponse("hello-body");
+    html.dropBody();
+    EXPECT_EQ(html.getHeader("Content-Length"), "10");
+    EXPECT_TRUE(html.toString().ends_with("\r\n\r\n"));
+
+    HTTPResponse parts(HTTPResponse::Status::PARTIAL_CONTENT, {{"Content-Type", "text/plain"}});
+    parts.setBodyParts({{"first", std::nullopt}, {"second", std::nullopt}});
+    parts.dropBody();
+    EXPECT_EQ(parts.getHeader("Content-Length"), "11");
+    EXPECT_TRUE(parts.getBodyParts().empty());
+
+    // Canned bytes are shared, only this response's view of them is cut
+    HTTPResponse notFound = ResponseGenerator::generateNotFoundResponse();
+    notFound.dropBody();
+    EXPECT_TRUE(notFound.getCanned().ends_with("\r\n\r\n"));
+    EXPECT_NE(notFound.getCanned().find("Content-Length: 13\r\n"), std::string::npos);
+    EXPECT_TRUE(ResponseGenerator::generateNotFoundResponse().getCanned().ends_with("404 Not Found"));
+
+    HTTPResponse serialized(HTTPResponse::Status::OK, std::make_shared<const std::string>("Content-Length: 10\r\n\r\nhello-body"));
+    serialized.dropBody();
+    EXPECT_EQ(*serialized.getSerialized(), "Content-Length: 10\r\n\r\n");
+}
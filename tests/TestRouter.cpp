@@ -0,0 +1,104 @@
+#include <gtest/gtest.h>
+#include "Router.h"
+#include "ResponseGenerator.h"
+
+class RouterTest : public ::testing::Test {
+protected:
+    Router m_router{std::filesystem::temp_directory_path()};
+
+    // Registers a handler that answers with its own name, so a test can tell which route matched
+    void add(const std::string& route, int method = HTTPRequest::Method::GET) {
+        m_router.addRoute(route, method, [route](const RequestView&) {
+            return ResponseGenerator::generateHTMLResponse(route);
+        });
+    }
+
+    std::string dispatch(RequestView& request) {
+        const ViewHandler* handler = m_router.getHandler(request);
+        return handler ? (*handler)(request).getBody() : "none";
+    }
+
+    std::string dispatch(std::string_view path, HTTPRequest::Method method = HTTPRequest::Method::GET) {
+        RequestView request(method, path, "HTTP/1.1", "");
+        return dispatch(request);
+    }
+};
+
+TEST_F(RouterTest, LiteralRoutesShareAPrefix) {
+    add("/api/users");
+    add("/api/user");
+    add("/api/items");
+    add("/");
+
+    EXPECT_EQ(dispatch("/api/users"), "/api/users");
+    EXPECT_EQ(dispatch("/api/user"), "/api/user");
+    EXPECT_EQ(dispatch("/api/items"), "/api/items");
+    EXPECT_EQ(dispatch("/"), "/");
+    EXPECT_EQ(dispatch("/api/use"), "none");
+    EXPECT_EQ(dispatch("/api/users/"), "none");
+    EXPECT_EQ(dispatch("/api/items?page=2"), "/api/items");
+}
+
+TEST_F(RouterTest, CapturesParameters) {
+    add("/users/:id");
+    add("/users/:id/files/*path");
+    add("/users/new");
+
+    RequestView request(HTTPRequest::Method::GET, "/users/42/files/a/b.txt", "HTTP/1.1", "");
+    EXPECT_EQ(dispatch(request), "/users/:id/files/*path");
+    EXPECT_EQ(request.getParamCount(), 2u);
+    EXPECT_EQ(request.getParam("id"), "42");
+    EXPECT_EQ(request.getParam("path"), "a/b.txt");
+    // The values point into the request path, nothing was copied
+    EXPECT_EQ(request.getParam("id")->data(), request.getRoute().data() + 7);
+
+    // Literal text is preferred over a parameter
+    EXPECT_EQ(dispatch("/users/new"), "/users/new");
+    EXPECT_EQ(dispatch("/users/newer"), "/users/:id");
+    // A parameter never matches an empty segment
+    EXPECT_EQ(dispatch("/users/"), "none");
+}
+
+TEST_F(RouterTest, BacktracksOutOfDeadEnds) {
+    add("/files/static/index");
+    add("/files/:name/raw");
+    add("/files/*rest");
+
+    EXPECT_EQ(dispatch("/files/static/index"), "/files/static/index");
+    // "static" matched literally first, but only the parameter route goes on to "/raw"
+    RequestView request(HTTPRequest::Method::GET, "/files/static/raw", "HTTP/1.1", "");
+    EXPECT_EQ(dispatch(request), "/files/:name/raw");
+    EXPECT_EQ(request.getParam("name"), "static");
+    EXPECT_EQ(dispatch("/files/static/other"), "/files/*rest");
+    EXPECT_EQ(dispatch("/files/"), "/files/*rest");
+}
+
+TEST_F(RouterTest, MatchesMethodBitmasks) {
+    add("/resource", HTTPRequest::Method::GET | HTTPRequest::Method::HEAD);
+    m_router.addRoute("/resource", HTTPRequest::Method::POST, [](const HTTPRequest& request) {
+        return ResponseGenerator::generateHTMLResponse("post " + request.getRoute().string());
+    });
+
+    EXPECT_EQ(dispatch("/resource", HTTPRequest::Method::GET), "/resource");
+    EXPECT_EQ(dispatch("/resource", HTTPRequest::Method::HEAD), "/resource");
+    EXPECT_EQ(dispatch("/resource", HTTPRequest::Method::POST), "post /resource");
+    EXPECT_EQ(dispatch("/resource", HTTPRequest::Method::DELETE), "none");
+}
+
+TEST_F(RouterTest, OwningHandlersGetParameters) {
+    m_router.addRoute("/orders/:order", HTTPRequest::Method::GET, [](const HTTPRequest& request) {
+        return ResponseGenerator::generateHTMLResponse(request.getParam("order").value_or("missing"));
+    });
+    EXPECT_EQ(dispatch("/orders/7"), "7");
+}
+
+TEST_F(RouterTest, RejectsMalformedRoutes) {
+    add("/a/:id");
+    EXPECT_THROW(add("/a/:other/b"), std::runtime_error);
+    EXPECT_THROW(add("/b/:"), std::runtime_error);
+    EXPECT_THROW(add("/c/*rest/more"), std::runtime_error);
+    EXPECT_THROW(add("/:a/:b/:c/:d/:e/:f/:g/:h/:i"), std::runtime_error);
+    // Not at the start of a segment, so just literal text
+    add("/d/a:b*c");
+    EXPECT_EQ(dispatch("/d/a:b*c"), "/d/a:b*c");
+}
@@ -0,0 +1,86 @@
+#include <gtest/gtest.h>
+#include <random>
+#include "RequestParser.h"
+#include "Scanner.h"
+
+namespace {
+    std::vector<Scanner::Isa> supportedIsas() {
+        std::vector<Scanner::Isa> isas;
+        for (auto isa : {Scanner::Isa::SCALAR, Scanner::Isa::SSE42, Scanner::Isa::AVX2}) {
+            if (Scanner::getKernels(isa))
+                isas.push_back(isa);
+        }
+        return isas;
+    }
+}
+
+TEST(ScannerTest, ScalarIsAlwaysAvailable) {
+    EXPECT_NE(Scanner::getKernels(Scanner::Isa::SCALAR), nullptr);
+    EXPECT_NE(Scanner::getKernels(Scanner::getBestIsa()), nullptr);
+}
+
+// Put every possible byte at every position of blocks around the vector widths, and check
+// that each kernel stops exactly where the scalar version does
+TEST(ScannerTest, KernelsAgreeWithScalar) {
+    const Scanner::Kernels& scalar = *Scanner::getKernels(Scanner::Isa::SCALAR);
+    for (auto isa : supportedIsas()) {
+        const Scanner::Kernels& kernels = *Scanner::getKernels(isa);
+        for (size_t size : {0, 1, 15, 16, 17, 31, 32, 33, 63, 64, 100}) {
+            for (size_t position = 0; position < size; position += 7) {
+                for (int byte = 0; byte < 256; byte++) {
+                    std::string token(size, 'a');
+                    token[position] = static_cast<char>(byte);
+                    ASSERT_EQ(kernels.findTokenEnd(token.data(), size), scalar.findTokenEnd(token.data(), size))
+                        << "isa " << static_cast<int>(isa) << " byte " << byte << " at " << position << " of " << size;
+                    ASSERT_EQ(kernels.findTargetEnd(token.data(), size), scalar.findTargetEnd(token.data(), size))
+                        << "isa " << static_cast<int>(isa) << " byte " << byte << " at " << position << " of " << size;
+                    ASSERT_EQ(kernels.findValueEnd(token.data(), size), scalar.findValueEnd(token.data(), size))
+                        << "isa " << static_cast<int>(isa) << " byte " << byte << " at " << position << " of " << size;
+                }
+            }
+        }
+    }
+}
+
+TEST(ScannerTest, ClassifiesBytes) {
+    const Scanner::Kernels& scalar = *Scanner::getKernels(Scanner::Isa::SCALAR);
+    std::string name = "X-Forwarded-For: 1.2.3.4";
+    EXPECT_EQ(scalar.findTokenEnd(name.data(), name.size()), name.find(':'));
+    std::string target = "/search?q=a%20b HTTP/1.1";
+    EXPECT_EQ(scalar.findTargetEnd(target.data(), target.size()), target.find(' '));
+    std::string value = "text/html, */*;q=0.8\tnext\r\n";
+    EXPECT_EQ(scalar.findValueEnd(value.data(), value.size()), value.find('\r'));
+    // Non-ASCII bytes are allowed in values, but not in names or targets
+    std::string utf8 = "caf\xc3\xa9";
+    EXPECT_EQ(scalar.findValueEnd(utf8.data(), utf8.size()), utf8.size());
+    EXPECT_EQ(scalar.findTokenEnd(utf8.data(), utf8.size()), 3);
+    EXPECT_EQ(scalar.findTargetEnd(utf8.data(), utf8.size()), 3);
+}
+
+TEST(ScannerTest, RandomBuffers) {
+    std::mt19937 random(42);
+    for (auto isa : supportedIsas()) {
+        const Scanner::Kernels& kernels = *Scanner::getKernels(isa);
+        const Scanner::Kernels& scalar = *Scanner::getKernels(Scanner::Isa::SCALAR);
+        for (int round = 0; round < 1000; round++) {
+            // Mostly printable, so the scans run for a while before they stop
+            std::string buffer(random() % 200, ' ');
+            for (char& c : buffer)
+                c = random() % 50 == 0 ? static_cast<char>(random() % 256) : static_cast<char>('!' + random() % 94);
+            ASSERT_EQ(kernels.findTokenEnd(buffer.data(), buffer.size()), scalar.findTokenEnd(buffer.data(), buffer.size()));
+            ASSERT_EQ(kernels.findTargetEnd(buffer.data(), buffer.size()), scalar.findTargetEnd(buffer.data(), buffer.size()));
+            ASSERT_EQ(kernels.findValueEnd(buffer.data(), buffer.size()), scalar.findValueEnd(buffer.data(), buffer.size()));
+        }
+    }
+}
+
+TEST(ScannerTest, ParserRejectsInvalidCharacters) {
+    using Result = RequestParser::Result;
+    EXPECT_EQ(RequestParser().parse("GET /a b HTTP/1.1\r\n\r\n"), Result::BAD_REQUEST);
+    EXPECT_EQ(RequestParser().parse("GET /\x01 HTTP/1.1\r\n\r\n"), Result::BAD_REQUEST);
+    EXPECT_EQ(RequestParser().parse("GET / FTP/1.0\r\n\r\n"), Result::BAD_REQUEST);
+    EXPECT_EQ(RequestParser().parse("GET / HTTP/1.1\r\nHost : localhost\r\n\r\n"), Result::BAD_REQUEST);
+    EXPECT_EQ(RequestParser().parse("GET / HTTP/1.1\r\nHo(st: localhost\r\n\r\n"), Result::BAD_REQUEST);
+    EXPECT_EQ(RequestParser().parse("GET / HTTP/1.1\r\nHost: local\x7fhost\r\n\r\n"), Result::BAD_REQUEST);
+    EXPECT_EQ(RequestParser().parse("GET / HTTP/1.1\r\nX-Name: caf\xc3\xa9\r\n\r\n"), Result::COMPLETE);
+}
@@ -0,0 +1,138 @@
+#include <gtest/gtest.h>
+#include "Router.h"
+#include "Parser.h"
+#include "TempDirTest.h"
+
+class StaticFileCacheTest : public TempDirTest {
+protected:
+    StaticFileCacheTest() : TempDirTest("cache") {}
+
+    void SetUp() override {
+        TempDirTest::SetUp();
+        writeFile("a.txt", "first");
+    }
+
+    static std::optional<HTTPResponse> get(const Router& router, const std::string& path) {
+        auto request = Parser::parseRequest("GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n");
+        return router.getStaticFile(*request);
+    }
+};
+
+TEST_F(StaticFileCacheTest, SecondRequestIsServedSerialized) {
+    Router router(m_dir);
+    auto first = get(router, "/a.txt");
+    ASSERT_TRUE(first.has_value());
+    EXPECT_TRUE(first->getFileBody().has_value());
+
+    auto second = get(router, "/a.txt");
+    ASSERT_TRUE(second.has_value());
+    ASSERT_NE(second->getSerialized(), nullptr);
+    EXPECT_EQ(second->getStatus(), HTTPResponse::Status::OK);
+    EXPECT_TRUE(second->toString().ends_with("\r\n\r\nfirst"));
+    EXPECT_TRUE(second->toString().starts_with("HTTP/1.1 200 OK\r\nDate: "));
+
+    auto stats = router.getStaticFileCache().getStats();
+    EXPECT_EQ(stats.hits, 1);
+    EXPECT_EQ(stats.misses, 1);
+    EXPECT_EQ(stats.entries, 1);
+}
+
+TEST_F(StaticFileCacheTest, ModifiedFileIsInvalidated) {
+    Router router(m_dir);
+    get(router, "/a.txt");
+    writeFile("a.txt", "second");
+    router.getStaticFileCache().processEvents();
+    EXPECT_EQ(router.getStaticFileCache().getStats().entries, 0);
+
+    auto response = get(router, "/a.txt");
+    ASSERT_TRUE(response.has_value());
+    const FileBody& body = *response->getFileBody();
+    std::string content(body.length, '\0');
+    ASSERT_EQ(pread(body.file->get(), content.data(), content.size(), body.offset), body.length);
+    EXPECT_EQ(content, "second");
+}
+
+TEST_F(StaticFileCacheTest, EvictsWhenFull) {
+    writeFile("b.txt", std::string(200, 'b'));
+    Router router(m_dir);
+    router.getStaticFileCache().setLimits(400, 400);
+    get(router, "/a.txt");
+    get(router, "/b.txt");
+    auto stats = router.getStaticFileCache().getStats();
+    EXPECT_LE(stats.bytes, 400);
+    EXPECT_EQ(stats.entries, 1);
+    EXPECT_EQ(stats.evictions, 1);
+}
+
+TEST_F(StaticFileCacheTest, AnswersMatchingETagWithNotModified) {
+    Router router(m_dir);
+    auto full = router.getStaticFile(HTTPRequest::Method::GET, "/a.txt");
+    ASSERT_TRUE(full.has_value());
+    std::optional<std::string> etag = full->getHeader("ETag");
+    ASSERT_TRUE(etag.has_value());
+    EXPECT_TRUE(etag->starts_with('"') && etag->ends_with('"'));
+    ASSERT_TRUE(full->getHeader("Last-Modified").has_value());
+
+    // From the cache, the 304 is serialized in advance too
+    std::string ifNoneMatch = "\"other\", W/" + *etag;
+    ResponseGenerator::Conditions conditions{.ifNoneMatch = ifNoneMatch};
+    auto cached = router.getStaticFile(HTTPRequest::Method::GET, "/a.txt", Compression::IDENTITY, conditions);
+    ASSERT_TRUE(cached.has_value());
+    EXPECT_EQ(cached->getStatus(), HTTPResponse::Status::NOT_MODIFIED);
+    std::string wire = cached->toString();
+    EXPECT_TRUE(wire.starts_with("HTTP/1.1 304 Not Modified\r\nDate: ")) << wire;
+    EXPECT_NE(wire.find("ETag: " + *etag + "\r\n"), std::string::npos) << wire;
+    EXPECT_EQ(wire.find("Content-Length"), std::string::npos) << wire;
+    EXPECT_TRUE(wire.ends_with("\r\n\r\n"));
+
+    // A stale tag gets the whole file
+    ResponseGenerator::Conditions stale{.ifNoneMatch = "\"stale\""};
+    auto changed = router.getStaticFile(HTTPRequest::Method::GET, "/a.txt", Compression::IDENTITY, stale);
+    ASSERT_TRUE(changed.has_value());
+    EXPECT_EQ(changed->getStatus(), HTTPResponse::Status::OK);
+
+    // Not cached yet, answered the same way
+    writeFile("b.txt", "other file");
+    std::string bTag = router.getStaticFile(HTTPRequest::Method::GET, "/b.txt")->getHeader("ETag").value();
+    router.getStaticFileCache().setLimits(0, 0);
+    ResponseGenerator::Conditions uncached{.ifNoneMatch = bTag};
+    auto fresh = router.getStaticFile(HTTPRequest::Method::GET, "/b.txt", Compression::IDENTITY, uncached);
+    ASSERT_TRUE(fresh.has_value());
+    EXPECT_EQ(fresh->getStatus(), HTTPResponse::Status::NOT_MODIFIED);
+    EXPECT_FALSE(fresh->getFileBody().has_value());
+}
+
+TEST_F(StaticFileCacheTest, HonorsIfModifiedSince) {
+    Router router(m_dir);
+    std::string lastModified = router.getStaticFile(HTTPRequest::Method::GET, "/a.txt")->getHeader("Last-Modified").value();
+    time_t modified = HTTPResponse::parseDate(lastModified).value();
+
+    ResponseGenerator::Conditions since{.ifModifiedSince = lastModified};
+    EXPECT_EQ(router.getStaticFile(HTTPRequest::Method::GET, "/a.txt", Compression::IDENTITY, since)->getStatus(), HTTPResponse::Status::NOT_MODIFIED);
+    std::string before = HTTPResponse::formatDate(modified - 60);
+    ResponseGenerator::Conditions older{.ifModifiedSince = before};
+    EXPECT_EQ(router.getStaticFile(HTTPRequest::Method::GET, "/a.txt", Compression::IDENTITY, older)->getStatus(), HTTPResponse::Status::OK);
+    // If-None-Match wins when both are sent
+    ResponseGenerator::Conditions both{.ifNoneMatch = "\"stale\"", .ifModifiedSince = lastModified};
+    EXPECT_EQ(router.getStaticFile(HTTPRequest::Method::GET, "/a.txt", Compression::IDENTITY, both)->getStatus(), HTTPResponse::Status::OK);
+}
+
+TEST_F(StaticFileCacheTest, SetsCacheControlByPrefix) {
+    std::filesystem::create_directories(m_dir / "assets" / "fonts");
+    writeFile("assets/app.css", "body {}");
+    writeFile("assets/fonts/a.woff", "font");
+    Router router(m_dir);
+    router.setCacheControl("/", "no-cache");
+    router.setCacheControl("/assets/", "public, max-age=60");
+    router.setCacheControl("/assets/fonts/", "public, max-age=31536000, immutable");
+    router.setCacheControl("/assets/", "public, max-age=3600");
+
+    EXPECT_EQ(router.getStaticFile(HTTPRequest::Method::GET, "/a.txt")->getHeader("Cache-Control"), "no-cache");
+    EXPECT_EQ(router.getStaticFile(HTTPRequest::Method::GET, "/assets/app.css")->getHeader("Cache-Control"), "public, max-age=3600");
+    EXPECT_EQ(router.getStaticFile(HTTPRequest::Method::GET, "/assets/fonts/a.woff")->getHeader("Cache-Control"), "public, max-age=31536000, immutable");
+
+    // The 304 carries it too, so caches renew the copy they have
+    ResponseGenerator::Conditions conditions{.ifNoneMatch = "*"};
+    std::string wire = router.getStaticFile(HTTPRequest::Method::GET, "/assets/app.css", Compression::IDENTITY, conditions)->toString();
+    EXPECT_NE(wire.find("Cache-Control: public, max-age=3600\r\n"), std::string::npos) << wire;
+}
@@ -0,0 +1,88 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include "TimerWheel.h"
+
+using namespace std::chrono_literals;
+using Deadline = TimerWheel::Deadline;
+
+class TimerWheelTest : public ::testing::Test {
+protected:
+    TimerWheel::Clock::time_point m_start = TimerWheel::Clock::now();
+    TimerWheel m_wheel{100ms, m_start};
+
+    std::vector<int> expiredFds(TimerWheel::Clock::time_point now) {
+        std::vector<int> fds;
+        for (const TimerWheel::Expired& expired : m_wheel.advance(now))
+            fds.push_back(expired.fd);
+        std::sort(fds.begin(), fds.end());
+        return fds;
+    }
+};
+
+TEST_F(TimerWheelTest, FiresAfterTheDeadline) {
+    m_wheel.schedule(3, Deadline::KEEP_ALIVE, m_start + 1s);
+    m_wheel.schedule(7, Deadline::HEADER_READ, m_start + 2s);
+
+    EXPECT_TRUE(expiredFds(m_start + 900ms).empty());
+    auto expired = m_wheel.advance(m_start + 1200ms);
+    ASSERT_EQ(expired.size(), 1);
+    EXPECT_EQ(expired[0].fd, 3);
+    EXPECT_EQ(expired[0].kind, Deadline::KEEP_ALIVE);
+    EXPECT_EQ(expiredFds(m_start + 2200ms), std::vector<int>{7});
+    EXPECT_FALSE(m_wheel.getKind(3).has_value());
+}
+
+TEST_F(TimerWheelTest, CancelAndReschedule) {
+    m_wheel.schedule(1, Deadline::KEEP_ALIVE, m_start + 1s);
+    m_wheel.schedule(2, Deadline::KEEP_ALIVE, m_start + 1s);
+    m_wheel.schedule(3, Deadline::KEEP_ALIVE, m_start + 1s);
+    // Out of the middle of a slot
+    m_wheel.cancel(2);
+    m_wheel.schedule(3, Deadline::WRITE_STALL, m_start + 5s);
+    EXPECT_FALSE(m_wheel.getKind(2).has_value());
+
+    EXPECT_EQ(expiredFds(m_start + 2s), std::vector<int>{1});
+    EXPECT_EQ(m_wheel.getKind(3), Deadline::WRITE_STALL);
+    EXPECT_EQ(expiredFds(m_start + 6s), std::vector<int>{3});
+}
+
+TEST_F(TimerWheelTest, ReadsKeepTheirDeadline) {
+    m_wheel.touch(5, Deadline::HEADER_READ, 1s, m_start);
+    // More header bytes came in, but the request still isn't done
+    m_wheel.touch(5, Deadline::HEADER_READ, 1s, m_start + 800ms);
+    EXPECT_EQ(expiredFds(m_start + 1200ms), std::vector<int>{5});
+
+    m_wheel.touch(6, Deadline::KEEP_ALIVE, 1s, m_start + 1200ms);
+    m_wheel.touch(6, Deadline::KEEP_ALIVE, 1s, m_start + 2000ms);
+    // Moving on to a new kind starts a new timeout
+    m_wheel.touch(6, Deadline::HEADER_READ, 1s, m_start + 2500ms);
+    EXPECT_TRUE(expiredFds(m_start + 3300ms).empty());
+    EXPECT_EQ(expiredFds(m_start + 3700ms), std::vector<int>{6});
+}
+
+TEST_F(TimerWheelTest, DeadlinesPastOneTurn) {
+    // The wheel covers 102.4 seconds, this one lands in the same slot as a much earlier deadline
+    auto turn = 100ms * TimerWheel::SLOTS;
+    m_wheel.schedule(8, Deadline::KEEP_ALIVE, m_start + turn + 1s);
+    m_wheel.schedule(9, Deadline::KEEP_ALIVE, m_start + 1s);
+    EXPECT_EQ(expiredFds(m_start + 2s), std::vector<int>{9});
+    EXPECT_TRUE(expiredFds(m_start + turn).empty());
+    EXPECT_EQ(expiredFds(m_start + turn + 2s), std::vector<int>{8});
+}
+
+TEST_F(TimerWheelTest, WaitsForTheNextDeadline) {
+    EXPECT_EQ(m_wheel.getWaitMillis(m_start), -1);
+    m_wheel.schedule(10, Deadline::KEEP_ALIVE, m_start + 30s);
+    m_wheel.schedule(11, Deadline::KEEP_ALIVE, m_start + 1s);
+    int wait = m_wheel.getWaitMillis(m_start);
+    EXPECT_GE(wait, 1000);
+    EXPECT_LE(wait, 1100);
+    EXPECT_EQ(m_wheel.getWaitMillis(m_start + 5s), 0);
+
+    expiredFds(m_start + 5s);
+    wait = m_wheel.getWaitMillis(m_start + 5s);
+    EXPECT_GE(wait, 25000);
+    EXPECT_LE(wait, 25100);
+    m_wheel.cancel(10);
+    EXPECT_EQ(m_wheel.getWaitMillis(m_start + 5s), -1);
+}
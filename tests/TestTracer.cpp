@@ -0,0 +1,103 @@
+#include <gtest/gtest.h>
+#include <set>
+#include <thread>
+#include "Tracer.h"
+
+static size_t countOf(const std::string& text, const std::string& part) {
+    size_t count = 0;
+    for (size_t index = text.find(part); index != std::string::npos; index = text.find(part, index + 1))
+        count++;
+    return count;
+}
+
+TEST(TracerTest, RecordsNothingUntilStarted) {
+    Tracer tracer;
+    EXPECT_EQ(tracer.sample(), 0);
+    {
+        Tracer::Scope scope(tracer, tracer.sample(), "untraced");
+        Tracer::Span span("inner");
+    }
+    EXPECT_EQ(tracer.toChromeTrace().find("inner"), std::string::npos);
+}
+
+TEST(TracerTest, SamplesOneInEvery) {
+    Tracer tracer;
+    tracer.start(4);
+    std::vector<uint64_t> ids;
+    for (int i = 0; i < 100; i++) {
+        if (uint64_t id = tracer.sample())
+            ids.push_back(id);
+    }
+    EXPECT_EQ(ids.size(), 25);
+    // Every trace gets an id of its own
+    EXPECT_EQ(std::set<uint64_t>(ids.begin(), ids.end()).size(), ids.size());
+    tracer.stop();
+    EXPECT_EQ(tracer.sample(), 0);
+}
+
+TEST(TracerTest, WritesSpansInsideScopes) {
+    Tracer tracer;
+    tracer.start(1);
+    uint64_t id = tracer.sample();
+    {
+        Tracer::Scope scope(tracer, id, "outer");
+        Tracer::addInstant("woke", Tracer::Clock::now());
+        Tracer::Span span("inner");
+    }
+    // Outside of any trace
+    Tracer::Span span("stray");
+
+    std::string json = tracer.toChromeTrace();
+    EXPECT_TRUE(json.starts_with("{\"displayTimeUnit\":\"ns\",\"traceEvents\":["));
+    EXPECT_TRUE(json.ends_with("]}\n"));
+    EXPECT_NE(json.find("{\"name\":\"thread_name\",\"ph\":\"M\""), std::string::npos);
+    EXPECT_NE(json.find("\"name\":\"outer\",\"cat\":\"myhttp\""), std::string::npos);
+    EXPECT_NE(json.find("\"name\":\"inner\",\"cat\":\"myhttp\""), std::string::npos);
+    EXPECT_NE(json.find("\"ph\":\"i\""), std::string::npos);
+    EXPECT_EQ(countOf(json, "\"args\":{\"trace\":" + std::to_string(id) + "}"), 3);
+    EXPECT_EQ(json.find("stray"), std::string::npos);
+}
+
+TEST(TracerTest, LinksThreadsWithFlows) {
+    Tracer tracer;
+    tracer.start(1);
+    uint64_t id = tracer.sample();
+    {
+        Tracer::Scope scope(tracer, id, "producer");
+        Tracer::addFlowStart("hop");
+    }
+    std::thread([&tracer, id] {
+        Tracer::Scope scope(tracer, id, "consumer");
+        Tracer::addFlowEnd("hop");
+    }).join();
+
+    std::string json = tracer.toChromeTrace();
+    EXPECT_NE(json.find("\"ph\":\"s\",\"id\":" + std::to_string(id)), std::string::npos);
+    EXPECT_NE(json.find("\"ph\":\"f\",\"bp\":\"e\",\"id\":" + std::to_string(id)), std::string::npos);
+    // One track per thread
+    EXPECT_EQ(countOf(json, "\"thread_name\""), 2);
+}
+
+TEST(TracerTest, KeepsTheNewestEvents) {
+    Tracer tracer;
+    tracer.start(1);
+    {
+        Tracer::Scope scope(tracer, tracer.sample(), "old");
+        for (size_t i = 0; i < Tracer::RING_EVENTS; i++)
+            Tracer::Span span("filler");
+    }
+    // The scope ended last, so it pushed out the first span. The oldest one left might be
+    // getting overwritten by the time it's copied, so that one is never written out either.
+    std::string json = tracer.toChromeTrace();
+    EXPECT_NE(json.find("\"old\""), std::string::npos);
+    EXPECT_EQ(countOf(json, "\"filler\""), Tracer::RING_EVENTS - 2);
+
+    // Starting again drops everything from before
+    tracer.start(1);
+    {
+        Tracer::Scope scope(tracer, tracer.sample(), "new");
+    }
+    json = tracer.toChromeTrace();
+    EXPECT_EQ(json.find("\"filler\""), std::string::npos);
+    EXPECT_NE(json.find("\"new\""), std::string::npos);
+}
@@ -1,4 +1,6 @@
 #include <gtest/gtest.h>
+#include <atomic>
+#include <string>
 #include "WorkerPool.h"
 
 TEST(WorkerPoolTest, DoTasks) {
@@ -16,3 +18,105 @@ TEST(WorkerPoolTest, DoTasks) {
         ASSERT_EQ(arr[i], true);
     }
 }
+
+TEST(WorkerPoolTest, TasksQueueMoreTasks) {
+    std::atomic<int> count = 0;
+    {
+        WorkerPool pool(4);
+        // Each task fans out on its own worker's deque, the idle workers have to steal to help
+        for (int i = 0; i < 8; i++) {
+            pool.enqueue([&pool, &count] {
+                for (int j = 0; j < 1000; j++)
+                    pool.enqueue([&count] { count++; });
+            });
+        }
+        pool.stop();
+    }
+    EXPECT_EQ(count, 8000);
+}
+
+TEST(WorkerPoolTest, ManyProducers) {
+    std::atomic<int> count = 0;
+    WorkerPool pool(3);
+    std::vector<std::thread> producers;
+    for (int p = 0; p < 4; p++) {
+        producers.emplace_back([&pool, &count] {
+            // More than the injection queue holds at once
+            for (int i = 0; i < 10000; i++)
+                pool.enqueue([&count] { count++; });
+        });
+    }
+    for (std::thread& producer : producers)
+        producer.join();
+    pool.stop();
+    EXPECT_EQ(count, 40000);
+}
+
+TEST(WorkerPoolTest, NoWorkersRunsInline) {
+    WorkerPool pool(0);
+    bool ran = false;
+    pool.enqueue([&ran] { ran = true; });
+    EXPECT_TRUE(ran);
+}
+
+TEST(TaskTest, SmallCallablesAreInline) {
+    int value = 0;
+    Task small([&value] { value = 1; });
+    EXPECT_TRUE(small.isInline());
+    small();
+    EXPECT_EQ(value, 1);
+
+    std::string big(100, 'x');
+    char padding[64] = {};
+    Task large([&value, big, padding] { value = big.size() + sizeof(padding); });
+    EXPECT_FALSE(large.isInline());
+    Task moved = std::move(large);
+    EXPECT_FALSE(large);
+    moved();
+    EXPECT_EQ(value, 164);
+}
+
+TEST(TaskTest, MoveOnlyCallables) {
+    auto owned = std::make_unique<int>(7);
+    int result = 0;
+    Task task([owned = std::move(owned), &result] { result = *owned; });
+    Task other;
+    other = std::move(task);
+    other();
+    EXPECT_EQ(result, 7);
+}
+
+TEST(TaskQueuesTest, DequeOrder) {
+    WorkStealingDeque deque(2);
+    std::vector<int> order;
+    // Past the starting capacity, so the ring has to grow
+    for (int i = 0; i < 5; i++)
+        deque.push(std::make_unique<Task>([&order, i] { order.push_back(i); }));
+
+    (*deque.steal())();
+    (*deque.pop())();
+    (*deque.pop())();
+    (*deque.steal())();
+    (*deque.pop())();
+    EXPECT_EQ(deque.pop(), nullptr);
+    EXPECT_EQ(deque.steal(), nullptr);
+    EXPECT_EQ(order, (std::vector<int>{0, 4, 3, 1, 2}));
+}
+
+TEST(TaskQueuesTest, InjectionQueueFillsUp) {
+    InjectionQueue queue(4);
+    int sum = 0;
+    for (int i = 1; i <= 4; i++) {
+        Task task([&sum, i] { sum += i; });
+        ASSERT_TRUE(queue.tryPush(task));
+    }
+    Task extra([&sum] { sum += 100; });
+    EXPECT_FALSE(queue.tryPush(extra));
+    EXPECT_TRUE(extra);
+
+    Task task;
+    while (queue.tryPop(task))
+        task();
+    EXPECT_EQ(sum, 10);
+    EXPECT_TRUE(queue.tryPush(extra));
+}